@@ -18,37 +18,261 @@
 #include "libDaltonLens.h"
 
 #include <math.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 /*
     From https://en.wikipedia.org/wiki/SRGB
 
-    This is the standard used by most images and displays. This is the textbook
-    implementation that uses powf. 
+    This is the standard used by most images and displays. The textbook
+    implementation of the decoding function uses powf:
 
-    Optimizations are beyond the scope of this library, but it is possible to
-    make it faster by using a lookup-table (only 256 values), but then it's less
-    SIMD-friendly. It's also unclear if it'll be much faster on recent CPUs as
-    they are often memory-bound.
+    float linearRGB_from_sRGB(unsigned char v)
+    {
+        float fv = v / 255.f;
+        if (fv < 0.04045f) return fv / 12.92f;
+        return powf((fv + 0.055f) / 1.055f, 2.4f);
+    }
+
+    But since the input only has 256 possible values we precompute it in a
+    lookup-table instead. The values below were dumped from the function above
+    (printf with %.9g, so they round-trip exactly to the same floats), so the
+    output is identical, just without the 3 powf calls per pixel.
 
     Another option is to use a fast pow implementation, e.g. with a Chebychev
     approximation:
     https://stackoverflow.com/questions/6475373/optimizations-for-pow-with-const-non-integer-exponent
 */
+static const float dl_linearRGB_from_sRGB_table[256] = {
+    0.f, 0.000303526991f, 0.000607053982f, 0.000910580973f, 0.00121410796f, 0.00151763496f, 0.00182116195f, 0.00212468882f,
+    0.00242821593f, 0.00273174304f, 0.00303526991f, 0.00334653561f, 0.00367650692f, 0.00402471703f, 0.00439144205f, 0.00477695325f,
+    0.00518151699f, 0.00560539169f, 0.00604883255f, 0.00651209103f, 0.00699541019f, 0.00749903172f, 0.00802319217f, 0.00856812485f,
+    0.00913405698f, 0.00972121768f, 0.010329823f, 0.0109600937f, 0.0116122449f, 0.012286487f, 0.0129830306f, 0.0137020806f,
+    0.0144438436f, 0.0152085144f, 0.0159962922f, 0.0168073755f, 0.0176419523f, 0.0185002182f, 0.0193823613f, 0.0202885624f,
+    0.0212190095f, 0.0221738834f, 0.0231533647f, 0.0241576303f, 0.0251868572f, 0.0262412224f, 0.0273208916f, 0.0284260381f,
+    0.0295568332f, 0.0307134409f, 0.0318960287f, 0.0331047624f, 0.0343398079f, 0.0356013142f, 0.036889445f, 0.0382043645f,
+    0.0395462364f, 0.0409151986f, 0.0423114114f, 0.0437350273f, 0.045186203f, 0.0466650836f, 0.048171822f, 0.0497065634f,
+    0.0512694679f, 0.0528606549f, 0.0544802807f, 0.0561284944f, 0.0578054339f, 0.0595112406f, 0.061246071f, 0.0630100295f,
+    0.0648032799f, 0.0666259527f, 0.068478182f, 0.0703601092f, 0.0722718611f, 0.0742135793f, 0.0761853904f, 0.0781874284f,
+    0.0802198276f, 0.0822827145f, 0.0843762159f, 0.0865004659f, 0.0886556059f, 0.0908417329f, 0.093058981f, 0.0953074843f,
+    0.0975873619f, 0.0998987406f, 0.102241747f, 0.104616493f, 0.107023112f, 0.109461717f, 0.111932434f, 0.114435382f,
+    0.116970673f, 0.119538434f, 0.122138798f, 0.124771841f, 0.127437696f, 0.13013649f, 0.132868335f, 0.135633349f,
+    0.138431624f, 0.141263306f, 0.144128487f, 0.147027284f, 0.149959803f, 0.152926162f, 0.155926466f, 0.158960864f,
+    0.1620294f, 0.165132225f, 0.168269396f, 0.171441093f, 0.174647391f, 0.177888408f, 0.181164235f, 0.18447499f,
+    0.187820762f, 0.191201672f, 0.194617808f, 0.198069304f, 0.201556236f, 0.205078706f, 0.20863685f, 0.212230727f,
+    0.215860531f, 0.219526231f, 0.223227978f, 0.226965889f, 0.23074007f, 0.234550655f, 0.238397658f, 0.242281199f,
+    0.246201396f, 0.25015837f, 0.254152179f, 0.258182913f, 0.262250721f, 0.266355664f, 0.270497859f, 0.274677366f,
+    0.278894335f, 0.283148795f, 0.287440896f, 0.291770697f, 0.296138316f, 0.300543845f, 0.304987371f, 0.309468955f,
+    0.313988745f, 0.318546832f, 0.323143244f, 0.327778131f, 0.332451582f, 0.337163657f, 0.341914445f, 0.346704096f,
+    0.351532698f, 0.356400251f, 0.361306876f, 0.366252691f, 0.371237785f, 0.376262218f, 0.381326109f, 0.386429518f,
+    0.391572565f, 0.396755308f, 0.401977867f, 0.407240301f, 0.412542701f, 0.417885154f, 0.423267752f, 0.428690553f,
+    0.434153706f, 0.439657241f, 0.445201248f, 0.450785846f, 0.456411064f, 0.462077051f, 0.467783839f, 0.473531544f,
+    0.479320228f, 0.48514998f, 0.491020888f, 0.496933043f, 0.502886593f, 0.50888145f, 0.514917791f, 0.520995677f,
+    0.527115226f, 0.533276498f, 0.539479613f, 0.545724571f, 0.55201149f, 0.55834049f, 0.56471163f, 0.571124911f,
+    0.577580512f, 0.584078491f, 0.590618908f, 0.597201884f, 0.603827417f, 0.610495627f, 0.617206633f, 0.623960435f,
+    0.630757213f, 0.637596965f, 0.644479752f, 0.651405692f, 0.658374846f, 0.665387332f, 0.672443211f, 0.679542542f,
+    0.686685443f, 0.693871915f, 0.701102018f, 0.708375931f, 0.715693653f, 0.723055243f, 0.730460882f, 0.737910569f,
+    0.745404363f, 0.752942324f, 0.760524631f, 0.768151283f, 0.775822341f, 0.783537924f, 0.791298032f, 0.799102843f,
+    0.806952357f, 0.814846694f, 0.822785854f, 0.830769956f, 0.838799119f, 0.846873283f, 0.854992688f, 0.863157272f,
+    0.871367216f, 0.87962234f, 0.887923181f, 0.896269381f, 0.904661357f, 0.913098693f, 0.921582043f, 0.930110872f,
+    0.938685894f, 0.947306573f, 0.955973506f, 0.964686275f, 0.973445475f, 0.982250571f, 0.991102219f, 1.f
+};
+
 static inline float linearRGB_from_sRGB(unsigned char v)
 {
-    float fv = v / 255.f;
-    if (fv < 0.04045f) return fv / 12.92f;
-    return powf((fv + 0.055f) / 1.055f, 2.4f);
+    return dl_linearRGB_from_sRGB_table[v];
 }
 
+/*
+    The textbook encoding function is:
+
+    unsigned char sRGB_from_linearRGB(float v)
+    {
+        if (v <= 0.f) return 0;
+        if (v >= 1.f) return 255;
+        if (v < 0.0031308f) return 0.5f + (v * 12.92 * 255.f);
+        return 0.f + 255.f * (powf(v, 1.f / 2.4f) * 1.055f - 0.055f);
+    }
+
+    The linear segment is cheap, but the powf is not. Here the pow segment is
+    approximated piecewise-linearly, with 32 segments per power of two between
+    2^-9 (just below 0.0031308) and 1. This makes it possible to directly
+    index the table with the exponent and the 5 most significant bits of the
+    mantissa of the float, and the remaining mantissa bits give the
+    interpolation factor.
+
+    Each entry is 255 * (1.055 * x^(1/2.4) - 0.055) for x = 2^e * (1 + m/32),
+    e in [-9,-1] and m in [0,31], plus a final entry for x = 1. The
+    interpolation error is below 0.002 (in 8-bit units), so the output is
+    within ±1 of the powf version over the entire float range, and almost
+    always identical to it.
+*/
+static const float dl_sRGB_from_linearRGB_table[9*32 + 1] = {
+    5.97040276f, 6.22842489f, 6.48192521f, 6.73111256f, 6.97618049f, 7.21730876f, 7.45466468f, 7.68840427f,
+    7.91867328f, 8.14560812f, 8.36933667f, 8.58997899f, 8.80764796f, 9.02244989f, 9.23448504f, 9.44384803f,
+    9.65062837f, 9.85491072f, 10.0567753f, 10.2562984f, 10.4535521f, 10.6486052f, 10.8415231f, 11.0323681f,
+    11.2211995f, 11.408074f, 11.5930457f, 11.7761662f, 11.9574851f, 12.1370495f, 12.3149049f, 12.4910947f,
+    12.6656605f, 13.0100787f, 13.3484611f, 13.6810863f, 14.0082127f, 14.3300803f, 14.6469125f, 14.9589174f,
+    15.2662896f, 15.5692113f, 15.8678531f, 16.1623753f, 16.4529285f, 16.7396547f, 17.0226876f, 17.3021537f,
+    17.5781723f, 17.8508565f, 18.1203135f, 18.3866448f, 18.6499469f, 18.9103115f, 19.1678261f, 19.4225736f,
+    19.6746333f, 19.9240808f, 20.1709884f, 20.415425f, 20.6574566f, 20.8971464f, 21.1345548f, 21.3697399f,
+    21.6027574f, 22.0625005f, 22.5141868f, 22.9581881f, 23.3948496f, 23.8244913f, 24.2474115f, 24.6638881f,
+    25.0741808f, 25.4785327f, 25.8771717f, 26.2703116f, 26.6581536f, 27.0408871f, 27.4186908f, 27.7917333f,
+    28.1601739f, 28.5241637f, 28.8838456f, 29.2393552f, 29.5908213f, 29.9383665f, 30.2821071f, 30.6221542f,
+    30.9586136f, 31.2915861f, 31.6211681f, 31.9474518f, 32.2705253f, 32.5904728f, 32.907375f, 33.2213095f,
+    33.5323505f, 34.146034f, 34.7489627f, 35.3416335f, 35.9245065f, 36.4980094f, 37.0625401f, 37.6184697f,
+    38.1661448f, 38.7058898f, 39.238009f, 39.7627878f, 40.2804948f, 40.7913828f, 41.2956902f, 41.7936421f,
+    42.2854514f, 42.7713195f, 43.2514371f, 43.7259855f, 44.1951366f, 44.6590537f, 45.1178924f, 45.5718008f,
+    46.0209202f, 46.4653852f, 46.9053244f, 47.3408609f, 47.7721122f, 48.1991909f, 48.6222046f, 49.0412569f,
+    49.4564467f, 50.2756159f, 51.0804293f, 51.8715498f, 52.649592f, 53.4151265f, 54.1686846f, 54.9107616f,
+    55.6418201f, 56.3622933f, 57.0725872f, 57.7730829f, 58.4641388f, 59.1460924f, 59.819262f, 60.4839481f,
+    61.1404347f, 61.7889908f, 62.429871f, 63.0633171f, 63.6895586f, 64.3088136f, 64.9212898f, 65.5271849f,
+    66.1266873f, 66.7199769f, 67.3072254f, 67.8885968f, 68.4642483f, 69.0343298f, 69.5989855f, 70.1583532f,
+    70.7125651f, 71.8060248f, 72.8803217f, 73.936341f, 74.9749027f, 75.9967687f, 77.002648f, 77.9932019f,
+    78.969048f, 79.9307643f, 80.8788929f, 81.8139425f, 82.7363914f, 83.6466903f, 84.545264f, 85.4325134f,
+    86.308818f, 87.1745364f, 88.0300089f, 88.875558f, 89.7114901f, 90.5380964f, 91.355654f, 92.1644269f,
+    92.9646666f, 93.7566132f, 94.5404959f, 95.3165337f, 96.0849361f, 96.8459037f, 97.5996286f, 98.3462949f,
+    99.0860791f, 100.545673f, 101.979687f, 103.389304f, 104.775617f, 106.139645f, 107.482332f, 108.804563f,
+    110.107161f, 111.390899f, 112.656499f, 113.90464f, 115.135962f, 116.351065f, 117.550517f, 118.734853f,
+    119.904579f, 121.060174f, 122.202093f, 123.330766f, 124.446601f, 125.549988f, 126.641297f, 127.720879f,
+    128.789071f, 129.846193f, 130.892551f, 131.928437f, 132.954131f, 133.969901f, 134.976003f, 135.972683f,
+    136.960176f, 138.9085f, 140.822679f, 142.704292f, 144.554798f, 146.375557f, 148.16783f, 149.932796f,
+    151.671556f, 153.38514f, 155.074513f, 156.740582f, 158.384199f, 160.006167f, 161.607244f, 163.188142f,
+    164.74954f, 166.292075f, 167.816353f, 169.32295f, 170.812412f, 172.285257f, 173.741979f, 175.183049f,
+    176.608914f, 178.020002f, 179.416722f, 180.799464f, 182.168602f, 183.524492f, 184.867477f, 186.197885f,
+    187.516031f, 190.116731f, 192.671854f, 195.183505f, 197.653635f, 200.084056f, 202.476453f, 204.832401f,
+    207.153367f, 209.440727f, 211.695769f, 213.919705f, 216.11367f, 218.278738f, 220.415918f, 222.526165f,
+    224.61038f, 226.669417f, 228.704085f, 230.715151f, 232.703344f, 234.669356f, 236.613847f, 238.537444f,
+    240.440746f, 242.324323f, 244.18872f, 246.03446f, 247.862039f, 249.671935f, 251.464605f, 253.240487f,
+    255.f
+};
+
 static inline unsigned char sRGB_from_linearRGB(float v)
 {
-    if (v <= 0.f) return 0;
+    // Written so that NaN also gives 0, instead of an index out of the table.
+    if (!(v > 0.f)) return 0;
+    if (v >= 1.f) return 255;
+    if (v < 0.0031308f) return 0.5f + v * (12.92f * 255.f);
+
+    // The exponent and the top 5 bits of the mantissa are contiguous, so
+    // they directly give the index once we remove the bias of 2^-9.
+    uint32_t bits;
+    memcpy (&bits, &v, sizeof(float));
+    const uint32_t index = (bits >> 18) - ((127 - 9) << 5);
+    const float t = (bits & 0x3ffff) * (1.f / 262144.f);
+    const float* segment = dl_sRGB_from_linearRGB_table + index;
+    return segment[0] + t*(segment[1] - segment[0]);
+}
+
+/*
+    Encodings for the other accuracy modes of the simulators (the default is
+    the one above).
+
+    Exact is the textbook version, with its powf.
+
+    Fast approximates the pow segment with a cubic polynomial in s = sqrt(v),
+    fitted to minimize the maximum error: 255 * (1.055 * v^(1/2.4) - 0.055)
+    ~= c0 + c1*s + c2*s^2 + c3*s^3. The error is below 0.49 (in 8-bit units),
+    so the output is within ±1 of the textbook version, like the table. It
+    only takes a sqrt and 3 multiply-adds with no table lookup, so the SIMD
+    kernels can do it on full vectors. They evaluate it in the same order
+    as below to get identical results.
+*/
+static inline unsigned char sRGB_from_linearRGB_exact(float v)
+{
+    if (!(v > 0.f)) return 0;
     if (v >= 1.f) return 255;
     if (v < 0.0031308f) return 0.5f + (v * 12.92 * 255.f);
     return 0.f + 255.f * (powf(v, 1.f / 2.4f) * 1.055f - 0.055f);
 }
 
+static const float dl_fast_sRGB_c0 = -8.15243839f;
+static const float dl_fast_sRGB_c1 = 346.173140f;
+static const float dl_fast_sRGB_c2 = -137.876565f;
+static const float dl_fast_sRGB_c3 = 55.3368685f;
+
+static inline unsigned char sRGB_from_linearRGB_fast(float v)
+{
+    if (!(v > 0.f)) return 0;
+    if (v >= 1.f) return 255;
+    if (v < 0.0031308f) return 0.5f + v * (12.92f * 255.f);
+
+    const float s = sqrtf(v);
+    return ((dl_fast_sRGB_c3*s + dl_fast_sRGB_c2)*s + dl_fast_sRGB_c1)*s + dl_fast_sRGB_c0;
+}
+
+static inline unsigned char dl_sRGB_from_linearRGB_accuracy(float v, enum DLAccuracy accuracy)
+{
+    switch (accuracy)
+    {
+        case DLAccuracy_Exact: return sRGB_from_linearRGB_exact(v);
+        case DLAccuracy_Fast: return sRGB_from_linearRGB_fast(v);
+        default: return sRGB_from_linearRGB(v);
+    }
+}
+
+/*
+    Pixel layouts
+
+    Only the byte offsets of the channels change between the supported
+    formats, so the kernels take them as a parameter instead of assuming
+    RGBA. The extra byte of the 4-byte formats (alpha or padding) is copied
+    unchanged.
+*/
+struct DLPixelLayout
+{
+    int pixelSize;
+    int r, g, b;
+    // Offset of the byte to copy as is, -1 if there is none.
+    int a;
+};
+
+static const struct DLPixelLayout dl_pixel_layouts[] = {
+    /* DLPixelFormat_RGBA32 */ { 4, 0, 1, 2, 3 },
+    /* DLPixelFormat_BGRA32 */ { 4, 2, 1, 0, 3 },
+    /* DLPixelFormat_ARGB32 */ { 4, 1, 2, 3, 0 },
+    /* DLPixelFormat_RGBX32 */ { 4, 0, 1, 2, 3 },
+    /* DLPixelFormat_RGB24 */  { 3, 0, 1, 2, -1 },
+    /* DLPixelFormat_BGR24 */  { 3, 2, 1, 0, -1 },
+};
+
+#define dl_rgba_layout (dl_pixel_layouts[DLPixelFormat_RGBA32])
+
+static inline void dl_decode_pixel (const struct DLPixelLayout* layout, const unsigned char* px, float rgb[3])
+{
+    rgb[0] = linearRGB_from_sRGB(px[layout->r]);
+    rgb[1] = linearRGB_from_sRGB(px[layout->g]);
+    rgb[2] = linearRGB_from_sRGB(px[layout->b]);
+}
+
+static inline void dl_encode_pixel (const struct DLPixelLayout* layout, const unsigned char* srcPx, unsigned char* dstPx, const float rgb_cvd[3])
+{
+    // Read it first, srcPx and dstPx can be the same.
+    const unsigned char a = layout->a >= 0 ? srcPx[layout->a] : 0;
+    dstPx[layout->r] = sRGB_from_linearRGB(rgb_cvd[0]);
+    dstPx[layout->g] = sRGB_from_linearRGB(rgb_cvd[1]);
+    dstPx[layout->b] = sRGB_from_linearRGB(rgb_cvd[2]);
+    if (layout->a >= 0)
+    {
+        dstPx[layout->a] = a;
+    }
+}
+
+static inline void dl_encode_pixel_accuracy (const struct DLPixelLayout* layout, const unsigned char* srcPx, unsigned char* dstPx, const float rgb_cvd[3], enum DLAccuracy accuracy)
+{
+    const unsigned char a = layout->a >= 0 ? srcPx[layout->a] : 0;
+    dstPx[layout->r] = dl_sRGB_from_linearRGB_accuracy(rgb_cvd[0], accuracy);
+    dstPx[layout->g] = dl_sRGB_from_linearRGB_accuracy(rgb_cvd[1], accuracy);
+    dstPx[layout->b] = dl_sRGB_from_linearRGB_accuracy(rgb_cvd[2], accuracy);
+    if (layout->a >= 0)
+    {
+        dstPx[layout->a] = a;
+    }
+}
+
 /*
     Brettel 1997 precomputed parameters.
 
@@ -150,58 +374,44 @@ static struct DLBrettel1997Params brettel_tritan_params = {
     { 0.03901, -0.02788, -0.01113 }
 };
 
-void dl_simulate_cvd_brettel1997 (enum DLDeficiency deficiency, float severity, unsigned char* srgba_image, size_t width, size_t height, size_t bytesPerRow)
+static inline void dl_brettel1997_pixel (const struct DLBrettel1997Params* params, float severity, const float rgb[3], float rgb_cvd[3])
 {
-    // Compute a default bytesPerRow if it wasn't specified.
-    if (bytesPerRow == 0)
-    {
-        bytesPerRow = width * 4;
-    }
+    // Check on which plane we should project by comparing wih the separation plane normal.
+    const float* n = params->separationPlaneNormalInRgb;
+    const float dotWithSepPlane = rgb[0]*n[0] + rgb[1]*n[1] + rgb[2]*n[2];
+    const float* rgbCvdFromRgb = (dotWithSepPlane >= 0 ? params->rgbCvdFromRgb_1 : params->rgbCvdFromRgb_2);
 
-    const struct DLBrettel1997Params* params = NULL;
-    switch (deficiency)
+    rgb_cvd[0] = rgbCvdFromRgb[0]*rgb[0] + rgbCvdFromRgb[1]*rgb[1] + rgbCvdFromRgb[2]*rgb[2];
+    rgb_cvd[1] = rgbCvdFromRgb[3]*rgb[0] + rgbCvdFromRgb[4]*rgb[1] + rgbCvdFromRgb[5]*rgb[2];
+    rgb_cvd[2] = rgbCvdFromRgb[6]*rgb[0] + rgbCvdFromRgb[7]*rgb[1] + rgbCvdFromRgb[8]*rgb[2];
+
+    // Apply the severity factor as a linear interpolation.
+    // It's the same to do it in the RGB space or in the LMS
+    // space since it's a linear transform. Skipping it for
+    // a severity of exactly 1 does not change the output.
+    if (severity < 1.f)
     {
-        case DLDeficiency_Protan: params = &brettel_protan_params; break;
-        case DLDeficiency_Deutan: params = &brettel_deutan_params; break;
-        case DLDeficiency_Tritan: params = &brettel_tritan_params; break;
+        rgb_cvd[0] = rgb_cvd[0]*severity + rgb[0]*(1.f-severity);
+        rgb_cvd[1] = rgb_cvd[1]*severity + rgb[1]*(1.f-severity);
+        rgb_cvd[2] = rgb_cvd[2]*severity + rgb[2]*(1.f-severity);
     }
+}
 
-    for (size_t row = 0; row < height; ++row)
+static void dl_brettel1997_row_scalar (const struct DLBrettel1997Params* params, float severity, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width)
+{
+    const size_t pixelSize = layout->pixelSize;
+    for (size_t col = 0; col < width*pixelSize; col += pixelSize)
     {
-        unsigned char* rowPtr = srgba_image + bytesPerRow*row;
-        for (size_t col = 0; col < width*4; col += 4)
-        {
-            // rgb = linearRGB_from_sRGB(srgb)
-            // alpha is untouched.
-            const float rgb[3] = {
-                linearRGB_from_sRGB(rowPtr[col + 0]),
-                linearRGB_from_sRGB(rowPtr[col + 1]),
-                linearRGB_from_sRGB(rowPtr[col + 2])
-            };
-            
-            // Check on which plane we should project by comparing wih the separation plane normal.
-            const float* n = params->separationPlaneNormalInRgb;
-            const float dotWithSepPlane = rgb[0]*n[0] + rgb[1]*n[1] + rgb[2]*n[2];
-            const float* rgbCvdFromRgb = (dotWithSepPlane >= 0 ? params->rgbCvdFromRgb_1 : params->rgbCvdFromRgb_2);
+        // rgb = linearRGB_from_sRGB(srgb)
+        // alpha is just copied.
+        float rgb[3];
+        dl_decode_pixel(layout, src + col, rgb);
 
-            float rgb_cvd[3] = {
-                rgbCvdFromRgb[0]*rgb[0] + rgbCvdFromRgb[1]*rgb[1] + rgbCvdFromRgb[2]*rgb[2],
-                rgbCvdFromRgb[3]*rgb[0] + rgbCvdFromRgb[4]*rgb[1] + rgbCvdFromRgb[5]*rgb[2],
-                rgbCvdFromRgb[6]*rgb[0] + rgbCvdFromRgb[7]*rgb[1] + rgbCvdFromRgb[8]*rgb[2]
-            };
+        float rgb_cvd[3];
+        dl_brettel1997_pixel(params, severity, rgb, rgb_cvd);
 
-            // Apply the severity factor as a linear interpolation.
-            // It's the same to do it in the RGB space or in the LMS
-            // space since it's a linear transform.
-            rgb_cvd[0] = rgb_cvd[0]*severity + rgb[0]*(1.f-severity);
-            rgb_cvd[1] = rgb_cvd[1]*severity + rgb[1]*(1.f-severity);
-            rgb_cvd[2] = rgb_cvd[2]*severity + rgb[2]*(1.f-severity);
-
-            // Encode as sRGB and write the result.
-            rowPtr[col + 0] = sRGB_from_linearRGB(rgb_cvd[0]);
-            rowPtr[col + 1] = sRGB_from_linearRGB(rgb_cvd[1]);
-            rowPtr[col + 2] = sRGB_from_linearRGB(rgb_cvd[2]);
-        }
+        // Encode as sRGB and write the result.
+        dl_encode_pixel(layout, src + col, dst + col, rgb_cvd);
     }
 }
 
@@ -244,70 +454,5201 @@ static float dl_vienot_tritan_rgbCvd_from_rgb[] = {
     -0.00000, 0.85924, 0.14076
 };
 
-void dl_simulate_cvd_vienot1999 (enum DLDeficiency deficiency, float severity, unsigned char* srgba_image, size_t width, size_t height, size_t bytesPerRow)
+static inline void dl_vienot1999_pixel (const float* rgbCvd_from_rgb, float severity, const float rgb[3], float rgb_cvd[3])
 {
-    // Compute a default bytesPerRow if it wasn't specified.
-    if (bytesPerRow == 0)
+    // rgb_cvd = rgbCvd_from_rgb * rgb
+    rgb_cvd[0] = rgbCvd_from_rgb[0]*rgb[0] + rgbCvd_from_rgb[1]*rgb[1] + rgbCvd_from_rgb[2]*rgb[2];
+    rgb_cvd[1] = rgbCvd_from_rgb[3]*rgb[0] + rgbCvd_from_rgb[4]*rgb[1] + rgbCvd_from_rgb[5]*rgb[2];
+    rgb_cvd[2] = rgbCvd_from_rgb[6]*rgb[0] + rgbCvd_from_rgb[7]*rgb[1] + rgbCvd_from_rgb[8]*rgb[2];
+
+    // Implement the severity factor as a linear interpolation.
+    if (severity < 0.999f)
     {
-        bytesPerRow = width * 4;
+        rgb_cvd[0] = severity*rgb_cvd[0] + (1.f - severity)*rgb[0];
+        rgb_cvd[1] = severity*rgb_cvd[1] + (1.f - severity)*rgb[1];
+        rgb_cvd[2] = severity*rgb_cvd[2] + (1.f - severity)*rgb[2];
     }
+}
 
-    const float* rgbCvd_from_rgb = NULL;
-    switch (deficiency)
+static void dl_vienot1999_row_scalar (const float* rgbCvd_from_rgb, float severity, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width)
+{
+    const size_t pixelSize = layout->pixelSize;
+    for (size_t col = 0; col < width*pixelSize; col += pixelSize)
+    {
+        // rgb = linearRGB_from_sRGB(srgb)
+        // alpha is just copied.
+        float rgb[3];
+        dl_decode_pixel(layout, src + col, rgb);
+
+        float rgb_cvd[3];
+        dl_vienot1999_pixel(rgbCvd_from_rgb, severity, rgb, rgb_cvd);
+
+        // Write the result, encoded to sRGB
+        dl_encode_pixel(layout, src + col, dst + col, rgb_cvd);
+    }
+}
+
+// Rows with the encoding of another accuracy mode, inlined with a constant
+// 'accuracy' in the wrappers below. Exact only has this scalar version.
+static inline void dl_brettel1997_row_accuracy (const struct DLBrettel1997Params* params, float severity, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width, enum DLAccuracy accuracy)
+{
+    const size_t pixelSize = layout->pixelSize;
+    for (size_t col = 0; col < width*pixelSize; col += pixelSize)
     {
-        case DLDeficiency_Protan: rgbCvd_from_rgb = dl_vienot_protan_rgbCvd_from_rgb; break;
-        case DLDeficiency_Deutan: rgbCvd_from_rgb = dl_vienot_deutan_rgbCvd_from_rgb; break;
-        case DLDeficiency_Tritan: rgbCvd_from_rgb = dl_vienot_tritan_rgbCvd_from_rgb; break;
+        float rgb[3], rgb_cvd[3];
+        dl_decode_pixel(layout, src + col, rgb);
+        dl_brettel1997_pixel(params, severity, rgb, rgb_cvd);
+        dl_encode_pixel_accuracy(layout, src + col, dst + col, rgb_cvd, accuracy);
     }
+}
 
-    for (size_t row = 0; row < height; ++row)
+static inline void dl_vienot1999_row_accuracy (const float* rgbCvd_from_rgb, float severity, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width, enum DLAccuracy accuracy)
+{
+    const size_t pixelSize = layout->pixelSize;
+    for (size_t col = 0; col < width*pixelSize; col += pixelSize)
     {
-        unsigned char* rowPtr = srgba_image + bytesPerRow*row;
-        for (size_t col = 0; col < width*4; col += 4)
+        float rgb[3], rgb_cvd[3];
+        dl_decode_pixel(layout, src + col, rgb);
+        dl_vienot1999_pixel(rgbCvd_from_rgb, severity, rgb, rgb_cvd);
+        dl_encode_pixel_accuracy(layout, src + col, dst + col, rgb_cvd, accuracy);
+    }
+}
+
+static void dl_brettel1997_row_exact (const struct DLBrettel1997Params* params, float severity, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width)
+{
+    dl_brettel1997_row_accuracy(params, severity, layout, src, dst, width, DLAccuracy_Exact);
+}
+
+static void dl_vienot1999_row_exact (const float* rgbCvd_from_rgb, float severity, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width)
+{
+    dl_vienot1999_row_accuracy(rgbCvd_from_rgb, severity, layout, src, dst, width, DLAccuracy_Exact);
+}
+
+static void dl_brettel1997_row_fast_scalar (const struct DLBrettel1997Params* params, float severity, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width)
+{
+    dl_brettel1997_row_accuracy(params, severity, layout, src, dst, width, DLAccuracy_Fast);
+}
+
+static void dl_vienot1999_row_fast_scalar (const float* rgbCvd_from_rgb, float severity, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width)
+{
+    dl_vienot1999_row_accuracy(rgbCvd_from_rgb, severity, layout, src, dst, width, DLAccuracy_Fast);
+}
+
+// Rows with one severity per pixel, see dl_simulate_cvd_severity_map.
+static void dl_brettel1997_row_map_scalar (const struct DLBrettel1997Params* params, const float* severities, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width)
+{
+    const size_t pixelSize = layout->pixelSize;
+    for (size_t i = 0; i < width; ++i)
+    {
+        float rgb[3], rgb_cvd[3];
+        dl_decode_pixel(layout, src + i*pixelSize, rgb);
+        dl_brettel1997_pixel(params, severities[i], rgb, rgb_cvd);
+        dl_encode_pixel(layout, src + i*pixelSize, dst + i*pixelSize, rgb_cvd);
+    }
+}
+
+static void dl_vienot1999_row_map_scalar (const float* rgbCvd_from_rgb, const float* severities, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width)
+{
+    const size_t pixelSize = layout->pixelSize;
+    for (size_t i = 0; i < width; ++i)
+    {
+        float rgb[3], rgb_cvd[3];
+        dl_decode_pixel(layout, src + i*pixelSize, rgb);
+        dl_vienot1999_pixel(rgbCvd_from_rgb, severities[i], rgb, rgb_cvd);
+        dl_encode_pixel(layout, src + i*pixelSize, dst + i*pixelSize, rgb_cvd);
+    }
+}
+
+/*
+    Simulates the 3 deficiencies in a single pass, with the same algorithms
+    as dl_simulate_cvd: Viénot 1999 for protanopia and deuteranopia, Brettel
+    1997 for tritanopia. Each pixel only gets read and decoded once. 'dst' is
+    indexed by DLDeficiency and NULL entries are skipped.
+*/
+static void dl_all_deficiencies_row_scalar (float severity, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* const dst[3], size_t width)
+{
+    const size_t pixelSize = layout->pixelSize;
+    for (size_t col = 0; col < width*pixelSize; col += pixelSize)
+    {
+        float rgb[3];
+        dl_decode_pixel(layout, src + col, rgb);
+
+        for (int d = 0; d < 3; ++d)
         {
-            // rgb = linearRGB_from_sRGB(srgb)
-            // alpha is untouched.
-            float rgb[3] = {
-                linearRGB_from_sRGB(rowPtr[col + 0]),
-                linearRGB_from_sRGB(rowPtr[col + 1]),
-                linearRGB_from_sRGB(rowPtr[col + 2])
-            };
-            
-            // rgb_cvd = rgbCvd_from_rgb * rgb
-            float rgb_cvd[3] = {
-                rgbCvd_from_rgb[0]*rgb[0] + rgbCvd_from_rgb[1]*rgb[1] + rgbCvd_from_rgb[2]*rgb[2],
-                rgbCvd_from_rgb[3]*rgb[0] + rgbCvd_from_rgb[4]*rgb[1] + rgbCvd_from_rgb[5]*rgb[2],
-                rgbCvd_from_rgb[6]*rgb[0] + rgbCvd_from_rgb[7]*rgb[1] + rgbCvd_from_rgb[8]*rgb[2]
-            };
-
-            // Implement the severity factor as a linear interpolation.
-            if (severity < 0.999f)
+            if (dst[d] == NULL) continue;
+
+            float rgb_cvd[3];
+            switch (d)
             {
-                rgb_cvd[0] = severity*rgb_cvd[0] + (1.f - severity)*rgb[0];
-                rgb_cvd[1] = severity*rgb_cvd[1] + (1.f - severity)*rgb[1];
-                rgb_cvd[2] = severity*rgb_cvd[2] + (1.f - severity)*rgb[2];
+                case DLDeficiency_Protan: dl_vienot1999_pixel(dl_vienot_protan_rgbCvd_from_rgb, severity, rgb, rgb_cvd); break;
+                case DLDeficiency_Deutan: dl_vienot1999_pixel(dl_vienot_deutan_rgbCvd_from_rgb, severity, rgb, rgb_cvd); break;
+                default: dl_brettel1997_pixel(&brettel_tritan_params, severity, rgb, rgb_cvd); break;
             }
 
-            // Write the result, encoded to sRGB
-            rowPtr[col + 0] = sRGB_from_linearRGB(rgb_cvd[0]);
-            rowPtr[col + 1] = sRGB_from_linearRGB(rgb_cvd[1]);
-            rowPtr[col + 2] = sRGB_from_linearRGB(rgb_cvd[2]);
+            dl_encode_pixel(layout, src + col, dst[d] + col, rgb_cvd);
         }
     }
 }
 
-void dl_simulate_cvd (enum DLDeficiency deficiency, float severity, unsigned char* srgba_image, size_t width, size_t height, size_t bytesPerRow)
+// Advance the non-NULL destination rows by the given number of bytes.
+static inline void dl_offset_dst_rows (unsigned char* const dst[3], size_t numBytes, unsigned char* offsetDst[3])
 {
-    // Viénot 1999 is not accurate for tritanopia, so use Brettel in that case.
-    // Otherwise use Viénot 1999 because it's a bit faster.
-    if (deficiency == DLDeficiency_Tritan)
+    for (int d = 0; d < 3; ++d)
+        offsetDst[d] = dst[d] ? dst[d] + numBytes : NULL;
+}
+
+/*
+    Wide samples
+
+    RGBA images with more than 8 bits per channel, 4 channels per pixel and
+    alpha copied unchanged. Linear float images directly go through the
+    transforms, without any transfer function, so the values are not
+    clamped and HDR or negative (out of gamut) values are transformed just
+    like the others. The other sample formats get converted to linear float
+    RGBA by chunks of pixels and back.
+*/
+
+static void dl_brettel1997_row_f32_scalar (const struct DLBrettel1997Params* params, float severity, const float* src, float* dst, size_t width)
+{
+    for (size_t col = 0; col < width*4; col += 4)
     {
-        dl_simulate_cvd_brettel1997(deficiency, severity, srgba_image, width, height, bytesPerRow);
+        float rgb_cvd[3];
+        dl_brettel1997_pixel(params, severity, src + col, rgb_cvd);
+        const float a = src[col + 3];
+        dst[col + 0] = rgb_cvd[0];
+        dst[col + 1] = rgb_cvd[1];
+        dst[col + 2] = rgb_cvd[2];
+        dst[col + 3] = a;
+    }
+}
+
+static void dl_vienot1999_row_f32_scalar (const float* rgbCvd_from_rgb, float severity, const float* src, float* dst, size_t width)
+{
+    for (size_t col = 0; col < width*4; col += 4)
+    {
+        float rgb_cvd[3];
+        dl_vienot1999_pixel(rgbCvd_from_rgb, severity, src + col, rgb_cvd);
+        const float a = src[col + 3];
+        dst[col + 0] = rgb_cvd[0];
+        dst[col + 1] = rgb_cvd[1];
+        dst[col + 2] = rgb_cvd[2];
+        dst[col + 3] = a;
+    }
+}
+
+/*
+    IEEE 754 half floats, with the same results as the F16C and NEON
+    conversion instructions: round to nearest even, overflows to infinity
+    and quiet NaNs.
+*/
+static inline float dl_float_from_half (uint16_t h)
+{
+    const uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    const uint32_t exponent = (h >> 10) & 0x1f;
+    const uint32_t mantissa = h & 0x3ff;
+
+    uint32_t bits;
+    if (exponent == 0x1f)
+    {
+        bits = sign | 0x7f800000 | (mantissa << 13) | (mantissa ? 0x400000 : 0);
+    }
+    else if (exponent == 0)
+    {
+        // Zero or denormal, exactly representable as mantissa * 2^-24.
+        const float v = mantissa * (1.f / 16777216.f);
+        memcpy (&bits, &v, sizeof(float));
+        bits |= sign;
     }
     else
     {
-        dl_simulate_cvd_vienot1999(deficiency, severity, srgba_image, width, height, bytesPerRow);
+        bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+    }
+
+    float v;
+    memcpy (&v, &bits, sizeof(float));
+    return v;
+}
+
+static inline uint16_t dl_half_from_float (float v)
+{
+    uint32_t bits;
+    memcpy (&bits, &v, sizeof(float));
+    const uint16_t sign = (bits >> 16) & 0x8000;
+    bits &= 0x7fffffff;
+
+    if (bits >= 0x7f800000)
+    {
+        // Infinity or NaN.
+        return sign | 0x7c00 | (bits > 0x7f800000 ? 0x200 | ((bits >> 13) & 0x3ff) : 0);
+    }
+
+    if (bits >= 0x477ff000)
+    {
+        // Rounds to a value larger than 65504.
+        return sign | 0x7c00;
+    }
+
+    if (bits < 0x38800000)
+    {
+        // Denormal or zero: adding 0.5 aligns the mantissa to the 2^-24
+        // step and lets the FPU do the rounding.
+        float abs;
+        memcpy (&abs, &bits, sizeof(float));
+        abs += 0.5f;
+        memcpy (&bits, &abs, sizeof(float));
+        return sign | (uint16_t)(bits - 0x3f000000);
+    }
+
+    // Normal: rebias the exponent and round the 13 dropped mantissa bits to
+    // nearest even.
+    const uint32_t mantissaOdd = (bits >> 13) & 1;
+    bits += ((uint32_t)(15 - 127) << 23) + 0xfff + mantissaOdd;
+    return sign | (uint16_t)(bits >> 13);
+}
+
+static void dl_float_from_half_scalar (const uint16_t* src, float* dst, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+        dst[i] = dl_float_from_half(src[i]);
+}
+
+static void dl_half_from_float_scalar (const float* src, uint16_t* dst, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+        dst[i] = dl_half_from_float(src[i]);
+}
+
+/*
+    16-bit sRGB. The 8-bit tables are not precise enough for 16-bit values,
+    especially in the dark colors, so this uses the textbook functions with
+    powf. It is the bottleneck of this format.
+*/
+static inline float dl_linearRGB_from_sRGB16 (uint16_t v)
+{
+    const float fv = v * (1.f / 65535.f);
+    if (fv < 0.04045f) return fv / 12.92f;
+    return powf((fv + 0.055f) / 1.055f, 2.4f);
+}
+
+static inline uint16_t dl_sRGB16_from_linearRGB (float v)
+{
+    if (!(v > 0.f)) return 0;
+    if (v >= 1.f) return 65535;
+    if (v < 0.0031308f) return 0.5f + v * (12.92f * 65535.f);
+    return 0.5f + 65535.f * (powf(v, 1.f / 2.4f) * 1.055f - 0.055f);
+}
+
+static void dl_decode_sRGB16_pixels (const uint16_t* src, float* dst, size_t width)
+{
+    for (size_t i = 0; i < width*4; i += 4)
+    {
+        dst[i + 0] = dl_linearRGB_from_sRGB16(src[i + 0]);
+        dst[i + 1] = dl_linearRGB_from_sRGB16(src[i + 1]);
+        dst[i + 2] = dl_linearRGB_from_sRGB16(src[i + 2]);
+        dst[i + 3] = src[i + 3];
+    }
+}
+
+static void dl_encode_sRGB16_pixels (const float* src, uint16_t* dst, size_t width)
+{
+    for (size_t i = 0; i < width*4; i += 4)
+    {
+        dst[i + 0] = dl_sRGB16_from_linearRGB(src[i + 0]);
+        dst[i + 1] = dl_sRGB16_from_linearRGB(src[i + 1]);
+        dst[i + 2] = dl_sRGB16_from_linearRGB(src[i + 2]);
+        dst[i + 3] = (uint16_t)src[i + 3];
+    }
+}
+
+/*
+    SIMD kernels
+
+    These process 4 (SSE4.1) or 8 (AVX2) RGBA pixels per iteration and fall
+    back to the scalar version for the remaining pixels of each row. The
+    decoding, transforms and encoding are separate inline functions, so the
+    single pass multi-deficiency kernels can decode the pixels only once. Each
+    pixel is loaded as a 32-bit lane, so the deinterleaving is just a few
+    shifts and masks, and alpha is re-injected from the original lanes.
+
+    Only multiplications and additions are used, in the same order as the
+    scalar code, so the output is identical to the scalar version (unless
+    the compiler decides to contract the scalar code into FMAs).
+
+    They are always compiled on x86, using function target attributes with
+    GCC and clang so the rest of the code does not need -msse4.1 or -mavx2,
+    and the best one is picked at runtime (see dl_get_kernels below).
+*/
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86) || defined(__wasm_simd128__)
+
+/*
+    Byte shuffles between a pixel layout and RGB values in the low bytes of
+    32-bit lanes, computed once per row. Each 16 bytes (or each 128-bit lane
+    with AVX2) hold 4 pixels, so with 3-byte pixels only 12 of them are used.
+    Shared by the x86 and WebAssembly kernels.
+*/
+struct DLSimdLayout
+{
+    int pixelSize;
+    unsigned char toRgb[16];
+    unsigned char fromRgb[16];
+    unsigned char extraMask[16];
+};
+
+static void dl_simd_layout_init (struct DLSimdLayout* simd, const struct DLPixelLayout* layout)
+{
+    // 0x80 clears the byte, both in pshufb and i8x16.swizzle.
+    memset (simd->toRgb, 0x80, 16);
+    memset (simd->fromRgb, 0x80, 16);
+    memset (simd->extraMask, 0, 16);
+    simd->pixelSize = layout->pixelSize;
+    for (int k = 0; k < 4; ++k)
+    {
+        const int px = k*layout->pixelSize;
+        simd->toRgb[k*4 + 0] = px + layout->r;
+        simd->toRgb[k*4 + 1] = px + layout->g;
+        simd->toRgb[k*4 + 2] = px + layout->b;
+        simd->fromRgb[px + layout->r] = k*4 + 0;
+        simd->fromRgb[px + layout->g] = k*4 + 1;
+        simd->fromRgb[px + layout->b] = k*4 + 2;
+        if (layout->a >= 0)
+        {
+            simd->extraMask[px + layout->a] = 0xff;
+        }
+    }
+}
+
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+
+#define DL_HAS_X86_SIMD 1
+
+#include <immintrin.h>
+
+#if defined(__GNUC__) || defined(__clang__)
+#  include <cpuid.h>
+#  define DL_TARGET_SSE41 __attribute__((target("sse4.1")))
+#  define DL_TARGET_AVX2 __attribute__((target("avx2")))
+#  define DL_TARGET_AVX2_F16C __attribute__((target("avx2,f16c")))
+#else
+#  include <intrin.h>
+// MSVC does not need anything special to use the intrinsics.
+#  define DL_TARGET_SSE41
+#  define DL_TARGET_AVX2
+#  define DL_TARGET_AVX2_F16C
+#endif
+
+// 3-byte pixels: load or store exactly 12 bytes, to stay within the row.
+DL_TARGET_SSE41 static inline __m128i dl_sse41_load12 (const unsigned char* src)
+{
+    int last;
+    memcpy (&last, src + 8, 4);
+    return _mm_insert_epi32(_mm_loadl_epi64((const __m128i*)src), last, 2);
+}
+
+DL_TARGET_SSE41 static inline void dl_sse41_store12 (unsigned char* dst, __m128i v)
+{
+    const int last = _mm_extract_epi32(v, 2);
+    _mm_storel_epi64((__m128i*)dst, v);
+    memcpy (dst + 8, &last, 4);
+}
+
+DL_TARGET_SSE41 static inline void dl_sse41_decode_rgb (const struct DLPixelLayout* layout, const unsigned char* src, __m128 rgb[3])
+{
+    // No gather instruction in SSE, so just load the table values one by one.
+    const float* table = dl_linearRGB_from_sRGB_table;
+    const unsigned char* p0 = src;
+    const unsigned char* p1 = p0 + layout->pixelSize;
+    const unsigned char* p2 = p1 + layout->pixelSize;
+    const unsigned char* p3 = p2 + layout->pixelSize;
+    rgb[0] = _mm_setr_ps(table[p0[layout->r]], table[p1[layout->r]], table[p2[layout->r]], table[p3[layout->r]]);
+    rgb[1] = _mm_setr_ps(table[p0[layout->g]], table[p1[layout->g]], table[p2[layout->g]], table[p3[layout->g]]);
+    rgb[2] = _mm_setr_ps(table[p0[layout->b]], table[p1[layout->b]], table[p2[layout->b]], table[p3[layout->b]]);
+}
+
+// Same as sRGB_from_linearRGB, returns the 8-bit values in 32-bit lanes.
+DL_TARGET_SSE41 static inline __m128i dl_sse41_encode (__m128 v)
+{
+    // Clamp to the pow segment range before computing the index so that we
+    // never read outside of the table, the other cases get blended later.
+    const __m128 clamped = _mm_min_ps(_mm_max_ps(v, _mm_set1_ps(0.0031308f)),
+                                      _mm_castsi128_ps(_mm_set1_epi32(0x3f7fffff) /* largest float < 1 */));
+    const __m128i bits = _mm_castps_si128(clamped);
+    const __m128i index = _mm_sub_epi32(_mm_srli_epi32(bits, 18), _mm_set1_epi32((127 - 9) << 5));
+    const __m128 t = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(bits, _mm_set1_epi32(0x3ffff))), _mm_set1_ps(1.f / 262144.f));
+
+    const float* table = dl_sRGB_from_linearRGB_table;
+    const int i0 = _mm_extract_epi32(index, 0);
+    const int i1 = _mm_extract_epi32(index, 1);
+    const int i2 = _mm_extract_epi32(index, 2);
+    const int i3 = _mm_extract_epi32(index, 3);
+    const __m128 s0 = _mm_setr_ps(table[i0], table[i1], table[i2], table[i3]);
+    const __m128 s1 = _mm_setr_ps(table[i0+1], table[i1+1], table[i2+1], table[i3+1]);
+    __m128 srgb = _mm_add_ps(s0, _mm_mul_ps(t, _mm_sub_ps(s1, s0)));
+
+    const __m128 linear = _mm_add_ps(_mm_set1_ps(0.5f), _mm_mul_ps(v, _mm_set1_ps(12.92f * 255.f)));
+    srgb = _mm_blendv_ps(srgb, linear, _mm_cmplt_ps(v, _mm_set1_ps(0.0031308f)));
+    srgb = _mm_blendv_ps(srgb, _mm_setzero_ps(), _mm_cmple_ps(v, _mm_setzero_ps()));
+    srgb = _mm_blendv_ps(srgb, _mm_set1_ps(255.f), _mm_cmpge_ps(v, _mm_set1_ps(1.f)));
+    return _mm_cvttps_epi32(srgb);
+}
+
+// Same as sRGB_from_linearRGB_fast, no table lookup.
+DL_TARGET_SSE41 static inline __m128i dl_sse41_encode_fast (__m128 v)
+{
+    const __m128 s = _mm_sqrt_ps(_mm_max_ps(v, _mm_setzero_ps()));
+    __m128 srgb = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(dl_fast_sRGB_c3), s), _mm_set1_ps(dl_fast_sRGB_c2));
+    srgb = _mm_add_ps(_mm_mul_ps(srgb, s), _mm_set1_ps(dl_fast_sRGB_c1));
+    srgb = _mm_add_ps(_mm_mul_ps(srgb, s), _mm_set1_ps(dl_fast_sRGB_c0));
+
+    const __m128 linear = _mm_add_ps(_mm_set1_ps(0.5f), _mm_mul_ps(v, _mm_set1_ps(12.92f * 255.f)));
+    srgb = _mm_blendv_ps(srgb, linear, _mm_cmplt_ps(v, _mm_set1_ps(0.0031308f)));
+    srgb = _mm_blendv_ps(srgb, _mm_setzero_ps(), _mm_cmple_ps(v, _mm_setzero_ps()));
+    srgb = _mm_blendv_ps(srgb, _mm_set1_ps(255.f), _mm_cmpge_ps(v, _mm_set1_ps(1.f)));
+    return _mm_cvttps_epi32(srgb);
+}
+
+#define dl_sse41_encode_accuracy(v, fast) ((fast) ? dl_sse41_encode_fast(v) : dl_sse41_encode(v))
+
+DL_TARGET_SSE41 static inline void dl_sse41_encode_rgb (const struct DLSimdLayout* simd, const unsigned char* src, unsigned char* dst, const __m128 rgb[3], int fast)
+{
+    __m128i rgbOut = dl_sse41_encode_accuracy(rgb[0], fast);
+    rgbOut = _mm_or_si128(rgbOut, _mm_slli_epi32(dl_sse41_encode_accuracy(rgb[1], fast), 8));
+    rgbOut = _mm_or_si128(rgbOut, _mm_slli_epi32(dl_sse41_encode_accuracy(rgb[2], fast), 16));
+    const __m128i out = _mm_shuffle_epi8(rgbOut, _mm_loadu_si128((const __m128i*)simd->fromRgb));
+    if (simd->pixelSize == 4)
+    {
+        // Keep the alpha / padding byte of the source.
+        const __m128i extra = _mm_and_si128(_mm_loadu_si128((const __m128i*)src), _mm_loadu_si128((const __m128i*)simd->extraMask));
+        _mm_storeu_si128((__m128i*)dst, _mm_or_si128(out, extra));
+    }
+    else
+    {
+        dl_sse41_store12(dst, out);
+    }
+}
+
+DL_TARGET_SSE41 static inline void dl_sse41_apply_matrix (const __m128 m[9], const __m128 rgb[3], __m128 out[3])
+{
+    out[0] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[0], rgb[0]), _mm_mul_ps(m[1], rgb[1])), _mm_mul_ps(m[2], rgb[2]));
+    out[1] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[3], rgb[0]), _mm_mul_ps(m[4], rgb[1])), _mm_mul_ps(m[5], rgb[2]));
+    out[2] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[6], rgb[0]), _mm_mul_ps(m[7], rgb[1])), _mm_mul_ps(m[8], rgb[2]));
+}
+
+// rgb_cvd = rgb_cvd*severity + rgb*(1-severity)
+DL_TARGET_SSE41 static inline void dl_sse41_apply_severity (__m128 severity, __m128 oneMinusSeverity, const __m128 rgb[3], __m128 rgb_cvd[3])
+{
+    for (int c = 0; c < 3; ++c)
+        rgb_cvd[c] = _mm_add_ps(_mm_mul_ps(rgb_cvd[c], severity), _mm_mul_ps(rgb[c], oneMinusSeverity));
+}
+
+// Same with one severity per pixel.
+DL_TARGET_SSE41 static inline void dl_sse41_apply_severity_map (const float* severities, const __m128 rgb[3], __m128 rgb_cvd[3])
+{
+    const __m128 severity = _mm_loadu_ps(severities);
+    dl_sse41_apply_severity(severity, _mm_sub_ps(_mm_set1_ps(1.f), severity), rgb, rgb_cvd);
+}
+
+// Parameters broadcasted to all the lanes.
+struct DLSse41Brettel1997
+{
+    __m128 m1[9];
+    __m128 m2[9];
+    __m128 n[3];
+    __m128 severity;
+    __m128 oneMinusSeverity;
+    int applySeverity;
+};
+
+struct DLSse41Vienot1999
+{
+    __m128 m[9];
+    __m128 severity;
+    __m128 oneMinusSeverity;
+    int applySeverity;
+};
+
+DL_TARGET_SSE41 static inline void dl_sse41_brettel1997_init (struct DLSse41Brettel1997* p, const struct DLBrettel1997Params* params, float severity)
+{
+    for (int i = 0; i < 9; ++i)
+    {
+        p->m1[i] = _mm_set1_ps(params->rgbCvdFromRgb_1[i]);
+        p->m2[i] = _mm_set1_ps(params->rgbCvdFromRgb_2[i]);
+    }
+    for (int i = 0; i < 3; ++i)
+        p->n[i] = _mm_set1_ps(params->separationPlaneNormalInRgb[i]);
+    p->severity = _mm_set1_ps(severity);
+    p->oneMinusSeverity = _mm_set1_ps(1.f - severity);
+    p->applySeverity = severity < 1.f;
+}
+
+DL_TARGET_SSE41 static inline void dl_sse41_vienot1999_init (struct DLSse41Vienot1999* p, const float* rgbCvd_from_rgb, float severity)
+{
+    for (int i = 0; i < 9; ++i)
+        p->m[i] = _mm_set1_ps(rgbCvd_from_rgb[i]);
+    p->severity = _mm_set1_ps(severity);
+    p->oneMinusSeverity = _mm_set1_ps(1.f - severity);
+    p->applySeverity = severity < 0.999f;
+}
+
+DL_TARGET_SSE41 static inline void dl_sse41_brettel1997 (const struct DLSse41Brettel1997* p, const __m128 rgb[3], __m128 rgb_cvd[3])
+{
+    // Branchless plane selection: blend the two matrices with the sign mask.
+    const __m128 dotWithSepPlane = _mm_add_ps(_mm_add_ps(_mm_mul_ps(rgb[0], p->n[0]), _mm_mul_ps(rgb[1], p->n[1])), _mm_mul_ps(rgb[2], p->n[2]));
+    const __m128 usePlane1 = _mm_cmpge_ps(dotWithSepPlane, _mm_setzero_ps());
+    __m128 m[9];
+    for (int i = 0; i < 9; ++i)
+        m[i] = _mm_blendv_ps(p->m2[i], p->m1[i], usePlane1);
+
+    dl_sse41_apply_matrix(m, rgb, rgb_cvd);
+    if (p->applySeverity)
+    {
+        dl_sse41_apply_severity(p->severity, p->oneMinusSeverity, rgb, rgb_cvd);
+    }
+}
+
+DL_TARGET_SSE41 static inline void dl_sse41_vienot1999 (const struct DLSse41Vienot1999* p, const __m128 rgb[3], __m128 rgb_cvd[3])
+{
+    dl_sse41_apply_matrix(p->m, rgb, rgb_cvd);
+    if (p->applySeverity)
+    {
+        dl_sse41_apply_severity(p->severity, p->oneMinusSeverity, rgb, rgb_cvd);
+    }
+}
+
+DL_TARGET_SSE41 static inline void dl_sse41_brettel1997_row (const struct DLBrettel1997Params* params, float severity, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width, int fast, const float* severities)
+{
+    struct DLSse41Brettel1997 p;
+    dl_sse41_brettel1997_init(&p, params, severity);
+    struct DLSimdLayout simd;
+    dl_simd_layout_init(&simd, layout);
+
+    const size_t pixelSize = layout->pixelSize;
+    size_t col = 0;
+    for (; col + 4 <= width; col += 4)
+    {
+        __m128 rgb[3], rgb_cvd[3];
+        dl_sse41_decode_rgb(layout, src + col*pixelSize, rgb);
+        dl_sse41_brettel1997(&p, rgb, rgb_cvd);
+        if (severities)
+            dl_sse41_apply_severity_map(severities + col, rgb, rgb_cvd);
+        dl_sse41_encode_rgb(&simd, src + col*pixelSize, dst + col*pixelSize, rgb_cvd, fast);
+    }
+
+    if (severities)
+    {
+        dl_brettel1997_row_map_scalar(params, severities + col, layout, src + col*pixelSize, dst + col*pixelSize, width - col);
+    }
+    else if (fast)
+    {
+        dl_brettel1997_row_fast_scalar(params, severity, layout, src + col*pixelSize, dst + col*pixelSize, width - col);
+    }
+    else
+    {
+        dl_brettel1997_row_scalar(params, severity, layout, src + col*pixelSize, dst + col*pixelSize, width - col);
+    }
+}
+
+DL_TARGET_SSE41 static void dl_brettel1997_row_sse41 (const struct DLBrettel1997Params* params, float severity, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width)
+{
+    dl_sse41_brettel1997_row(params, severity, layout, src, dst, width, 0, NULL);
+}
+
+DL_TARGET_SSE41 static void dl_brettel1997_row_fast_sse41 (const struct DLBrettel1997Params* params, float severity, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width)
+{
+    dl_sse41_brettel1997_row(params, severity, layout, src, dst, width, 1, NULL);
+}
+
+DL_TARGET_SSE41 static void dl_brettel1997_row_map_sse41 (const struct DLBrettel1997Params* params, const float* severities, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width)
+{
+    dl_sse41_brettel1997_row(params, 1.f, layout, src, dst, width, 0, severities);
+}
+
+DL_TARGET_SSE41 static inline void dl_sse41_vienot1999_row (const float* rgbCvd_from_rgb, float severity, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width, int fast, const float* severities)
+{
+    struct DLSse41Vienot1999 p;
+    dl_sse41_vienot1999_init(&p, rgbCvd_from_rgb, severity);
+    struct DLSimdLayout simd;
+    dl_simd_layout_init(&simd, layout);
+
+    const size_t pixelSize = layout->pixelSize;
+    size_t col = 0;
+    for (; col + 4 <= width; col += 4)
+    {
+        __m128 rgb[3], rgb_cvd[3];
+        dl_sse41_decode_rgb(layout, src + col*pixelSize, rgb);
+        dl_sse41_vienot1999(&p, rgb, rgb_cvd);
+        if (severities)
+            dl_sse41_apply_severity_map(severities + col, rgb, rgb_cvd);
+        dl_sse41_encode_rgb(&simd, src + col*pixelSize, dst + col*pixelSize, rgb_cvd, fast);
+    }
+
+    if (severities)
+    {
+        dl_vienot1999_row_map_scalar(rgbCvd_from_rgb, severities + col, layout, src + col*pixelSize, dst + col*pixelSize, width - col);
+    }
+    else if (fast)
+    {
+        dl_vienot1999_row_fast_scalar(rgbCvd_from_rgb, severity, layout, src + col*pixelSize, dst + col*pixelSize, width - col);
+    }
+    else
+    {
+        dl_vienot1999_row_scalar(rgbCvd_from_rgb, severity, layout, src + col*pixelSize, dst + col*pixelSize, width - col);
+    }
+}
+
+DL_TARGET_SSE41 static void dl_vienot1999_row_sse41 (const float* rgbCvd_from_rgb, float severity, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width)
+{
+    dl_sse41_vienot1999_row(rgbCvd_from_rgb, severity, layout, src, dst, width, 0, NULL);
+}
+
+DL_TARGET_SSE41 static void dl_vienot1999_row_fast_sse41 (const float* rgbCvd_from_rgb, float severity, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width)
+{
+    dl_sse41_vienot1999_row(rgbCvd_from_rgb, severity, layout, src, dst, width, 1, NULL);
+}
+
+DL_TARGET_SSE41 static void dl_vienot1999_row_map_sse41 (const float* rgbCvd_from_rgb, const float* severities, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width)
+{
+    dl_sse41_vienot1999_row(rgbCvd_from_rgb, 1.f, layout, src, dst, width, 0, severities);
+}
+
+DL_TARGET_SSE41 static void dl_all_deficiencies_row_sse41 (float severity, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* const dst[3], size_t width)
+{
+    struct DLSse41Vienot1999 protan, deutan;
+    struct DLSse41Brettel1997 tritan;
+    dl_sse41_vienot1999_init(&protan, dl_vienot_protan_rgbCvd_from_rgb, severity);
+    dl_sse41_vienot1999_init(&deutan, dl_vienot_deutan_rgbCvd_from_rgb, severity);
+    dl_sse41_brettel1997_init(&tritan, &brettel_tritan_params, severity);
+    struct DLSimdLayout simd;
+    dl_simd_layout_init(&simd, layout);
+
+    const size_t pixelSize = layout->pixelSize;
+    size_t col = 0;
+    for (; col + 4 <= width; col += 4)
+    {
+        __m128 rgb[3], rgb_cvd[3];
+        dl_sse41_decode_rgb(layout, src + col*pixelSize, rgb);
+        if (dst[DLDeficiency_Protan])
+        {
+            dl_sse41_vienot1999(&protan, rgb, rgb_cvd);
+            dl_sse41_encode_rgb(&simd, src + col*pixelSize, dst[DLDeficiency_Protan] + col*pixelSize, rgb_cvd, 0);
+        }
+        if (dst[DLDeficiency_Deutan])
+        {
+            dl_sse41_vienot1999(&deutan, rgb, rgb_cvd);
+            dl_sse41_encode_rgb(&simd, src + col*pixelSize, dst[DLDeficiency_Deutan] + col*pixelSize, rgb_cvd, 0);
+        }
+        if (dst[DLDeficiency_Tritan])
+        {
+            dl_sse41_brettel1997(&tritan, rgb, rgb_cvd);
+            dl_sse41_encode_rgb(&simd, src + col*pixelSize, dst[DLDeficiency_Tritan] + col*pixelSize, rgb_cvd, 0);
+        }
+    }
+
+    unsigned char* tailDst[3];
+    dl_offset_dst_rows(dst, col*pixelSize, tailDst);
+    dl_all_deficiencies_row_scalar(severity, layout, src + col*pixelSize, tailDst, width - col);
+}
+
+// Loads 4 linear float RGBA pixels into r, g, b, a vectors. The transpose
+// is its own inverse, so the store does the same on the way back.
+DL_TARGET_SSE41 static inline void dl_sse41_load_rgba_f32 (const float* src, __m128 px[4])
+{
+    for (int k = 0; k < 4; ++k)
+        px[k] = _mm_loadu_ps(src + 4*k);
+    _MM_TRANSPOSE4_PS(px[0], px[1], px[2], px[3]);
+}
+
+DL_TARGET_SSE41 static inline void dl_sse41_store_rgba_f32 (float* dst, __m128 px[4])
+{
+    _MM_TRANSPOSE4_PS(px[0], px[1], px[2], px[3]);
+    for (int k = 0; k < 4; ++k)
+        _mm_storeu_ps(dst + 4*k, px[k]);
+}
+
+DL_TARGET_SSE41 static void dl_brettel1997_row_f32_sse41 (const struct DLBrettel1997Params* params, float severity, const float* src, float* dst, size_t width)
+{
+    struct DLSse41Brettel1997 p;
+    dl_sse41_brettel1997_init(&p, params, severity);
+
+    size_t col = 0;
+    for (; col + 4 <= width; col += 4)
+    {
+        __m128 px[4], rgb_cvd[3];
+        dl_sse41_load_rgba_f32(src + 4*col, px);
+        dl_sse41_brettel1997(&p, px, rgb_cvd);
+        px[0] = rgb_cvd[0];
+        px[1] = rgb_cvd[1];
+        px[2] = rgb_cvd[2];
+        dl_sse41_store_rgba_f32(dst + 4*col, px);
+    }
+
+    dl_brettel1997_row_f32_scalar(params, severity, src + 4*col, dst + 4*col, width - col);
+}
+
+DL_TARGET_SSE41 static void dl_vienot1999_row_f32_sse41 (const float* rgbCvd_from_rgb, float severity, const float* src, float* dst, size_t width)
+{
+    struct DLSse41Vienot1999 p;
+    dl_sse41_vienot1999_init(&p, rgbCvd_from_rgb, severity);
+
+    size_t col = 0;
+    for (; col + 4 <= width; col += 4)
+    {
+        __m128 px[4], rgb_cvd[3];
+        dl_sse41_load_rgba_f32(src + 4*col, px);
+        dl_sse41_vienot1999(&p, px, rgb_cvd);
+        px[0] = rgb_cvd[0];
+        px[1] = rgb_cvd[1];
+        px[2] = rgb_cvd[2];
+        dl_sse41_store_rgba_f32(dst + 4*col, px);
+    }
+
+    dl_vienot1999_row_f32_scalar(rgbCvd_from_rgb, severity, src + 4*col, dst + 4*col, width - col);
+}
+
+DL_TARGET_AVX2 static inline void dl_avx2_decode_rgb (__m256i rgba, __m256 rgb[3])
+{
+    const __m256i mask = _mm256_set1_epi32(0xff);
+    const float* table = dl_linearRGB_from_sRGB_table;
+    rgb[0] = _mm256_i32gather_ps(table, _mm256_and_si256(rgba, mask), 4);
+    rgb[1] = _mm256_i32gather_ps(table, _mm256_and_si256(_mm256_srli_epi32(rgba, 8), mask), 4);
+    rgb[2] = _mm256_i32gather_ps(table, _mm256_and_si256(_mm256_srli_epi32(rgba, 16), mask), 4);
+}
+
+// Same as sRGB_from_linearRGB, returns the 8-bit values in 32-bit lanes.
+DL_TARGET_AVX2 static inline __m256i dl_avx2_encode (__m256 v)
+{
+    // Clamp to the pow segment range before computing the index so that we
+    // never read outside of the table, the other cases get blended later.
+    const __m256 clamped = _mm256_min_ps(_mm256_max_ps(v, _mm256_set1_ps(0.0031308f)),
+                                         _mm256_castsi256_ps(_mm256_set1_epi32(0x3f7fffff) /* largest float < 1 */));
+    const __m256i bits = _mm256_castps_si256(clamped);
+    const __m256i index = _mm256_sub_epi32(_mm256_srli_epi32(bits, 18), _mm256_set1_epi32((127 - 9) << 5));
+    const __m256 t = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(bits, _mm256_set1_epi32(0x3ffff))), _mm256_set1_ps(1.f / 262144.f));
+
+    const __m256 s0 = _mm256_i32gather_ps(dl_sRGB_from_linearRGB_table, index, 4);
+    const __m256 s1 = _mm256_i32gather_ps(dl_sRGB_from_linearRGB_table + 1, index, 4);
+    __m256 srgb = _mm256_add_ps(s0, _mm256_mul_ps(t, _mm256_sub_ps(s1, s0)));
+
+    const __m256 linear = _mm256_add_ps(_mm256_set1_ps(0.5f), _mm256_mul_ps(v, _mm256_set1_ps(12.92f * 255.f)));
+    srgb = _mm256_blendv_ps(srgb, linear, _mm256_cmp_ps(v, _mm256_set1_ps(0.0031308f), _CMP_LT_OQ));
+    srgb = _mm256_blendv_ps(srgb, _mm256_setzero_ps(), _mm256_cmp_ps(v, _mm256_setzero_ps(), _CMP_LE_OQ));
+    srgb = _mm256_blendv_ps(srgb, _mm256_set1_ps(255.f), _mm256_cmp_ps(v, _mm256_set1_ps(1.f), _CMP_GE_OQ));
+    return _mm256_cvttps_epi32(srgb);
+}
+
+// Same as sRGB_from_linearRGB_fast, no gather.
+DL_TARGET_AVX2 static inline __m256i dl_avx2_encode_fast (__m256 v)
+{
+    const __m256 s = _mm256_sqrt_ps(_mm256_max_ps(v, _mm256_setzero_ps()));
+    __m256 srgb = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(dl_fast_sRGB_c3), s), _mm256_set1_ps(dl_fast_sRGB_c2));
+    srgb = _mm256_add_ps(_mm256_mul_ps(srgb, s), _mm256_set1_ps(dl_fast_sRGB_c1));
+    srgb = _mm256_add_ps(_mm256_mul_ps(srgb, s), _mm256_set1_ps(dl_fast_sRGB_c0));
+
+    const __m256 linear = _mm256_add_ps(_mm256_set1_ps(0.5f), _mm256_mul_ps(v, _mm256_set1_ps(12.92f * 255.f)));
+    srgb = _mm256_blendv_ps(srgb, linear, _mm256_cmp_ps(v, _mm256_set1_ps(0.0031308f), _CMP_LT_OQ));
+    srgb = _mm256_blendv_ps(srgb, _mm256_setzero_ps(), _mm256_cmp_ps(v, _mm256_setzero_ps(), _CMP_LE_OQ));
+    srgb = _mm256_blendv_ps(srgb, _mm256_set1_ps(255.f), _mm256_cmp_ps(v, _mm256_set1_ps(1.f), _CMP_GE_OQ));
+    return _mm256_cvttps_epi32(srgb);
+}
+
+#define dl_avx2_encode_accuracy(v, fast) ((fast) ? dl_avx2_encode_fast(v) : dl_avx2_encode(v))
+
+// Same shuffles in both 128-bit lanes.
+DL_TARGET_AVX2 static inline __m256i dl_avx2_broadcast_shuffle (const unsigned char bytes[16])
+{
+    return _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)bytes));
+}
+
+// Loads 8 pixels, 4 in each 128-bit lane.
+DL_TARGET_AVX2 static inline __m256i dl_avx2_load_pixels (const struct DLSimdLayout* simd, const unsigned char* src)
+{
+    if (simd->pixelSize == 4)
+    {
+        return _mm256_loadu_si256((const __m256i*)src);
+    }
+    return _mm256_inserti128_si256(_mm256_castsi128_si256(dl_sse41_load12(src)), dl_sse41_load12(src + 12), 1);
+}
+
+// 'px' is the source pixels as returned by dl_avx2_load_pixels.
+DL_TARGET_AVX2 static inline void dl_avx2_encode_rgb (const struct DLSimdLayout* simd, __m256i px, unsigned char* dst, const __m256 rgb[3], int fast)
+{
+    __m256i rgbOut = dl_avx2_encode_accuracy(rgb[0], fast);
+    rgbOut = _mm256_or_si256(rgbOut, _mm256_slli_epi32(dl_avx2_encode_accuracy(rgb[1], fast), 8));
+    rgbOut = _mm256_or_si256(rgbOut, _mm256_slli_epi32(dl_avx2_encode_accuracy(rgb[2], fast), 16));
+    const __m256i out = _mm256_shuffle_epi8(rgbOut, dl_avx2_broadcast_shuffle(simd->fromRgb));
+    if (simd->pixelSize == 4)
+    {
+        // Keep the alpha / padding byte of the source.
+        const __m256i extra = _mm256_and_si256(px, dl_avx2_broadcast_shuffle(simd->extraMask));
+        _mm256_storeu_si256((__m256i*)dst, _mm256_or_si256(out, extra));
+    }
+    else
+    {
+        dl_sse41_store12(dst, _mm256_castsi256_si128(out));
+        dl_sse41_store12(dst + 12, _mm256_extracti128_si256(out, 1));
+    }
+}
+
+DL_TARGET_AVX2 static inline void dl_avx2_apply_matrix (const __m256 m[9], const __m256 rgb[3], __m256 out[3])
+{
+    out[0] = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m[0], rgb[0]), _mm256_mul_ps(m[1], rgb[1])), _mm256_mul_ps(m[2], rgb[2]));
+    out[1] = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m[3], rgb[0]), _mm256_mul_ps(m[4], rgb[1])), _mm256_mul_ps(m[5], rgb[2]));
+    out[2] = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m[6], rgb[0]), _mm256_mul_ps(m[7], rgb[1])), _mm256_mul_ps(m[8], rgb[2]));
+}
+
+// rgb_cvd = rgb_cvd*severity + rgb*(1-severity)
+DL_TARGET_AVX2 static inline void dl_avx2_apply_severity (__m256 severity, __m256 oneMinusSeverity, const __m256 rgb[3], __m256 rgb_cvd[3])
+{
+    for (int c = 0; c < 3; ++c)
+        rgb_cvd[c] = _mm256_add_ps(_mm256_mul_ps(rgb_cvd[c], severity), _mm256_mul_ps(rgb[c], oneMinusSeverity));
+}
+
+DL_TARGET_AVX2 static inline void dl_avx2_apply_severity_map (const float* severities, const __m256 rgb[3], __m256 rgb_cvd[3])
+{
+    const __m256 severity = _mm256_loadu_ps(severities);
+    dl_avx2_apply_severity(severity, _mm256_sub_ps(_mm256_set1_ps(1.f), severity), rgb, rgb_cvd);
+}
+
+// Parameters broadcasted to all the lanes.
+struct DLAvx2Brettel1997
+{
+    __m256 m1[9];
+    __m256 m2[9];
+    __m256 n[3];
+    __m256 severity;
+    __m256 oneMinusSeverity;
+    int applySeverity;
+};
+
+struct DLAvx2Vienot1999
+{
+    __m256 m[9];
+    __m256 severity;
+    __m256 oneMinusSeverity;
+    int applySeverity;
+};
+
+DL_TARGET_AVX2 static inline void dl_avx2_brettel1997_init (struct DLAvx2Brettel1997* p, const struct DLBrettel1997Params* params, float severity)
+{
+    for (int i = 0; i < 9; ++i)
+    {
+        p->m1[i] = _mm256_set1_ps(params->rgbCvdFromRgb_1[i]);
+        p->m2[i] = _mm256_set1_ps(params->rgbCvdFromRgb_2[i]);
+    }
+    for (int i = 0; i < 3; ++i)
+        p->n[i] = _mm256_set1_ps(params->separationPlaneNormalInRgb[i]);
+    p->severity = _mm256_set1_ps(severity);
+    p->oneMinusSeverity = _mm256_set1_ps(1.f - severity);
+    p->applySeverity = severity < 1.f;
+}
+
+DL_TARGET_AVX2 static inline void dl_avx2_vienot1999_init (struct DLAvx2Vienot1999* p, const float* rgbCvd_from_rgb, float severity)
+{
+    for (int i = 0; i < 9; ++i)
+        p->m[i] = _mm256_set1_ps(rgbCvd_from_rgb[i]);
+    p->severity = _mm256_set1_ps(severity);
+    p->oneMinusSeverity = _mm256_set1_ps(1.f - severity);
+    p->applySeverity = severity < 0.999f;
+}
+
+DL_TARGET_AVX2 static inline void dl_avx2_brettel1997 (const struct DLAvx2Brettel1997* p, const __m256 rgb[3], __m256 rgb_cvd[3])
+{
+    // Branchless plane selection: blend the two matrices with the sign mask.
+    const __m256 dotWithSepPlane = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(rgb[0], p->n[0]), _mm256_mul_ps(rgb[1], p->n[1])), _mm256_mul_ps(rgb[2], p->n[2]));
+    const __m256 usePlane1 = _mm256_cmp_ps(dotWithSepPlane, _mm256_setzero_ps(), _CMP_GE_OQ);
+    __m256 m[9];
+    for (int i = 0; i < 9; ++i)
+        m[i] = _mm256_blendv_ps(p->m2[i], p->m1[i], usePlane1);
+
+    dl_avx2_apply_matrix(m, rgb, rgb_cvd);
+    if (p->applySeverity)
+    {
+        dl_avx2_apply_severity(p->severity, p->oneMinusSeverity, rgb, rgb_cvd);
+    }
+}
+
+DL_TARGET_AVX2 static inline void dl_avx2_vienot1999 (const struct DLAvx2Vienot1999* p, const __m256 rgb[3], __m256 rgb_cvd[3])
+{
+    dl_avx2_apply_matrix(p->m, rgb, rgb_cvd);
+    if (p->applySeverity)
+    {
+        dl_avx2_apply_severity(p->severity, p->oneMinusSeverity, rgb, rgb_cvd);
+    }
+}
+
+DL_TARGET_AVX2 static inline void dl_avx2_brettel1997_row (const struct DLBrettel1997Params* params, float severity, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width, int fast, const float* severities)
+{
+    struct DLAvx2Brettel1997 p;
+    dl_avx2_brettel1997_init(&p, params, severity);
+    struct DLSimdLayout simd;
+    dl_simd_layout_init(&simd, layout);
+    const __m256i toRgb = dl_avx2_broadcast_shuffle(simd.toRgb);
+
+    const size_t pixelSize = layout->pixelSize;
+    size_t col = 0;
+    for (; col + 8 <= width; col += 8)
+    {
+        const __m256i px = dl_avx2_load_pixels(&simd, src + col*pixelSize);
+        __m256 rgb[3], rgb_cvd[3];
+        dl_avx2_decode_rgb(_mm256_shuffle_epi8(px, toRgb), rgb);
+        dl_avx2_brettel1997(&p, rgb, rgb_cvd);
+        if (severities)
+            dl_avx2_apply_severity_map(severities + col, rgb, rgb_cvd);
+        dl_avx2_encode_rgb(&simd, px, dst + col*pixelSize, rgb_cvd, fast);
+    }
+
+    // Clear the upper halves of the ymm registers before running SSE code
+    // again (including the scalar code and the caller), otherwise every SSE
+    // instruction pays a large state transition penalty on most Intel CPUs.
+    // GCC does not insert it automatically with the target attribute.
+    _mm256_zeroupper();
+    if (severities)
+    {
+        dl_brettel1997_row_map_scalar(params, severities + col, layout, src + col*pixelSize, dst + col*pixelSize, width - col);
+    }
+    else if (fast)
+    {
+        dl_brettel1997_row_fast_scalar(params, severity, layout, src + col*pixelSize, dst + col*pixelSize, width - col);
+    }
+    else
+    {
+        dl_brettel1997_row_scalar(params, severity, layout, src + col*pixelSize, dst + col*pixelSize, width - col);
+    }
+}
+
+DL_TARGET_AVX2 static void dl_brettel1997_row_avx2 (const struct DLBrettel1997Params* params, float severity, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width)
+{
+    dl_avx2_brettel1997_row(params, severity, layout, src, dst, width, 0, NULL);
+}
+
+DL_TARGET_AVX2 static void dl_brettel1997_row_fast_avx2 (const struct DLBrettel1997Params* params, float severity, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width)
+{
+    dl_avx2_brettel1997_row(params, severity, layout, src, dst, width, 1, NULL);
+}
+
+DL_TARGET_AVX2 static void dl_brettel1997_row_map_avx2 (const struct DLBrettel1997Params* params, const float* severities, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width)
+{
+    dl_avx2_brettel1997_row(params, 1.f, layout, src, dst, width, 0, severities);
+}
+
+DL_TARGET_AVX2 static inline void dl_avx2_vienot1999_row (const float* rgbCvd_from_rgb, float severity, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width, int fast, const float* severities)
+{
+    struct DLAvx2Vienot1999 p;
+    dl_avx2_vienot1999_init(&p, rgbCvd_from_rgb, severity);
+    struct DLSimdLayout simd;
+    dl_simd_layout_init(&simd, layout);
+    const __m256i toRgb = dl_avx2_broadcast_shuffle(simd.toRgb);
+
+    const size_t pixelSize = layout->pixelSize;
+    size_t col = 0;
+    for (; col + 8 <= width; col += 8)
+    {
+        const __m256i px = dl_avx2_load_pixels(&simd, src + col*pixelSize);
+        __m256 rgb[3], rgb_cvd[3];
+        dl_avx2_decode_rgb(_mm256_shuffle_epi8(px, toRgb), rgb);
+        dl_avx2_vienot1999(&p, rgb, rgb_cvd);
+        if (severities)
+            dl_avx2_apply_severity_map(severities + col, rgb, rgb_cvd);
+        dl_avx2_encode_rgb(&simd, px, dst + col*pixelSize, rgb_cvd, fast);
+    }
+
+    _mm256_zeroupper();
+    if (severities)
+    {
+        dl_vienot1999_row_map_scalar(rgbCvd_from_rgb, severities + col, layout, src + col*pixelSize, dst + col*pixelSize, width - col);
+    }
+    else if (fast)
+    {
+        dl_vienot1999_row_fast_scalar(rgbCvd_from_rgb, severity, layout, src + col*pixelSize, dst + col*pixelSize, width - col);
+    }
+    else
+    {
+        dl_vienot1999_row_scalar(rgbCvd_from_rgb, severity, layout, src + col*pixelSize, dst + col*pixelSize, width - col);
+    }
+}
+
+DL_TARGET_AVX2 static void dl_vienot1999_row_avx2 (const float* rgbCvd_from_rgb, float severity, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width)
+{
+    dl_avx2_vienot1999_row(rgbCvd_from_rgb, severity, layout, src, dst, width, 0, NULL);
+}
+
+DL_TARGET_AVX2 static void dl_vienot1999_row_fast_avx2 (const float* rgbCvd_from_rgb, float severity, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width)
+{
+    dl_avx2_vienot1999_row(rgbCvd_from_rgb, severity, layout, src, dst, width, 1, NULL);
+}
+
+DL_TARGET_AVX2 static void dl_vienot1999_row_map_avx2 (const float* rgbCvd_from_rgb, const float* severities, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width)
+{
+    dl_avx2_vienot1999_row(rgbCvd_from_rgb, 1.f, layout, src, dst, width, 0, severities);
+}
+
+DL_TARGET_AVX2 static void dl_all_deficiencies_row_avx2 (float severity, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* const dst[3], size_t width)
+{
+    struct DLAvx2Vienot1999 protan, deutan;
+    struct DLAvx2Brettel1997 tritan;
+    dl_avx2_vienot1999_init(&protan, dl_vienot_protan_rgbCvd_from_rgb, severity);
+    dl_avx2_vienot1999_init(&deutan, dl_vienot_deutan_rgbCvd_from_rgb, severity);
+    dl_avx2_brettel1997_init(&tritan, &brettel_tritan_params, severity);
+    struct DLSimdLayout simd;
+    dl_simd_layout_init(&simd, layout);
+    const __m256i toRgb = dl_avx2_broadcast_shuffle(simd.toRgb);
+
+    const size_t pixelSize = layout->pixelSize;
+    size_t col = 0;
+    for (; col + 8 <= width; col += 8)
+    {
+        const __m256i px = dl_avx2_load_pixels(&simd, src + col*pixelSize);
+        __m256 rgb[3], rgb_cvd[3];
+        dl_avx2_decode_rgb(_mm256_shuffle_epi8(px, toRgb), rgb);
+        if (dst[DLDeficiency_Protan])
+        {
+            dl_avx2_vienot1999(&protan, rgb, rgb_cvd);
+            dl_avx2_encode_rgb(&simd, px, dst[DLDeficiency_Protan] + col*pixelSize, rgb_cvd, 0);
+        }
+        if (dst[DLDeficiency_Deutan])
+        {
+            dl_avx2_vienot1999(&deutan, rgb, rgb_cvd);
+            dl_avx2_encode_rgb(&simd, px, dst[DLDeficiency_Deutan] + col*pixelSize, rgb_cvd, 0);
+        }
+        if (dst[DLDeficiency_Tritan])
+        {
+            dl_avx2_brettel1997(&tritan, rgb, rgb_cvd);
+            dl_avx2_encode_rgb(&simd, px, dst[DLDeficiency_Tritan] + col*pixelSize, rgb_cvd, 0);
+        }
+    }
+
+    _mm256_zeroupper();
+    unsigned char* tailDst[3];
+    dl_offset_dst_rows(dst, col*pixelSize, tailDst);
+    dl_all_deficiencies_row_scalar(severity, layout, src + col*pixelSize, tailDst, width - col);
+}
+
+// Same as dl_sse41_load_rgba_f32 within each 128-bit lane, so the lanes hold
+// pixels 0, 2, 4, 6 then 1, 3, 5, 7. The order doesn't matter for per-pixel
+// transforms, and the store puts them back in place.
+DL_TARGET_AVX2 static inline void dl_avx2_transpose_rgba_f32 (__m256 px[4])
+{
+    const __m256 t0 = _mm256_unpacklo_ps(px[0], px[1]);
+    const __m256 t1 = _mm256_unpackhi_ps(px[0], px[1]);
+    const __m256 t2 = _mm256_unpacklo_ps(px[2], px[3]);
+    const __m256 t3 = _mm256_unpackhi_ps(px[2], px[3]);
+    px[0] = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+    px[1] = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+    px[2] = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+    px[3] = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+}
+
+DL_TARGET_AVX2 static inline void dl_avx2_load_rgba_f32 (const float* src, __m256 px[4])
+{
+    for (int k = 0; k < 4; ++k)
+        px[k] = _mm256_loadu_ps(src + 8*k);
+    dl_avx2_transpose_rgba_f32(px);
+}
+
+DL_TARGET_AVX2 static inline void dl_avx2_store_rgba_f32 (float* dst, __m256 px[4])
+{
+    dl_avx2_transpose_rgba_f32(px);
+    for (int k = 0; k < 4; ++k)
+        _mm256_storeu_ps(dst + 8*k, px[k]);
+}
+
+DL_TARGET_AVX2 static void dl_brettel1997_row_f32_avx2 (const struct DLBrettel1997Params* params, float severity, const float* src, float* dst, size_t width)
+{
+    struct DLAvx2Brettel1997 p;
+    dl_avx2_brettel1997_init(&p, params, severity);
+
+    size_t col = 0;
+    for (; col + 8 <= width; col += 8)
+    {
+        __m256 px[4], rgb_cvd[3];
+        dl_avx2_load_rgba_f32(src + 4*col, px);
+        dl_avx2_brettel1997(&p, px, rgb_cvd);
+        px[0] = rgb_cvd[0];
+        px[1] = rgb_cvd[1];
+        px[2] = rgb_cvd[2];
+        dl_avx2_store_rgba_f32(dst + 4*col, px);
+    }
+
+    _mm256_zeroupper();
+    dl_brettel1997_row_f32_scalar(params, severity, src + 4*col, dst + 4*col, width - col);
+}
+
+DL_TARGET_AVX2 static void dl_vienot1999_row_f32_avx2 (const float* rgbCvd_from_rgb, float severity, const float* src, float* dst, size_t width)
+{
+    struct DLAvx2Vienot1999 p;
+    dl_avx2_vienot1999_init(&p, rgbCvd_from_rgb, severity);
+
+    size_t col = 0;
+    for (; col + 8 <= width; col += 8)
+    {
+        __m256 px[4], rgb_cvd[3];
+        dl_avx2_load_rgba_f32(src + 4*col, px);
+        dl_avx2_vienot1999(&p, px, rgb_cvd);
+        px[0] = rgb_cvd[0];
+        px[1] = rgb_cvd[1];
+        px[2] = rgb_cvd[2];
+        dl_avx2_store_rgba_f32(dst + 4*col, px);
+    }
+
+    _mm256_zeroupper();
+    dl_vienot1999_row_f32_scalar(rgbCvd_from_rgb, severity, src + 4*col, dst + 4*col, width - col);
+}
+
+// F16C is not part of AVX2, but all the CPUs with AVX2 have it and
+// dl_cpu_has_kernel checks both.
+DL_TARGET_AVX2_F16C static void dl_float_from_half_avx2 (const uint16_t* src, float* dst, size_t count)
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(src + i))));
+
+    _mm256_zeroupper();
+    dl_float_from_half_scalar(src + i, dst + i, count - i);
+}
+
+DL_TARGET_AVX2_F16C static void dl_half_from_float_avx2 (const float* src, uint16_t* dst, size_t count)
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+        _mm_storeu_si128((__m128i*)(dst + i), _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT));
+
+    _mm256_zeroupper();
+    dl_half_from_float_scalar(src + i, dst + i, count - i);
+}
+
+#endif // DL_HAS_X86_SIMD
+
+/*
+    NEON kernels, only for AArch64 where NEON is always available (Apple
+    Silicon, Graviton, etc.).
+
+    These process 16 RGBA pixels per iteration: vld4q_u8 deinterleaves the
+    channels into 4 planes and vst4q_u8 writes them back, keeping the
+    original alpha plane. There is no gather instruction, so the table
+    lookups are done lane by lane, and the float computations are done on 4
+    groups of 4 pixels.
+*/
+
+#if (defined(__ARM_NEON) && defined(__aarch64__)) || defined(_M_ARM64)
+
+#include <arm_neon.h>
+
+// Deinterleaves 16 pixels into planes, with vld3q_u8 for 3-byte pixels.
+static inline uint8x16x4_t dl_neon_load_pixels (const struct DLPixelLayout* layout, const unsigned char* src)
+{
+    if (layout->pixelSize == 4)
+    {
+        return vld4q_u8(src);
+    }
+
+    const uint8x16x3_t px3 = vld3q_u8(src);
+    uint8x16x4_t px;
+    px.val[0] = px3.val[0];
+    px.val[1] = px3.val[1];
+    px.val[2] = px3.val[2];
+    px.val[3] = vdupq_n_u8(0);
+    return px;
+}
+
+// Decodes the 16 pixels into rgb[channel][group of 4 pixels].
+static inline void dl_neon_decode_rgb (const struct DLPixelLayout* layout, uint8x16x4_t px, float32x4_t rgb[3][4])
+{
+    uint8_t planes[3][16];
+    vst1q_u8(planes[0], px.val[layout->r]);
+    vst1q_u8(planes[1], px.val[layout->g]);
+    vst1q_u8(planes[2], px.val[layout->b]);
+
+    const float* table = dl_linearRGB_from_sRGB_table;
+    for (int c = 0; c < 3; ++c)
+    {
+        for (int q = 0; q < 4; ++q)
+        {
+            const uint8_t* p = planes[c] + q*4;
+            const float values[4] = { table[p[0]], table[p[1]], table[p[2]], table[p[3]] };
+            rgb[c][q] = vld1q_f32(values);
+        }
+    }
+}
+
+// Same as sRGB_from_linearRGB, returns the 8-bit values in 32-bit lanes.
+static inline uint32x4_t dl_neon_encode (float32x4_t v)
+{
+    // Clamp to the pow segment range before computing the index so that we
+    // never read outside of the table, the other cases get blended later.
+    const float32x4_t clamped = vminnmq_f32(vmaxnmq_f32(v, vdupq_n_f32(0.0031308f)),
+                                            vreinterpretq_f32_u32(vdupq_n_u32(0x3f7fffff) /* largest float < 1 */));
+    const uint32x4_t bits = vreinterpretq_u32_f32(clamped);
+    const uint32x4_t index = vsubq_u32(vshrq_n_u32(bits, 18), vdupq_n_u32((127 - 9) << 5));
+    const float32x4_t t = vmulq_f32(vcvtq_f32_u32(vandq_u32(bits, vdupq_n_u32(0x3ffff))), vdupq_n_f32(1.f / 262144.f));
+
+    uint32_t i[4];
+    vst1q_u32(i, index);
+    const float* table = dl_sRGB_from_linearRGB_table;
+    const float l0[4] = { table[i[0]], table[i[1]], table[i[2]], table[i[3]] };
+    const float l1[4] = { table[i[0]+1], table[i[1]+1], table[i[2]+1], table[i[3]+1] };
+    const float32x4_t s0 = vld1q_f32(l0);
+    const float32x4_t s1 = vld1q_f32(l1);
+    float32x4_t srgb = vaddq_f32(s0, vmulq_f32(t, vsubq_f32(s1, s0)));
+
+    const float32x4_t linear = vaddq_f32(vdupq_n_f32(0.5f), vmulq_f32(v, vdupq_n_f32(12.92f * 255.f)));
+    srgb = vbslq_f32(vcltq_f32(v, vdupq_n_f32(0.0031308f)), linear, srgb);
+    srgb = vbslq_f32(vcleq_f32(v, vdupq_n_f32(0.f)), vdupq_n_f32(0.f), srgb);
+    srgb = vbslq_f32(vcgeq_f32(v, vdupq_n_f32(1.f)), vdupq_n_f32(255.f), srgb);
+    return vcvtq_u32_f32(srgb);
+}
+
+// Same as sRGB_from_linearRGB_fast, no table lookup.
+static inline uint32x4_t dl_neon_encode_fast (float32x4_t v)
+{
+    const float32x4_t s = vsqrtq_f32(vmaxq_f32(v, vdupq_n_f32(0.f)));
+    float32x4_t srgb = vaddq_f32(vmulq_f32(vdupq_n_f32(dl_fast_sRGB_c3), s), vdupq_n_f32(dl_fast_sRGB_c2));
+    srgb = vaddq_f32(vmulq_f32(srgb, s), vdupq_n_f32(dl_fast_sRGB_c1));
+    srgb = vaddq_f32(vmulq_f32(srgb, s), vdupq_n_f32(dl_fast_sRGB_c0));
+
+    const float32x4_t linear = vaddq_f32(vdupq_n_f32(0.5f), vmulq_f32(v, vdupq_n_f32(12.92f * 255.f)));
+    srgb = vbslq_f32(vcltq_f32(v, vdupq_n_f32(0.0031308f)), linear, srgb);
+    srgb = vbslq_f32(vcleq_f32(v, vdupq_n_f32(0.f)), vdupq_n_f32(0.f), srgb);
+    srgb = vbslq_f32(vcgeq_f32(v, vdupq_n_f32(1.f)), vdupq_n_f32(255.f), srgb);
+    return vcvtq_u32_f32(srgb);
+}
+
+#define dl_neon_encode_accuracy(v, fast) ((fast) ? dl_neon_encode_fast(v) : dl_neon_encode(v))
+
+// Encode the 4 groups of 4 values and narrow them back into a 16 bytes plane.
+static inline uint8x16_t dl_neon_encode_plane (const float32x4_t v[4], int fast)
+{
+    const uint16x8_t lo = vcombine_u16(vmovn_u32(dl_neon_encode_accuracy(v[0], fast)), vmovn_u32(dl_neon_encode_accuracy(v[1], fast)));
+    const uint16x8_t hi = vcombine_u16(vmovn_u32(dl_neon_encode_accuracy(v[2], fast)), vmovn_u32(dl_neon_encode_accuracy(v[3], fast)));
+    return vcombine_u8(vmovn_u16(lo), vmovn_u16(hi));
+}
+
+// Encode the 16 pixels, keeping the alpha / padding plane of 'px'.
+static inline void dl_neon_encode_rgb (const struct DLPixelLayout* layout, uint8x16x4_t px, float32x4_t rgb[3][4], unsigned char* dst, int fast)
+{
+    px.val[layout->r] = dl_neon_encode_plane(rgb[0], fast);
+    px.val[layout->g] = dl_neon_encode_plane(rgb[1], fast);
+    px.val[layout->b] = dl_neon_encode_plane(rgb[2], fast);
+    if (layout->pixelSize == 4)
+    {
+        vst4q_u8(dst, px);
+    }
+    else
+    {
+        const uint8x16x3_t px3 = { { px.val[0], px.val[1], px.val[2] } };
+        vst3q_u8(dst, px3);
+    }
+}
+
+static inline void dl_neon_apply_matrix (const float32x4_t m[9], const float32x4_t rgb[3], float32x4_t out[3])
+{
+    out[0] = vaddq_f32(vaddq_f32(vmulq_f32(m[0], rgb[0]), vmulq_f32(m[1], rgb[1])), vmulq_f32(m[2], rgb[2]));
+    out[1] = vaddq_f32(vaddq_f32(vmulq_f32(m[3], rgb[0]), vmulq_f32(m[4], rgb[1])), vmulq_f32(m[5], rgb[2]));
+    out[2] = vaddq_f32(vaddq_f32(vmulq_f32(m[6], rgb[0]), vmulq_f32(m[7], rgb[1])), vmulq_f32(m[8], rgb[2]));
+}
+
+// rgb_cvd = rgb_cvd*severity + rgb*(1-severity)
+static inline void dl_neon_apply_severity (float32x4_t severity, float32x4_t oneMinusSeverity, const float32x4_t rgb[3], float32x4_t rgb_cvd[3])
+{
+    for (int c = 0; c < 3; ++c)
+        rgb_cvd[c] = vaddq_f32(vmulq_f32(rgb_cvd[c], severity), vmulq_f32(rgb[c], oneMinusSeverity));
+}
+
+// Same with one severity per pixel, for the 4 groups of 4 pixels.
+static inline void dl_neon_apply_severity_map (const float* severities, float32x4_t rgb[3][4], float32x4_t rgb_cvd[3][4])
+{
+    for (int q = 0; q < 4; ++q)
+    {
+        const float32x4_t severity = vld1q_f32(severities + 4*q);
+        const float32x4_t in[3] = { rgb[0][q], rgb[1][q], rgb[2][q] };
+        float32x4_t out[3] = { rgb_cvd[0][q], rgb_cvd[1][q], rgb_cvd[2][q] };
+        dl_neon_apply_severity(severity, vsubq_f32(vdupq_n_f32(1.f), severity), in, out);
+        for (int c = 0; c < 3; ++c)
+            rgb_cvd[c][q] = out[c];
+    }
+}
+
+// Parameters broadcasted to all the lanes.
+struct DLNeonBrettel1997
+{
+    float32x4_t m1[9];
+    float32x4_t m2[9];
+    float32x4_t n[3];
+    float32x4_t severity;
+    float32x4_t oneMinusSeverity;
+    int applySeverity;
+};
+
+struct DLNeonVienot1999
+{
+    float32x4_t m[9];
+    float32x4_t severity;
+    float32x4_t oneMinusSeverity;
+    int applySeverity;
+};
+
+static inline void dl_neon_brettel1997_init (struct DLNeonBrettel1997* p, const struct DLBrettel1997Params* params, float severity)
+{
+    for (int i = 0; i < 9; ++i)
+    {
+        p->m1[i] = vdupq_n_f32(params->rgbCvdFromRgb_1[i]);
+        p->m2[i] = vdupq_n_f32(params->rgbCvdFromRgb_2[i]);
+    }
+    for (int i = 0; i < 3; ++i)
+        p->n[i] = vdupq_n_f32(params->separationPlaneNormalInRgb[i]);
+    p->severity = vdupq_n_f32(severity);
+    p->oneMinusSeverity = vdupq_n_f32(1.f - severity);
+    p->applySeverity = severity < 1.f;
+}
+
+static inline void dl_neon_vienot1999_init (struct DLNeonVienot1999* p, const float* rgbCvd_from_rgb, float severity)
+{
+    for (int i = 0; i < 9; ++i)
+        p->m[i] = vdupq_n_f32(rgbCvd_from_rgb[i]);
+    p->severity = vdupq_n_f32(severity);
+    p->oneMinusSeverity = vdupq_n_f32(1.f - severity);
+    p->applySeverity = severity < 0.999f;
+}
+
+// Transform the 16 pixels, with rgb and rgb_cvd indexed by [channel][group].
+static inline void dl_neon_brettel1997 (const struct DLNeonBrettel1997* p, float32x4_t rgb[3][4], float32x4_t rgb_cvd[3][4])
+{
+    for (int q = 0; q < 4; ++q)
+    {
+        const float32x4_t in[3] = { rgb[0][q], rgb[1][q], rgb[2][q] };
+
+        // Branchless plane selection: blend the two matrices with the sign mask.
+        const float32x4_t dotWithSepPlane = vaddq_f32(vaddq_f32(vmulq_f32(in[0], p->n[0]), vmulq_f32(in[1], p->n[1])), vmulq_f32(in[2], p->n[2]));
+        const uint32x4_t usePlane1 = vcgeq_f32(dotWithSepPlane, vdupq_n_f32(0.f));
+        float32x4_t m[9];
+        for (int i = 0; i < 9; ++i)
+            m[i] = vbslq_f32(usePlane1, p->m1[i], p->m2[i]);
+
+        float32x4_t out[3];
+        dl_neon_apply_matrix(m, in, out);
+        if (p->applySeverity)
+        {
+            dl_neon_apply_severity(p->severity, p->oneMinusSeverity, in, out);
+        }
+        for (int c = 0; c < 3; ++c)
+            rgb_cvd[c][q] = out[c];
+    }
+}
+
+static inline void dl_neon_vienot1999 (const struct DLNeonVienot1999* p, float32x4_t rgb[3][4], float32x4_t rgb_cvd[3][4])
+{
+    for (int q = 0; q < 4; ++q)
+    {
+        const float32x4_t in[3] = { rgb[0][q], rgb[1][q], rgb[2][q] };
+        float32x4_t out[3];
+        dl_neon_apply_matrix(p->m, in, out);
+        if (p->applySeverity)
+        {
+            dl_neon_apply_severity(p->severity, p->oneMinusSeverity, in, out);
+        }
+        for (int c = 0; c < 3; ++c)
+            rgb_cvd[c][q] = out[c];
+    }
+}
+
+static inline void dl_neon_brettel1997_row (const struct DLBrettel1997Params* params, float severity, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width, int fast, const float* severities)
+{
+    struct DLNeonBrettel1997 p;
+    dl_neon_brettel1997_init(&p, params, severity);
+
+    const size_t pixelSize = layout->pixelSize;
+    size_t col = 0;
+    for (; col + 16 <= width; col += 16)
+    {
+        const uint8x16x4_t px = dl_neon_load_pixels(layout, src + col*pixelSize);
+        float32x4_t rgb[3][4], rgb_cvd[3][4];
+        dl_neon_decode_rgb(layout, px, rgb);
+        dl_neon_brettel1997(&p, rgb, rgb_cvd);
+        if (severities)
+            dl_neon_apply_severity_map(severities + col, rgb, rgb_cvd);
+        dl_neon_encode_rgb(layout, px, rgb_cvd, dst + col*pixelSize, fast);
+    }
+
+    if (severities)
+    {
+        dl_brettel1997_row_map_scalar(params, severities + col, layout, src + col*pixelSize, dst + col*pixelSize, width - col);
+    }
+    else if (fast)
+    {
+        dl_brettel1997_row_fast_scalar(params, severity, layout, src + col*pixelSize, dst + col*pixelSize, width - col);
+    }
+    else
+    {
+        dl_brettel1997_row_scalar(params, severity, layout, src + col*pixelSize, dst + col*pixelSize, width - col);
+    }
+}
+
+static void dl_brettel1997_row_neon (const struct DLBrettel1997Params* params, float severity, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width)
+{
+    dl_neon_brettel1997_row(params, severity, layout, src, dst, width, 0, NULL);
+}
+
+static void dl_brettel1997_row_fast_neon (const struct DLBrettel1997Params* params, float severity, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width)
+{
+    dl_neon_brettel1997_row(params, severity, layout, src, dst, width, 1, NULL);
+}
+
+static void dl_brettel1997_row_map_neon (const struct DLBrettel1997Params* params, const float* severities, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width)
+{
+    dl_neon_brettel1997_row(params, 1.f, layout, src, dst, width, 0, severities);
+}
+
+static inline void dl_neon_vienot1999_row (const float* rgbCvd_from_rgb, float severity, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width, int fast, const float* severities)
+{
+    struct DLNeonVienot1999 p;
+    dl_neon_vienot1999_init(&p, rgbCvd_from_rgb, severity);
+
+    const size_t pixelSize = layout->pixelSize;
+    size_t col = 0;
+    for (; col + 16 <= width; col += 16)
+    {
+        const uint8x16x4_t px = dl_neon_load_pixels(layout, src + col*pixelSize);
+        float32x4_t rgb[3][4], rgb_cvd[3][4];
+        dl_neon_decode_rgb(layout, px, rgb);
+        dl_neon_vienot1999(&p, rgb, rgb_cvd);
+        if (severities)
+            dl_neon_apply_severity_map(severities + col, rgb, rgb_cvd);
+        dl_neon_encode_rgb(layout, px, rgb_cvd, dst + col*pixelSize, fast);
+    }
+
+    if (severities)
+    {
+        dl_vienot1999_row_map_scalar(rgbCvd_from_rgb, severities + col, layout, src + col*pixelSize, dst + col*pixelSize, width - col);
+    }
+    else if (fast)
+    {
+        dl_vienot1999_row_fast_scalar(rgbCvd_from_rgb, severity, layout, src + col*pixelSize, dst + col*pixelSize, width - col);
+    }
+    else
+    {
+        dl_vienot1999_row_scalar(rgbCvd_from_rgb, severity, layout, src + col*pixelSize, dst + col*pixelSize, width - col);
+    }
+}
+
+static void dl_vienot1999_row_neon (const float* rgbCvd_from_rgb, float severity, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width)
+{
+    dl_neon_vienot1999_row(rgbCvd_from_rgb, severity, layout, src, dst, width, 0, NULL);
+}
+
+static void dl_vienot1999_row_fast_neon (const float* rgbCvd_from_rgb, float severity, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width)
+{
+    dl_neon_vienot1999_row(rgbCvd_from_rgb, severity, layout, src, dst, width, 1, NULL);
+}
+
+static void dl_vienot1999_row_map_neon (const float* rgbCvd_from_rgb, const float* severities, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width)
+{
+    dl_neon_vienot1999_row(rgbCvd_from_rgb, 1.f, layout, src, dst, width, 0, severities);
+}
+
+static void dl_all_deficiencies_row_neon (float severity, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* const dst[3], size_t width)
+{
+    struct DLNeonVienot1999 protan, deutan;
+    struct DLNeonBrettel1997 tritan;
+    dl_neon_vienot1999_init(&protan, dl_vienot_protan_rgbCvd_from_rgb, severity);
+    dl_neon_vienot1999_init(&deutan, dl_vienot_deutan_rgbCvd_from_rgb, severity);
+    dl_neon_brettel1997_init(&tritan, &brettel_tritan_params, severity);
+
+    const size_t pixelSize = layout->pixelSize;
+    size_t col = 0;
+    for (; col + 16 <= width; col += 16)
+    {
+        const uint8x16x4_t px = dl_neon_load_pixels(layout, src + col*pixelSize);
+        float32x4_t rgb[3][4], rgb_cvd[3][4];
+        dl_neon_decode_rgb(layout, px, rgb);
+        if (dst[DLDeficiency_Protan])
+        {
+            dl_neon_vienot1999(&protan, rgb, rgb_cvd);
+            dl_neon_encode_rgb(layout, px, rgb_cvd, dst[DLDeficiency_Protan] + col*pixelSize, 0);
+        }
+        if (dst[DLDeficiency_Deutan])
+        {
+            dl_neon_vienot1999(&deutan, rgb, rgb_cvd);
+            dl_neon_encode_rgb(layout, px, rgb_cvd, dst[DLDeficiency_Deutan] + col*pixelSize, 0);
+        }
+        if (dst[DLDeficiency_Tritan])
+        {
+            dl_neon_brettel1997(&tritan, rgb, rgb_cvd);
+            dl_neon_encode_rgb(layout, px, rgb_cvd, dst[DLDeficiency_Tritan] + col*pixelSize, 0);
+        }
+    }
+
+    unsigned char* tailDst[3];
+    dl_offset_dst_rows(dst, col*pixelSize, tailDst);
+    dl_all_deficiencies_row_scalar(severity, layout, src + col*pixelSize, tailDst, width - col);
+}
+
+// Loads 16 linear float RGBA pixels as rgb[channel][group of 4 pixels],
+// vld4q_f32 doing the deinterleaving. The alpha groups are kept in 'alpha'.
+static inline void dl_neon_load_rgba_f32 (const float* src, float32x4_t rgb[3][4], float32x4_t alpha[4])
+{
+    for (int q = 0; q < 4; ++q)
+    {
+        const float32x4x4_t px = vld4q_f32(src + 16*q);
+        for (int c = 0; c < 3; ++c)
+            rgb[c][q] = px.val[c];
+        alpha[q] = px.val[3];
+    }
+}
+
+static inline void dl_neon_store_rgba_f32 (float* dst, float32x4_t rgb[3][4], const float32x4_t alpha[4])
+{
+    for (int q = 0; q < 4; ++q)
+    {
+        const float32x4x4_t px = { { rgb[0][q], rgb[1][q], rgb[2][q], alpha[q] } };
+        vst4q_f32(dst + 16*q, px);
+    }
+}
+
+static void dl_brettel1997_row_f32_neon (const struct DLBrettel1997Params* params, float severity, const float* src, float* dst, size_t width)
+{
+    struct DLNeonBrettel1997 p;
+    dl_neon_brettel1997_init(&p, params, severity);
+
+    size_t col = 0;
+    for (; col + 16 <= width; col += 16)
+    {
+        float32x4_t rgb[3][4], rgb_cvd[3][4], alpha[4];
+        dl_neon_load_rgba_f32(src + 4*col, rgb, alpha);
+        dl_neon_brettel1997(&p, rgb, rgb_cvd);
+        dl_neon_store_rgba_f32(dst + 4*col, rgb_cvd, alpha);
+    }
+
+    dl_brettel1997_row_f32_scalar(params, severity, src + 4*col, dst + 4*col, width - col);
+}
+
+static void dl_vienot1999_row_f32_neon (const float* rgbCvd_from_rgb, float severity, const float* src, float* dst, size_t width)
+{
+    struct DLNeonVienot1999 p;
+    dl_neon_vienot1999_init(&p, rgbCvd_from_rgb, severity);
+
+    size_t col = 0;
+    for (; col + 16 <= width; col += 16)
+    {
+        float32x4_t rgb[3][4], rgb_cvd[3][4], alpha[4];
+        dl_neon_load_rgba_f32(src + 4*col, rgb, alpha);
+        dl_neon_vienot1999(&p, rgb, rgb_cvd);
+        dl_neon_store_rgba_f32(dst + 4*col, rgb_cvd, alpha);
+    }
+
+    dl_vienot1999_row_f32_scalar(rgbCvd_from_rgb, severity, src + 4*col, dst + 4*col, width - col);
+}
+
+static void dl_float_from_half_neon (const uint16_t* src, float* dst, size_t count)
+{
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+        vst1q_f32(dst + i, vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(src + i))));
+
+    dl_float_from_half_scalar(src + i, dst + i, count - i);
+}
+
+static void dl_half_from_float_neon (const float* src, uint16_t* dst, size_t count)
+{
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+        vst1_u16(dst + i, vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(src + i))));
+
+    dl_half_from_float_scalar(src + i, dst + i, count - i);
+}
+
+#define DL_HAS_NEON 1
+
+#endif // NEON
+
+/*
+    WebAssembly SIMD kernels, when compiling with -msimd128 (e.g. with
+    Emscripten). There is no runtime detection in WebAssembly: a module using
+    SIMD instructions just fails to validate on engines without it, so they
+    are selected at compile time like NEON.
+
+    These are the SSE4.1 kernels translated to wasm_simd128.h, 4 pixels per
+    iteration with the table lookups done lane by lane, i8x16.swizzle for the
+    byte shuffles and bitselect for the blends. The operations are the same
+    and in the same order, so the output is still identical to the scalar
+    version.
+*/
+
+#if defined(__wasm_simd128__)
+
+#include <wasm_simd128.h>
+
+static inline void dl_wasm_decode_rgb (const struct DLPixelLayout* layout, const unsigned char* src, v128_t rgb[3])
+{
+    const float* table = dl_linearRGB_from_sRGB_table;
+    const unsigned char* p0 = src;
+    const unsigned char* p1 = p0 + layout->pixelSize;
+    const unsigned char* p2 = p1 + layout->pixelSize;
+    const unsigned char* p3 = p2 + layout->pixelSize;
+    rgb[0] = wasm_f32x4_make(table[p0[layout->r]], table[p1[layout->r]], table[p2[layout->r]], table[p3[layout->r]]);
+    rgb[1] = wasm_f32x4_make(table[p0[layout->g]], table[p1[layout->g]], table[p2[layout->g]], table[p3[layout->g]]);
+    rgb[2] = wasm_f32x4_make(table[p0[layout->b]], table[p1[layout->b]], table[p2[layout->b]], table[p3[layout->b]]);
+}
+
+// Same as sRGB_from_linearRGB, returns the 8-bit values in 32-bit lanes.
+static inline v128_t dl_wasm_encode (v128_t v)
+{
+    // Unlike _mm_max_ps and vmaxnmq_f32, pmin and pmax return NaN lanes
+    // unchanged, so set them to 0 first. They then encode to 0 like the
+    // scalar version.
+    v = wasm_v128_bitselect(v, wasm_f32x4_splat(0.f), wasm_f32x4_eq(v, v));
+
+    // Clamp to the pow segment range before computing the index so that we
+    // never read outside of the table, the other cases get blended later.
+    const v128_t clamped = wasm_f32x4_pmin(wasm_f32x4_pmax(v, wasm_f32x4_splat(0.0031308f)),
+                                           wasm_i32x4_splat(0x3f7fffff) /* largest float < 1 */);
+    const v128_t index = wasm_i32x4_sub(wasm_u32x4_shr(clamped, 18), wasm_i32x4_splat((127 - 9) << 5));
+    const v128_t t = wasm_f32x4_mul(wasm_f32x4_convert_i32x4(wasm_v128_and(clamped, wasm_i32x4_splat(0x3ffff))), wasm_f32x4_splat(1.f / 262144.f));
+
+    const float* table = dl_sRGB_from_linearRGB_table;
+    const int i0 = wasm_i32x4_extract_lane(index, 0);
+    const int i1 = wasm_i32x4_extract_lane(index, 1);
+    const int i2 = wasm_i32x4_extract_lane(index, 2);
+    const int i3 = wasm_i32x4_extract_lane(index, 3);
+    const v128_t s0 = wasm_f32x4_make(table[i0], table[i1], table[i2], table[i3]);
+    const v128_t s1 = wasm_f32x4_make(table[i0+1], table[i1+1], table[i2+1], table[i3+1]);
+    v128_t srgb = wasm_f32x4_add(s0, wasm_f32x4_mul(t, wasm_f32x4_sub(s1, s0)));
+
+    // bitselect(a, b, mask) picks a where the mask is set.
+    const v128_t linear = wasm_f32x4_add(wasm_f32x4_splat(0.5f), wasm_f32x4_mul(v, wasm_f32x4_splat(12.92f * 255.f)));
+    srgb = wasm_v128_bitselect(linear, srgb, wasm_f32x4_lt(v, wasm_f32x4_splat(0.0031308f)));
+    srgb = wasm_v128_bitselect(wasm_f32x4_splat(0.f), srgb, wasm_f32x4_le(v, wasm_f32x4_splat(0.f)));
+    srgb = wasm_v128_bitselect(wasm_f32x4_splat(255.f), srgb, wasm_f32x4_ge(v, wasm_f32x4_splat(1.f)));
+    return wasm_i32x4_trunc_sat_f32x4(srgb);
+}
+
+// Same as sRGB_from_linearRGB_fast, no table lookup.
+static inline v128_t dl_wasm_encode_fast (v128_t v)
+{
+    const v128_t s = wasm_f32x4_sqrt(wasm_f32x4_pmax(v, wasm_f32x4_splat(0.f)));
+    v128_t srgb = wasm_f32x4_add(wasm_f32x4_mul(wasm_f32x4_splat(dl_fast_sRGB_c3), s), wasm_f32x4_splat(dl_fast_sRGB_c2));
+    srgb = wasm_f32x4_add(wasm_f32x4_mul(srgb, s), wasm_f32x4_splat(dl_fast_sRGB_c1));
+    srgb = wasm_f32x4_add(wasm_f32x4_mul(srgb, s), wasm_f32x4_splat(dl_fast_sRGB_c0));
+
+    const v128_t linear = wasm_f32x4_add(wasm_f32x4_splat(0.5f), wasm_f32x4_mul(v, wasm_f32x4_splat(12.92f * 255.f)));
+    srgb = wasm_v128_bitselect(linear, srgb, wasm_f32x4_lt(v, wasm_f32x4_splat(0.0031308f)));
+    srgb = wasm_v128_bitselect(wasm_f32x4_splat(0.f), srgb, wasm_f32x4_le(v, wasm_f32x4_splat(0.f)));
+    srgb = wasm_v128_bitselect(wasm_f32x4_splat(255.f), srgb, wasm_f32x4_ge(v, wasm_f32x4_splat(1.f)));
+    return wasm_i32x4_trunc_sat_f32x4(srgb);
+}
+
+#define dl_wasm_encode_accuracy(v, fast) ((fast) ? dl_wasm_encode_fast(v) : dl_wasm_encode(v))
+
+static inline void dl_wasm_encode_rgb (const struct DLSimdLayout* simd, const unsigned char* src, unsigned char* dst, const v128_t rgb[3], int fast)
+{
+    v128_t rgbOut = dl_wasm_encode_accuracy(rgb[0], fast);
+    rgbOut = wasm_v128_or(rgbOut, wasm_i32x4_shl(dl_wasm_encode_accuracy(rgb[1], fast), 8));
+    rgbOut = wasm_v128_or(rgbOut, wasm_i32x4_shl(dl_wasm_encode_accuracy(rgb[2], fast), 16));
+    const v128_t out = wasm_i8x16_swizzle(rgbOut, wasm_v128_load(simd->fromRgb));
+    if (simd->pixelSize == 4)
+    {
+        // Keep the alpha / padding byte of the source.
+        const v128_t extra = wasm_v128_and(wasm_v128_load(src), wasm_v128_load(simd->extraMask));
+        wasm_v128_store(dst, wasm_v128_or(out, extra));
+    }
+    else
+    {
+        // 3-byte pixels: store exactly 12 bytes, to stay within the row.
+        wasm_v128_store64_lane(dst, out, 0);
+        wasm_v128_store32_lane(dst + 8, out, 2);
+    }
+}
+
+static inline void dl_wasm_apply_matrix (const v128_t m[9], const v128_t rgb[3], v128_t out[3])
+{
+    out[0] = wasm_f32x4_add(wasm_f32x4_add(wasm_f32x4_mul(m[0], rgb[0]), wasm_f32x4_mul(m[1], rgb[1])), wasm_f32x4_mul(m[2], rgb[2]));
+    out[1] = wasm_f32x4_add(wasm_f32x4_add(wasm_f32x4_mul(m[3], rgb[0]), wasm_f32x4_mul(m[4], rgb[1])), wasm_f32x4_mul(m[5], rgb[2]));
+    out[2] = wasm_f32x4_add(wasm_f32x4_add(wasm_f32x4_mul(m[6], rgb[0]), wasm_f32x4_mul(m[7], rgb[1])), wasm_f32x4_mul(m[8], rgb[2]));
+}
+
+// rgb_cvd = rgb_cvd*severity + rgb*(1-severity)
+static inline void dl_wasm_apply_severity (v128_t severity, v128_t oneMinusSeverity, const v128_t rgb[3], v128_t rgb_cvd[3])
+{
+    for (int c = 0; c < 3; ++c)
+        rgb_cvd[c] = wasm_f32x4_add(wasm_f32x4_mul(rgb_cvd[c], severity), wasm_f32x4_mul(rgb[c], oneMinusSeverity));
+}
+
+// Same with one severity per pixel.
+static inline void dl_wasm_apply_severity_map (const float* severities, const v128_t rgb[3], v128_t rgb_cvd[3])
+{
+    const v128_t severity = wasm_v128_load(severities);
+    dl_wasm_apply_severity(severity, wasm_f32x4_sub(wasm_f32x4_splat(1.f), severity), rgb, rgb_cvd);
+}
+
+// Parameters broadcasted to all the lanes.
+struct DLWasmBrettel1997
+{
+    v128_t m1[9];
+    v128_t m2[9];
+    v128_t n[3];
+    v128_t severity;
+    v128_t oneMinusSeverity;
+    int applySeverity;
+};
+
+struct DLWasmVienot1999
+{
+    v128_t m[9];
+    v128_t severity;
+    v128_t oneMinusSeverity;
+    int applySeverity;
+};
+
+static inline void dl_wasm_brettel1997_init (struct DLWasmBrettel1997* p, const struct DLBrettel1997Params* params, float severity)
+{
+    for (int i = 0; i < 9; ++i)
+    {
+        p->m1[i] = wasm_f32x4_splat(params->rgbCvdFromRgb_1[i]);
+        p->m2[i] = wasm_f32x4_splat(params->rgbCvdFromRgb_2[i]);
+    }
+    for (int i = 0; i < 3; ++i)
+        p->n[i] = wasm_f32x4_splat(params->separationPlaneNormalInRgb[i]);
+    p->severity = wasm_f32x4_splat(severity);
+    p->oneMinusSeverity = wasm_f32x4_splat(1.f - severity);
+    p->applySeverity = severity < 1.f;
+}
+
+static inline void dl_wasm_vienot1999_init (struct DLWasmVienot1999* p, const float* rgbCvd_from_rgb, float severity)
+{
+    for (int i = 0; i < 9; ++i)
+        p->m[i] = wasm_f32x4_splat(rgbCvd_from_rgb[i]);
+    p->severity = wasm_f32x4_splat(severity);
+    p->oneMinusSeverity = wasm_f32x4_splat(1.f - severity);
+    p->applySeverity = severity < 0.999f;
+}
+
+static inline void dl_wasm_brettel1997 (const struct DLWasmBrettel1997* p, const v128_t rgb[3], v128_t rgb_cvd[3])
+{
+    // Branchless plane selection: blend the two matrices with the sign mask.
+    const v128_t dotWithSepPlane = wasm_f32x4_add(wasm_f32x4_add(wasm_f32x4_mul(rgb[0], p->n[0]), wasm_f32x4_mul(rgb[1], p->n[1])), wasm_f32x4_mul(rgb[2], p->n[2]));
+    const v128_t usePlane1 = wasm_f32x4_ge(dotWithSepPlane, wasm_f32x4_splat(0.f));
+    v128_t m[9];
+    for (int i = 0; i < 9; ++i)
+        m[i] = wasm_v128_bitselect(p->m1[i], p->m2[i], usePlane1);
+
+    dl_wasm_apply_matrix(m, rgb, rgb_cvd);
+    if (p->applySeverity)
+    {
+        dl_wasm_apply_severity(p->severity, p->oneMinusSeverity, rgb, rgb_cvd);
+    }
+}
+
+static inline void dl_wasm_vienot1999 (const struct DLWasmVienot1999* p, const v128_t rgb[3], v128_t rgb_cvd[3])
+{
+    dl_wasm_apply_matrix(p->m, rgb, rgb_cvd);
+    if (p->applySeverity)
+    {
+        dl_wasm_apply_severity(p->severity, p->oneMinusSeverity, rgb, rgb_cvd);
+    }
+}
+
+static inline void dl_wasm_brettel1997_row (const struct DLBrettel1997Params* params, float severity, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width, int fast, const float* severities)
+{
+    struct DLWasmBrettel1997 p;
+    dl_wasm_brettel1997_init(&p, params, severity);
+    struct DLSimdLayout simd;
+    dl_simd_layout_init(&simd, layout);
+
+    const size_t pixelSize = layout->pixelSize;
+    size_t col = 0;
+    for (; col + 4 <= width; col += 4)
+    {
+        v128_t rgb[3], rgb_cvd[3];
+        dl_wasm_decode_rgb(layout, src + col*pixelSize, rgb);
+        dl_wasm_brettel1997(&p, rgb, rgb_cvd);
+        if (severities)
+            dl_wasm_apply_severity_map(severities + col, rgb, rgb_cvd);
+        dl_wasm_encode_rgb(&simd, src + col*pixelSize, dst + col*pixelSize, rgb_cvd, fast);
+    }
+
+    if (severities)
+    {
+        dl_brettel1997_row_map_scalar(params, severities + col, layout, src + col*pixelSize, dst + col*pixelSize, width - col);
+    }
+    else if (fast)
+    {
+        dl_brettel1997_row_fast_scalar(params, severity, layout, src + col*pixelSize, dst + col*pixelSize, width - col);
+    }
+    else
+    {
+        dl_brettel1997_row_scalar(params, severity, layout, src + col*pixelSize, dst + col*pixelSize, width - col);
+    }
+}
+
+static void dl_brettel1997_row_wasm (const struct DLBrettel1997Params* params, float severity, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width)
+{
+    dl_wasm_brettel1997_row(params, severity, layout, src, dst, width, 0, NULL);
+}
+
+static void dl_brettel1997_row_fast_wasm (const struct DLBrettel1997Params* params, float severity, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width)
+{
+    dl_wasm_brettel1997_row(params, severity, layout, src, dst, width, 1, NULL);
+}
+
+static void dl_brettel1997_row_map_wasm (const struct DLBrettel1997Params* params, const float* severities, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width)
+{
+    dl_wasm_brettel1997_row(params, 1.f, layout, src, dst, width, 0, severities);
+}
+
+static inline void dl_wasm_vienot1999_row (const float* rgbCvd_from_rgb, float severity, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width, int fast, const float* severities)
+{
+    struct DLWasmVienot1999 p;
+    dl_wasm_vienot1999_init(&p, rgbCvd_from_rgb, severity);
+    struct DLSimdLayout simd;
+    dl_simd_layout_init(&simd, layout);
+
+    const size_t pixelSize = layout->pixelSize;
+    size_t col = 0;
+    for (; col + 4 <= width; col += 4)
+    {
+        v128_t rgb[3], rgb_cvd[3];
+        dl_wasm_decode_rgb(layout, src + col*pixelSize, rgb);
+        dl_wasm_vienot1999(&p, rgb, rgb_cvd);
+        if (severities)
+            dl_wasm_apply_severity_map(severities + col, rgb, rgb_cvd);
+        dl_wasm_encode_rgb(&simd, src + col*pixelSize, dst + col*pixelSize, rgb_cvd, fast);
+    }
+
+    if (severities)
+    {
+        dl_vienot1999_row_map_scalar(rgbCvd_from_rgb, severities + col, layout, src + col*pixelSize, dst + col*pixelSize, width - col);
+    }
+    else if (fast)
+    {
+        dl_vienot1999_row_fast_scalar(rgbCvd_from_rgb, severity, layout, src + col*pixelSize, dst + col*pixelSize, width - col);
+    }
+    else
+    {
+        dl_vienot1999_row_scalar(rgbCvd_from_rgb, severity, layout, src + col*pixelSize, dst + col*pixelSize, width - col);
+    }
+}
+
+static void dl_vienot1999_row_wasm (const float* rgbCvd_from_rgb, float severity, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width)
+{
+    dl_wasm_vienot1999_row(rgbCvd_from_rgb, severity, layout, src, dst, width, 0, NULL);
+}
+
+static void dl_vienot1999_row_fast_wasm (const float* rgbCvd_from_rgb, float severity, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width)
+{
+    dl_wasm_vienot1999_row(rgbCvd_from_rgb, severity, layout, src, dst, width, 1, NULL);
+}
+
+static void dl_vienot1999_row_map_wasm (const float* rgbCvd_from_rgb, const float* severities, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width)
+{
+    dl_wasm_vienot1999_row(rgbCvd_from_rgb, 1.f, layout, src, dst, width, 0, severities);
+}
+
+static void dl_all_deficiencies_row_wasm (float severity, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* const dst[3], size_t width)
+{
+    struct DLWasmVienot1999 protan, deutan;
+    struct DLWasmBrettel1997 tritan;
+    dl_wasm_vienot1999_init(&protan, dl_vienot_protan_rgbCvd_from_rgb, severity);
+    dl_wasm_vienot1999_init(&deutan, dl_vienot_deutan_rgbCvd_from_rgb, severity);
+    dl_wasm_brettel1997_init(&tritan, &brettel_tritan_params, severity);
+    struct DLSimdLayout simd;
+    dl_simd_layout_init(&simd, layout);
+
+    const size_t pixelSize = layout->pixelSize;
+    size_t col = 0;
+    for (; col + 4 <= width; col += 4)
+    {
+        v128_t rgb[3], rgb_cvd[3];
+        dl_wasm_decode_rgb(layout, src + col*pixelSize, rgb);
+        if (dst[DLDeficiency_Protan])
+        {
+            dl_wasm_vienot1999(&protan, rgb, rgb_cvd);
+            dl_wasm_encode_rgb(&simd, src + col*pixelSize, dst[DLDeficiency_Protan] + col*pixelSize, rgb_cvd, 0);
+        }
+        if (dst[DLDeficiency_Deutan])
+        {
+            dl_wasm_vienot1999(&deutan, rgb, rgb_cvd);
+            dl_wasm_encode_rgb(&simd, src + col*pixelSize, dst[DLDeficiency_Deutan] + col*pixelSize, rgb_cvd, 0);
+        }
+        if (dst[DLDeficiency_Tritan])
+        {
+            dl_wasm_brettel1997(&tritan, rgb, rgb_cvd);
+            dl_wasm_encode_rgb(&simd, src + col*pixelSize, dst[DLDeficiency_Tritan] + col*pixelSize, rgb_cvd, 0);
+        }
+    }
+
+    unsigned char* tailDst[3];
+    dl_offset_dst_rows(dst, col*pixelSize, tailDst);
+    dl_all_deficiencies_row_scalar(severity, layout, src + col*pixelSize, tailDst, width - col);
+}
+
+// 4x4 transpose between RGBA pixels and r, g, b, a vectors, its own inverse.
+static inline void dl_wasm_transpose4 (v128_t px[4])
+{
+    const v128_t t0 = wasm_i32x4_shuffle(px[0], px[1], 0, 4, 1, 5);
+    const v128_t t1 = wasm_i32x4_shuffle(px[0], px[1], 2, 6, 3, 7);
+    const v128_t t2 = wasm_i32x4_shuffle(px[2], px[3], 0, 4, 1, 5);
+    const v128_t t3 = wasm_i32x4_shuffle(px[2], px[3], 2, 6, 3, 7);
+    px[0] = wasm_i32x4_shuffle(t0, t2, 0, 1, 4, 5);
+    px[1] = wasm_i32x4_shuffle(t0, t2, 2, 3, 6, 7);
+    px[2] = wasm_i32x4_shuffle(t1, t3, 0, 1, 4, 5);
+    px[3] = wasm_i32x4_shuffle(t1, t3, 2, 3, 6, 7);
+}
+
+static inline void dl_wasm_load_rgba_f32 (const float* src, v128_t px[4])
+{
+    for (int k = 0; k < 4; ++k)
+        px[k] = wasm_v128_load(src + 4*k);
+    dl_wasm_transpose4(px);
+}
+
+static inline void dl_wasm_store_rgba_f32 (float* dst, v128_t px[4])
+{
+    dl_wasm_transpose4(px);
+    for (int k = 0; k < 4; ++k)
+        wasm_v128_store(dst + 4*k, px[k]);
+}
+
+static void dl_brettel1997_row_f32_wasm (const struct DLBrettel1997Params* params, float severity, const float* src, float* dst, size_t width)
+{
+    struct DLWasmBrettel1997 p;
+    dl_wasm_brettel1997_init(&p, params, severity);
+
+    size_t col = 0;
+    for (; col + 4 <= width; col += 4)
+    {
+        v128_t px[4], rgb_cvd[3];
+        dl_wasm_load_rgba_f32(src + 4*col, px);
+        dl_wasm_brettel1997(&p, px, rgb_cvd);
+        px[0] = rgb_cvd[0];
+        px[1] = rgb_cvd[1];
+        px[2] = rgb_cvd[2];
+        dl_wasm_store_rgba_f32(dst + 4*col, px);
+    }
+
+    dl_brettel1997_row_f32_scalar(params, severity, src + 4*col, dst + 4*col, width - col);
+}
+
+static void dl_vienot1999_row_f32_wasm (const float* rgbCvd_from_rgb, float severity, const float* src, float* dst, size_t width)
+{
+    struct DLWasmVienot1999 p;
+    dl_wasm_vienot1999_init(&p, rgbCvd_from_rgb, severity);
+
+    size_t col = 0;
+    for (; col + 4 <= width; col += 4)
+    {
+        v128_t px[4], rgb_cvd[3];
+        dl_wasm_load_rgba_f32(src + 4*col, px);
+        dl_wasm_vienot1999(&p, px, rgb_cvd);
+        px[0] = rgb_cvd[0];
+        px[1] = rgb_cvd[1];
+        px[2] = rgb_cvd[2];
+        dl_wasm_store_rgba_f32(dst + 4*col, px);
+    }
+
+    dl_vienot1999_row_f32_scalar(rgbCvd_from_rgb, severity, src + 4*col, dst + 4*col, width - col);
+}
+
+#define DL_HAS_WASM_SIMD 1
+
+#endif // __wasm_simd128__
+
+/*
+    Runtime dispatch
+
+    The best kernels for the current CPU are detected once and cached in a
+    table of function pointers, so each call only pays for an indirect call
+    per row.
+*/
+
+struct DLKernels
+{
+    enum DLKernel kernel;
+    void (*brettel1997_row) (const struct DLBrettel1997Params* params, float severity, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width);
+    void (*vienot1999_row) (const float* rgbCvd_from_rgb, float severity, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width);
+    void (*all_deficiencies_row) (float severity, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* const dst[3], size_t width);
+
+    // DLAccuracy_Fast versions of the first two.
+    void (*brettel1997_row_fast) (const struct DLBrettel1997Params* params, float severity, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width);
+    void (*vienot1999_row_fast) (const float* rgbCvd_from_rgb, float severity, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width);
+
+    // One severity per pixel instead of the 'severity' argument.
+    void (*brettel1997_row_map) (const struct DLBrettel1997Params* params, const float* severities, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width);
+    void (*vienot1999_row_map) (const float* rgbCvd_from_rgb, const float* severities, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width);
+
+    // Linear float RGBA.
+    void (*brettel1997_row_f32) (const struct DLBrettel1997Params* params, float severity, const float* src, float* dst, size_t width);
+    void (*vienot1999_row_f32) (const float* rgbCvd_from_rgb, float severity, const float* src, float* dst, size_t width);
+    void (*float_from_half) (const uint16_t* src, float* dst, size_t count);
+    void (*half_from_float) (const float* src, uint16_t* dst, size_t count);
+};
+
+static const struct DLKernels dl_scalar_kernels = {
+    DLKernel_Scalar, dl_brettel1997_row_scalar, dl_vienot1999_row_scalar, dl_all_deficiencies_row_scalar,
+    dl_brettel1997_row_fast_scalar, dl_vienot1999_row_fast_scalar,
+    dl_brettel1997_row_map_scalar, dl_vienot1999_row_map_scalar,
+    dl_brettel1997_row_f32_scalar, dl_vienot1999_row_f32_scalar, dl_float_from_half_scalar, dl_half_from_float_scalar
+};
+#if defined(DL_HAS_X86_SIMD)
+// SSE4.1 has no half float conversions.
+static const struct DLKernels dl_sse41_kernels = {
+    DLKernel_SSE41, dl_brettel1997_row_sse41, dl_vienot1999_row_sse41, dl_all_deficiencies_row_sse41,
+    dl_brettel1997_row_fast_sse41, dl_vienot1999_row_fast_sse41,
+    dl_brettel1997_row_map_sse41, dl_vienot1999_row_map_sse41,
+    dl_brettel1997_row_f32_sse41, dl_vienot1999_row_f32_sse41, dl_float_from_half_scalar, dl_half_from_float_scalar
+};
+static const struct DLKernels dl_avx2_kernels = {
+    DLKernel_AVX2, dl_brettel1997_row_avx2, dl_vienot1999_row_avx2, dl_all_deficiencies_row_avx2,
+    dl_brettel1997_row_fast_avx2, dl_vienot1999_row_fast_avx2,
+    dl_brettel1997_row_map_avx2, dl_vienot1999_row_map_avx2,
+    dl_brettel1997_row_f32_avx2, dl_vienot1999_row_f32_avx2, dl_float_from_half_avx2, dl_half_from_float_avx2
+};
+#endif
+#if defined(DL_HAS_NEON)
+static const struct DLKernels dl_neon_kernels = {
+    DLKernel_NEON, dl_brettel1997_row_neon, dl_vienot1999_row_neon, dl_all_deficiencies_row_neon,
+    dl_brettel1997_row_fast_neon, dl_vienot1999_row_fast_neon,
+    dl_brettel1997_row_map_neon, dl_vienot1999_row_map_neon,
+    dl_brettel1997_row_f32_neon, dl_vienot1999_row_f32_neon, dl_float_from_half_neon, dl_half_from_float_neon
+};
+#endif
+#if defined(DL_HAS_WASM_SIMD)
+// No half float conversions in WebAssembly SIMD either.
+static const struct DLKernels dl_wasm_kernels = {
+    DLKernel_WasmSIMD128, dl_brettel1997_row_wasm, dl_vienot1999_row_wasm, dl_all_deficiencies_row_wasm,
+    dl_brettel1997_row_fast_wasm, dl_vienot1999_row_fast_wasm,
+    dl_brettel1997_row_map_wasm, dl_vienot1999_row_map_wasm,
+    dl_brettel1997_row_f32_wasm, dl_vienot1999_row_f32_wasm, dl_float_from_half_scalar, dl_half_from_float_scalar
+};
+#endif
+
+#if defined(DL_HAS_X86_SIMD)
+static void dl_cpuid (unsigned leaf, unsigned subleaf, unsigned regs[4])
+{
+#if defined(__GNUC__) || defined(__clang__)
+    regs[0] = regs[1] = regs[2] = regs[3] = 0;
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#else
+    __cpuidex((int*)regs, (int)leaf, (int)subleaf);
+#endif
+}
+
+static int dl_cpu_has_kernel (enum DLKernel kernel)
+{
+    unsigned regs[4];
+    dl_cpuid(0, 0, regs);
+    const unsigned maxLeaf = regs[0];
+    if (maxLeaf < 1) return 0;
+
+    dl_cpuid(1, 0, regs);
+    const int hasSSE41 = (regs[2] >> 19) & 1;
+    if (kernel == DLKernel_SSE41) return hasSSE41;
+    if (kernel != DLKernel_AVX2 || maxLeaf < 7) return 0;
+
+    // The OS also needs to save the AVX registers (OSXSAVE + XCR0 bits 1 and 2).
+    const int hasAVX = (regs[2] >> 28) & 1;
+    const int hasOSXSAVE = (regs[2] >> 27) & 1;
+    const int hasF16C = (regs[2] >> 29) & 1;
+    if (!hasAVX || !hasOSXSAVE || !hasF16C) return 0;
+#if defined(__GNUC__) || defined(__clang__)
+    unsigned xcr0Low, xcr0High;
+    __asm__ volatile ("xgetbv" : "=a"(xcr0Low), "=d"(xcr0High) : "c"(0));
+#else
+    const unsigned xcr0Low = (unsigned)_xgetbv(0);
+#endif
+    if ((xcr0Low & 0x6) != 0x6) return 0;
+
+    dl_cpuid(7, 0, regs);
+    return (regs[1] >> 5) & 1;
+}
+#endif
+
+static const struct DLKernels* dl_kernels_for (enum DLKernel kernel)
+{
+    switch (kernel)
+    {
+        case DLKernel_Auto:
+        {
+#if defined(DL_HAS_NEON)
+            return &dl_neon_kernels;
+#elif defined(DL_HAS_WASM_SIMD)
+            return &dl_wasm_kernels;
+#elif defined(DL_HAS_X86_SIMD)
+            if (dl_cpu_has_kernel(DLKernel_AVX2)) return &dl_avx2_kernels;
+            if (dl_cpu_has_kernel(DLKernel_SSE41)) return &dl_sse41_kernels;
+#endif
+            return &dl_scalar_kernels;
+        }
+
+        case DLKernel_Scalar: return &dl_scalar_kernels;
+
+#if defined(DL_HAS_X86_SIMD)
+        case DLKernel_SSE41: return dl_cpu_has_kernel(DLKernel_SSE41) ? &dl_sse41_kernels : NULL;
+        case DLKernel_AVX2: return dl_cpu_has_kernel(DLKernel_AVX2) ? &dl_avx2_kernels : NULL;
+#endif
+
+#if defined(DL_HAS_NEON)
+        case DLKernel_NEON: return &dl_neon_kernels;
+#endif
+
+#if defined(DL_HAS_WASM_SIMD)
+        case DLKernel_WasmSIMD128: return &dl_wasm_kernels;
+#endif
+
+        default: return NULL;
+    }
+}
+
+// Detected once, on the first call that needs it, so that concurrent first
+// simulations don't race on it. Only dl_force_kernel changes it later, and
+// it must not be called while simulations are running (see the header).
+static const struct DLKernels* dl_active_kernels = NULL;
+
+static void dl_detect_kernels (void)
+{
+    dl_active_kernels = dl_kernels_for(DLKernel_Auto);
+}
+
+#if defined(DL_NO_THREADS)
+static void dl_init_kernels (void)
+{
+    if (dl_active_kernels == NULL)
+    {
+        dl_detect_kernels();
+    }
+}
+#elif defined(_WIN32)
+#  include <windows.h>
+static BOOL CALLBACK dl_detect_kernels_once (PINIT_ONCE once, PVOID param, PVOID* context)
+{
+    (void)once;
+    (void)param;
+    (void)context;
+    dl_detect_kernels();
+    return TRUE;
+}
+
+static void dl_init_kernels (void)
+{
+    static INIT_ONCE once = INIT_ONCE_STATIC_INIT;
+    InitOnceExecuteOnce(&once, dl_detect_kernels_once, NULL, NULL);
+}
+#else
+#  include <pthread.h>
+static void dl_init_kernels (void)
+{
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, dl_detect_kernels);
+}
+#endif
+
+static const struct DLKernels* dl_get_kernels (void)
+{
+    dl_init_kernels();
+    return dl_active_kernels;
+}
+
+int dl_force_kernel (enum DLKernel kernel)
+{
+    const struct DLKernels* kernels = dl_kernels_for(kernel);
+    if (kernels == NULL)
+    {
+        return 0;
+    }
+    // Detect first, so that it can't override the forced kernel later.
+    dl_init_kernels();
+    dl_active_kernels = kernels;
+    return 1;
+}
+
+enum DLKernel dl_get_kernel (void)
+{
+    return dl_get_kernels()->kernel;
+}
+
+/*
+    Multi-threading
+
+    Rows are fully independent, so the images are split into bands of rows
+    that get processed by a small pool of worker threads. The pool is
+    created on the first multi-threaded call, grows up to the largest
+    requested number of threads, and is reused by the following calls. The
+    calling thread also processes bands, so num_threads == 1 does not use the
+    pool at all.
+
+    Applications that already have their own task scheduler can register it
+    with dl_set_parallel_for, and then the bands get pushed through it
+    instead of the internal pool.
+
+    Define DL_NO_THREADS to compile without any thread support, in which
+    case the _mt functions just run on the calling thread. It is implied
+    with Emscripten unless building with -pthread, since the browser main
+    thread can't block on the workers anyway.
+*/
+
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__) && !defined(DL_NO_THREADS)
+#  define DL_NO_THREADS 1
+#endif
+
+typedef void (*DLRowsFunc) (void* ctx, size_t firstRow, size_t endRow);
+
+static DLParallelFor dl_parallel_for = NULL;
+static void* dl_parallel_for_ctx = NULL;
+
+void dl_set_parallel_for (DLParallelFor parallel_for, void* scheduler_ctx)
+{
+    dl_parallel_for = parallel_for;
+    dl_parallel_for_ctx = scheduler_ctx;
+}
+
+// Adapts a function processing rows to a function processing bands of rows.
+struct DLBands
+{
+    DLRowsFunc func;
+    void* ctx;
+    size_t height;
+    size_t rowsPerBand;
+};
+
+static void dl_bands_process (void* ctx, size_t firstBand, size_t endBand)
+{
+    const struct DLBands* bands = (const struct DLBands*)ctx;
+    const size_t firstRow = firstBand * bands->rowsPerBand;
+    const size_t endRow = endBand * bands->rowsPerBand;
+    bands->func(bands->ctx, firstRow, endRow < bands->height ? endRow : bands->height);
+}
+
+#define DL_MAX_THREADS 64
+
+// Split the work in more bands than threads to balance the load a bit.
+#define DL_BANDS_PER_THREAD 4
+
+// Below that number of pixels per band the threading overhead dominates.
+#define DL_MIN_PIXELS_PER_BAND 16384
+
+#if !defined(DL_NO_THREADS)
+
+#if defined(_WIN32)
+#  include <windows.h>
+typedef HANDLE DLThread;
+typedef SRWLOCK DLMutex;
+typedef CONDITION_VARIABLE DLCond;
+#  define DL_MUTEX_INITIALIZER SRWLOCK_INIT
+#  define DL_COND_INITIALIZER CONDITION_VARIABLE_INIT
+static void dl_mutex_lock (DLMutex* m) { AcquireSRWLockExclusive(m); }
+static int dl_mutex_trylock (DLMutex* m) { return TryAcquireSRWLockExclusive(m) != 0; }
+static void dl_mutex_unlock (DLMutex* m) { ReleaseSRWLockExclusive(m); }
+static void dl_cond_wait (DLCond* c, DLMutex* m) { SleepConditionVariableSRW(c, m, INFINITE, 0); }
+static void dl_cond_broadcast (DLCond* c) { WakeAllConditionVariable(c); }
+#else
+#  include <pthread.h>
+#  include <unistd.h>
+typedef pthread_t DLThread;
+typedef pthread_mutex_t DLMutex;
+typedef pthread_cond_t DLCond;
+#  define DL_MUTEX_INITIALIZER PTHREAD_MUTEX_INITIALIZER
+#  define DL_COND_INITIALIZER PTHREAD_COND_INITIALIZER
+static void dl_mutex_lock (DLMutex* m) { pthread_mutex_lock(m); }
+static int dl_mutex_trylock (DLMutex* m) { return pthread_mutex_trylock(m) == 0; }
+static void dl_mutex_unlock (DLMutex* m) { pthread_mutex_unlock(m); }
+static void dl_cond_wait (DLCond* c, DLMutex* m) { pthread_cond_wait(c, m); }
+static void dl_cond_broadcast (DLCond* c) { pthread_cond_broadcast(c); }
+#endif
+
+struct DLThreadPool
+{
+    // Only one multi-threaded call can use the pool at a time.
+    DLMutex callMutex;
+
+    // Protects everything below.
+    DLMutex mutex;
+    DLCond workAvailable;
+    DLCond workDone;
+
+    DLThread threads[DL_MAX_THREADS];
+    int numThreads;
+    int shutdown;
+
+    // Incremented for each new job, so the workers know when to wake up.
+    unsigned generation;
+
+    // Current job.
+    DLRangeFunc func;
+    void* ctx;
+    size_t numBands;
+    size_t nextBand;
+    size_t bandsRemaining;
+    int maxHelpers;
+    int numHelpers;
+};
+
+static struct DLThreadPool dl_thread_pool = {
+    .callMutex = DL_MUTEX_INITIALIZER,
+    .mutex = DL_MUTEX_INITIALIZER,
+    .workAvailable = DL_COND_INITIALIZER,
+    .workDone = DL_COND_INITIALIZER
+};
+
+// Must be called with the pool mutex locked.
+static void dl_thread_pool_process_bands (struct DLThreadPool* pool)
+{
+    while (pool->nextBand < pool->numBands)
+    {
+        const size_t band = pool->nextBand++;
+        DLRangeFunc func = pool->func;
+        void* ctx = pool->ctx;
+
+        dl_mutex_unlock(&pool->mutex);
+        func(ctx, band, band + 1);
+        dl_mutex_lock(&pool->mutex);
+
+        if (--pool->bandsRemaining == 0)
+        {
+            dl_cond_broadcast(&pool->workDone);
+        }
+    }
+}
+
+#if defined(_WIN32)
+static DWORD WINAPI dl_thread_pool_worker (LPVOID arg)
+#else
+static void* dl_thread_pool_worker (void* arg)
+#endif
+{
+    struct DLThreadPool* pool = (struct DLThreadPool*)arg;
+    dl_mutex_lock(&pool->mutex);
+
+    // Start from 0 so a thread created for the current job still helps with
+    // it. Joining a job that's already finished is harmless, there are just
+    // no bands left.
+    unsigned lastGeneration = 0;
+    for (;;)
+    {
+        while (pool->generation == lastGeneration && !pool->shutdown)
+        {
+            dl_cond_wait(&pool->workAvailable, &pool->mutex);
+        }
+
+        if (pool->shutdown)
+        {
+            break;
+        }
+
+        lastGeneration = pool->generation;
+        if (pool->numHelpers < pool->maxHelpers)
+        {
+            ++pool->numHelpers;
+            dl_thread_pool_process_bands(pool);
+        }
+    }
+    dl_mutex_unlock(&pool->mutex);
+    return 0;
+}
+
+// Must be called with the pool mutex locked.
+static void dl_thread_pool_grow (struct DLThreadPool* pool, int numThreads)
+{
+    while (pool->numThreads < numThreads)
+    {
+#if defined(_WIN32)
+        DLThread thread = CreateThread(NULL, 0, dl_thread_pool_worker, pool, 0, NULL);
+        if (thread == NULL) break;
+#else
+        DLThread thread;
+        if (pthread_create(&thread, NULL, dl_thread_pool_worker, pool) != 0) break;
+#endif
+        pool->threads[pool->numThreads++] = thread;
+    }
+}
+
+static int dl_hardware_concurrency (void)
+{
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else
+    const long numCpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return numCpus > 0 ? (int)numCpus : 1;
+#endif
+}
+
+void dl_release_threads (void)
+{
+    struct DLThreadPool* pool = &dl_thread_pool;
+    dl_mutex_lock(&pool->callMutex);
+    dl_mutex_lock(&pool->mutex);
+    pool->shutdown = 1;
+    dl_cond_broadcast(&pool->workAvailable);
+    dl_mutex_unlock(&pool->mutex);
+
+    for (int i = 0; i < pool->numThreads; ++i)
+    {
+#if defined(_WIN32)
+        WaitForSingleObject(pool->threads[i], INFINITE);
+        CloseHandle(pool->threads[i]);
+#else
+        pthread_join(pool->threads[i], NULL);
+#endif
+    }
+
+    pool->numThreads = 0;
+    pool->shutdown = 0;
+    dl_mutex_unlock(&pool->callMutex);
+}
+
+#else // DL_NO_THREADS
+
+static int dl_hardware_concurrency (void)
+{
+    return 1;
+}
+
+void dl_release_threads (void)
+{
+}
+
+#endif // DL_NO_THREADS
+
+/*
+    Instrumentation
+
+    Everything is compiled out without DL_ENABLE_STATS, the hooks in the
+    simulation code are all behind #if.
+
+    The stats of the current scope are in a thread local, and get captured
+    by the jobs when they are initialized on the calling thread, so the rows
+    processed by the workers accumulate in the same struct under a mutex.
+*/
+
+#if defined(DL_ENABLE_STATS)
+
+#if defined(_WIN32) && defined(DL_NO_THREADS)
+#  include <windows.h>
+#elif !defined(_WIN32)
+#  include <time.h>
+#endif
+
+#if defined(DL_NO_THREADS)
+#  define DL_THREAD_LOCAL
+#elif defined(_MSC_VER)
+#  define DL_THREAD_LOCAL __declspec(thread)
+#else
+#  define DL_THREAD_LOCAL __thread
+#endif
+
+static DL_THREAD_LOCAL struct DLStats* dl_current_stats = NULL;
+static DL_THREAD_LOCAL double dl_current_stats_start = 0.;
+
+#if !defined(DL_NO_THREADS)
+static DLMutex dl_stats_mutex = DL_MUTEX_INITIALIZER;
+#endif
+
+static DLTraceFunc dl_trace_begin = NULL;
+static DLTraceFunc dl_trace_end = NULL;
+static void* dl_trace_ctx = NULL;
+
+static double dl_stats_now (void)
+{
+#if defined(_WIN32)
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + (double)t.tv_nsec * 1e-9;
+#endif
+}
+
+static void dl_stats_add (struct DLStats* stats, const struct DLStats* counts)
+{
+#if !defined(DL_NO_THREADS)
+    dl_mutex_lock(&dl_stats_mutex);
+#endif
+    stats->numPixels += counts->numPixels;
+    stats->numClippedChannels += counts->numClippedChannels;
+    stats->numBrettelPlane1 += counts->numBrettelPlane1;
+    stats->numBrettelPlane2 += counts->numBrettelPlane2;
+    stats->processingSeconds += counts->processingSeconds;
+    if (counts->kernel != DLKernel_Auto)
+    {
+        stats->kernel = counts->kernel;
+    }
+#if !defined(DL_NO_THREADS)
+    dl_mutex_unlock(&dl_stats_mutex);
+#endif
+}
+
+// A traced and timed unit of work.
+struct DLZone
+{
+    const char* name;
+    struct DLStats* stats;
+    double start;
+};
+
+static void dl_zone_begin (struct DLZone* zone, const char* name, struct DLStats* stats)
+{
+    zone->name = name;
+    zone->stats = stats;
+    if (dl_trace_begin)
+    {
+        dl_trace_begin(dl_trace_ctx, name);
+    }
+    zone->start = stats ? dl_stats_now() : 0.;
+}
+
+static void dl_zone_end (struct DLZone* zone)
+{
+    if (zone->stats)
+    {
+        struct DLStats counts = { 0 };
+        counts.processingSeconds = dl_stats_now() - zone->start;
+        dl_stats_add(zone->stats, &counts);
+    }
+    if (dl_trace_end)
+    {
+        dl_trace_end(dl_trace_ctx, zone->name);
+    }
+}
+
+int dl_stats_begin (struct DLStats* stats)
+{
+    dl_current_stats = stats;
+    dl_current_stats_start = dl_stats_now();
+    return 1;
+}
+
+void dl_stats_end (void)
+{
+    if (dl_current_stats)
+    {
+        dl_current_stats->wallSeconds += dl_stats_now() - dl_current_stats_start;
+    }
+    dl_current_stats = NULL;
+}
+
+void dl_set_trace_callbacks (DLTraceFunc begin, DLTraceFunc end, void* trace_ctx)
+{
+    dl_trace_begin = begin;
+    dl_trace_end = end;
+    dl_trace_ctx = trace_ctx;
+}
+
+#else // DL_ENABLE_STATS
+
+int dl_stats_begin (struct DLStats* stats)
+{
+    (void)stats;
+    return 0;
+}
+
+void dl_stats_end (void)
+{
+}
+
+void dl_set_trace_callbacks (DLTraceFunc begin, DLTraceFunc end, void* trace_ctx)
+{
+    (void)begin;
+    (void)end;
+    (void)trace_ctx;
+}
+
+#endif // DL_ENABLE_STATS
+
+static void dl_parallel_for_rows (DLRowsFunc func, void* ctx, size_t width, size_t height, int num_threads)
+{
+    if (num_threads <= 0)
+    {
+        num_threads = dl_hardware_concurrency();
+    }
+    if (num_threads > DL_MAX_THREADS)
+    {
+        num_threads = DL_MAX_THREADS;
+    }
+
+    const size_t minRowsPerBand = width > 0 ? (DL_MIN_PIXELS_PER_BAND + width - 1) / width : 1;
+    size_t rowsPerBand = height / ((size_t)num_threads * DL_BANDS_PER_THREAD);
+    if (rowsPerBand < minRowsPerBand)
+    {
+        rowsPerBand = minRowsPerBand;
+    }
+
+    const struct DLBands bands = { func, ctx, height, rowsPerBand };
+    const size_t numBands = (height + rowsPerBand - 1) / rowsPerBand;
+    if (num_threads == 1 || numBands <= 1)
+    {
+        func(ctx, 0, height);
+        return;
+    }
+
+    if (dl_parallel_for)
+    {
+        dl_parallel_for(dl_parallel_for_ctx, 0, numBands, dl_bands_process, (void*)&bands);
+        return;
+    }
+
+#if !defined(DL_NO_THREADS)
+    // If another thread is already using the pool just do the work on the
+    // calling thread, at least that's always making progress.
+    struct DLThreadPool* pool = &dl_thread_pool;
+    if (dl_mutex_trylock(&pool->callMutex))
+    {
+        dl_mutex_lock(&pool->mutex);
+        dl_thread_pool_grow(pool, num_threads - 1);
+        pool->func = dl_bands_process;
+        pool->ctx = (void*)&bands;
+        pool->numBands = numBands;
+        pool->nextBand = 0;
+        pool->bandsRemaining = numBands;
+        pool->maxHelpers = num_threads - 1;
+        pool->numHelpers = 0;
+        ++pool->generation;
+        dl_cond_broadcast(&pool->workAvailable);
+
+        // Participate, and then wait for the bands still being processed
+        // by the workers.
+        dl_thread_pool_process_bands(pool);
+        while (pool->bandsRemaining > 0)
+        {
+            dl_cond_wait(&pool->workDone, &pool->mutex);
+        }
+
+        dl_mutex_unlock(&pool->mutex);
+        dl_mutex_unlock(&pool->callMutex);
+        return;
+    }
+#endif
+
+    func(ctx, 0, height);
+}
+
+/*
+    Allocation
+
+    A NULL context stands for malloc and free everywhere, so the regular
+    functions just forward NULL to the dl_context_* ones. The scratch buffer
+    of a context grows to the largest request and is kept, while without a
+    context it gets allocated and freed on each call.
+*/
+struct DLContext
+{
+    struct DLAllocator allocator;
+    void* scratch;
+    size_t scratchSize;
+};
+
+static void* dl_context_allocate (struct DLContext* context, size_t size)
+{
+    if (context == NULL)
+    {
+        return malloc(size);
+    }
+    return context->allocator.allocate(context->allocator.allocator_ctx, size);
+}
+
+static void dl_context_deallocate (struct DLContext* context, void* ptr)
+{
+    if (ptr == NULL)
+    {
+        return;
+    }
+    if (context == NULL)
+    {
+        free (ptr);
+        return;
+    }
+    context->allocator.deallocate(context->allocator.allocator_ctx, ptr);
+}
+
+// Valid until the next call with the same context, or released with
+// dl_context_release_scratch.
+static void* dl_context_acquire_scratch (struct DLContext* context, size_t size)
+{
+    if (context == NULL)
+    {
+        return malloc(size);
+    }
+    if (size > context->scratchSize)
+    {
+        dl_context_deallocate(context, context->scratch);
+        context->scratch = dl_context_allocate(context, size);
+        context->scratchSize = context->scratch ? size : 0;
+    }
+    return context->scratch;
+}
+
+static void dl_context_release_scratch (struct DLContext* context, void* scratch)
+{
+    if (context == NULL)
+    {
+        free (scratch);
+    }
+}
+
+static void* dl_malloc_allocate (void* allocator_ctx, size_t size)
+{
+    (void)allocator_ctx;
+    return malloc(size);
+}
+
+static void dl_malloc_deallocate (void* allocator_ctx, void* ptr)
+{
+    (void)allocator_ctx;
+    free (ptr);
+}
+
+struct DLContext* dl_context_create (const struct DLAllocator* allocator)
+{
+    const struct DLAllocator defaultAllocator = { dl_malloc_allocate, dl_malloc_deallocate, NULL };
+    if (allocator == NULL)
+    {
+        allocator = &defaultAllocator;
+    }
+
+    struct DLContext* context = (struct DLContext*)allocator->allocate(allocator->allocator_ctx, sizeof(struct DLContext));
+    if (context == NULL)
+    {
+        return NULL;
+    }
+    context->allocator = *allocator;
+    context->scratch = NULL;
+    context->scratchSize = 0;
+    return context;
+}
+
+void dl_context_destroy (struct DLContext* context)
+{
+    if (context == NULL)
+    {
+        return;
+    }
+    // Copy it first, the context itself comes from the allocator.
+    const struct DLAllocator allocator = context->allocator;
+    if (context->scratch)
+    {
+        allocator.deallocate(allocator.allocator_ctx, context->scratch);
+    }
+    allocator.deallocate(allocator.allocator_ctx, context);
+}
+
+/*
+    Each arena block starts with the offsets of its start and end, so that
+    freeing the last block can move 'used' back to its start.
+*/
+#define DL_ARENA_ALIGNMENT 16
+
+struct DLArenaHeader
+{
+    size_t start;
+    size_t end;
+};
+
+static size_t dl_arena_align (size_t offset)
+{
+    return (offset + DL_ARENA_ALIGNMENT - 1) & ~(size_t)(DL_ARENA_ALIGNMENT - 1);
+}
+
+#define DL_ARENA_HEADER_SIZE (((sizeof(struct DLArenaHeader) + DL_ARENA_ALIGNMENT - 1) / DL_ARENA_ALIGNMENT) * DL_ARENA_ALIGNMENT)
+
+static void* dl_arena_allocate (void* allocator_ctx, size_t size)
+{
+    struct DLArena* arena = (struct DLArena*)allocator_ctx;
+    const size_t start = arena->used;
+    const size_t available = arena->size - start;
+    // The first test avoids overflowing the second.
+    if (size > available || DL_ARENA_HEADER_SIZE + dl_arena_align(size) > available)
+    {
+        return NULL;
+    }
+
+    struct DLArenaHeader header = { start, start + DL_ARENA_HEADER_SIZE + dl_arena_align(size) };
+    memcpy (arena->buffer + start, &header, sizeof(header));
+    arena->used = header.end;
+    if (arena->used > arena->peak)
+    {
+        arena->peak = arena->used;
+    }
+    return arena->buffer + start + DL_ARENA_HEADER_SIZE;
+}
+
+static void dl_arena_deallocate (void* allocator_ctx, void* ptr)
+{
+    struct DLArena* arena = (struct DLArena*)allocator_ctx;
+    struct DLArenaHeader header;
+    memcpy (&header, (unsigned char*)ptr - DL_ARENA_HEADER_SIZE, sizeof(header));
+    if (header.end == arena->used)
+    {
+        arena->used = header.start;
+    }
+}
+
+void dl_arena_init (struct DLArena* arena, void* buffer, size_t size)
+{
+    // Align the start of the buffer too, the blocks are relative to it.
+    const size_t padding = dl_arena_align((uintptr_t)buffer) - (uintptr_t)buffer;
+    arena->buffer = (unsigned char*)buffer + padding;
+    arena->size = size > padding ? size - padding : 0;
+    arena->used = 0;
+    arena->peak = 0;
+}
+
+void dl_arena_reset (struct DLArena* arena)
+{
+    arena->used = 0;
+}
+
+struct DLAllocator dl_arena_allocator (struct DLArena* arena)
+{
+    struct DLAllocator allocator = { dl_arena_allocate, dl_arena_deallocate, arena };
+    return allocator;
+}
+
+/*
+    3D LUTs
+
+    Any simulator is a function of the 8-bit sRGB input only, so it can be
+    baked into a table indexed by the input color. With a 256^3 grid this is
+    a direct lookup of the exact output (48 MB). Smaller grids store the
+    output at regularly spaced sRGB values and interpolate with tetrahedra,
+    as most GPU and video tools do with .cube files.
+
+    Both tables are ordered with red varying fastest, like .cube files.
+*/
+
+struct DLLut3D
+{
+    struct DLContext* context;
+    int gridSize;
+
+    // gridSize == 256
+    unsigned char* direct;
+
+    // Otherwise: sRGB output in [0,255] at the grid points.
+    float* grid;
+    // Lower grid index and interpolation weight for each 8-bit input.
+    int gridIndex[256];
+    float gridFrac[256];
+};
+
+static void dl_lut3d_direct_row (const struct DLLut3D* lut, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width)
+{
+    const size_t pixelSize = layout->pixelSize;
+    for (size_t col = 0; col < width*pixelSize; col += pixelSize)
+    {
+        const unsigned char* px = src + col;
+        const unsigned char* out = lut->direct + 3*(px[layout->r] | (px[layout->g] << 8) | ((size_t)px[layout->b] << 16));
+        dst[col + layout->r] = out[0];
+        dst[col + layout->g] = out[1];
+        dst[col + layout->b] = out[2];
+        if (layout->a >= 0)
+        {
+            dst[col + layout->a] = px[layout->a];
+        }
+    }
+}
+
+static void dl_lut3d_tetrahedral_row (const struct DLLut3D* lut, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width)
+{
+    const size_t dr = 3;
+    const size_t dg = dr*lut->gridSize;
+    const size_t db = dg*lut->gridSize;
+
+    const size_t pixelSize = layout->pixelSize;
+    for (size_t col = 0; col < width*pixelSize; col += pixelSize)
+    {
+        const unsigned char r = src[col + layout->r];
+        const unsigned char g = src[col + layout->g];
+        const unsigned char b = src[col + layout->b];
+        const float fr = lut->gridFrac[r];
+        const float fg = lut->gridFrac[g];
+        const float fb = lut->gridFrac[b];
+        const float* c000 = lut->grid + dr*lut->gridIndex[r] + dg*lut->gridIndex[g] + db*lut->gridIndex[b];
+        const float* c111 = c000 + dr + dg + db;
+
+        // Pick the tetrahedron containing the point: the 2 intermediate
+        // vertices follow the order of the fractional parts.
+        const float* c1;
+        const float* c2;
+        float w0, w1, w2, w3;
+        if (fr > fg)
+        {
+            if (fg > fb)      { c1 = c000 + dr; c2 = c000 + dr + dg; w0 = 1.f - fr; w1 = fr - fg; w2 = fg - fb; w3 = fb; }
+            else if (fr > fb) { c1 = c000 + dr; c2 = c000 + dr + db; w0 = 1.f - fr; w1 = fr - fb; w2 = fb - fg; w3 = fg; }
+            else              { c1 = c000 + db; c2 = c000 + dr + db; w0 = 1.f - fb; w1 = fb - fr; w2 = fr - fg; w3 = fg; }
+        }
+        else
+        {
+            if (fb > fg)      { c1 = c000 + db; c2 = c000 + dg + db; w0 = 1.f - fb; w1 = fb - fg; w2 = fg - fr; w3 = fr; }
+            else if (fb > fr) { c1 = c000 + dg; c2 = c000 + dg + db; w0 = 1.f - fg; w1 = fg - fb; w2 = fb - fr; w3 = fr; }
+            else              { c1 = c000 + dg; c2 = c000 + dr + dg; w0 = 1.f - fg; w1 = fg - fr; w2 = fr - fb; w3 = fb; }
+        }
+
+        // The weights sum to 1, so the result stays in [0,255].
+        const int offsets[3] = { layout->r, layout->g, layout->b };
+        if (layout->a >= 0)
+        {
+            dst[col + layout->a] = src[col + layout->a];
+        }
+        for (int c = 0; c < 3; ++c)
+        {
+            dst[col + offsets[c]] = (unsigned char)(0.5f + w0*c000[c] + w1*c1[c] + w2*c2[c] + w3*c111[c]);
+        }
+    }
+}
+
+static void dl_lut3d_row (const struct DLLut3D* lut, const struct DLPixelLayout* layout, const unsigned char* src, unsigned char* dst, size_t width)
+{
+    if (lut->direct)
+    {
+        dl_lut3d_direct_row(lut, layout, src, dst, width);
+    }
+    else
+    {
+        dl_lut3d_tetrahedral_row(lut, layout, src, dst, width);
+    }
+}
+
+/*
+    Public API
+
+    Each simulation is described by a job that processes a range of rows,
+    either directly on the calling thread or split into bands.
+*/
+
+struct DLSimulationJob
+{
+    const struct DLKernels* kernels;
+
+    // Only one of them is set, depending on the algorithm.
+    const struct DLBrettel1997Params* brettelParams;
+    const float* vienotRgbCvdFromRgb;
+    const struct DLLut3D* lut;
+
+    float severity;
+    // NULL for the wide sample formats, which only support RGBA.
+    const struct DLPixelLayout* layout;
+    enum DLAlphaMode alphaMode;
+    enum DLAccuracy accuracy;
+    enum DLSampleFormat sampleFormat;
+    // Replaces 'severity' when set, see dl_simulate_cvd_severity_map.
+    const struct DLSeverityMap* severityMap;
+    size_t height;
+#if defined(DL_ENABLE_STATS)
+    // Stats of the scope the job was created in, or NULL.
+    struct DLStats* stats;
+#endif
+    const unsigned char* src;
+    unsigned char* dst;
+    size_t width;
+    size_t srcBytesPerRow;
+    size_t dstBytesPerRow;
+};
+
+// Pixels converted at once for the 16-bit sample formats, so the float
+// buffer stays in the L1 cache.
+#define DL_SAMPLES_CHUNK_SIZE 256
+
+static void dl_simulation_job_f32_row (const struct DLSimulationJob* job, const float* src, float* dst, size_t width)
+{
+    if (job->brettelParams)
+    {
+        job->kernels->brettel1997_row_f32(job->brettelParams, job->severity, src, dst, width);
+    }
+    else
+    {
+        job->kernels->vienot1999_row_f32(job->vienotRgbCvdFromRgb, job->severity, src, dst, width);
+    }
+}
+
+static void dl_simulation_job_samples_row (const struct DLSimulationJob* job, const unsigned char* src, unsigned char* dst)
+{
+#if defined(DL_ENABLE_STATS)
+    if (job->stats)
+    {
+        struct DLStats counts = { 0 };
+        counts.numPixels = job->width;
+        counts.kernel = job->kernels->kernel;
+        dl_stats_add(job->stats, &counts);
+    }
+#endif
+
+    if (job->sampleFormat == DLSampleFormat_LinearRGBA32F)
+    {
+        dl_simulation_job_f32_row(job, (const float*)src, (float*)dst, job->width);
+        return;
+    }
+
+    float buffer[4*DL_SAMPLES_CHUNK_SIZE];
+    for (size_t col = 0; col < job->width; col += DL_SAMPLES_CHUNK_SIZE)
+    {
+        const size_t numPixels = job->width - col < DL_SAMPLES_CHUNK_SIZE ? job->width - col : DL_SAMPLES_CHUNK_SIZE;
+        const uint16_t* chunkSrc = (const uint16_t*)src + 4*col;
+        uint16_t* chunkDst = (uint16_t*)dst + 4*col;
+        if (job->sampleFormat == DLSampleFormat_LinearRGBA16F)
+        {
+            job->kernels->float_from_half(chunkSrc, buffer, 4*numPixels);
+            dl_simulation_job_f32_row(job, buffer, buffer, numPixels);
+            job->kernels->half_from_float(buffer, chunkDst, 4*numPixels);
+        }
+        else
+        {
+            dl_decode_sRGB16_pixels(chunkSrc, buffer, numPixels);
+            dl_simulation_job_f32_row(job, buffer, buffer, numPixels);
+            dl_encode_sRGB16_pixels(buffer, chunkDst, numPixels);
+        }
+    }
+}
+
+#if defined(DL_ENABLE_STATS)
+// Replays the scalar path on the input to get the counters, before the
+// kernels overwrite it when processing in place.
+static void dl_simulation_job_count_pixels (const struct DLSimulationJob* job, const unsigned char* src, size_t width)
+{
+    struct DLStats counts = { 0 };
+    counts.numPixels = width;
+    counts.kernel = job->kernels->kernel;
+    const struct DLPixelLayout* layout = job->layout;
+    for (size_t col = 0; col < width && !job->lut; ++col)
+    {
+        float rgb[3], rgb_cvd[3];
+        dl_decode_pixel(layout, src + col*layout->pixelSize, rgb);
+        if (job->brettelParams)
+        {
+            const float* n = job->brettelParams->separationPlaneNormalInRgb;
+            const float dotWithSepPlane = rgb[0]*n[0] + rgb[1]*n[1] + rgb[2]*n[2];
+            if (dotWithSepPlane >= 0)
+                ++counts.numBrettelPlane1;
+            else
+                ++counts.numBrettelPlane2;
+            dl_brettel1997_pixel(job->brettelParams, job->severity, rgb, rgb_cvd);
+        }
+        else
+        {
+            dl_vienot1999_pixel(job->vienotRgbCvdFromRgb, job->severity, rgb, rgb_cvd);
+        }
+        for (int c = 0; c < 3; ++c)
+        {
+            counts.numClippedChannels += (rgb_cvd[c] <= 0.f || rgb_cvd[c] >= 1.f);
+        }
+    }
+    dl_stats_add(job->stats, &counts);
+}
+#endif
+
+static void dl_simulation_job_process_straight (const struct DLSimulationJob* job, const unsigned char* src, unsigned char* dst, size_t width)
+{
+#if defined(DL_ENABLE_STATS)
+    if (job->stats)
+    {
+        dl_simulation_job_count_pixels(job, src, width);
+    }
+#endif
+
+    if (job->lut)
+    {
+        dl_lut3d_row(job->lut, job->layout, src, dst, width);
+    }
+    else if (job->brettelParams)
+    {
+        if (job->accuracy == DLAccuracy_Exact)
+            dl_brettel1997_row_exact(job->brettelParams, job->severity, job->layout, src, dst, width);
+        else if (job->accuracy == DLAccuracy_Fast)
+            job->kernels->brettel1997_row_fast(job->brettelParams, job->severity, job->layout, src, dst, width);
+        else
+            job->kernels->brettel1997_row(job->brettelParams, job->severity, job->layout, src, dst, width);
+    }
+    else
+    {
+        if (job->accuracy == DLAccuracy_Exact)
+            dl_vienot1999_row_exact(job->vienotRgbCvdFromRgb, job->severity, job->layout, src, dst, width);
+        else if (job->accuracy == DLAccuracy_Fast)
+            job->kernels->vienot1999_row_fast(job->vienotRgbCvdFromRgb, job->severity, job->layout, src, dst, width);
+        else
+            job->kernels->vienot1999_row(job->vienotRgbCvdFromRgb, job->severity, job->layout, src, dst, width);
+    }
+}
+
+/*
+    Alpha modes
+
+    Transparent pixels get skipped 16 at a time (64 bytes, one cache line)
+    by OR-ing 64-bit words and testing the alpha bytes, which compilers turn
+    into a couple of vector instructions. The visible runs in between go
+    through the kernels as usual.
+
+    Premultiplied pixels go through a small stack buffer: unpremultiply,
+    simulate, and premultiply again while writing to dst.
+*/
+
+// round(c*a/255) for 8-bit values.
+static inline unsigned char dl_premultiply (unsigned c, unsigned a)
+{
+    const unsigned t = c*a + 128;
+    return (unsigned char)((t + (t >> 8)) >> 8);
+}
+
+// round(c*255/a), clamped for invalid values with c > a. 'a' must be > 0.
+static inline unsigned char dl_unpremultiply (unsigned c, unsigned a)
+{
+    const unsigned v = (c*255 + a/2) / a;
+    return (unsigned char)(v > 255 ? 255 : v);
+}
+
+// Returns the first pixel from 'col' with a non-zero alpha, or 'width'.
+static size_t dl_skip_transparent_pixels (const struct DLPixelLayout* layout, const unsigned char* src, size_t col, size_t width)
+{
+    unsigned char alphaBytes[8] = { 0 };
+    alphaBytes[layout->a] = alphaBytes[layout->a + 4] = 0xff;
+    uint64_t alphaMask;
+    memcpy (&alphaMask, alphaBytes, 8);
+
+    for (; col + 16 <= width; col += 16)
+    {
+        uint64_t words[8];
+        memcpy (words, src + col*4, 64);
+        const uint64_t any = words[0] | words[1] | words[2] | words[3] | words[4] | words[5] | words[6] | words[7];
+        if (any & alphaMask)
+        {
+            break;
+        }
+    }
+
+    while (col < width && src[col*4 + layout->a] == 0)
+    {
+        ++col;
+    }
+    return col;
+}
+
+// Returns the first pixel from 'col' with a zero alpha, or 'width'.
+static size_t dl_skip_visible_pixels (const struct DLPixelLayout* layout, const unsigned char* src, size_t col, size_t width)
+{
+    while (col < width && src[col*4 + layout->a] != 0)
+    {
+        ++col;
+    }
+    return col;
+}
+
+#define DL_PREMULTIPLIED_CHUNK_SIZE 256
+
+static void dl_simulation_job_process_premultiplied (const struct DLSimulationJob* job, const unsigned char* src, unsigned char* dst, size_t width)
+{
+    const struct DLPixelLayout* layout = job->layout;
+    unsigned char buffer[4*DL_PREMULTIPLIED_CHUNK_SIZE];
+    for (size_t col = 0; col < width; col += DL_PREMULTIPLIED_CHUNK_SIZE)
+    {
+        const size_t numPixels = width - col < DL_PREMULTIPLIED_CHUNK_SIZE ? width - col : DL_PREMULTIPLIED_CHUNK_SIZE;
+        const unsigned char* chunkSrc = src + 4*col;
+        unsigned char* chunkDst = dst + 4*col;
+
+        memcpy (buffer, chunkSrc, 4*numPixels);
+        for (size_t i = 0; i < numPixels; ++i)
+        {
+            unsigned char* p = buffer + 4*i;
+            const unsigned a = p[layout->a];
+            if (a != 255)
+            {
+                p[layout->r] = dl_unpremultiply(p[layout->r], a);
+                p[layout->g] = dl_unpremultiply(p[layout->g], a);
+                p[layout->b] = dl_unpremultiply(p[layout->b], a);
+            }
+        }
+
+        dl_simulation_job_process_straight(job, buffer, buffer, numPixels);
+
+        for (size_t i = 0; i < numPixels; ++i)
+        {
+            unsigned char* p = buffer + 4*i;
+            const unsigned a = p[layout->a];
+            if (a != 255)
+            {
+                p[layout->r] = dl_premultiply(p[layout->r], a);
+                p[layout->g] = dl_premultiply(p[layout->g], a);
+                p[layout->b] = dl_premultiply(p[layout->b], a);
+            }
+        }
+        memcpy (chunkDst, buffer, 4*numPixels);
+    }
+}
+
+static void dl_simulation_job_process_visible (const struct DLSimulationJob* job, const unsigned char* src, unsigned char* dst, size_t width)
+{
+    size_t col = 0;
+    while (col < width)
+    {
+        const size_t firstVisible = dl_skip_transparent_pixels(job->layout, src, col, width);
+        if (src != dst && firstVisible > col)
+        {
+            memcpy (dst + 4*col, src + 4*col, 4*(firstVisible - col));
+        }
+
+        col = dl_skip_visible_pixels(job->layout, src, firstVisible, width);
+        if (col > firstVisible)
+        {
+            if (job->alphaMode == DLAlphaMode_Premultiplied)
+            {
+                dl_simulation_job_process_premultiplied(job, src + 4*firstVisible, dst + 4*firstVisible, col - firstVisible);
+            }
+            else
+            {
+                dl_simulation_job_process_straight(job, src + 4*firstVisible, dst + 4*firstVisible, col - firstVisible);
+            }
+        }
+    }
+}
+
+// Processes 'width' pixels in the 8-bit layout of the job.
+static void dl_simulation_job_process_pixels (const struct DLSimulationJob* job, const unsigned char* src, unsigned char* dst, size_t width)
+{
+    if (job->alphaMode == DLAlphaMode_Straight)
+    {
+        dl_simulation_job_process_straight(job, src, dst, width);
+    }
+    else
+    {
+        dl_simulation_job_process_visible(job, src, dst, width);
+    }
+}
+
+// Severities sampled at once from the map, so the buffer stays in the L1
+// cache.
+#define DL_SEVERITY_MAP_CHUNK_SIZE 256
+
+static inline float dl_severity_map_value (const struct DLSeverityMap* map, const unsigned char* mapRow, size_t x)
+{
+    if (map->format == DLSeverityMapFormat_U8)
+    {
+        return mapRow[x] / 255.f;
+    }
+
+    float v;
+    memcpy(&v, mapRow + x*sizeof(float), sizeof(float));
+    // Written so that NaN becomes 0.
+    return v > 0.f ? (v < 1.f ? v : 1.f) : 0.f;
+}
+
+static void dl_simulation_job_severity_map_row (const struct DLSimulationJob* job, size_t row, const unsigned char* src, unsigned char* dst)
+{
+    const struct DLSeverityMap* map = job->severityMap;
+    const size_t valueSize = map->format == DLSeverityMapFormat_U8 ? 1 : sizeof(float);
+    const size_t mapBytesPerRow = map->bytesPerRow ? map->bytesPerRow : map->width*valueSize;
+    const unsigned char* mapRow = (const unsigned char*)map->values + mapBytesPerRow*((row*map->height)/job->height);
+    const size_t pixelSize = job->layout->pixelSize;
+#if defined(DL_ENABLE_STATS)
+    // The clipped channels are counted at full severity.
+    if (job->stats)
+    {
+        dl_simulation_job_count_pixels(job, src, job->width);
+    }
+#endif
+
+    float severities[DL_SEVERITY_MAP_CHUNK_SIZE];
+    for (size_t col = 0; col < job->width; col += DL_SEVERITY_MAP_CHUNK_SIZE)
+    {
+        const size_t numPixels = job->width - col < DL_SEVERITY_MAP_CHUNK_SIZE ? job->width - col : DL_SEVERITY_MAP_CHUNK_SIZE;
+        for (size_t i = 0; i < numPixels; ++i)
+        {
+            severities[i] = dl_severity_map_value(map, mapRow, ((col + i)*map->width)/job->width);
+        }
+
+        const unsigned char* chunkSrc = src + col*pixelSize;
+        unsigned char* chunkDst = dst + col*pixelSize;
+        if (job->brettelParams)
+        {
+            job->kernels->brettel1997_row_map(job->brettelParams, severities, job->layout, chunkSrc, chunkDst, numPixels);
+        }
+        else
+        {
+            // The SIMD kernels always interpolate, so snap to 1 where the
+            // scalar version would skip it.
+            for (size_t i = 0; i < numPixels; ++i)
+            {
+                severities[i] = severities[i] < 0.999f ? severities[i] : 1.f;
+            }
+            job->kernels->vienot1999_row_map(job->vienotRgbCvdFromRgb, severities, job->layout, chunkSrc, chunkDst, numPixels);
+        }
+    }
+}
+
+static void dl_simulation_job_process_rows (void* ctx, size_t firstRow, size_t endRow)
+{
+    const struct DLSimulationJob* job = (const struct DLSimulationJob*)ctx;
+#if defined(DL_ENABLE_STATS)
+    struct DLZone zone;
+    dl_zone_begin(&zone, "dl_rows", job->stats);
+#endif
+    for (size_t row = firstRow; row < endRow; ++row)
+    {
+        const unsigned char* srcRow = job->src + job->srcBytesPerRow*row;
+        unsigned char* dstRow = job->dst + job->dstBytesPerRow*row;
+        if (job->layout == NULL)
+        {
+            dl_simulation_job_samples_row(job, srcRow, dstRow);
+        }
+        else if (job->severityMap)
+        {
+            dl_simulation_job_severity_map_row(job, row, srcRow, dstRow);
+        }
+        else
+        {
+            dl_simulation_job_process_pixels(job, srcRow, dstRow, job->width);
+        }
+    }
+#if defined(DL_ENABLE_STATS)
+    dl_zone_end(&zone);
+#endif
+}
+
+static void dl_simulation_job_init_format (struct DLSimulationJob* job, enum DLPixelFormat format, float severity, const unsigned char* src, unsigned char* dst, size_t width, size_t srcBytesPerRow, size_t dstBytesPerRow)
+{
+    job->layout = &dl_pixel_layouts[format];
+    job->alphaMode = DLAlphaMode_Straight;
+    job->accuracy = DLAccuracy_Default;
+    job->severityMap = NULL;
+    job->height = 0;
+#if defined(DL_ENABLE_STATS)
+    job->stats = dl_current_stats;
+#endif
+
+    // Compute a default bytesPerRow if it wasn't specified.
+    if (srcBytesPerRow == 0)
+    {
+        srcBytesPerRow = width * job->layout->pixelSize;
+    }
+    if (dstBytesPerRow == 0)
+    {
+        dstBytesPerRow = width * job->layout->pixelSize;
+    }
+
+    job->kernels = dl_get_kernels();
+    job->sampleFormat = DLSampleFormat_LinearRGBA32F;
+    job->brettelParams = NULL;
+    job->vienotRgbCvdFromRgb = NULL;
+    job->lut = NULL;
+    job->severity = severity;
+    job->src = src;
+    job->dst = dst;
+    job->width = width;
+    job->srcBytesPerRow = srcBytesPerRow;
+    job->dstBytesPerRow = dstBytesPerRow;
+}
+
+static void dl_simulation_job_init (struct DLSimulationJob* job, float severity, const unsigned char* srgba_src, unsigned char* srgba_dst, size_t width, size_t srcBytesPerRow, size_t dstBytesPerRow)
+{
+    dl_simulation_job_init_format(job, DLPixelFormat_RGBA32, severity, srgba_src, srgba_dst, width, srcBytesPerRow, dstBytesPerRow);
+}
+
+static int dl_is_valid_sample_format (enum DLSampleFormat format)
+{
+    return format >= DLSampleFormat_LinearRGBA32F && format <= DLSampleFormat_sRGBA16;
+}
+
+static void dl_simulation_job_init_samples (struct DLSimulationJob* job, enum DLSampleFormat format, float severity, const void* src, void* dst, size_t width, size_t srcBytesPerRow, size_t dstBytesPerRow)
+{
+    const size_t pixelSize = format == DLSampleFormat_LinearRGBA32F ? 4*sizeof(float) : 4*sizeof(uint16_t);
+    if (srcBytesPerRow == 0)
+    {
+        srcBytesPerRow = width * pixelSize;
+    }
+    if (dstBytesPerRow == 0)
+    {
+        dstBytesPerRow = width * pixelSize;
+    }
+
+    dl_simulation_job_init(job, severity, (const unsigned char*)src, (unsigned char*)dst, width, srcBytesPerRow, dstBytesPerRow);
+    job->layout = NULL;
+    job->sampleFormat = format;
+}
+
+static void dl_simulation_job_set_brettel1997 (struct DLSimulationJob* job, enum DLDeficiency deficiency)
+{
+    switch (deficiency)
+    {
+        case DLDeficiency_Protan: job->brettelParams = &brettel_protan_params; break;
+        case DLDeficiency_Deutan: job->brettelParams = &brettel_deutan_params; break;
+        case DLDeficiency_Tritan: job->brettelParams = &brettel_tritan_params; break;
+    }
+}
+
+static void dl_simulation_job_set_vienot1999 (struct DLSimulationJob* job, enum DLDeficiency deficiency)
+{
+    switch (deficiency)
+    {
+        case DLDeficiency_Protan: job->vienotRgbCvdFromRgb = dl_vienot_protan_rgbCvd_from_rgb; break;
+        case DLDeficiency_Deutan: job->vienotRgbCvdFromRgb = dl_vienot_deutan_rgbCvd_from_rgb; break;
+        case DLDeficiency_Tritan: job->vienotRgbCvdFromRgb = dl_vienot_tritan_rgbCvd_from_rgb; break;
+    }
+}
+
+// Returns 0 if the algorithm or the deficiency is invalid.
+static int dl_simulation_job_set_algorithm (struct DLSimulationJob* job, enum DLAlgorithm algorithm, enum DLDeficiency deficiency)
+{
+    if (algorithm == DLAlgorithm_Auto)
+    {
+        algorithm = (deficiency == DLDeficiency_Tritan) ? DLAlgorithm_Brettel1997 : DLAlgorithm_Vienot1999;
+    }
+
+    switch (algorithm)
+    {
+        case DLAlgorithm_Brettel1997: dl_simulation_job_set_brettel1997(job, deficiency); break;
+        case DLAlgorithm_Vienot1999: dl_simulation_job_set_vienot1999(job, deficiency); break;
+        default: break;
+    }
+
+    return job->brettelParams != NULL || job->vienotRgbCvdFromRgb != NULL;
+}
+
+void dl_simulate_cvd_brettel1997 (enum DLDeficiency deficiency, float severity, unsigned char* srgba_image, size_t width, size_t height, size_t bytesPerRow)
+{
+    dl_simulate_cvd_brettel1997_to(deficiency, severity, srgba_image, srgba_image, width, height, bytesPerRow, bytesPerRow);
+}
+
+void dl_simulate_cvd_vienot1999 (enum DLDeficiency deficiency, float severity, unsigned char* srgba_image, size_t width, size_t height, size_t bytesPerRow)
+{
+    dl_simulate_cvd_vienot1999_to(deficiency, severity, srgba_image, srgba_image, width, height, bytesPerRow, bytesPerRow);
+}
+
+void dl_simulate_cvd_brettel1997_to (enum DLDeficiency deficiency, float severity, const unsigned char* srgba_src, unsigned char* srgba_dst, size_t width, size_t height, size_t srcBytesPerRow, size_t dstBytesPerRow)
+{
+    struct DLSimulationJob job;
+    dl_simulation_job_init(&job, severity, srgba_src, srgba_dst, width, srcBytesPerRow, dstBytesPerRow);
+    dl_simulation_job_set_brettel1997(&job, deficiency);
+    dl_simulation_job_process_rows(&job, 0, height);
+}
+
+void dl_simulate_cvd_vienot1999_to (enum DLDeficiency deficiency, float severity, const unsigned char* srgba_src, unsigned char* srgba_dst, size_t width, size_t height, size_t srcBytesPerRow, size_t dstBytesPerRow)
+{
+    struct DLSimulationJob job;
+    dl_simulation_job_init(&job, severity, srgba_src, srgba_dst, width, srcBytesPerRow, dstBytesPerRow);
+    dl_simulation_job_set_vienot1999(&job, deficiency);
+    dl_simulation_job_process_rows(&job, 0, height);
+}
+
+void dl_simulate_cvd_brettel1997_mt (enum DLDeficiency deficiency, float severity, unsigned char* srgba_image, size_t width, size_t height, size_t bytesPerRow, int num_threads)
+{
+    struct DLSimulationJob job;
+    dl_simulation_job_init(&job, severity, srgba_image, srgba_image, width, bytesPerRow, bytesPerRow);
+    dl_simulation_job_set_brettel1997(&job, deficiency);
+    dl_parallel_for_rows(dl_simulation_job_process_rows, &job, width, height, num_threads);
+}
+
+void dl_simulate_cvd_vienot1999_mt (enum DLDeficiency deficiency, float severity, unsigned char* srgba_image, size_t width, size_t height, size_t bytesPerRow, int num_threads)
+{
+    struct DLSimulationJob job;
+    dl_simulation_job_init(&job, severity, srgba_image, srgba_image, width, bytesPerRow, bytesPerRow);
+    dl_simulation_job_set_vienot1999(&job, deficiency);
+    dl_parallel_for_rows(dl_simulation_job_process_rows, &job, width, height, num_threads);
+}
+
+/*
+    Simulator with the severity already folded into the matrices. Since
+    both the transform and the severity interpolation are linear:
+
+        severity*(M*rgb) + (1-severity)*rgb == (severity*M + (1-severity)*I)*rgb
+
+    so the kernels can be called with a severity of 1 and skip the
+    interpolation. For Brettel 1997 the separation plane is unchanged and
+    both half-plane matrices get folded.
+*/
+struct DLSimulator
+{
+    // Only one of them is used, depending on the algorithm.
+    struct DLBrettel1997Params brettelParams;
+    float vienotRgbCvdFromRgb[9];
+    int useBrettel;
+    enum DLAccuracy accuracy;
+    // Where it was allocated, unused for the copies on the stack.
+    struct DLContext* context;
+};
+
+static void dl_fold_severity (const float* rgbCvd_from_rgb, float severity, float* folded)
+{
+    for (int i = 0; i < 9; ++i)
+    {
+        const float identity = (i % 4 == 0) ? 1.f : 0.f;
+        folded[i] = severity*rgbCvd_from_rgb[i] + (1.f - severity)*identity;
+    }
+}
+
+static int dl_simulator_init (struct DLSimulator* simulator, enum DLAlgorithm algorithm, enum DLDeficiency deficiency, float severity)
+{
+    if (algorithm == DLAlgorithm_Auto)
+    {
+        algorithm = (deficiency == DLDeficiency_Tritan) ? DLAlgorithm_Brettel1997 : DLAlgorithm_Vienot1999;
+    }
+
+    // The job helpers only use the parameter they set, a temporary job is
+    // just a convenient way to map the deficiency to the parameters.
+    struct DLSimulationJob job;
+    job.brettelParams = NULL;
+    job.vienotRgbCvdFromRgb = NULL;
+    switch (algorithm)
+    {
+        case DLAlgorithm_Brettel1997: dl_simulation_job_set_brettel1997(&job, deficiency); break;
+        case DLAlgorithm_Vienot1999: dl_simulation_job_set_vienot1999(&job, deficiency); break;
+        default: break;
+    }
+
+    if (job.brettelParams == NULL && job.vienotRgbCvdFromRgb == NULL)
+    {
+        return 0;
+    }
+
+    simulator->accuracy = DLAccuracy_Default;
+    simulator->context = NULL;
+    simulator->useBrettel = job.brettelParams != NULL;
+    if (simulator->useBrettel)
+    {
+        dl_fold_severity(job.brettelParams->rgbCvdFromRgb_1, severity, simulator->brettelParams.rgbCvdFromRgb_1);
+        dl_fold_severity(job.brettelParams->rgbCvdFromRgb_2, severity, simulator->brettelParams.rgbCvdFromRgb_2);
+        memcpy(simulator->brettelParams.separationPlaneNormalInRgb, job.brettelParams->separationPlaneNormalInRgb, sizeof(float)*3);
+    }
+    else
+    {
+        dl_fold_severity(job.vienotRgbCvdFromRgb, severity, simulator->vienotRgbCvdFromRgb);
+    }
+    return 1;
+}
+
+static struct DLSimulator* dl_context_copy_simulator (struct DLContext* context, const struct DLSimulator* params)
+{
+    struct DLSimulator* simulator = (struct DLSimulator*)dl_context_allocate(context, sizeof(struct DLSimulator));
+    if (simulator != NULL)
+    {
+        *simulator = *params;
+        simulator->context = context;
+    }
+    return simulator;
+}
+
+struct DLSimulator* dl_simulator_create (enum DLAlgorithm algorithm, enum DLDeficiency deficiency, float severity)
+{
+    return dl_context_create_simulator(NULL, algorithm, deficiency, severity);
+}
+
+struct DLSimulator* dl_context_create_simulator (struct DLContext* context, enum DLAlgorithm algorithm, enum DLDeficiency deficiency, float severity)
+{
+    struct DLSimulator params;
+    if (!dl_simulator_init(&params, algorithm, deficiency, severity))
+    {
+        return NULL;
+    }
+    return dl_context_copy_simulator(context, &params);
+}
+
+/*
+    Daltonization, following Fidaner et al. (2005): the difference between
+    the image and its simulation is the information that gets lost, and it
+    is shifted to the channels that the dichromat can still see:
+
+        rgb_corrected = rgb + errorShift * (rgb - rgb_cvd)
+
+    Since rgb_cvd is a linear function of rgb (piecewise for Brettel), the
+    whole correction is also one, so it is folded into the matrices of a
+    simulator and runs through the exact same kernels:
+
+        rgbCorrected_from_rgb = I + errorShift * (I - rgbCvd_from_rgb)
+
+    The severity is applied to the simulation first, so a severity of 0
+    leaves the image unchanged. Unlike the original, which worked on the
+    sRGB values, this is done in linear RGB like the simulations.
+*/
+
+// Indexed by DLDeficiency. The lost red-green contrast goes to green and
+// blue for protans and deutans, and the lost blue-yellow contrast to red
+// and green for tritans.
+static const float dl_daltonize_error_shift[3][9] = {
+    {
+        0.0f, 0.0f, 0.0f,
+        0.7f, 1.0f, 0.0f,
+        0.7f, 0.0f, 1.0f,
+    },
+    {
+        0.0f, 0.0f, 0.0f,
+        0.7f, 1.0f, 0.0f,
+        0.7f, 0.0f, 1.0f,
+    },
+    {
+        1.0f, 0.0f, 0.7f,
+        0.0f, 1.0f, 0.7f,
+        0.0f, 0.0f, 0.0f,
+    },
+};
+
+static void dl_fold_daltonization (const float* errorShift, float* rgbCvd_from_rgb)
+{
+    // loss = I - rgbCvd_from_rgb
+    float loss[9];
+    for (int i = 0; i < 9; ++i)
+    {
+        const float identity = (i % 4 == 0) ? 1.f : 0.f;
+        loss[i] = identity - rgbCvd_from_rgb[i];
+    }
+
+    // rgbCorrected_from_rgb = I + errorShift * loss
+    for (int row = 0; row < 3; ++row)
+    for (int col = 0; col < 3; ++col)
+    {
+        const float identity = (row == col) ? 1.f : 0.f;
+        rgbCvd_from_rgb[row*3 + col] = identity
+                                       + errorShift[row*3 + 0]*loss[0*3 + col]
+                                       + errorShift[row*3 + 1]*loss[1*3 + col]
+                                       + errorShift[row*3 + 2]*loss[2*3 + col];
+    }
+}
+
+static int dl_daltonizer_init (struct DLSimulator* daltonizer, enum DLAlgorithm algorithm, enum DLDeficiency deficiency, float severity)
+{
+    if (!dl_simulator_init(daltonizer, algorithm, deficiency, severity))
+    {
+        return 0;
+    }
+
+    const float* errorShift = dl_daltonize_error_shift[deficiency];
+    if (daltonizer->useBrettel)
+    {
+        // The separation plane is still the one of the simulation.
+        dl_fold_daltonization(errorShift, daltonizer->brettelParams.rgbCvdFromRgb_1);
+        dl_fold_daltonization(errorShift, daltonizer->brettelParams.rgbCvdFromRgb_2);
+    }
+    else
+    {
+        dl_fold_daltonization(errorShift, daltonizer->vienotRgbCvdFromRgb);
+    }
+    return 1;
+}
+
+struct DLSimulator* dl_daltonizer_create (enum DLAlgorithm algorithm, enum DLDeficiency deficiency, float severity)
+{
+    return dl_context_create_daltonizer(NULL, algorithm, deficiency, severity);
+}
+
+struct DLSimulator* dl_context_create_daltonizer (struct DLContext* context, enum DLAlgorithm algorithm, enum DLDeficiency deficiency, float severity)
+{
+    struct DLSimulator params;
+    if (!dl_daltonizer_init(&params, algorithm, deficiency, severity))
+    {
+        return NULL;
+    }
+    return dl_context_copy_simulator(context, &params);
+}
+
+void dl_simulator_destroy (struct DLSimulator* simulator)
+{
+    if (simulator != NULL)
+    {
+        dl_context_deallocate(simulator->context, simulator);
+    }
+}
+
+int dl_simulator_set_accuracy (struct DLSimulator* simulator, enum DLAccuracy accuracy)
+{
+    switch (accuracy)
+    {
+        case DLAccuracy_Default:
+        case DLAccuracy_Exact:
+        case DLAccuracy_Fast:
+            simulator->accuracy = accuracy;
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static void dl_simulation_job_set_simulator (struct DLSimulationJob* job, const struct DLSimulator* simulator)
+{
+    // The severity is already in the matrices.
+    job->severity = 1.f;
+    job->accuracy = simulator->accuracy;
+    if (simulator->useBrettel)
+    {
+        job->brettelParams = &simulator->brettelParams;
+    }
+    else
+    {
+        job->vienotRgbCvdFromRgb = simulator->vienotRgbCvdFromRgb;
+    }
+}
+
+void dl_simulator_apply (const struct DLSimulator* simulator, unsigned char* srgba_image, size_t width, size_t height, size_t bytesPerRow)
+{
+    dl_simulator_apply_to(simulator, srgba_image, srgba_image, width, height, bytesPerRow, bytesPerRow);
+}
+
+void dl_simulator_apply_to (const struct DLSimulator* simulator, const unsigned char* srgba_src, unsigned char* srgba_dst, size_t width, size_t height, size_t srcBytesPerRow, size_t dstBytesPerRow)
+{
+    struct DLSimulationJob job;
+    dl_simulation_job_init(&job, 1.f, srgba_src, srgba_dst, width, srcBytesPerRow, dstBytesPerRow);
+    dl_simulation_job_set_simulator(&job, simulator);
+    dl_simulation_job_process_rows(&job, 0, height);
+}
+
+void dl_simulator_apply_mt (const struct DLSimulator* simulator, unsigned char* srgba_image, size_t width, size_t height, size_t bytesPerRow, int num_threads)
+{
+    struct DLSimulationJob job;
+    dl_simulation_job_init(&job, 1.f, srgba_image, srgba_image, width, bytesPerRow, bytesPerRow);
+    dl_simulation_job_set_simulator(&job, simulator);
+    dl_parallel_for_rows(dl_simulation_job_process_rows, &job, width, height, num_threads);
+}
+
+void dl_daltonize (enum DLDeficiency deficiency, float severity, unsigned char* srgba_image, size_t width, size_t height, size_t bytesPerRow)
+{
+    dl_daltonize_to(deficiency, severity, srgba_image, srgba_image, width, height, bytesPerRow, bytesPerRow);
+}
+
+void dl_daltonize_to (enum DLDeficiency deficiency, float severity, const unsigned char* srgba_src, unsigned char* srgba_dst, size_t width, size_t height, size_t srcBytesPerRow, size_t dstBytesPerRow)
+{
+    struct DLSimulator daltonizer;
+    if (dl_daltonizer_init(&daltonizer, DLAlgorithm_Auto, deficiency, severity))
+    {
+        dl_simulator_apply_to(&daltonizer, srgba_src, srgba_dst, width, height, srcBytesPerRow, dstBytesPerRow);
+    }
+}
+
+void dl_daltonize_mt (enum DLDeficiency deficiency, float severity, unsigned char* srgba_image, size_t width, size_t height, size_t bytesPerRow, int num_threads)
+{
+    struct DLSimulator daltonizer;
+    if (dl_daltonizer_init(&daltonizer, DLAlgorithm_Auto, deficiency, severity))
+    {
+        dl_simulator_apply_mt(&daltonizer, srgba_image, width, height, bytesPerRow, num_threads);
+    }
+}
+
+/*
+    Batches are seen as a single image of width 1 whose rows are all the
+    pixels of all the images, so dl_parallel_for_rows balances the bands by
+    pixel count. Each band then gets mapped back to spans of rows.
+*/
+struct DLBatchJob
+{
+    const struct DLSimulator* simulator;
+    const struct DLBatchImage* images;
+    // Index of the first pixel of each image in the batch, plus the total.
+    const size_t* firstPixels;
+    size_t numImages;
+#if defined(DL_ENABLE_STATS)
+    struct DLStats* stats;
+#endif
+};
+
+static void dl_batch_job_process_pixels (void* ctx, size_t firstPixel, size_t endPixel)
+{
+    const struct DLBatchJob* batch = (const struct DLBatchJob*)ctx;
+#if defined(DL_ENABLE_STATS)
+    struct DLZone zone;
+    dl_zone_begin(&zone, "dl_batch", batch->stats);
+#endif
+
+    // Last image starting at or before firstPixel. Empty images share the
+    // index of the next one, so this skips them.
+    size_t imageIdx = 0;
+    size_t endIdx = batch->numImages;
+    while (endIdx - imageIdx > 1)
+    {
+        const size_t midIdx = imageIdx + (endIdx - imageIdx) / 2;
+        if (batch->firstPixels[midIdx] <= firstPixel)
+        {
+            imageIdx = midIdx;
+        }
+        else
+        {
+            endIdx = midIdx;
+        }
+    }
+
+    for (; firstPixel < endPixel; ++imageIdx)
+    {
+        const struct DLBatchImage* image = &batch->images[imageIdx];
+        const size_t imageEnd = batch->firstPixels[imageIdx + 1];
+        if (firstPixel >= imageEnd)
+        {
+            continue;
+        }
+
+        struct DLSimulationJob job;
+        if (image->srgba_dst)
+        {
+            dl_simulation_job_init(&job, 1.f, image->srgba_src, image->srgba_dst, image->width, image->srcBytesPerRow, image->dstBytesPerRow);
+        }
+        else
+        {
+            unsigned char* srgba_image = (unsigned char*)image->srgba_src;
+            dl_simulation_job_init(&job, 1.f, srgba_image, srgba_image, image->width, image->srcBytesPerRow, image->srcBytesPerRow);
+        }
+        dl_simulation_job_set_simulator(&job, batch->simulator);
+#if defined(DL_ENABLE_STATS)
+        // The job may be initialized on a worker, outside of the scope.
+        job.stats = batch->stats;
+#endif
+
+        size_t first = firstPixel - batch->firstPixels[imageIdx];
+        const size_t end = (endPixel < imageEnd ? endPixel : imageEnd) - batch->firstPixels[imageIdx];
+        firstPixel += end - first;
+
+        // The band can start and end in the middle of rows.
+        size_t row = first / image->width;
+        const size_t col = first % image->width;
+        if (col > 0)
+        {
+            const size_t numPixels = (end - first < image->width - col) ? end - first : image->width - col;
+            dl_simulation_job_process_pixels(&job, job.src + row*job.srcBytesPerRow + col*4, job.dst + row*job.dstBytesPerRow + col*4, numPixels);
+            first += numPixels;
+            ++row;
+        }
+
+        const size_t endRow = end / image->width;
+        if (first < end && row < endRow)
+        {
+            for (; row < endRow; ++row)
+            {
+                dl_simulation_job_process_pixels(&job, job.src + row*job.srcBytesPerRow, job.dst + row*job.dstBytesPerRow, image->width);
+            }
+            first = endRow * image->width;
+        }
+
+        if (first < end)
+        {
+            dl_simulation_job_process_pixels(&job, job.src + endRow*job.srcBytesPerRow, job.dst + endRow*job.dstBytesPerRow, end - first);
+        }
+    }
+#if defined(DL_ENABLE_STATS)
+    dl_zone_end(&zone);
+#endif
+}
+
+int dl_simulator_apply_batch (const struct DLSimulator* simulator, const struct DLBatchImage* images, size_t numImages, int num_threads)
+{
+    return dl_context_apply_batch(NULL, simulator, images, numImages, num_threads);
+}
+
+int dl_context_apply_batch (struct DLContext* context, const struct DLSimulator* simulator, const struct DLBatchImage* images, size_t numImages, int num_threads)
+{
+    size_t* firstPixels = (size_t*)dl_context_acquire_scratch(context, (numImages + 1) * sizeof(size_t));
+    if (firstPixels == NULL)
+    {
+        return 0;
+    }
+
+    firstPixels[0] = 0;
+    for (size_t i = 0; i < numImages; ++i)
+    {
+        firstPixels[i + 1] = firstPixels[i] + images[i].width * images[i].height;
+    }
+
+    struct DLBatchJob batch = { 0 };
+    batch.simulator = simulator;
+    batch.images = images;
+    batch.firstPixels = firstPixels;
+    batch.numImages = numImages;
+#if defined(DL_ENABLE_STATS)
+    batch.stats = dl_current_stats;
+#endif
+    dl_parallel_for_rows(dl_batch_job_process_pixels, (void*)&batch, 1, firstPixels[numImages], num_threads);
+    dl_context_release_scratch(context, firstPixels);
+    return 1;
+}
+
+static int dl_is_valid_pixel_format (enum DLPixelFormat format)
+{
+    return format >= 0 && (size_t)format < sizeof(dl_pixel_layouts)/sizeof(dl_pixel_layouts[0]);
+}
+
+int dl_simulator_apply_format (const struct DLSimulator* simulator, enum DLPixelFormat format, const unsigned char* src, unsigned char* dst, size_t width, size_t height, size_t srcBytesPerRow, size_t dstBytesPerRow)
+{
+    if (!dl_is_valid_pixel_format(format))
+    {
+        return 0;
+    }
+
+    struct DLSimulationJob job;
+    dl_simulation_job_init_format(&job, format, 1.f, src, dst, width, srcBytesPerRow, dstBytesPerRow);
+    dl_simulation_job_set_simulator(&job, simulator);
+    dl_simulation_job_process_rows(&job, 0, height);
+    return 1;
+}
+
+// The alpha modes need a real alpha channel, RGBX32 only has padding.
+static int dl_is_valid_alpha_mode (enum DLPixelFormat format, enum DLAlphaMode alphaMode)
+{
+    switch (alphaMode)
+    {
+        case DLAlphaMode_Straight:
+            return 1;
+        case DLAlphaMode_SkipTransparent:
+        case DLAlphaMode_Premultiplied:
+            return format == DLPixelFormat_RGBA32 || format == DLPixelFormat_BGRA32 || format == DLPixelFormat_ARGB32;
+        default:
+            return 0;
+    }
+}
+
+int dl_simulator_apply_alpha (const struct DLSimulator* simulator, enum DLPixelFormat format, enum DLAlphaMode alphaMode, const unsigned char* src, unsigned char* dst, size_t width, size_t height, size_t srcBytesPerRow, size_t dstBytesPerRow)
+{
+    if (!dl_is_valid_pixel_format(format) || !dl_is_valid_alpha_mode(format, alphaMode))
+    {
+        return 0;
+    }
+
+    struct DLSimulationJob job;
+    dl_simulation_job_init_format(&job, format, 1.f, src, dst, width, srcBytesPerRow, dstBytesPerRow);
+    dl_simulation_job_set_simulator(&job, simulator);
+    job.alphaMode = alphaMode;
+    dl_simulation_job_process_rows(&job, 0, height);
+    return 1;
+}
+
+int dl_simulator_apply_samples (const struct DLSimulator* simulator, enum DLSampleFormat format, const void* src, void* dst, size_t width, size_t height, size_t srcBytesPerRow, size_t dstBytesPerRow)
+{
+    if (!dl_is_valid_sample_format(format))
+    {
+        return 0;
+    }
+
+    struct DLSimulationJob job;
+    dl_simulation_job_init_samples(&job, format, 1.f, src, dst, width, srcBytesPerRow, dstBytesPerRow);
+    dl_simulation_job_set_simulator(&job, simulator);
+    dl_simulation_job_process_rows(&job, 0, height);
+    return 1;
+}
+
+/*
+    Streams keep their own copy of the simulator and a job with everything
+    resolved once, so pushing rows only has to set the buffers.
+*/
+struct DLStream
+{
+    struct DLContext* context;
+    struct DLSimulator simulator;
+    struct DLSimulationJob job;
+    size_t rowsPushed;
+};
+
+struct DLStream* dl_stream_begin (const struct DLSimulator* simulator, enum DLPixelFormat format, size_t width)
+{
+    return dl_context_begin_stream(NULL, simulator, format, width);
+}
+
+struct DLStream* dl_context_begin_stream (struct DLContext* context, const struct DLSimulator* simulator, enum DLPixelFormat format, size_t width)
+{
+    if (!dl_is_valid_pixel_format(format))
+    {
+        return NULL;
+    }
+
+    struct DLStream* stream = (struct DLStream*)dl_context_allocate(context, sizeof(struct DLStream));
+    if (stream == NULL)
+    {
+        return NULL;
+    }
+
+    memset (stream, 0, sizeof(struct DLStream));
+    stream->context = context;
+    stream->simulator = *simulator;
+    dl_simulation_job_init_format(&stream->job, format, 1.f, NULL, NULL, width, 0, 0);
+    dl_simulation_job_set_simulator(&stream->job, &stream->simulator);
+    return stream;
+}
+
+void dl_stream_push_rows (struct DLStream* stream, unsigned char* rows, size_t numRows, size_t bytesPerRow)
+{
+    dl_stream_push_rows_to(stream, rows, rows, numRows, bytesPerRow, bytesPerRow);
+}
+
+void dl_stream_push_rows_to (struct DLStream* stream, const unsigned char* src, unsigned char* dst, size_t numRows, size_t srcBytesPerRow, size_t dstBytesPerRow)
+{
+    struct DLSimulationJob* job = &stream->job;
+    const size_t packedBytesPerRow = job->width * job->layout->pixelSize;
+    job->src = src;
+    job->dst = dst;
+    job->srcBytesPerRow = srcBytesPerRow ? srcBytesPerRow : packedBytesPerRow;
+    job->dstBytesPerRow = dstBytesPerRow ? dstBytesPerRow : packedBytesPerRow;
+#if defined(DL_ENABLE_STATS)
+    // Pushes can happen outside of the scope where the stream was created.
+    job->stats = dl_current_stats;
+#endif
+    dl_simulation_job_process_rows(job, 0, numRows);
+    stream->rowsPushed += numRows;
+}
+
+size_t dl_stream_rows_pushed (const struct DLStream* stream)
+{
+    return stream->rowsPushed;
+}
+
+size_t dl_stream_end (struct DLStream* stream)
+{
+    const size_t rowsPushed = stream->rowsPushed;
+    dl_context_deallocate(stream->context, stream);
+    return rowsPushed;
+}
+
+/*
+    Memoization of the simulator output per 24-bit color, for images with
+    few distinct colors like UI screenshots. Consecutive identical pixels
+    reuse the previous result directly, and other colors are looked up in a
+    small open-addressing hash table. Misses are computed with the scalar
+    code, which gives the same output as the SIMD kernels.
+*/
+
+// 4096 entries, 32 KB on the stack.
+#define DL_COLOR_CACHE_BITS 12
+
+// Give up and overwrite the first slot after that many probes.
+#define DL_COLOR_CACHE_MAX_PROBES 8
+
+struct DLColorCache
+{
+    // Packed input RGB with bit 24 set, 0 for empty slots.
+    uint32_t keys[1 << DL_COLOR_CACHE_BITS];
+    // Packed output RGB.
+    uint32_t values[1 << DL_COLOR_CACHE_BITS];
+};
+
+static uint32_t dl_simulator_pixel_packed (const struct DLSimulator* simulator, uint32_t srgb)
+{
+    const float rgb[3] = {
+        linearRGB_from_sRGB(srgb & 0xff),
+        linearRGB_from_sRGB((srgb >> 8) & 0xff),
+        linearRGB_from_sRGB((srgb >> 16) & 0xff)
+    };
+
+    float rgb_cvd[3];
+    if (simulator->useBrettel)
+    {
+        dl_brettel1997_pixel(&simulator->brettelParams, 1.f, rgb, rgb_cvd);
+    }
+    else
+    {
+        dl_vienot1999_pixel(simulator->vienotRgbCvdFromRgb, 1.f, rgb, rgb_cvd);
+    }
+
+    return dl_sRGB_from_linearRGB_accuracy(rgb_cvd[0], simulator->accuracy)
+        | (dl_sRGB_from_linearRGB_accuracy(rgb_cvd[1], simulator->accuracy) << 8)
+        | ((uint32_t)dl_sRGB_from_linearRGB_accuracy(rgb_cvd[2], simulator->accuracy) << 16);
+}
+
+static uint32_t dl_color_cache_lookup (struct DLColorCache* cache, const struct DLSimulator* simulator, uint32_t srgb, size_t* numHits)
+{
+    const uint32_t mask = (1 << DL_COLOR_CACHE_BITS) - 1;
+    const uint32_t key = srgb | (1 << 24);
+    const uint32_t home = (srgb * 2654435761u) >> (32 - DL_COLOR_CACHE_BITS);
+
+    uint32_t slot = home;
+    for (int probe = 0; probe < DL_COLOR_CACHE_MAX_PROBES; ++probe, slot = (slot + 1) & mask)
+    {
+        if (cache->keys[slot] == key)
+        {
+            ++*numHits;
+            return cache->values[slot];
+        }
+
+        if (cache->keys[slot] == 0)
+        {
+            break;
+        }
+    }
+
+    // Not found: use the first empty slot, or evict the home one.
+    if (cache->keys[slot] != 0)
+    {
+        slot = home;
+    }
+    cache->keys[slot] = key;
+    cache->values[slot] = dl_simulator_pixel_packed(simulator, srgb);
+    return cache->values[slot];
+}
+
+void dl_simulator_apply_cached_to (const struct DLSimulator* simulator, const unsigned char* srgba_src, unsigned char* srgba_dst, size_t width, size_t height, size_t srcBytesPerRow, size_t dstBytesPerRow, struct DLCacheStats* stats)
+{
+    if (srcBytesPerRow == 0)
+    {
+        srcBytesPerRow = width * 4;
+    }
+    if (dstBytesPerRow == 0)
+    {
+        dstBytesPerRow = width * 4;
+    }
+
+    struct DLColorCache cache;
+    memset (cache.keys, 0, sizeof(cache.keys));
+
+    size_t numHits = 0;
+    for (size_t row = 0; row < height; ++row)
+    {
+        const unsigned char* src = srgba_src + srcBytesPerRow*row;
+        unsigned char* dst = srgba_dst + dstBytesPerRow*row;
+
+        // Never matches a packed 24-bit color.
+        uint32_t lastSrgb = 0xffffffff;
+        uint32_t lastOutput = 0;
+        for (size_t col = 0; col < width*4; col += 4)
+        {
+            const uint32_t srgb = src[col + 0] | (src[col + 1] << 8) | ((uint32_t)src[col + 2] << 16);
+            if (srgb == lastSrgb)
+            {
+                ++numHits;
+            }
+            else
+            {
+                lastSrgb = srgb;
+                lastOutput = dl_color_cache_lookup(&cache, simulator, srgb, &numHits);
+            }
+
+            const unsigned char alpha = src[col + 3];
+            dst[col + 0] = lastOutput & 0xff;
+            dst[col + 1] = (lastOutput >> 8) & 0xff;
+            dst[col + 2] = (lastOutput >> 16) & 0xff;
+            dst[col + 3] = alpha;
+        }
+    }
+
+    if (stats)
+    {
+        stats->numPixels = width * height;
+        stats->numHits = numHits;
+    }
+
+#if defined(DL_ENABLE_STATS)
+    if (dl_current_stats)
+    {
+        struct DLStats counts = { 0 };
+        counts.numPixels = width * height;
+        dl_stats_add(dl_current_stats, &counts);
+    }
+#endif
+}
+
+void dl_simulator_apply_cached (const struct DLSimulator* simulator, unsigned char* srgba_image, size_t width, size_t height, size_t bytesPerRow, struct DLCacheStats* stats)
+{
+    dl_simulator_apply_cached_to(simulator, srgba_image, srgba_image, width, height, bytesPerRow, bytesPerRow, stats);
+}
+
+void dl_simulator_apply_rects (const struct DLSimulator* simulator, const unsigned char* srgba_src, unsigned char* srgba_dst, size_t width, size_t height, size_t srcBytesPerRow, size_t dstBytesPerRow, const struct DLRect* rects, size_t numRects)
+{
+    if (srcBytesPerRow == 0)
+    {
+        srcBytesPerRow = width * 4;
+    }
+    if (dstBytesPerRow == 0)
+    {
+        dstBytesPerRow = width * 4;
+    }
+
+    for (size_t i = 0; i < numRects; ++i)
+    {
+        const struct DLRect* rect = &rects[i];
+        if (rect->x >= width || rect->y >= height)
+        {
+            continue;
+        }
+
+        const size_t rectWidth = rect->width < width - rect->x ? rect->width : width - rect->x;
+        const size_t rectHeight = rect->height < height - rect->y ? rect->height : height - rect->y;
+        if (rectWidth == 0)
+        {
+            continue;
+        }
+
+        struct DLSimulationJob job;
+        dl_simulation_job_init(&job,
+                               1.f,
+                               srgba_src + rect->y*srcBytesPerRow + rect->x*4,
+                               srgba_dst + rect->y*dstBytesPerRow + rect->x*4,
+                               rectWidth,
+                               srcBytesPerRow,
+                               dstBytesPerRow);
+        dl_simulation_job_set_simulator(&job, simulator);
+        dl_simulation_job_process_rows(&job, 0, rectHeight);
+    }
+}
+
+static int dl_is_tile_changed (const unsigned char* previous, const unsigned char* current, size_t previousBytesPerRow, size_t currentBytesPerRow, size_t tileWidth, size_t tileHeight)
+{
+    for (size_t row = 0; row < tileHeight; ++row)
+    {
+        if (memcmp(previous + row*previousBytesPerRow, current + row*currentBytesPerRow, tileWidth*4) != 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+size_t dl_diff_tiles (const unsigned char* srgba_previous, const unsigned char* srgba_current, size_t width, size_t height, size_t previousBytesPerRow, size_t currentBytesPerRow, size_t tileSize, struct DLRect* rects, size_t maxRects)
+{
+    if (previousBytesPerRow == 0)
+    {
+        previousBytesPerRow = width * 4;
+    }
+    if (currentBytesPerRow == 0)
+    {
+        currentBytesPerRow = width * 4;
+    }
+    if (tileSize == 0)
+    {
+        tileSize = 64;
+    }
+
+    size_t numRects = 0;
+    int overflow = 0;
+    size_t minX = width, minY = height, maxX = 0, maxY = 0;
+    for (size_t y = 0; y < height; y += tileSize)
+    {
+        const size_t tileHeight = tileSize < height - y ? tileSize : height - y;
+        size_t x = 0;
+        while (x < width)
+        {
+            // Find the next run of changed tiles on this tile row.
+            size_t endX = x;
+            while (endX < width)
+            {
+                const size_t tileWidth = tileSize < width - endX ? tileSize : width - endX;
+                if (!dl_is_tile_changed(srgba_previous + y*previousBytesPerRow + endX*4,
+                                        srgba_current + y*currentBytesPerRow + endX*4,
+                                        previousBytesPerRow,
+                                        currentBytesPerRow,
+                                        tileWidth,
+                                        tileHeight))
+                {
+                    break;
+                }
+                endX += tileWidth;
+            }
+
+            if (endX > x)
+            {
+                if (numRects < maxRects)
+                {
+                    rects[numRects].x = x;
+                    rects[numRects].y = y;
+                    rects[numRects].width = endX - x;
+                    rects[numRects].height = tileHeight;
+                }
+                else
+                {
+                    overflow = 1;
+                }
+                ++numRects;
+
+                minX = x < minX ? x : minX;
+                minY = y < minY ? y : minY;
+                maxX = endX > maxX ? endX : maxX;
+                maxY = y + tileHeight;
+                x = endX;
+            }
+
+            // Skip the unchanged tile that ended the run.
+            x += tileSize;
+        }
+    }
+
+    if (overflow)
+    {
+        if (maxRects == 0)
+        {
+            return 0;
+        }
+        rects[0].x = minX;
+        rects[0].y = minY;
+        rects[0].width = maxX - minX;
+        rects[0].height = maxY - minY;
+        return 1;
+    }
+    return numRects;
+}
+
+/*
+    The grid points generally don't fall on 8-bit values, so they get
+    evaluated in float with the textbook transfer functions instead of the
+    8-bit tables.
+*/
+static float dl_linearRGB_from_sRGB_float (float v)
+{
+    const float fv = v / 255.f;
+    if (fv < 0.04045f) return fv / 12.92f;
+    return powf((fv + 0.055f) / 1.055f, 2.4f);
+}
+
+static float dl_sRGB_from_linearRGB_float (float v)
+{
+    if (!(v > 0.f)) return 0.f;
+    if (v >= 1.f) return 255.f;
+    if (v < 0.0031308f) return v * 12.92f * 255.f;
+    return 255.f * (powf(v, 1.f / 2.4f) * 1.055f - 0.055f);
+}
+
+static int dl_lut3d_bake_direct (struct DLLut3D* lut, const struct DLSimulator* simulator)
+{
+    // Run the regular kernels on one 256x256 slice of blue at a time.
+    unsigned char* slice = (unsigned char*)dl_context_acquire_scratch(lut->context, 256*256*4);
+    if (slice == NULL)
+    {
+        return 0;
+    }
+
+    for (int b = 0; b < 256; ++b)
+    {
+        for (int g = 0; g < 256; ++g)
+        for (int r = 0; r < 256; ++r)
+        {
+            unsigned char* px = slice + (g*256 + r)*4;
+            px[0] = r; px[1] = g; px[2] = b; px[3] = 255;
+        }
+
+        dl_simulator_apply(simulator, slice, 256, 256, 0);
+
+        unsigned char* out = lut->direct + (size_t)b*256*256*3;
+        for (int i = 0; i < 256*256; ++i)
+        {
+            out[i*3 + 0] = slice[i*4 + 0];
+            out[i*3 + 1] = slice[i*4 + 1];
+            out[i*3 + 2] = slice[i*4 + 2];
+        }
+    }
+
+    dl_context_release_scratch(lut->context, slice);
+    return 1;
+}
+
+static void dl_lut3d_bake_grid (struct DLLut3D* lut, const struct DLSimulator* simulator)
+{
+    const int n = lut->gridSize;
+    const float step = 255.f / (n - 1);
+
+    float* out = lut->grid;
+    for (int b = 0; b < n; ++b)
+    for (int g = 0; g < n; ++g)
+    for (int r = 0; r < n; ++r)
+    {
+        const float rgb[3] = {
+            dl_linearRGB_from_sRGB_float(r*step),
+            dl_linearRGB_from_sRGB_float(g*step),
+            dl_linearRGB_from_sRGB_float(b*step)
+        };
+
+        float rgb_cvd[3];
+        if (simulator->useBrettel)
+        {
+            dl_brettel1997_pixel(&simulator->brettelParams, 1.f, rgb, rgb_cvd);
+        }
+        else
+        {
+            dl_vienot1999_pixel(simulator->vienotRgbCvdFromRgb, 1.f, rgb, rgb_cvd);
+        }
+
+        for (int c = 0; c < 3; ++c)
+        {
+            *out++ = dl_sRGB_from_linearRGB_float(rgb_cvd[c]);
+        }
+    }
+
+    for (int v = 0; v < 256; ++v)
+    {
+        int i = (int)(v / step);
+        if (i > n - 2) i = n - 2;
+        lut->gridIndex[v] = i;
+        lut->gridFrac[v] = v / step - i;
+    }
+}
+
+void dl_lut3d_destroy (struct DLLut3D* lut)
+{
+    if (lut == NULL)
+    {
+        return;
+    }
+
+    struct DLContext* context = lut->context;
+    dl_context_deallocate(context, lut->direct);
+    dl_context_deallocate(context, lut->grid);
+    dl_context_deallocate(context, lut);
+}
+
+struct DLLut3D* dl_lut3d_create (const struct DLSimulator* simulator, int gridSize)
+{
+    return dl_context_create_lut3d(NULL, simulator, gridSize);
+}
+
+struct DLLut3D* dl_context_create_lut3d (struct DLContext* context, const struct DLSimulator* simulator, int gridSize)
+{
+    if (simulator == NULL || gridSize < 2 || gridSize > 256)
+    {
+        return NULL;
+    }
+
+    struct DLLut3D* lut = (struct DLLut3D*)dl_context_allocate(context, sizeof(struct DLLut3D));
+    if (lut == NULL)
+    {
+        return NULL;
+    }
+    memset (lut, 0, sizeof(struct DLLut3D));
+
+    lut->context = context;
+    lut->gridSize = gridSize;
+    const size_t numValues = (size_t)gridSize*gridSize*gridSize*3;
+    if (gridSize == 256)
+    {
+        lut->direct = (unsigned char*)dl_context_allocate(context, numValues);
+    }
+    else
+    {
+        lut->grid = (float*)dl_context_allocate(context, numValues*sizeof(float));
+    }
+
+    if (lut->grid)
+    {
+        dl_lut3d_bake_grid(lut, simulator);
+        return lut;
+    }
+
+    if (lut->direct && dl_lut3d_bake_direct(lut, simulator))
+    {
+        return lut;
+    }
+
+    dl_lut3d_destroy(lut);
+    return NULL;
+}
+
+int dl_lut3d_grid_size (const struct DLLut3D* lut)
+{
+    return lut->gridSize;
+}
+
+void dl_lut3d_apply (const struct DLLut3D* lut, unsigned char* srgba_image, size_t width, size_t height, size_t bytesPerRow)
+{
+    dl_lut3d_apply_to(lut, srgba_image, srgba_image, width, height, bytesPerRow, bytesPerRow);
+}
+
+void dl_lut3d_apply_to (const struct DLLut3D* lut, const unsigned char* srgba_src, unsigned char* srgba_dst, size_t width, size_t height, size_t srcBytesPerRow, size_t dstBytesPerRow)
+{
+    struct DLSimulationJob job;
+    dl_simulation_job_init(&job, 1.f, srgba_src, srgba_dst, width, srcBytesPerRow, dstBytesPerRow);
+    job.lut = lut;
+    dl_simulation_job_process_rows(&job, 0, height);
+}
+
+void dl_lut3d_apply_mt (const struct DLLut3D* lut, unsigned char* srgba_image, size_t width, size_t height, size_t bytesPerRow, int num_threads)
+{
+    struct DLSimulationJob job;
+    dl_simulation_job_init(&job, 1.f, srgba_image, srgba_image, width, bytesPerRow, bytesPerRow);
+    job.lut = lut;
+    dl_parallel_for_rows(dl_simulation_job_process_rows, &job, width, height, num_threads);
+}
+
+int dl_lut3d_apply_format (const struct DLLut3D* lut, enum DLPixelFormat format, const unsigned char* src, unsigned char* dst, size_t width, size_t height, size_t srcBytesPerRow, size_t dstBytesPerRow)
+{
+    if (!dl_is_valid_pixel_format(format))
+    {
+        return 0;
+    }
+
+    struct DLSimulationJob job;
+    dl_simulation_job_init_format(&job, format, 1.f, src, dst, width, srcBytesPerRow, dstBytesPerRow);
+    job.lut = lut;
+    dl_simulation_job_process_rows(&job, 0, height);
+    return 1;
+}
+
+int dl_lut3d_write_cube (const struct DLLut3D* lut, const char* path)
+{
+    FILE* f = fopen(path, "w");
+    if (f == NULL)
+    {
+        return 0;
+    }
+
+    fprintf (f, "# Generated by libDaltonLens\n");
+    fprintf (f, "LUT_3D_SIZE %d\n", lut->gridSize);
+    fprintf (f, "DOMAIN_MIN 0.0 0.0 0.0\n");
+    fprintf (f, "DOMAIN_MAX 1.0 1.0 1.0\n");
+
+    const size_t numValues = (size_t)lut->gridSize*lut->gridSize*lut->gridSize*3;
+    for (size_t i = 0; i < numValues; i += 3)
+    {
+        if (lut->direct)
+        {
+            fprintf (f, "%.6f %.6f %.6f\n", lut->direct[i] / 255.f, lut->direct[i+1] / 255.f, lut->direct[i+2] / 255.f);
+        }
+        else
+        {
+            fprintf (f, "%.6f %.6f %.6f\n", lut->grid[i] / 255.f, lut->grid[i+1] / 255.f, lut->grid[i+2] / 255.f);
+        }
+    }
+
+    const int success = !ferror(f);
+    return fclose(f) == 0 && success;
+}
+
+/*
+    Shader sources. GLSL, HLSL, MSL and WGSL are close enough that the
+    only differences needed here are the type names, the declaration of
+    functions and locals, and how to pick between two vectors. The matrix
+    products are written as dot products with the rows to avoid the
+    different row / column conventions of the matrix types.
+*/
+struct DLShaderSyntax
+{
+    const char* vec3;
+    const char* floatSuffix;
+    const char* mix;
+    int isWgsl;
+};
+
+static const struct DLShaderSyntax dl_shader_syntaxes[] = {
+    { "vec3", "", "mix", 0 },             // GLSL
+    { "float3", "f", "lerp", 0 },         // HLSL
+    { "float3", "f", "mix", 0 },          // MSL
+    { "vec3<f32>", "", "mix", 1 },        // WGSL
+};
+
+// Append to a text buffer with the snprintf conventions, the full length
+// is tracked even when it doesn't fit.
+struct DLTextWriter
+{
+    char* buffer;
+    size_t bufferSize;
+    size_t length;
+};
+
+static void dl_text_append (struct DLTextWriter* w, const char* format, ...)
+{
+    va_list args;
+    va_start (args, format);
+    char* dst = w->length < w->bufferSize ? w->buffer + w->length : NULL;
+    const int n = vsnprintf(dst, dst ? w->bufferSize - w->length : 0, format, args);
+    va_end (args);
+    w->length += n > 0 ? (size_t)n : 0;
+}
+
+static void dl_shader_float (struct DLTextWriter* w, const struct DLShaderSyntax* syntax, float v)
+{
+    // Shortest representation that gives back the same float. Float
+    // literals need a '.' or an exponent in GLSL.
+    char str[32];
+    for (int precision = 6; precision <= 9; ++precision)
+    {
+        snprintf (str, sizeof(str), "%.*g", precision, v);
+        if (strtof(str, NULL) == v)
+        {
+            break;
+        }
+    }
+    dl_text_append (w, "%s%s%s", str, strpbrk(str, ".e") ? "" : ".0", syntax->floatSuffix);
+}
+
+static void dl_shader_vec3 (struct DLTextWriter* w, const struct DLShaderSyntax* syntax, float x, float y, float z)
+{
+    dl_text_append (w, "%s(", syntax->vec3);
+    dl_shader_float (w, syntax, x);
+    dl_text_append (w, ", ");
+    dl_shader_float (w, syntax, y);
+    dl_text_append (w, ", ");
+    dl_shader_float (w, syntax, z);
+    dl_text_append (w, ")");
+}
+
+static void dl_shader_splat (struct DLTextWriter* w, const struct DLShaderSyntax* syntax, float v)
+{
+    dl_shader_vec3 (w, syntax, v, v, v);
+}
+
+static void dl_shader_begin_function (struct DLTextWriter* w, const struct DLShaderSyntax* syntax, const char* name, const char* arg)
+{
+    if (syntax->isWgsl)
+    {
+        dl_text_append (w, "\nfn %s (%s: %s) -> %s\n{\n", name, arg, syntax->vec3, syntax->vec3);
+    }
+    else
+    {
+        dl_text_append (w, "\n%s %s (%s %s)\n{\n", syntax->vec3, name, syntax->vec3, arg);
+    }
+}
+
+static void dl_shader_declare (struct DLTextWriter* w, const struct DLShaderSyntax* syntax, const char* type, const char* name)
+{
+    dl_text_append (w, "    %s %s = ", syntax->isWgsl ? "let" : type, name);
+}
+
+static void dl_shader_matrix_product (struct DLTextWriter* w, const struct DLShaderSyntax* syntax, const float* m, const char* v)
+{
+    dl_text_append (w, "%s(", syntax->vec3);
+    for (int row = 0; row < 3; ++row)
+    {
+        dl_text_append (w, row > 0 ? ",\n        dot(" : "\n        dot(");
+        dl_shader_vec3 (w, syntax, m[row*3], m[row*3+1], m[row*3+2]);
+        dl_text_append (w, ", %s)", v);
+    }
+    dl_text_append (w, ")");
+}
+
+size_t dl_simulator_shader_source (const struct DLSimulator* simulator, enum DLShaderLanguage language, char* buffer, size_t bufferSize)
+{
+    if (language < DLShaderLanguage_GLSL || language > DLShaderLanguage_WGSL)
+    {
+        return 0;
+    }
+
+    const struct DLShaderSyntax* syntax = &dl_shader_syntaxes[language];
+    struct DLTextWriter w = { buffer, bufferSize, 0 };
+    if (bufferSize > 0)
+    {
+        buffer[0] = '\0';
+    }
+
+    dl_text_append (&w, "// Generated by libDaltonLens (%s).\n", simulator->useBrettel ? "Brettel 1997" : "Vienot 1999");
+
+    dl_shader_begin_function (&w, syntax, "dl_linearRGB_from_sRGB", "v");
+    dl_text_append (&w, "    return %s(v / ", syntax->mix);
+    dl_shader_float (&w, syntax, 12.92f);
+    dl_text_append (&w, ",\n        pow((v + ");
+    dl_shader_float (&w, syntax, 0.055f);
+    dl_text_append (&w, ") / ");
+    dl_shader_float (&w, syntax, 1.055f);
+    dl_text_append (&w, ", ");
+    dl_shader_splat (&w, syntax, 2.4f);
+    dl_text_append (&w, "),\n        step(");
+    dl_shader_splat (&w, syntax, 0.04045f);
+    dl_text_append (&w, ", v));\n}\n");
+
+    dl_shader_begin_function (&w, syntax, "dl_sRGB_from_linearRGB", "v");
+    dl_shader_declare (&w, syntax, syntax->vec3, "c");
+    dl_text_append (&w, "clamp(v, ");
+    dl_shader_splat (&w, syntax, 0.f);
+    dl_text_append (&w, ", ");
+    dl_shader_splat (&w, syntax, 1.f);
+    dl_text_append (&w, ");\n    return %s(c * ", syntax->mix);
+    dl_shader_float (&w, syntax, 12.92f);
+    dl_text_append (&w, ",\n        pow(c, ");
+    dl_shader_splat (&w, syntax, 1.f / 2.4f);
+    dl_text_append (&w, ") * ");
+    dl_shader_float (&w, syntax, 1.055f);
+    dl_text_append (&w, " - ");
+    dl_shader_float (&w, syntax, 0.055f);
+    dl_text_append (&w, ",\n        step(");
+    dl_shader_splat (&w, syntax, 0.0031308f);
+    dl_text_append (&w, ", c));\n}\n");
+
+    dl_shader_begin_function (&w, syntax, "dl_simulate_cvd_linear", "rgb");
+    if (simulator->useBrettel)
+    {
+        // Same choice of the projection plane as dl_brettel1997_pixel.
+        const float* n = simulator->brettelParams.separationPlaneNormalInRgb;
+        dl_shader_declare (&w, syntax, "float", "d");
+        dl_text_append (&w, "dot(");
+        dl_shader_vec3 (&w, syntax, n[0], n[1], n[2]);
+        dl_text_append (&w, ", rgb);\n");
+        dl_shader_declare (&w, syntax, syntax->vec3, "cvd1");
+        dl_shader_matrix_product (&w, syntax, simulator->brettelParams.rgbCvdFromRgb_1, "rgb");
+        dl_text_append (&w, ";\n");
+        dl_shader_declare (&w, syntax, syntax->vec3, "cvd2");
+        dl_shader_matrix_product (&w, syntax, simulator->brettelParams.rgbCvdFromRgb_2, "rgb");
+        dl_text_append (&w, ";\n");
+        if (syntax->isWgsl)
+        {
+            dl_text_append (&w, "    return select(cvd2, cvd1, d >= 0.0);\n}\n");
+        }
+        else
+        {
+            dl_text_append (&w, "    return d >= 0.0%s ? cvd1 : cvd2;\n}\n", syntax->floatSuffix);
+        }
+    }
+    else
+    {
+        dl_text_append (&w, "    return ");
+        dl_shader_matrix_product (&w, syntax, simulator->vienotRgbCvdFromRgb, "rgb");
+        dl_text_append (&w, ";\n}\n");
+    }
+
+    dl_shader_begin_function (&w, syntax, "dl_simulate_cvd", "srgb");
+    dl_text_append (&w, "    return dl_sRGB_from_linearRGB(dl_simulate_cvd_linear(dl_linearRGB_from_sRGB(srgb)));\n}\n");
+    return w.length;
+}
+
+struct DLAllDeficienciesJob
+{
+    const struct DLKernels* kernels;
+    float severity;
+    const unsigned char* src;
+    unsigned char* dst[3]; // indexed by DLDeficiency, NULL to skip it.
+    size_t width;
+    size_t srcBytesPerRow;
+    size_t dstBytesPerRow;
+};
+
+static void dl_all_deficiencies_job_process_rows (void* ctx, size_t firstRow, size_t endRow)
+{
+    const struct DLAllDeficienciesJob* job = (const struct DLAllDeficienciesJob*)ctx;
+    for (size_t row = firstRow; row < endRow; ++row)
+    {
+        unsigned char* dstRows[3];
+        for (int i = 0; i < 3; ++i)
+        {
+            dstRows[i] = job->dst[i] ? job->dst[i] + job->dstBytesPerRow*row : NULL;
+        }
+        job->kernels->all_deficiencies_row(job->severity, &dl_rgba_layout, job->src + job->srcBytesPerRow*row, dstRows, job->width);
+    }
+}
+
+static void dl_all_deficiencies_job_init (struct DLAllDeficienciesJob* job, float severity, const unsigned char* srgba_src, unsigned char* protan_dst, unsigned char* deutan_dst, unsigned char* tritan_dst, size_t width, size_t srcBytesPerRow, size_t dstBytesPerRow)
+{
+    if (srcBytesPerRow == 0)
+    {
+        srcBytesPerRow = width * 4;
+    }
+    if (dstBytesPerRow == 0)
+    {
+        dstBytesPerRow = width * 4;
+    }
+
+    job->kernels = dl_get_kernels();
+    job->severity = severity;
+    job->src = srgba_src;
+    job->dst[DLDeficiency_Protan] = protan_dst;
+    job->dst[DLDeficiency_Deutan] = deutan_dst;
+    job->dst[DLDeficiency_Tritan] = tritan_dst;
+    job->width = width;
+    job->srcBytesPerRow = srcBytesPerRow;
+    job->dstBytesPerRow = dstBytesPerRow;
+}
+
+void dl_simulate_cvd_all_deficiencies (float severity, const unsigned char* srgba_src, unsigned char* protan_dst, unsigned char* deutan_dst, unsigned char* tritan_dst, size_t width, size_t height, size_t srcBytesPerRow, size_t dstBytesPerRow)
+{
+    struct DLAllDeficienciesJob job;
+    dl_all_deficiencies_job_init(&job, severity, srgba_src, protan_dst, deutan_dst, tritan_dst, width, srcBytesPerRow, dstBytesPerRow);
+    dl_all_deficiencies_job_process_rows(&job, 0, height);
+}
+
+void dl_simulate_cvd_all_deficiencies_mt (float severity, const unsigned char* srgba_src, unsigned char* protan_dst, unsigned char* deutan_dst, unsigned char* tritan_dst, size_t width, size_t height, size_t srcBytesPerRow, size_t dstBytesPerRow, int num_threads)
+{
+    struct DLAllDeficienciesJob job;
+    dl_all_deficiencies_job_init(&job, severity, srgba_src, protan_dst, deutan_dst, tritan_dst, width, srcBytesPerRow, dstBytesPerRow);
+    dl_parallel_for_rows(dl_all_deficiencies_job_process_rows, &job, width, height, num_threads);
+}
+
+float dl_linearRGB_from_sRGB (unsigned char v)
+{
+    return linearRGB_from_sRGB(v);
+}
+
+unsigned char dl_sRGB_from_linearRGB (float v)
+{
+    return sRGB_from_linearRGB(v);
+}
+
+void dl_simulate_cvd (enum DLDeficiency deficiency, float severity, unsigned char* srgba_image, size_t width, size_t height, size_t bytesPerRow)
+{
+    // Viénot 1999 is not accurate for tritanopia, so use Brettel in that case.
+    // Otherwise use Viénot 1999 because it's a bit faster.
+    if (deficiency == DLDeficiency_Tritan)
+    {
+        dl_simulate_cvd_brettel1997(deficiency, severity, srgba_image, width, height, bytesPerRow);
+    }
+    else
+    {
+        dl_simulate_cvd_vienot1999(deficiency, severity, srgba_image, width, height, bytesPerRow);
+    }
+}
+
+void dl_simulate_cvd_to (enum DLDeficiency deficiency, float severity, const unsigned char* srgba_src, unsigned char* srgba_dst, size_t width, size_t height, size_t srcBytesPerRow, size_t dstBytesPerRow)
+{
+    if (deficiency == DLDeficiency_Tritan)
+    {
+        dl_simulate_cvd_brettel1997_to(deficiency, severity, srgba_src, srgba_dst, width, height, srcBytesPerRow, dstBytesPerRow);
+    }
+    else
+    {
+        dl_simulate_cvd_vienot1999_to(deficiency, severity, srgba_src, srgba_dst, width, height, srcBytesPerRow, dstBytesPerRow);
+    }
+}
+
+int dl_simulate_cvd_format (enum DLAlgorithm algorithm, enum DLPixelFormat format, enum DLDeficiency deficiency, float severity, const unsigned char* src, unsigned char* dst, size_t width, size_t height, size_t srcBytesPerRow, size_t dstBytesPerRow)
+{
+    if (!dl_is_valid_pixel_format(format))
+    {
+        return 0;
+    }
+
+    struct DLSimulationJob job;
+    dl_simulation_job_init_format(&job, format, severity, src, dst, width, srcBytesPerRow, dstBytesPerRow);
+    if (!dl_simulation_job_set_algorithm(&job, algorithm, deficiency))
+    {
+        return 0;
+    }
+
+    dl_simulation_job_process_rows(&job, 0, height);
+    return 1;
+}
+
+int dl_simulate_cvd_alpha (enum DLAlgorithm algorithm, enum DLPixelFormat format, enum DLAlphaMode alphaMode, enum DLDeficiency deficiency, float severity, const unsigned char* src, unsigned char* dst, size_t width, size_t height, size_t srcBytesPerRow, size_t dstBytesPerRow)
+{
+    if (!dl_is_valid_pixel_format(format) || !dl_is_valid_alpha_mode(format, alphaMode))
+    {
+        return 0;
+    }
+
+    struct DLSimulationJob job;
+    dl_simulation_job_init_format(&job, format, severity, src, dst, width, srcBytesPerRow, dstBytesPerRow);
+    if (!dl_simulation_job_set_algorithm(&job, algorithm, deficiency))
+    {
+        return 0;
+    }
+
+    job.alphaMode = alphaMode;
+    dl_simulation_job_process_rows(&job, 0, height);
+    return 1;
+}
+
+static int dl_is_valid_severity_map (const struct DLSeverityMap* map)
+{
+    if (map == NULL || map->values == NULL || map->width == 0 || map->height == 0)
+    {
+        return 0;
+    }
+
+    const size_t valueSize = map->format == DLSeverityMapFormat_U8 ? 1 : sizeof(float);
+    return (map->format == DLSeverityMapFormat_U8 || map->format == DLSeverityMapFormat_F32)
+        && (map->bytesPerRow == 0 || map->bytesPerRow >= map->width*valueSize);
+}
+
+static int dl_simulation_job_init_severity_map (struct DLSimulationJob* job, enum DLAlgorithm algorithm, enum DLPixelFormat format, enum DLDeficiency deficiency, const struct DLSeverityMap* severityMap, const unsigned char* src, unsigned char* dst, size_t width, size_t height, size_t srcBytesPerRow, size_t dstBytesPerRow)
+{
+    if (!dl_is_valid_pixel_format(format) || !dl_is_valid_severity_map(severityMap))
+    {
+        return 0;
+    }
+
+    dl_simulation_job_init_format(job, format, 1.f, src, dst, width, srcBytesPerRow, dstBytesPerRow);
+    job->severityMap = severityMap;
+    job->height = height;
+    return dl_simulation_job_set_algorithm(job, algorithm, deficiency);
+}
+
+int dl_simulate_cvd_severity_map (enum DLAlgorithm algorithm, enum DLPixelFormat format, enum DLDeficiency deficiency, const struct DLSeverityMap* severityMap, const unsigned char* src, unsigned char* dst, size_t width, size_t height, size_t srcBytesPerRow, size_t dstBytesPerRow)
+{
+    struct DLSimulationJob job;
+    if (!dl_simulation_job_init_severity_map(&job, algorithm, format, deficiency, severityMap, src, dst, width, height, srcBytesPerRow, dstBytesPerRow))
+    {
+        return 0;
+    }
+
+    dl_simulation_job_process_rows(&job, 0, height);
+    return 1;
+}
+
+int dl_simulate_cvd_severity_map_mt (enum DLAlgorithm algorithm, enum DLPixelFormat format, enum DLDeficiency deficiency, const struct DLSeverityMap* severityMap, const unsigned char* src, unsigned char* dst, size_t width, size_t height, size_t srcBytesPerRow, size_t dstBytesPerRow, int num_threads)
+{
+    struct DLSimulationJob job;
+    if (!dl_simulation_job_init_severity_map(&job, algorithm, format, deficiency, severityMap, src, dst, width, height, srcBytesPerRow, dstBytesPerRow))
+    {
+        return 0;
+    }
+
+    dl_parallel_for_rows(dl_simulation_job_process_rows, &job, width, height, num_threads);
+    return 1;
+}
+
+int dl_simulate_cvd_samples (enum DLAlgorithm algorithm, enum DLSampleFormat format, enum DLDeficiency deficiency, float severity, const void* src, void* dst, size_t width, size_t height, size_t srcBytesPerRow, size_t dstBytesPerRow)
+{
+    if (!dl_is_valid_sample_format(format))
+    {
+        return 0;
+    }
+
+    struct DLSimulationJob job;
+    dl_simulation_job_init_samples(&job, format, severity, src, dst, width, srcBytesPerRow, dstBytesPerRow);
+    if (!dl_simulation_job_set_algorithm(&job, algorithm, deficiency))
+    {
+        return 0;
+    }
+
+    dl_simulation_job_process_rows(&job, 0, height);
+    return 1;
+}
+
+void dl_simulate_cvd_mt (enum DLDeficiency deficiency, float severity, unsigned char* srgba_image, size_t width, size_t height, size_t bytesPerRow, int num_threads)
+{
+    if (deficiency == DLDeficiency_Tritan)
+    {
+        dl_simulate_cvd_brettel1997_mt(deficiency, severity, srgba_image, width, height, bytesPerRow, num_threads);
+    }
+    else
+    {
+        dl_simulate_cvd_vienot1999_mt(deficiency, severity, srgba_image, width, height, bytesPerRow, num_threads);
+    }
+}
+
+/*
+    Planar and YUV 4:2:0 images
+
+    These are converted by chunks of pixels into a small RGB24 buffer that
+    goes through the regular kernels and back. The buffer stays in the L1
+    cache, so it's much cheaper than a separate conversion to a full RGBA
+    image.
+
+    YUV uses the BT.709 matrices with the limited (video) range, and the
+    decoded R'G'B' values are considered sRGB-encoded, as displays do. The
+    conversions are in 16-bit fixed point. The chroma is upsampled by
+    replication, and downsampled by averaging each 2x2 block.
+*/
+
+#define DL_PLANAR_CHUNK_SIZE 256
+
+static void dl_planar_row (const struct DLSimulationJob* rgb24Job, const unsigned char* const src[3], unsigned char* const dst[3], size_t width)
+{
+    unsigned char buffer[3*DL_PLANAR_CHUNK_SIZE];
+    for (size_t col = 0; col < width; col += DL_PLANAR_CHUNK_SIZE)
+    {
+        const size_t numPixels = width - col < DL_PLANAR_CHUNK_SIZE ? width - col : DL_PLANAR_CHUNK_SIZE;
+        for (size_t i = 0; i < numPixels; ++i)
+            for (int c = 0; c < 3; ++c)
+                buffer[3*i + c] = src[c][col + i];
+
+        dl_simulation_job_process_pixels(rgb24Job, buffer, buffer, numPixels);
+
+        for (size_t i = 0; i < numPixels; ++i)
+            for (int c = 0; c < 3; ++c)
+                dst[c][col + i] = buffer[3*i + c];
+    }
+}
+
+// Rounds a 16.16 fixed point value and clamps it to [0,255].
+static inline unsigned char dl_clamp_fixed16 (int32_t v)
+{
+    // Written so that compilers use conditional moves instead of branches.
+    v = (v + (1 << 15)) >> 16;
+    v = v < 0 ? 0 : v;
+    return (unsigned char)(v > 255 ? 255 : v);
+}
+
+static inline unsigned char dl_luma_from_rgb (const unsigned char rgb[3])
+{
+    return (unsigned char)((11966*rgb[0] + 40254*rgb[1] + 4064*rgb[2] + (16 << 16) + (1 << 15)) >> 16);
+}
+
+// Chroma of the sum of 4 pixels. The coefficients of each row sum to 0,
+// so the results stay in [16,240] and the numerators are positive.
+static inline void dl_chroma_from_rgb_sum (const int32_t sum[3], unsigned char* u, unsigned char* v)
+{
+    const int32_t offset = 4*((128 << 16) + (1 << 15));
+    *u = (unsigned char)((offset - 6596*sum[0] - 22188*sum[1] + 28784*sum[2]) >> 18);
+    *v = (unsigned char)((offset + 28784*sum[0] - 26145*sum[1] - 2639*sum[2]) >> 18);
+}
+
+// Pointers to the first U and V samples of a chroma row, and the distance
+// between consecutive samples.
+struct DLChromaRow
+{
+    unsigned char* u;
+    unsigned char* v;
+    size_t step;
+};
+
+static struct DLChromaRow dl_yuv_chroma_row (const struct DLYuvImage* image, enum DLYuvFormat format, size_t row)
+{
+    struct DLChromaRow chroma;
+    chroma.u = image->planes[1] + row*image->bytesPerRow[1];
+    if (format == DLYuvFormat_NV12)
+    {
+        chroma.v = chroma.u + 1;
+        chroma.step = 2;
+    }
+    else
+    {
+        chroma.v = image->planes[2] + row*image->bytesPerRow[2];
+        chroma.step = 1;
+    }
+    return chroma;
+}
+
+static inline void dl_rgb_from_yuv (int32_t y, int32_t r, int32_t g, int32_t b, unsigned char* px)
+{
+    px[0] = dl_clamp_fixed16(y + r);
+    px[1] = dl_clamp_fixed16(y + g);
+    px[2] = dl_clamp_fixed16(y + b);
+}
+
+// Converts the pixels [col, col + numPixels) of a row to RGB, with 'col'
+// even. Each chroma sample is shared by 2 consecutive pixels.
+static void dl_rgb_from_yuv_row (const unsigned char* luma, const struct DLChromaRow* chroma, size_t col, size_t numPixels, unsigned char* dst, size_t dstPixelSize)
+{
+    // Local copies, the compiler can't tell that the stores don't modify them.
+    const unsigned char* u = chroma->u + (col/2)*chroma->step;
+    const unsigned char* v = chroma->v + (col/2)*chroma->step;
+    const size_t step = chroma->step;
+    luma += col;
+
+    for (size_t i = 0; i < numPixels; i += 2)
+    {
+        const int32_t cu = *u - 128;
+        const int32_t cv = *v - 128;
+        u += step;
+        v += step;
+        const int32_t r = 117489*cv;
+        const int32_t g = -13975*cu - 34925*cv;
+        const int32_t b = 138438*cu;
+        dl_rgb_from_yuv(76309*(luma[i] - 16), r, g, b, dst + i*dstPixelSize);
+        if (i + 1 < numPixels)
+        {
+            dl_rgb_from_yuv(76309*(luma[i + 1] - 16), r, g, b, dst + (i + 1)*dstPixelSize);
+        }
+    }
+}
+
+// Copy of the image with the default strides filled in.
+static struct DLYuvImage dl_yuv_image_with_strides (const struct DLYuvImage* image, enum DLYuvFormat format, size_t width)
+{
+    const size_t chromaWidth = (width + 1) / 2;
+    const size_t defaultBytesPerRow[3] = { width, format == DLYuvFormat_NV12 ? 2*chromaWidth : chromaWidth, chromaWidth };
+    struct DLYuvImage withStrides = *image;
+    for (int p = 0; p < 3; ++p)
+    {
+        if (withStrides.bytesPerRow[p] == 0)
+        {
+            withStrides.bytesPerRow[p] = defaultBytesPerRow[p];
+        }
+    }
+    return withStrides;
+}
+
+// Converts the luma rows [firstRow, endRow) sharing the chroma row
+// firstRow/2 to RGB24, for the pixels [col, col + numPixels).
+static void dl_rgb24_from_yuv_rows (const struct DLYuvImage* src, enum DLYuvFormat format, size_t firstRow, size_t endRow, size_t col, size_t numPixels, unsigned char* rgb24)
+{
+    const struct DLChromaRow chroma = dl_yuv_chroma_row(src, format, firstRow / 2);
+    for (size_t row = firstRow; row < endRow; ++row)
+    {
+        const unsigned char* luma = src->planes[0] + row*src->bytesPerRow[0];
+        dl_rgb_from_yuv_row(luma, &chroma, col, numPixels, rgb24 + 3*(row - firstRow)*numPixels, 3);
+    }
+}
+
+static void dl_yuv_from_rgb24_rows (const unsigned char* rgb24, size_t numRows, size_t col, size_t numPixels, const struct DLYuvImage* dst, enum DLYuvFormat format, size_t firstRow)
+{
+    for (size_t r = 0; r < numRows; ++r)
+    {
+        unsigned char* luma = dst->planes[0] + (firstRow + r)*dst->bytesPerRow[0] + col;
+        const unsigned char* rgb = rgb24 + 3*r*numPixels;
+        for (size_t i = 0; i < numPixels; ++i)
+            luma[i] = dl_luma_from_rgb(rgb + 3*i);
+    }
+
+    const struct DLChromaRow chroma = dl_yuv_chroma_row(dst, format, firstRow / 2);
+    unsigned char* u = chroma.u + (col/2)*chroma.step;
+    unsigned char* v = chroma.v + (col/2)*chroma.step;
+    const size_t step = chroma.step;
+    const size_t nextRow = numRows > 1 ? 3*numPixels : 0;
+    for (size_t i = 0; i < numPixels; i += 2)
+    {
+        // The last block of odd widths or heights has fewer pixels, they
+        // get duplicated, which gives the same average.
+        const unsigned char* p0 = rgb24 + 3*i;
+        const unsigned char* p1 = i + 1 < numPixels ? p0 + 3 : p0;
+        int32_t sum[3];
+        for (int c = 0; c < 3; ++c)
+            sum[c] = p0[c] + p1[c] + p0[nextRow + c] + p1[nextRow + c];
+        dl_chroma_from_rgb_sum(sum, u, v);
+        u += step;
+        v += step;
+    }
+}
+
+static int dl_is_valid_yuv_format (enum DLYuvFormat format)
+{
+    return format == DLYuvFormat_I420 || format == DLYuvFormat_NV12;
+}
+
+int dl_simulate_cvd_planar (enum DLAlgorithm algorithm, enum DLDeficiency deficiency, float severity, const unsigned char* const src[3], unsigned char* const dst[3], size_t width, size_t height, size_t srcBytesPerRow, size_t dstBytesPerRow)
+{
+    struct DLSimulationJob job;
+    dl_simulation_job_init_format(&job, DLPixelFormat_RGB24, severity, NULL, NULL, width, 0, 0);
+    if (!dl_simulation_job_set_algorithm(&job, algorithm, deficiency))
+    {
+        return 0;
+    }
+
+    if (srcBytesPerRow == 0)
+    {
+        srcBytesPerRow = width;
+    }
+    if (dstBytesPerRow == 0)
+    {
+        dstBytesPerRow = width;
+    }
+
+    for (size_t row = 0; row < height; ++row)
+    {
+        const unsigned char* srcRows[3];
+        unsigned char* dstRows[3];
+        for (int c = 0; c < 3; ++c)
+        {
+            srcRows[c] = src[c] + row*srcBytesPerRow;
+            dstRows[c] = dst[c] + row*dstBytesPerRow;
+        }
+        dl_planar_row(&job, srcRows, dstRows, width);
+    }
+    return 1;
+}
+
+int dl_simulate_cvd_yuv (enum DLAlgorithm algorithm, enum DLYuvFormat format, enum DLDeficiency deficiency, float severity, const struct DLYuvImage* src, const struct DLYuvImage* dst, size_t width, size_t height)
+{
+    struct DLSimulationJob job;
+    dl_simulation_job_init_format(&job, DLPixelFormat_RGB24, severity, NULL, NULL, width, 0, 0);
+    if (!dl_is_valid_yuv_format(format) || !dl_simulation_job_set_algorithm(&job, algorithm, deficiency))
+    {
+        return 0;
+    }
+
+    const struct DLYuvImage srcImage = dl_yuv_image_with_strides(src, format, width);
+    const struct DLYuvImage dstImage = dl_yuv_image_with_strides(dst, format, width);
+
+    // Pairs of rows sharing the same chroma row, by chunks of an even number
+    // of pixels.
+    unsigned char buffer[2*3*DL_PLANAR_CHUNK_SIZE];
+    for (size_t row = 0; row < height; row += 2)
+    {
+        const size_t numRows = height - row < 2 ? height - row : 2;
+        for (size_t col = 0; col < width; col += DL_PLANAR_CHUNK_SIZE)
+        {
+            const size_t numPixels = width - col < DL_PLANAR_CHUNK_SIZE ? width - col : DL_PLANAR_CHUNK_SIZE;
+            dl_rgb24_from_yuv_rows(&srcImage, format, row, row + numRows, col, numPixels, buffer);
+            dl_simulation_job_process_pixels(&job, buffer, buffer, numRows*numPixels);
+            dl_yuv_from_rgb24_rows(buffer, numRows, col, numPixels, &dstImage, format, row);
+        }
+    }
+    return 1;
+}
+
+int dl_simulate_cvd_yuv_to_rgba (enum DLAlgorithm algorithm, enum DLYuvFormat format, enum DLDeficiency deficiency, float severity, const struct DLYuvImage* src, unsigned char* srgba_dst, size_t width, size_t height, size_t dstBytesPerRow)
+{
+    struct DLSimulationJob job;
+    dl_simulation_job_init(&job, severity, NULL, NULL, width, 0, 0);
+    if (!dl_is_valid_yuv_format(format) || !dl_simulation_job_set_algorithm(&job, algorithm, deficiency))
+    {
+        return 0;
+    }
+
+    if (dstBytesPerRow == 0)
+    {
+        dstBytesPerRow = width*4;
+    }
+
+    // Convert each row directly in the destination and simulate it in place.
+    const struct DLYuvImage srcImage = dl_yuv_image_with_strides(src, format, width);
+    for (size_t row = 0; row < height; ++row)
+    {
+        const unsigned char* luma = srcImage.planes[0] + row*srcImage.bytesPerRow[0];
+        const struct DLChromaRow chroma = dl_yuv_chroma_row(&srcImage, format, row / 2);
+        unsigned char* dstRow = srgba_dst + row*dstBytesPerRow;
+        dl_rgb_from_yuv_row(luma, &chroma, 0, width, dstRow, 4);
+        for (size_t i = 0; i < width; ++i)
+            dstRow[4*i + 3] = 255;
+        dl_simulation_job_process_pixels(&job, dstRow, dstRow, width);
     }
+    return 1;
 }
 
 /*
@@ -29,8 +29,15 @@
     For more information, please refer to <https://unlicense.org>
 */
 
+#ifndef LIB_DALTON_LENS_H
+#define LIB_DALTON_LENS_H
+
 #include <stddef.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 enum DLDeficiency
 {
     DLDeficiency_Protan,
@@ -38,6 +45,82 @@ enum DLDeficiency
     DLDeficiency_Tritan
 };
 
+/*
+    Memory layouts of the pixels, 8 bits per channel, named by byte order in
+    memory (e.g. BGRA32 is Windows / DXGI, ARGB32 is CoreGraphics with
+    kCGImageAlphaFirst and big endian). The 4th byte of RGBX32 is padding,
+    it's copied unchanged like alpha.
+*/
+enum DLPixelFormat
+{
+    DLPixelFormat_RGBA32,
+    DLPixelFormat_BGRA32,
+    DLPixelFormat_ARGB32,
+    DLPixelFormat_RGBX32,
+    DLPixelFormat_RGB24,
+    DLPixelFormat_BGR24
+};
+
+/*
+    How the alpha channel of RGBA32, BGRA32 and ARGB32 images is handled.
+
+    Straight is the default of all the functions: the color channels are
+    transformed regardless of alpha.
+
+    SkipTransparent leaves the pixels with alpha == 0 unchanged, so mostly
+    empty layers like sprite sheets cost little more than a scan of their
+    alpha channel. The other pixels get the same output as Straight.
+
+    Premultiplied is for images whose color channels are premultiplied by
+    alpha. The colors get unpremultiplied, simulated and premultiplied
+    again in a single pass, and the transparent pixels are skipped too.
+    Opaque pixels get the same output as Straight.
+*/
+enum DLAlphaMode
+{
+    DLAlphaMode_Straight,
+    DLAlphaMode_SkipTransparent,
+    DLAlphaMode_Premultiplied
+};
+
+/*
+    RGBA images with more than 8 bits per channel, in native endianness.
+    LinearRGBA32F and LinearRGBA16F (IEEE half floats) hold linear RGB
+    values, and sRGBA16 holds 16-bit unsigned values encoded as sRGB.
+*/
+enum DLSampleFormat
+{
+    DLSampleFormat_LinearRGBA32F,
+    DLSampleFormat_LinearRGBA16F,
+    DLSampleFormat_sRGBA16
+};
+
+/*
+    Simulation algorithms, see dl_simulate_cvd below. DLAlgorithm_Auto picks
+    the same one as dl_simulate_cvd.
+*/
+enum DLAlgorithm
+{
+    DLAlgorithm_Auto,
+    DLAlgorithm_Brettel1997,
+    DLAlgorithm_Vienot1999
+};
+
+/*
+    Implementations of the inner loops. By default the best one for the
+    current CPU is detected at runtime. WebAssembly SIMD has no runtime
+    detection, it is used when compiling with -msimd128.
+*/
+enum DLKernel
+{
+    DLKernel_Auto,
+    DLKernel_Scalar,
+    DLKernel_SSE41,
+    DLKernel_AVX2,
+    DLKernel_NEON,
+    DLKernel_WasmSIMD128
+};
+
 /*
     Automatically picks the best CVD simulation algorithm (Brettel 1997 for
     tritanopia, Viénot 1999 for protanopia and deuteranopia).
@@ -85,3 +168,564 @@ void dl_simulate_cvd_brettel1997 (enum DLDeficiency deficiency, float severity,
     This version is adapted to modern sRGB monitors.
 */
 void dl_simulate_cvd_vienot1999 (enum DLDeficiency deficiency, float severity, unsigned char* srgba_image, size_t width, size_t height, size_t bytesPerRow);
+
+/*
+    Out-of-place versions of the functions above. 'srgba_src' is left
+    untouched and the result is written to 'srgba_dst', including the
+    original alpha. Only the first width*4 bytes of each destination row are
+    written.
+
+    The two buffers can have different strides, and each can be 0 to use
+    width*4. They must not overlap, unless they are the same buffer with the
+    same stride, which is then equivalent to the in-place version.
+*/
+void dl_simulate_cvd_to (enum DLDeficiency deficiency, float severity, const unsigned char* srgba_src, unsigned char* srgba_dst, size_t width, size_t height, size_t srcBytesPerRow, size_t dstBytesPerRow);
+void dl_simulate_cvd_brettel1997_to (enum DLDeficiency deficiency, float severity, const unsigned char* srgba_src, unsigned char* srgba_dst, size_t width, size_t height, size_t srcBytesPerRow, size_t dstBytesPerRow);
+void dl_simulate_cvd_vienot1999_to (enum DLDeficiency deficiency, float severity, const unsigned char* srgba_src, unsigned char* srgba_dst, size_t width, size_t height, size_t srcBytesPerRow, size_t dstBytesPerRow);
+
+/*
+    Multi-threaded versions of the in-place functions above. The image is split into
+    bands of rows that are processed in parallel by an internal pool of
+    threads, created on the first call and reused afterwards.
+
+    'num_threads' is the total number of threads to use, including the
+    calling one. 0 (or a negative value) means one per hardware thread.
+    Small images are not split, as the threading overhead would dominate.
+
+    When several threads call these functions concurrently, only one of
+    them uses the pool at a time, the others run on the calling thread.
+*/
+void dl_simulate_cvd_mt (enum DLDeficiency deficiency, float severity, unsigned char* srgba_image, size_t width, size_t height, size_t bytesPerRow, int num_threads);
+void dl_simulate_cvd_brettel1997_mt (enum DLDeficiency deficiency, float severity, unsigned char* srgba_image, size_t width, size_t height, size_t bytesPerRow, int num_threads);
+void dl_simulate_cvd_vienot1999_mt (enum DLDeficiency deficiency, float severity, unsigned char* srgba_image, size_t width, size_t height, size_t bytesPerRow, int num_threads);
+
+/*
+    Simulates the three deficiencies at once, as dl_simulate_cvd would do
+    with each of them: Viénot 1999 for protan and deutan, Brettel 1997 for
+    tritan. Each source pixel is read and decoded only once, which is
+    significantly faster than three separate calls.
+
+    Any of the destination buffers can be NULL to skip that deficiency. They
+    all share 'dstBytesPerRow' and must not overlap with each other or with
+    'srgba_src'. Both strides can be 0 to use width*4.
+*/
+void dl_simulate_cvd_all_deficiencies (float severity, const unsigned char* srgba_src, unsigned char* protan_dst, unsigned char* deutan_dst, unsigned char* tritan_dst, size_t width, size_t height, size_t srcBytesPerRow, size_t dstBytesPerRow);
+void dl_simulate_cvd_all_deficiencies_mt (float severity, const unsigned char* srgba_src, unsigned char* protan_dst, unsigned char* deutan_dst, unsigned char* tritan_dst, size_t width, size_t height, size_t srcBytesPerRow, size_t dstBytesPerRow, int num_threads);
+
+/*
+    Simulator for a fixed algorithm, deficiency and severity, e.g. to process
+    video frames. The severity is folded into the precomputed matrices once,
+    which saves the interpolation with the original image on every pixel.
+    The output can differ by ±1 from the dl_simulate_cvd* functions for
+    intermediate severities because of the different rounding.
+
+    dl_simulator_create returns NULL if the allocation fails or the
+    arguments are invalid. A simulator is immutable once set up (see
+    dl_simulator_set_accuracy) and can be used from several threads at the
+    same time. The apply functions follow the same conventions as the
+    corresponding dl_simulate_cvd* functions.
+*/
+struct DLSimulator;
+struct DLSimulator* dl_simulator_create (enum DLAlgorithm algorithm, enum DLDeficiency deficiency, float severity);
+void dl_simulator_destroy (struct DLSimulator* simulator);
+void dl_simulator_apply (const struct DLSimulator* simulator, unsigned char* srgba_image, size_t width, size_t height, size_t bytesPerRow);
+void dl_simulator_apply_to (const struct DLSimulator* simulator, const unsigned char* srgba_src, unsigned char* srgba_dst, size_t width, size_t height, size_t srcBytesPerRow, size_t dstBytesPerRow);
+void dl_simulator_apply_mt (const struct DLSimulator* simulator, unsigned char* srgba_image, size_t width, size_t height, size_t bytesPerRow, int num_threads);
+
+/*
+    Accuracy / speed trade-off of the sRGB encoding at the end of each pixel,
+    which dominates the cost of the 8-bit paths. The decoding is always an
+    exact table lookup.
+
+    Default uses a piecewise-linear lookup table, within ±1 of the textbook
+    powf formula. Exact uses powf, only has a scalar kernel and is several
+    times slower. Fast uses a cubic polynomial in sqrt(v) instead, also
+    within ±1 of the textbook formula but off by one more often, with no
+    table lookups so the SIMD kernels don't need gathers.
+
+    dl_simulator_set_accuracy must be called before sharing the simulator
+    between threads. It applies to the 8-bit functions, the color cache and
+    the direct 3D LUTs (gridSize 256) baked from the simulator. The smaller
+    grids, the wide sample formats and the shaders keep their own encoding. Returns 0 if
+    'accuracy' is invalid.
+*/
+enum DLAccuracy
+{
+    DLAccuracy_Default,
+    DLAccuracy_Exact,
+    DLAccuracy_Fast
+};
+
+int dl_simulator_set_accuracy (struct DLSimulator* simulator, enum DLAccuracy accuracy);
+
+/*
+    Daltonization: corrects the image for a dichromat instead of simulating
+    what they see, following Fidaner et al. (2005). The difference between
+    the image and its simulation is added back to the channels that remain
+    visible:
+
+        rgb + errorShift * (rgb - simulate(rgb))
+
+    with errorShift = [0 0 0; 0.7 1 0; 0.7 0 1] for protan and deutan, and
+    [1 0 0.7; 0 1 0.7; 0 0 0] for tritan, in linear RGB. This is folded
+    into the simulation matrices, so it costs the same as the simulation.
+
+    dl_daltonizer_create returns a simulator that corrects instead of
+    simulating, and that works with all the dl_simulator_* functions (pixel
+    formats, wide samples, streams, batches, shaders...). 'severity' is
+    the one of the simulation, 0 leaves the image unchanged. The other
+    functions use the same algorithm as dl_simulate_cvd.
+*/
+struct DLSimulator* dl_daltonizer_create (enum DLAlgorithm algorithm, enum DLDeficiency deficiency, float severity);
+void dl_daltonize (enum DLDeficiency deficiency, float severity, unsigned char* srgba_image, size_t width, size_t height, size_t bytesPerRow);
+void dl_daltonize_to (enum DLDeficiency deficiency, float severity, const unsigned char* srgba_src, unsigned char* srgba_dst, size_t width, size_t height, size_t srcBytesPerRow, size_t dstBytesPerRow);
+void dl_daltonize_mt (enum DLDeficiency deficiency, float severity, unsigned char* srgba_image, size_t width, size_t height, size_t bytesPerRow, int num_threads);
+
+/*
+    Versions that read and write 'format' directly instead of RGBA32, with
+    the same output for the color channels. 'src' and 'dst' use the same
+    format, and follow the same rules as the _to functions, with bytesPerRow
+    defaulting to width times the pixel size. They can be the same buffer.
+
+    Returns 1 on success, or 0 if one of the enums is invalid.
+*/
+int dl_simulate_cvd_format (enum DLAlgorithm algorithm, enum DLPixelFormat format, enum DLDeficiency deficiency, float severity, const unsigned char* src, unsigned char* dst, size_t width, size_t height, size_t srcBytesPerRow, size_t dstBytesPerRow);
+int dl_simulator_apply_format (const struct DLSimulator* simulator, enum DLPixelFormat format, const unsigned char* src, unsigned char* dst, size_t width, size_t height, size_t srcBytesPerRow, size_t dstBytesPerRow);
+
+/*
+    Versions of the _format functions with an alpha mode, see DLAlphaMode.
+    The modes other than Straight require a format with alpha (RGBA32,
+    BGRA32 or ARGB32).
+
+    Returns 1 on success, or 0 if one of the enums is invalid or if the
+    format has no alpha.
+*/
+int dl_simulate_cvd_alpha (enum DLAlgorithm algorithm, enum DLPixelFormat format, enum DLAlphaMode alphaMode, enum DLDeficiency deficiency, float severity, const unsigned char* src, unsigned char* dst, size_t width, size_t height, size_t srcBytesPerRow, size_t dstBytesPerRow);
+int dl_simulator_apply_alpha (const struct DLSimulator* simulator, enum DLPixelFormat format, enum DLAlphaMode alphaMode, const unsigned char* src, unsigned char* dst, size_t width, size_t height, size_t srcBytesPerRow, size_t dstBytesPerRow);
+
+/*
+    Severity maps, to vary the severity across the image in a single pass,
+    e.g. for gradients of anomalous trichromacy, before / after split views
+    or lenses. Each value is the severity of the corresponding pixels, 8-bit
+    values being divided by 255 and float values clamped to [0,1].
+
+    A map with the size of the image gives one severity per pixel. Smaller
+    maps get stretched to the image, each value covering a tile of about
+    (width/mapWidth) x (height/mapHeight) pixels, so a 2x1 map gives a split
+    view. bytesPerRow defaults to the map width times the size of a value.
+
+    The other arguments are the ones of dl_simulate_cvd_format, and a
+    constant map gives the same output as dl_simulate_cvd_format with that
+    severity. Returns 1 on success, or 0 if one of the enums or the map is
+    invalid.
+*/
+enum DLSeverityMapFormat
+{
+    DLSeverityMapFormat_U8,
+    DLSeverityMapFormat_F32
+};
+
+struct DLSeverityMap
+{
+    const void* values;
+    enum DLSeverityMapFormat format;
+    size_t width;
+    size_t height;
+    size_t bytesPerRow;
+};
+
+int dl_simulate_cvd_severity_map (enum DLAlgorithm algorithm, enum DLPixelFormat format, enum DLDeficiency deficiency, const struct DLSeverityMap* severityMap, const unsigned char* src, unsigned char* dst, size_t width, size_t height, size_t srcBytesPerRow, size_t dstBytesPerRow);
+int dl_simulate_cvd_severity_map_mt (enum DLAlgorithm algorithm, enum DLPixelFormat format, enum DLDeficiency deficiency, const struct DLSeverityMap* severityMap, const unsigned char* src, unsigned char* dst, size_t width, size_t height, size_t srcBytesPerRow, size_t dstBytesPerRow, int num_threads);
+
+/*
+    Versions for the wide sample formats, e.g. for compositors working on
+    RGBA16F / RGBA32F buffers. The linear formats skip the sRGB transfer
+    functions entirely and apply the transforms directly. Their values are
+    not clamped, so HDR and out of gamut colors get transformed too. sRGBA16
+    goes through the textbook powf transfer functions to keep the 16-bit
+    precision, so it is much slower than the linear formats.
+
+    Alpha is copied unchanged. 'src' and 'dst' must be aligned on the size
+    of a channel, and bytesPerRow defaults to width times the pixel size (16
+    or 8 bytes). They can be the same buffer.
+
+    Returns 1 on success, or 0 if one of the enums is invalid.
+*/
+int dl_simulate_cvd_samples (enum DLAlgorithm algorithm, enum DLSampleFormat format, enum DLDeficiency deficiency, float severity, const void* src, void* dst, size_t width, size_t height, size_t srcBytesPerRow, size_t dstBytesPerRow);
+int dl_simulator_apply_samples (const struct DLSimulator* simulator, enum DLSampleFormat format, const void* src, void* dst, size_t width, size_t height, size_t srcBytesPerRow, size_t dstBytesPerRow);
+
+/*
+    Streaming interface for images that don't fit in memory, e.g. gigapixel
+    tiles or scanned documents. Rows are simulated as soon as they are
+    pushed, typically one strip at a time as the decoder outputs them, so
+    the memory use only depends on the strips the caller keeps around.
+
+    dl_stream_begin copies the simulator, which can be destroyed right
+    after. It returns NULL if the allocation fails or 'format' is invalid.
+    The stream doesn't keep any pointer to the pushed rows, so the strips
+    can be recycled as soon as the call returns. A stream is not thread
+    safe, but it can be handed over between the threads of a decode /
+    simulate / encode pipeline, and several streams can run in parallel.
+
+    The push functions follow the conventions of dl_simulator_apply_format,
+    with bytesPerRow defaulting to width times the pixel size.
+    dl_stream_end returns the total number of rows pushed and frees the
+    stream.
+*/
+struct DLStream;
+struct DLStream* dl_stream_begin (const struct DLSimulator* simulator, enum DLPixelFormat format, size_t width);
+void dl_stream_push_rows (struct DLStream* stream, unsigned char* rows, size_t numRows, size_t bytesPerRow);
+void dl_stream_push_rows_to (struct DLStream* stream, const unsigned char* src, unsigned char* dst, size_t numRows, size_t srcBytesPerRow, size_t dstBytesPerRow);
+size_t dl_stream_rows_pushed (const struct DLStream* stream);
+size_t dl_stream_end (struct DLStream* stream);
+
+/*
+    Planar sRGB images, with 'src' and 'dst' pointing to the R, G and B
+    planes (8 bits per pixel). The 3 planes of an image share the same
+    stride, which defaults to 'width'. 'src' and 'dst' can be the same
+    planes. Returns 1 on success, or 0 if one of the enums is invalid.
+*/
+int dl_simulate_cvd_planar (enum DLAlgorithm algorithm, enum DLDeficiency deficiency, float severity, const unsigned char* const src[3], unsigned char* const dst[3], size_t width, size_t height, size_t srcBytesPerRow, size_t dstBytesPerRow);
+
+/*
+    YUV 4:2:0 video frames, as output by most hardware decoders. The chroma
+    planes have (width+1)/2 x (height+1)/2 samples.
+
+    I420: planes[0] is Y, planes[1] is U (Cb) and planes[2] is V (Cr).
+    NV12: planes[0] is Y, planes[1] has interleaved U and V samples, and
+    planes[2] is unused.
+
+    A bytesPerRow of 0 means the plane is tightly packed.
+*/
+enum DLYuvFormat
+{
+    DLYuvFormat_I420,
+    DLYuvFormat_NV12
+};
+
+struct DLYuvImage
+{
+    unsigned char* planes[3];
+    size_t bytesPerRow[3];
+};
+
+/*
+    Simulates CVD on YUV frames using BT.709 with the limited (16-235)
+    range, as for HD video. The YUV to RGB conversion, the simulation and
+    the conversion back to YUV (or to RGBA, with an opaque alpha) happen in
+    a single pass, without any intermediate image.
+
+    The pixels then get the same processing as with dl_simulate_cvd_format
+    on the RGB values decoded from YUV. For the YUV output the chroma of
+    each 2x2 block is averaged after the simulation. 'src' and 'dst' can be
+    the same frame.
+
+    Returns 1 on success, or 0 if one of the enums is invalid.
+*/
+int dl_simulate_cvd_yuv (enum DLAlgorithm algorithm, enum DLYuvFormat format, enum DLDeficiency deficiency, float severity, const struct DLYuvImage* src, const struct DLYuvImage* dst, size_t width, size_t height);
+int dl_simulate_cvd_yuv_to_rgba (enum DLAlgorithm algorithm, enum DLYuvFormat format, enum DLDeficiency deficiency, float severity, const struct DLYuvImage* src, unsigned char* srgba_dst, size_t width, size_t height, size_t dstBytesPerRow);
+
+/*
+    Versions of dl_simulator_apply that memoize the output per 24-bit color,
+    for images with a few hundred distinct colors like UI screenshots. Runs
+    of identical pixels and repeated colors skip the whole computation. The
+    output is identical to dl_simulator_apply.
+
+    This is slower than dl_simulator_apply on photos, so 'stats' (can be
+    NULL) reports how many pixels were served from the cache to help decide
+    when to use it. The cache only lives for the duration of the call.
+*/
+struct DLCacheStats
+{
+    size_t numPixels;
+    size_t numHits;
+};
+void dl_simulator_apply_cached (const struct DLSimulator* simulator, unsigned char* srgba_image, size_t width, size_t height, size_t bytesPerRow, struct DLCacheStats* stats);
+void dl_simulator_apply_cached_to (const struct DLSimulator* simulator, const unsigned char* srgba_src, unsigned char* srgba_dst, size_t width, size_t height, size_t srcBytesPerRow, size_t dstBytesPerRow, struct DLCacheStats* stats);
+
+/*
+    Incremental simulation for overlays that re-simulate the screen every
+    frame. dl_simulator_apply_rects only processes the given rectangles of
+    the image, clipped to its bounds, and leaves the rest of 'dst' alone.
+    When 'src' and 'dst' are the same image the rectangles must not
+    overlap, otherwise some pixels would get simulated twice.
+
+    dl_diff_tiles compares two RGBA32 frames by tiles of tileSize x tileSize
+    pixels (0 for the default of 64) and writes the changed areas to
+    'rects', as non-overlapping rectangles merging the consecutive changed
+    tiles of each tile row. It returns the number of rectangles, at most
+    maxRects, which must be at least 1. If more would be needed, a single
+    rectangle bounding all the changes is returned instead, so the output
+    can always be passed to dl_simulator_apply_rects.
+*/
+struct DLRect
+{
+    size_t x, y;
+    size_t width, height;
+};
+void dl_simulator_apply_rects (const struct DLSimulator* simulator, const unsigned char* srgba_src, unsigned char* srgba_dst, size_t width, size_t height, size_t srcBytesPerRow, size_t dstBytesPerRow, const struct DLRect* rects, size_t numRects);
+size_t dl_diff_tiles (const unsigned char* srgba_previous, const unsigned char* srgba_current, size_t width, size_t height, size_t previousBytesPerRow, size_t currentBytesPerRow, size_t tileSize, struct DLRect* rects, size_t maxRects);
+
+/*
+    Processes many RGBA32 images in one call, e.g. to audit icon sets. The
+    work is split across threads by pixel count rather than by image, so
+    batches of tiny images use all the cores and large images in the same
+    batch don't create stragglers. 'num_threads' follows the conventions
+    of the _mt functions.
+
+    'srgba_dst' can be NULL to process an image in place, dstBytesPerRow
+    is then ignored. The bytesPerRow default to width * 4. Returns 1 on success, or 0 if the
+    allocation of the small index over the images fails.
+*/
+struct DLBatchImage
+{
+    const unsigned char* srgba_src;
+    unsigned char* srgba_dst;
+    size_t width;
+    size_t height;
+    size_t srcBytesPerRow;
+    size_t dstBytesPerRow;
+};
+int dl_simulator_apply_batch (const struct DLSimulator* simulator, const struct DLBatchImage* images, size_t numImages, int num_threads);
+
+/*
+    Bakes a simulator into a 3D color LUT with 'gridSize' points per channel,
+    between 2 and 256.
+
+    With 256 the LUT is a direct 24-bit table (48 MB) that gives exactly
+    the same output as the simulator, and is typically 2x faster to apply
+    than the SIMD simulation kernels. Smaller grids, e.g. 33 or 65, are
+    mostly meant to be exported: they use tetrahedral interpolation between
+    the grid points, which is slower than the simulators on the CPU and only
+    approximates them. With 65 points most values are within ±1, with up to
+    ~10 levels of error in dark colors.
+
+    dl_lut3d_create returns NULL if the allocation fails or the arguments
+    are invalid. The LUT does not reference the simulator after creation.
+    The apply functions follow the same conventions as the corresponding
+    dl_simulate_cvd* functions.
+
+    dl_lut3d_write_cube saves the LUT in the .cube format (Adobe / Resolve)
+    for GPU shaders or ffmpeg's lut3d filter. The input and output are
+    sRGB-encoded values in [0,1]. Returns 1 on success, 0 on failure.
+*/
+struct DLLut3D;
+struct DLLut3D* dl_lut3d_create (const struct DLSimulator* simulator, int gridSize);
+void dl_lut3d_destroy (struct DLLut3D* lut);
+int dl_lut3d_grid_size (const struct DLLut3D* lut);
+void dl_lut3d_apply (const struct DLLut3D* lut, unsigned char* srgba_image, size_t width, size_t height, size_t bytesPerRow);
+void dl_lut3d_apply_to (const struct DLLut3D* lut, const unsigned char* srgba_src, unsigned char* srgba_dst, size_t width, size_t height, size_t srcBytesPerRow, size_t dstBytesPerRow);
+void dl_lut3d_apply_mt (const struct DLLut3D* lut, unsigned char* srgba_image, size_t width, size_t height, size_t bytesPerRow, int num_threads);
+int dl_lut3d_apply_format (const struct DLLut3D* lut, enum DLPixelFormat format, const unsigned char* src, unsigned char* dst, size_t width, size_t height, size_t srcBytesPerRow, size_t dstBytesPerRow);
+int dl_lut3d_write_cube (const struct DLLut3D* lut, const char* path);
+
+/*
+    Shader sources to run a simulator on the GPU, on textures that are
+    already there. The output defines these functions, with the parameters
+    of the simulator (including the severity) baked in as constants:
+
+        float3 dl_simulate_cvd (float3 srgb);
+        float3 dl_simulate_cvd_linear (float3 linear_rgb);
+        float3 dl_linearRGB_from_sRGB (float3 srgb);
+        float3 dl_sRGB_from_linearRGB (float3 linear_rgb);
+
+    with the float3 type of the language (vec3, float3 or vec3<f32>). Use
+    dl_simulate_cvd_linear when sampling sRGB textures that the GPU already
+    decodes. The transfer functions are the textbook ones, so the output
+    can differ by ±1 from the CPU kernels.
+
+    Writes up to bufferSize - 1 characters plus a terminating null, and
+    returns the length of the full source like snprintf, so it can be
+    called with a NULL buffer first to get the size. Returns 0 if
+    'language' is invalid.
+*/
+enum DLShaderLanguage
+{
+    DLShaderLanguage_GLSL,
+    DLShaderLanguage_HLSL,
+    DLShaderLanguage_MSL,
+    DLShaderLanguage_WGSL
+};
+size_t dl_simulator_shader_source (const struct DLSimulator* simulator, enum DLShaderLanguage language, char* buffer, size_t bufferSize);
+
+/*
+    Hook to run the multi-threaded functions on an external task scheduler
+    (e.g. a work-stealing pool) instead of the internal threads.
+
+    The library splits the work into chunks indexed in [begin, end) and calls
+    'parallel_for' once per multi-threaded call. It should call 'func' with
+    'func_ctx' on sub-ranges covering [begin, end) exactly once, possibly in
+    parallel, and only return once all of them are done.
+
+    'num_threads' is then only used to decide in how many chunks to split
+    the image. Pass NULL to go back to the internal pool. This is a global
+    setting, it should not be changed while simulations are running.
+*/
+typedef void (*DLRangeFunc) (void* func_ctx, size_t begin, size_t end);
+typedef void (*DLParallelFor) (void* scheduler_ctx, size_t begin, size_t end, DLRangeFunc func, void* func_ctx);
+void dl_set_parallel_for (DLParallelFor parallel_for, void* scheduler_ctx);
+
+/*
+    Stops and joins the threads of the internal pool, e.g. before unloading
+    the library. The next multi-threaded call will create them again.
+*/
+void dl_release_threads (void);
+
+/*
+    Memory allocation
+
+    Only these functions allocate: dl_simulator_create, dl_daltonizer_create,
+    dl_stream_begin, dl_lut3d_create (plus a 256 KB slice while baking the
+    direct LUT) and dl_simulator_apply_batch (an array of numImages + 1
+    offsets per call). Everything else, including the multi-threaded, alpha
+    and wide sample functions, only uses the stack and the caller buffers.
+    The internal thread pool creates its threads on the first multi-threaded
+    call, so a render loop that sets up its simulators, LUTs and streams
+    beforehand and calls a multi-threaded function once to warm up does no
+    heap allocation afterwards.
+
+    A context routes these allocations to a custom allocator, e.g. the arena
+    below. It also keeps the scratch buffers of dl_context_apply_batch and
+    dl_context_create_lut3d for the next calls, so repeated batches only
+    allocate until they reach their largest size. A NULL allocator uses
+    malloc and free.
+
+    The objects get destroyed with the usual functions, before their
+    context. The dl_context_* functions and the destroy functions of the
+    objects of a context must not be called concurrently, but the objects
+    themselves can be used from several threads as usual. 'allocate' must
+    return memory aligned on 16 bytes, or NULL.
+*/
+struct DLAllocator
+{
+    void* (*allocate) (void* allocator_ctx, size_t size);
+    void (*deallocate) (void* allocator_ctx, void* ptr);
+    void* allocator_ctx;
+};
+
+struct DLContext;
+struct DLContext* dl_context_create (const struct DLAllocator* allocator);
+void dl_context_destroy (struct DLContext* context);
+struct DLSimulator* dl_context_create_simulator (struct DLContext* context, enum DLAlgorithm algorithm, enum DLDeficiency deficiency, float severity);
+struct DLSimulator* dl_context_create_daltonizer (struct DLContext* context, enum DLAlgorithm algorithm, enum DLDeficiency deficiency, float severity);
+struct DLStream* dl_context_begin_stream (struct DLContext* context, const struct DLSimulator* simulator, enum DLPixelFormat format, size_t width);
+struct DLLut3D* dl_context_create_lut3d (struct DLContext* context, const struct DLSimulator* simulator, int gridSize);
+int dl_context_apply_batch (struct DLContext* context, const struct DLSimulator* simulator, const struct DLBatchImage* images, size_t numImages, int num_threads);
+
+/*
+    Linear allocator in a caller-provided buffer, for DLAllocator. It fails
+    once the buffer is full, and only reclaims the memory of the most recent
+    allocations (e.g. a stream begun and ended every frame), the rest is
+    freed all at once by dl_arena_reset. 'peak' is the most memory used at
+    any time, to size the buffer.
+*/
+struct DLArena
+{
+    unsigned char* buffer;
+    size_t size;
+    size_t used;
+    size_t peak;
+};
+void dl_arena_init (struct DLArena* arena, void* buffer, size_t size);
+void dl_arena_reset (struct DLArena* arena);
+struct DLAllocator dl_arena_allocator (struct DLArena* arena);
+
+/*
+    Decodes an 8-bit sRGB value to linear RGB in [0,1].
+
+    This is the transfer function used internally by the simulators, exposed
+    so callers can stay consistent with it. It is a simple table lookup.
+*/
+float dl_linearRGB_from_sRGB (unsigned char v);
+
+/*
+    Encodes a linear RGB value to 8-bit sRGB. Values outside [0,1] are
+    clamped, and NaN gives 0.
+
+    This uses a piecewise-linear approximation of the pow segment of the
+    curve that stays within ±1 of the textbook powf implementation.
+*/
+unsigned char dl_sRGB_from_linearRGB (float v);
+
+/*
+    Forces all the simulation functions to use the given kernel, e.g. for
+    benchmarking or to bisect correctness issues. DLKernel_Auto restores
+    the automatic detection.
+
+    Returns 1 on success, or 0 if the kernel is not supported by this CPU or
+    build, in which case the current selection is unchanged.
+
+    This is a global setting, it should not be called while other threads
+    are running simulations.
+*/
+int dl_force_kernel (enum DLKernel kernel);
+
+/*
+    Returns the kernel currently used by the simulation functions. Never
+    returns DLKernel_Auto.
+*/
+enum DLKernel dl_get_kernel (void);
+
+/*
+    Instrumentation, only compiled in when building libDaltonLens.c with
+    DL_ENABLE_STATS defined. Otherwise these functions do nothing, and the
+    simulation code is exactly the same as without them.
+
+    dl_stats_begin makes the following calls from the current thread add
+    their counters to 'stats', including the rows they hand to other
+    threads, until dl_stats_end. 'stats' is not reset, so it can accumulate
+    over several scopes. Returns 0 if the instrumentation is not compiled in.
+
+    The counters cover the 8-bit formats. They are not taken from the
+    kernels that produce the output: a separate pass replays the scalar
+    reference simulation on the input, so instrumented builds do about
+    twice the work. The counts are the same whichever kernel or accuracy
+    mode runs, since those only change the rounding of the sRGB encoding,
+    but 3D LUTs only count pixels, and severity maps count the channels at
+    full severity:
+
+    - numClippedChannels counts the simulated linear RGB channels that fall
+      outside of [0,1] before the sRGB encoding (v <= 0 or v >= 1).
+    - numBrettelPlane1 / numBrettelPlane2 count the pixels projected on each
+      half-plane by Brettel 1997 (rgbCvdFromRgb_1 or _2).
+    - kernel is the kernel of the last processed rows.
+    - processingSeconds is the time spent in the simulation loops, summed
+      over all the threads, and wallSeconds the time between dl_stats_begin
+      and dl_stats_end.
+
+    Multi-threaded calls do not include any fixed cost like waking up the
+    thread pool in processingSeconds, so the difference with wallSeconds
+    shows the overhead. There are no timers for the decoding, matrix and
+    encoding stages, they are fused in the kernels. Wide sample formats
+    and the cached functions only count pixels.
+*/
+struct DLStats
+{
+    size_t numPixels;
+    size_t numClippedChannels;
+    size_t numBrettelPlane1;
+    size_t numBrettelPlane2;
+    enum DLKernel kernel;
+    double processingSeconds;
+    double wallSeconds;
+};
+int dl_stats_begin (struct DLStats* stats);
+void dl_stats_end (void);
+
+/*
+    Tracing callbacks for profilers like Perfetto or Tracy, also only
+    called when DL_ENABLE_STATS is defined. 'begin' and 'end' are called on
+    the thread doing the work around each band of rows ("dl_rows") and each
+    part of a batch ("dl_batch"). 'name' is a static string.
+
+    Pass NULL to remove them. This is a global setting, it should not be
+    changed while simulations are running.
+*/
+typedef void (*DLTraceFunc) (void* trace_ctx, const char* name);
+void dl_set_trace_callbacks (DLTraceFunc begin, DLTraceFunc end, void* trace_ctx);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // LIB_DALTON_LENS_H
@@ -0,0 +1,357 @@
+/* libDaltonLens - public domain library - http://daltonlens.org
+                                  no warranty implied; use at your own risk
+
+    Author: Nicolas Burrus <nicolas@burrus.name>
+
+    This is free and unencumbered software released into the public domain.
+    See libDaltonLens.h for the full license.
+*/
+
+/*
+    Header-only C++17 front end, for when the algorithm, the deficiency and
+    the pixel format are known at compile time:
+
+        dl::simulate<DLAlgorithm_Auto, DLDeficiency_Protan>(severity, srgba_image, width, height);
+        dl::simulate_to<DLAlgorithm_Brettel1997, DLDeficiency_Tritan, DLPixelFormat_BGRA32>(severity, src, dst, width, height);
+
+    The parameters are constexpr, so each instantiation is a straight-line
+    kernel with the matrices folded into the code. The severity selects the
+    specialization once per call instead of being checked on every pixel:
+    a full severity skips the interpolation and a zero severity skips the
+    matrices. The tables and the arithmetic are the same as the scalar
+    kernels of libDaltonLens.c, so the output is identical to the
+    corresponding C functions. Only the enums of libDaltonLens.h are used,
+    there is nothing to link.
+
+    The runtime-dispatched SIMD kernels of the C library are still faster
+    on large images, this is meant to remove the per-call overhead on
+    small ones and to let the compiler inline the whole pipeline.
+*/
+
+#ifndef LIB_DALTON_LENS_HPP
+#define LIB_DALTON_LENS_HPP
+
+#include "libDaltonLens.h"
+
+#include <cstdint>
+#include <cstring>
+
+namespace dl
+{
+
+enum class SeverityMode
+{
+    // Severity of 1, no interpolation with the original image.
+    Full,
+    // Severity of 0, only the sRGB decoding / encoding round trip.
+    Zero,
+    // Any other severity, interpolated with the original image.
+    Partial
+};
+
+namespace detail
+{
+
+// Same values as dl_linearRGB_from_sRGB_table in libDaltonLens.c.
+inline constexpr float linearRGB_from_sRGB_table[256] = {
+    0.f, 0.000303526991f, 0.000607053982f, 0.000910580973f, 0.00121410796f, 0.00151763496f, 0.00182116195f, 0.00212468882f,
+    0.00242821593f, 0.00273174304f, 0.00303526991f, 0.00334653561f, 0.00367650692f, 0.00402471703f, 0.00439144205f, 0.00477695325f,
+    0.00518151699f, 0.00560539169f, 0.00604883255f, 0.00651209103f, 0.00699541019f, 0.00749903172f, 0.00802319217f, 0.00856812485f,
+    0.00913405698f, 0.00972121768f, 0.010329823f, 0.0109600937f, 0.0116122449f, 0.012286487f, 0.0129830306f, 0.0137020806f,
+    0.0144438436f, 0.0152085144f, 0.0159962922f, 0.0168073755f, 0.0176419523f, 0.0185002182f, 0.0193823613f, 0.0202885624f,
+    0.0212190095f, 0.0221738834f, 0.0231533647f, 0.0241576303f, 0.0251868572f, 0.0262412224f, 0.0273208916f, 0.0284260381f,
+    0.0295568332f, 0.0307134409f, 0.0318960287f, 0.0331047624f, 0.0343398079f, 0.0356013142f, 0.036889445f, 0.0382043645f,
+    0.0395462364f, 0.0409151986f, 0.0423114114f, 0.0437350273f, 0.045186203f, 0.0466650836f, 0.048171822f, 0.0497065634f,
+    0.0512694679f, 0.0528606549f, 0.0544802807f, 0.0561284944f, 0.0578054339f, 0.0595112406f, 0.061246071f, 0.0630100295f,
+    0.0648032799f, 0.0666259527f, 0.068478182f, 0.0703601092f, 0.0722718611f, 0.0742135793f, 0.0761853904f, 0.0781874284f,
+    0.0802198276f, 0.0822827145f, 0.0843762159f, 0.0865004659f, 0.0886556059f, 0.0908417329f, 0.093058981f, 0.0953074843f,
+    0.0975873619f, 0.0998987406f, 0.102241747f, 0.104616493f, 0.107023112f, 0.109461717f, 0.111932434f, 0.114435382f,
+    0.116970673f, 0.119538434f, 0.122138798f, 0.124771841f, 0.127437696f, 0.13013649f, 0.132868335f, 0.135633349f,
+    0.138431624f, 0.141263306f, 0.144128487f, 0.147027284f, 0.149959803f, 0.152926162f, 0.155926466f, 0.158960864f,
+    0.1620294f, 0.165132225f, 0.168269396f, 0.171441093f, 0.174647391f, 0.177888408f, 0.181164235f, 0.18447499f,
+    0.187820762f, 0.191201672f, 0.194617808f, 0.198069304f, 0.201556236f, 0.205078706f, 0.20863685f, 0.212230727f,
+    0.215860531f, 0.219526231f, 0.223227978f, 0.226965889f, 0.23074007f, 0.234550655f, 0.238397658f, 0.242281199f,
+    0.246201396f, 0.25015837f, 0.254152179f, 0.258182913f, 0.262250721f, 0.266355664f, 0.270497859f, 0.274677366f,
+    0.278894335f, 0.283148795f, 0.287440896f, 0.291770697f, 0.296138316f, 0.300543845f, 0.304987371f, 0.309468955f,
+    0.313988745f, 0.318546832f, 0.323143244f, 0.327778131f, 0.332451582f, 0.337163657f, 0.341914445f, 0.346704096f,
+    0.351532698f, 0.356400251f, 0.361306876f, 0.366252691f, 0.371237785f, 0.376262218f, 0.381326109f, 0.386429518f,
+    0.391572565f, 0.396755308f, 0.401977867f, 0.407240301f, 0.412542701f, 0.417885154f, 0.423267752f, 0.428690553f,
+    0.434153706f, 0.439657241f, 0.445201248f, 0.450785846f, 0.456411064f, 0.462077051f, 0.467783839f, 0.473531544f,
+    0.479320228f, 0.48514998f, 0.491020888f, 0.496933043f, 0.502886593f, 0.50888145f, 0.514917791f, 0.520995677f,
+    0.527115226f, 0.533276498f, 0.539479613f, 0.545724571f, 0.55201149f, 0.55834049f, 0.56471163f, 0.571124911f,
+    0.577580512f, 0.584078491f, 0.590618908f, 0.597201884f, 0.603827417f, 0.610495627f, 0.617206633f, 0.623960435f,
+    0.630757213f, 0.637596965f, 0.644479752f, 0.651405692f, 0.658374846f, 0.665387332f, 0.672443211f, 0.679542542f,
+    0.686685443f, 0.693871915f, 0.701102018f, 0.708375931f, 0.715693653f, 0.723055243f, 0.730460882f, 0.737910569f,
+    0.745404363f, 0.752942324f, 0.760524631f, 0.768151283f, 0.775822341f, 0.783537924f, 0.791298032f, 0.799102843f,
+    0.806952357f, 0.814846694f, 0.822785854f, 0.830769956f, 0.838799119f, 0.846873283f, 0.854992688f, 0.863157272f,
+    0.871367216f, 0.87962234f, 0.887923181f, 0.896269381f, 0.904661357f, 0.913098693f, 0.921582043f, 0.930110872f,
+    0.938685894f, 0.947306573f, 0.955973506f, 0.964686275f, 0.973445475f, 0.982250571f, 0.991102219f, 1.f
+};
+
+// Same values as dl_sRGB_from_linearRGB_table in libDaltonLens.c.
+inline constexpr float sRGB_from_linearRGB_table[9*32 + 1] = {
+    5.97040276f, 6.22842489f, 6.48192521f, 6.73111256f, 6.97618049f, 7.21730876f, 7.45466468f, 7.68840427f,
+    7.91867328f, 8.14560812f, 8.36933667f, 8.58997899f, 8.80764796f, 9.02244989f, 9.23448504f, 9.44384803f,
+    9.65062837f, 9.85491072f, 10.0567753f, 10.2562984f, 10.4535521f, 10.6486052f, 10.8415231f, 11.0323681f,
+    11.2211995f, 11.408074f, 11.5930457f, 11.7761662f, 11.9574851f, 12.1370495f, 12.3149049f, 12.4910947f,
+    12.6656605f, 13.0100787f, 13.3484611f, 13.6810863f, 14.0082127f, 14.3300803f, 14.6469125f, 14.9589174f,
+    15.2662896f, 15.5692113f, 15.8678531f, 16.1623753f, 16.4529285f, 16.7396547f, 17.0226876f, 17.3021537f,
+    17.5781723f, 17.8508565f, 18.1203135f, 18.3866448f, 18.6499469f, 18.9103115f, 19.1678261f, 19.4225736f,
+    19.6746333f, 19.9240808f, 20.1709884f, 20.415425f, 20.6574566f, 20.8971464f, 21.1345548f, 21.3697399f,
+    21.6027574f, 22.0625005f, 22.5141868f, 22.9581881f, 23.3948496f, 23.8244913f, 24.2474115f, 24.6638881f,
+    25.0741808f, 25.4785327f, 25.8771717f, 26.2703116f, 26.6581536f, 27.0408871f, 27.4186908f, 27.7917333f,
+    28.1601739f, 28.5241637f, 28.8838456f, 29.2393552f, 29.5908213f, 29.9383665f, 30.2821071f, 30.6221542f,
+    30.9586136f, 31.2915861f, 31.6211681f, 31.9474518f, 32.2705253f, 32.5904728f, 32.907375f, 33.2213095f,
+    33.5323505f, 34.146034f, 34.7489627f, 35.3416335f, 35.9245065f, 36.4980094f, 37.0625401f, 37.6184697f,
+    38.1661448f, 38.7058898f, 39.238009f, 39.7627878f, 40.2804948f, 40.7913828f, 41.2956902f, 41.7936421f,
+    42.2854514f, 42.7713195f, 43.2514371f, 43.7259855f, 44.1951366f, 44.6590537f, 45.1178924f, 45.5718008f,
+    46.0209202f, 46.4653852f, 46.9053244f, 47.3408609f, 47.7721122f, 48.1991909f, 48.6222046f, 49.0412569f,
+    49.4564467f, 50.2756159f, 51.0804293f, 51.8715498f, 52.649592f, 53.4151265f, 54.1686846f, 54.9107616f,
+    55.6418201f, 56.3622933f, 57.0725872f, 57.7730829f, 58.4641388f, 59.1460924f, 59.819262f, 60.4839481f,
+    61.1404347f, 61.7889908f, 62.429871f, 63.0633171f, 63.6895586f, 64.3088136f, 64.9212898f, 65.5271849f,
+    66.1266873f, 66.7199769f, 67.3072254f, 67.8885968f, 68.4642483f, 69.0343298f, 69.5989855f, 70.1583532f,
+    70.7125651f, 71.8060248f, 72.8803217f, 73.936341f, 74.9749027f, 75.9967687f, 77.002648f, 77.9932019f,
+    78.969048f, 79.9307643f, 80.8788929f, 81.8139425f, 82.7363914f, 83.6466903f, 84.545264f, 85.4325134f,
+    86.308818f, 87.1745364f, 88.0300089f, 88.875558f, 89.7114901f, 90.5380964f, 91.355654f, 92.1644269f,
+    92.9646666f, 93.7566132f, 94.5404959f, 95.3165337f, 96.0849361f, 96.8459037f, 97.5996286f, 98.3462949f,
+    99.0860791f, 100.545673f, 101.979687f, 103.389304f, 104.775617f, 106.139645f, 107.482332f, 108.804563f,
+    110.107161f, 111.390899f, 112.656499f, 113.90464f, 115.135962f, 116.351065f, 117.550517f, 118.734853f,
+    119.904579f, 121.060174f, 122.202093f, 123.330766f, 124.446601f, 125.549988f, 126.641297f, 127.720879f,
+    128.789071f, 129.846193f, 130.892551f, 131.928437f, 132.954131f, 133.969901f, 134.976003f, 135.972683f,
+    136.960176f, 138.9085f, 140.822679f, 142.704292f, 144.554798f, 146.375557f, 148.16783f, 149.932796f,
+    151.671556f, 153.38514f, 155.074513f, 156.740582f, 158.384199f, 160.006167f, 161.607244f, 163.188142f,
+    164.74954f, 166.292075f, 167.816353f, 169.32295f, 170.812412f, 172.285257f, 173.741979f, 175.183049f,
+    176.608914f, 178.020002f, 179.416722f, 180.799464f, 182.168602f, 183.524492f, 184.867477f, 186.197885f,
+    187.516031f, 190.116731f, 192.671854f, 195.183505f, 197.653635f, 200.084056f, 202.476453f, 204.832401f,
+    207.153367f, 209.440727f, 211.695769f, 213.919705f, 216.11367f, 218.278738f, 220.415918f, 222.526165f,
+    224.61038f, 226.669417f, 228.704085f, 230.715151f, 232.703344f, 234.669356f, 236.613847f, 238.537444f,
+    240.440746f, 242.324323f, 244.18872f, 246.03446f, 247.862039f, 249.671935f, 251.464605f, 253.240487f,
+    255.f
+};
+
+inline float linearRGB_from_sRGB (unsigned char v)
+{
+    return linearRGB_from_sRGB_table[v];
+}
+
+inline unsigned char sRGB_from_linearRGB (float v)
+{
+    if (v <= 0.f) return 0;
+    if (v >= 1.f) return 255;
+    if (v < 0.0031308f) return static_cast<unsigned char>(0.5f + v * (12.92f * 255.f));
+
+    std::uint32_t bits;
+    std::memcpy (&bits, &v, sizeof(float));
+    const std::uint32_t index = (bits >> 18) - ((127 - 9) << 5);
+    const float t = (bits & 0x3ffff) * (1.f / 262144.f);
+    const float* segment = sRGB_from_linearRGB_table + index;
+    return static_cast<unsigned char>(segment[0] + t*(segment[1] - segment[0]));
+}
+
+struct Brettel1997Params
+{
+    float rgbCvdFromRgb_1[9];
+    float rgbCvdFromRgb_2[9];
+    float separationPlaneNormalInRgb[3];
+};
+
+// Indexed by DLDeficiency.
+inline constexpr Brettel1997Params brettel1997Params[3] = {
+    {
+        {
+            0.14980, 1.19548, -0.34528,
+            0.10764, 0.84864, 0.04372,
+            0.00384, -0.00540, 1.00156,
+        },
+        {
+            0.14570, 1.16172, -0.30742,
+            0.10816, 0.85291, 0.03892,
+            0.00386, -0.00524, 1.00139,
+        },
+        { 0.00048, 0.00393, -0.00441 }
+    },
+    {
+        {
+            0.36477, 0.86381, -0.22858,
+            0.26294, 0.64245, 0.09462,
+            -0.02006, 0.02728, 0.99278,
+        },
+        {
+            0.37298, 0.88166, -0.25464,
+            0.25954, 0.63506, 0.10540,
+            -0.01980, 0.02784, 0.99196,
+        },
+        { -0.00281, -0.00611, 0.00892 }
+    },
+    {
+        {
+            1.01277, 0.13548, -0.14826,
+            -0.01243, 0.86812, 0.14431,
+            0.07589, 0.80500, 0.11911,
+        },
+        {
+            0.93678, 0.18979, -0.12657,
+            0.06154, 0.81526, 0.12320,
+            -0.37562, 1.12767, 0.24796,
+        },
+        { 0.03901, -0.02788, -0.01113 }
+    },
+};
+
+// Indexed by DLDeficiency. Viénot 1999 is not accurate for tritanopia.
+inline constexpr float vienot1999RgbCvdFromRgb[3][9] = {
+    {
+        0.11238, 0.88762, 0.00000,
+        0.11238, 0.88762, -0.00000,
+        0.00401, -0.00401, 1.00000
+    },
+    {
+        0.29275, 0.70725, 0.00000,
+        0.29275, 0.70725, -0.00000,
+        -0.02234, 0.02234, 1.00000
+    },
+    {
+        1.00000, 0.14461, -0.14461,
+        0.00000, 0.85924, 0.14076,
+        -0.00000, 0.85924, 0.14076
+    },
+};
+
+struct PixelLayout
+{
+    int pixelSize;
+    int r, g, b;
+    // Offset of the byte to copy as is, -1 if there is none.
+    int a;
+};
+
+// Indexed by DLPixelFormat, same as dl_pixel_layouts.
+inline constexpr PixelLayout pixelLayouts[] = {
+    /* DLPixelFormat_RGBA32 */ { 4, 0, 1, 2, 3 },
+    /* DLPixelFormat_BGRA32 */ { 4, 2, 1, 0, 3 },
+    /* DLPixelFormat_ARGB32 */ { 4, 1, 2, 3, 0 },
+    /* DLPixelFormat_RGBX32 */ { 4, 0, 1, 2, 3 },
+    /* DLPixelFormat_RGB24 */  { 3, 0, 1, 2, -1 },
+    /* DLPixelFormat_BGR24 */  { 3, 2, 1, 0, -1 },
+};
+
+// Same choice as dl_simulate_cvd.
+template <DLAlgorithm Algorithm, DLDeficiency Deficiency>
+inline constexpr DLAlgorithm resolvedAlgorithm =
+    Algorithm != DLAlgorithm_Auto ? Algorithm
+    : (Deficiency == DLDeficiency_Tritan ? DLAlgorithm_Brettel1997 : DLAlgorithm_Vienot1999);
+
+inline void matrix_product (const float* m, const float rgb[3], float rgb_cvd[3])
+{
+    rgb_cvd[0] = m[0]*rgb[0] + m[1]*rgb[1] + m[2]*rgb[2];
+    rgb_cvd[1] = m[3]*rgb[0] + m[4]*rgb[1] + m[5]*rgb[2];
+    rgb_cvd[2] = m[6]*rgb[0] + m[7]*rgb[1] + m[8]*rgb[2];
+}
+
+template <DLAlgorithm Algorithm, DLDeficiency Deficiency, SeverityMode Mode>
+inline void simulate_pixel (float severity, const float rgb[3], float rgb_cvd[3])
+{
+    if constexpr (Mode == SeverityMode::Zero)
+    {
+        rgb_cvd[0] = rgb[0];
+        rgb_cvd[1] = rgb[1];
+        rgb_cvd[2] = rgb[2];
+    }
+    else if constexpr (Algorithm == DLAlgorithm_Brettel1997)
+    {
+        constexpr const Brettel1997Params& params = brettel1997Params[Deficiency];
+        constexpr const float* n = params.separationPlaneNormalInRgb;
+        const float dotWithSepPlane = rgb[0]*n[0] + rgb[1]*n[1] + rgb[2]*n[2];
+        matrix_product (dotWithSepPlane >= 0 ? params.rgbCvdFromRgb_1 : params.rgbCvdFromRgb_2, rgb, rgb_cvd);
+        if constexpr (Mode == SeverityMode::Partial)
+        {
+            rgb_cvd[0] = rgb_cvd[0]*severity + rgb[0]*(1.f-severity);
+            rgb_cvd[1] = rgb_cvd[1]*severity + rgb[1]*(1.f-severity);
+            rgb_cvd[2] = rgb_cvd[2]*severity + rgb[2]*(1.f-severity);
+        }
+    }
+    else
+    {
+        matrix_product (vienot1999RgbCvdFromRgb[Deficiency], rgb, rgb_cvd);
+        if constexpr (Mode == SeverityMode::Partial)
+        {
+            rgb_cvd[0] = severity*rgb_cvd[0] + (1.f - severity)*rgb[0];
+            rgb_cvd[1] = severity*rgb_cvd[1] + (1.f - severity)*rgb[1];
+            rgb_cvd[2] = severity*rgb_cvd[2] + (1.f - severity)*rgb[2];
+        }
+    }
+}
+
+} // namespace detail
+
+/*
+    The kernel for one compile-time severity mode. dl::simulate_to picks it
+    from the runtime severity, call this directly to skip that check too.
+    'severity' is only used by SeverityMode::Partial. The strides follow
+    the conventions of dl_simulate_cvd_format.
+*/
+template <DLAlgorithm Algorithm, DLDeficiency Deficiency, DLPixelFormat Format, SeverityMode Mode>
+void simulate_rows (float severity, const unsigned char* src, unsigned char* dst, size_t width, size_t height, size_t srcBytesPerRow = 0, size_t dstBytesPerRow = 0)
+{
+    constexpr DLAlgorithm algorithm = detail::resolvedAlgorithm<Algorithm, Deficiency>;
+    constexpr detail::PixelLayout layout = detail::pixelLayouts[Format];
+    static_assert (Deficiency >= DLDeficiency_Protan && Deficiency <= DLDeficiency_Tritan, "invalid deficiency");
+    static_assert (Format >= DLPixelFormat_RGBA32 && Format <= DLPixelFormat_BGR24, "invalid pixel format");
+
+    if (srcBytesPerRow == 0) srcBytesPerRow = width * layout.pixelSize;
+    if (dstBytesPerRow == 0) dstBytesPerRow = width * layout.pixelSize;
+
+    for (size_t row = 0; row < height; ++row)
+    {
+        const unsigned char* srcPx = src + row*srcBytesPerRow;
+        unsigned char* dstPx = dst + row*dstBytesPerRow;
+        for (size_t col = 0; col < width; ++col, srcPx += layout.pixelSize, dstPx += layout.pixelSize)
+        {
+            const float rgb[3] = {
+                detail::linearRGB_from_sRGB(srcPx[layout.r]),
+                detail::linearRGB_from_sRGB(srcPx[layout.g]),
+                detail::linearRGB_from_sRGB(srcPx[layout.b]),
+            };
+
+            float rgb_cvd[3];
+            detail::simulate_pixel<algorithm, Deficiency, Mode>(severity, rgb, rgb_cvd);
+
+            // Read it first, srcPx and dstPx can be the same.
+            unsigned char a = 0;
+            if constexpr (layout.a >= 0) a = srcPx[layout.a];
+            dstPx[layout.r] = detail::sRGB_from_linearRGB(rgb_cvd[0]);
+            dstPx[layout.g] = detail::sRGB_from_linearRGB(rgb_cvd[1]);
+            dstPx[layout.b] = detail::sRGB_from_linearRGB(rgb_cvd[2]);
+            if constexpr (layout.a >= 0) dstPx[layout.a] = a;
+        }
+    }
+}
+
+/*
+    Same output as dl_simulate_cvd_format with the same algorithm (or
+    dl_simulate_cvd_to and the variants for RGBA32).
+*/
+template <DLAlgorithm Algorithm, DLDeficiency Deficiency, DLPixelFormat Format = DLPixelFormat_RGBA32>
+void simulate_to (float severity, const unsigned char* src, unsigned char* dst, size_t width, size_t height, size_t srcBytesPerRow = 0, size_t dstBytesPerRow = 0)
+{
+    // The C kernels skip the interpolation from 0.999 for Viénot, and only
+    // at exactly 1 for Brettel.
+    constexpr DLAlgorithm algorithm = detail::resolvedAlgorithm<Algorithm, Deficiency>;
+    const bool full = (algorithm == DLAlgorithm_Vienot1999) ? severity >= 0.999f : severity >= 1.f;
+    if (full)
+        simulate_rows<algorithm, Deficiency, Format, SeverityMode::Full>(severity, src, dst, width, height, srcBytesPerRow, dstBytesPerRow);
+    else if (severity == 0.f)
+        simulate_rows<algorithm, Deficiency, Format, SeverityMode::Zero>(severity, src, dst, width, height, srcBytesPerRow, dstBytesPerRow);
+    else
+        simulate_rows<algorithm, Deficiency, Format, SeverityMode::Partial>(severity, src, dst, width, height, srcBytesPerRow, dstBytesPerRow);
+}
+
+template <DLAlgorithm Algorithm, DLDeficiency Deficiency, DLPixelFormat Format = DLPixelFormat_RGBA32>
+void simulate (float severity, unsigned char* image, size_t width, size_t height, size_t bytesPerRow = 0)
+{
+    simulate_to<Algorithm, Deficiency, Format>(severity, image, image, width, height, bytesPerRow, bytesPerRow);
+}
+
+} // namespace dl
+
+#endif // LIB_DALTON_LENS_HPP
@@ -0,0 +1,190 @@
+#include <libDaltonLens.h>
+
+#define SOKOL_TIME_IMPL
+#include "sokol_time.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+
+    Micro-benchmarks of every algorithm, deficiency and severity regime,
+    across image sizes and kernels. The results are written as JSON to
+    stdout (or to the file given with --output) to track regressions, the
+    progress goes to stderr.
+
+    Usage: bench_simulation [--quick] [--output results.json]
+
+    Each configuration is timed over at least minSamples calls and
+    minSeconds, the image being restored from the source before each call
+    without counting it. Build with -DCMAKE_BUILD_TYPE=Release, the default
+    CMake configuration doesn't enable the optimizations.
+
+*/
+
+struct BenchSize
+{
+    int width;
+    int height;
+    const char* label;
+};
+
+// From L1-resident to far larger than the last level cache.
+static const struct BenchSize sizes[] = {
+    { 64, 64, "L1" },
+    { 256, 256, "L2" },
+    { 1024, 1024, "LLC" },
+    { 4096, 4096, "DRAM" },
+};
+
+static const char* kernelNames[] = { "auto", "scalar", "sse4.1", "avx2", "neon", "wasm-simd128" };
+static const char* deficiencyNames[] = { "protan", "deutan", "tritan" };
+static const char* algorithmNames[] = { "auto", "brettel1997", "vienot1999" };
+
+// 1 is the regular path, and below 0.999 the interpolation with the
+// original image kicks in.
+static const float severities[] = { 1.f, 0.5f };
+
+// Single thread for the kernels alone, 0 for all the hardware threads.
+static const int threadCounts[] = { 1, 0 };
+
+static int compare_doubles (const void* a, const void* b)
+{
+    const double da = *(const double*)a, db = *(const double*)b;
+    return (da > db) - (da < db);
+}
+
+static void simulate (enum DLAlgorithm algorithm, enum DLDeficiency deficiency, float severity, unsigned char* image, int width, int height, int num_threads)
+{
+    if (algorithm == DLAlgorithm_Brettel1997)
+    {
+        if (num_threads == 1)
+            dl_simulate_cvd_brettel1997(deficiency, severity, image, width, height, 0);
+        else
+            dl_simulate_cvd_brettel1997_mt(deficiency, severity, image, width, height, 0, num_threads);
+    }
+    else
+    {
+        if (num_threads == 1)
+            dl_simulate_cvd_vienot1999(deficiency, severity, image, width, height, 0);
+        else
+            dl_simulate_cvd_vienot1999_mt(deficiency, severity, image, width, height, 0, num_threads);
+    }
+}
+
+int main (int argc, char** argv)
+{
+    int minSamples = 20;
+    double minSeconds = 0.2;
+    FILE* output = stdout;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--quick") == 0)
+        {
+            minSamples = 3;
+            minSeconds = 0.02;
+        }
+        else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+        {
+            output = fopen(argv[++i], "w");
+            if (output == NULL)
+            {
+                fprintf (stderr, "Could not open %s\n", argv[i]);
+                return 1;
+            }
+        }
+        else
+        {
+            fprintf (stderr, "Usage: %s [--quick] [--output results.json]\n", argv[0]);
+            return 1;
+        }
+    }
+
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(__OPTIMIZE__)
+    fprintf (stderr, "WARNING: built without optimizations, the results are not meaningful.\n");
+#endif
+
+    stm_setup ();
+
+    const struct BenchSize* largest = &sizes[sizeof(sizes)/sizeof(sizes[0]) - 1];
+    const size_t maxBytes = (size_t)largest->width * largest->height * 4;
+    unsigned char* source = malloc(maxBytes);
+    unsigned char* image = malloc(maxBytes);
+
+    // Enough room for the samples of the smallest size.
+    const int maxSamples = 1 << 20;
+    double* samples = malloc(maxSamples * sizeof(double));
+    if (source == NULL || image == NULL || samples == NULL)
+    {
+        fprintf (stderr, "Could not allocate the buffers\n");
+        return 1;
+    }
+
+    srand (42);
+    for (size_t i = 0; i < maxBytes; ++i)
+        source[i] = rand() % 256;
+
+    fprintf (output, "{\n  \"library\": \"libDaltonLens\",\n  \"results\": [");
+    int numResults = 0;
+
+    for (int kernel = DLKernel_Scalar; kernel <= DLKernel_WasmSIMD128; ++kernel)
+    {
+        if (!dl_force_kernel(kernel))
+            continue;
+
+        for (size_t s = 0; s < sizeof(sizes)/sizeof(sizes[0]); ++s)
+        for (size_t t = 0; t < sizeof(threadCounts)/sizeof(threadCounts[0]); ++t)
+        for (int algorithm = DLAlgorithm_Brettel1997; algorithm <= DLAlgorithm_Vienot1999; ++algorithm)
+        for (int deficiency = DLDeficiency_Protan; deficiency <= DLDeficiency_Tritan; ++deficiency)
+        for (size_t v = 0; v < sizeof(severities)/sizeof(severities[0]); ++v)
+        {
+            const int w = sizes[s].width, h = sizes[s].height;
+            const size_t numBytes = (size_t)w * h * 4;
+
+            // Warm up the caches and the thread pool.
+            memcpy (image, source, numBytes);
+            simulate (algorithm, deficiency, severities[v], image, w, h, threadCounts[t]);
+
+            int numSamples = 0;
+            double totalSeconds = 0.;
+            while ((numSamples < minSamples || totalSeconds < minSeconds) && numSamples < maxSamples)
+            {
+                memcpy (image, source, numBytes);
+                const uint64_t timeStart = stm_now();
+                simulate (algorithm, deficiency, severities[v], image, w, h, threadCounts[t]);
+                samples[numSamples] = stm_ms(stm_since(timeStart));
+                totalSeconds += samples[numSamples] / 1000.;
+                ++numSamples;
+            }
+
+            qsort (samples, numSamples, sizeof(double), compare_doubles);
+            const double medianMs = samples[numSamples / 2];
+            const double p99Ms = samples[(numSamples * 99) / 100];
+            const double mpixPerSecond = (double)w * h / (medianMs * 1000.);
+
+            fprintf (stderr, "%-7s %-5s threads=%d %-11s %s severity=%.1f: %8.3f ms, %8.1f MPix/s\n",
+                     kernelNames[kernel], sizes[s].label, threadCounts[t], algorithmNames[algorithm],
+                     deficiencyNames[deficiency], severities[v], medianMs, mpixPerSecond);
+
+            fprintf (output, "%s\n    {\"kernel\": \"%s\", \"algorithm\": \"%s\", \"deficiency\": \"%s\", \"severity\": %.2f, "
+                             "\"width\": %d, \"height\": %d, \"threads\": %d, \"samples\": %d, "
+                             "\"median_ms\": %.6f, \"p99_ms\": %.6f, \"mpix_per_s\": %.2f}",
+                     numResults > 0 ? "," : "",
+                     kernelNames[kernel], algorithmNames[algorithm], deficiencyNames[deficiency], severities[v],
+                     w, h, threadCounts[t], numSamples,
+                     medianMs, p99Ms, mpixPerSecond);
+            ++numResults;
+        }
+    }
+
+    fprintf (output, "\n  ]\n}\n");
+
+    dl_force_kernel (DLKernel_Auto);
+    if (output != stdout)
+        fclose (output);
+    free (samples);
+    free (source);
+    free (image);
+    return 0;
+}
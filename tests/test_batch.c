@@ -0,0 +1,246 @@
+#include <libDaltonLens.h>
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/*
+
+    Runs the dl_batch tool (DL_BATCH_PATH) on small PPM, PAM and raw files,
+    in place and into output directories, and compares the pixels with
+    dl_simulator_apply_format. The files go to test_batch/ in the current
+    directory.
+
+*/
+
+#define BATCH_OPTIONS "--quiet --threads 1 --deficiency protan --severity 0.7"
+
+struct TestFile
+{
+    const char* name;
+    const char* header;
+    enum DLPixelFormat format;
+    int width;
+    int height;
+    // Extra arguments of dl_batch.
+    const char* args;
+};
+
+static const struct TestFile testFiles[] = {
+    { "a.ppm", "P6\n# comment\n7 5\n255\n", DLPixelFormat_RGB24, 7, 5, "" },
+    { "b.pam", "P7\nWIDTH 9\nHEIGHT 4\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n", DLPixelFormat_RGBA32, 9, 4, "" },
+    { "c.raw", "", DLPixelFormat_RGBA32, 5, 3, "--raw 5x3" },
+};
+
+static size_t pixel_bytes (const struct TestFile* file)
+{
+    return (size_t)file->width * file->height * (file->format == DLPixelFormat_RGB24 ? 3 : 4);
+}
+
+// The header followed by the pixels, optionally converted.
+static size_t make_file (const struct TestFile* file, int seed, int simulated, unsigned char* data)
+{
+    const size_t headerSize = strlen(file->header);
+    memcpy (data, file->header, headerSize);
+    unsigned char* pixels = data + headerSize;
+    for (size_t i = 0; i < pixel_bytes(file); ++i)
+        pixels[i] = (unsigned char)(i * 37 + seed * 101);
+
+    if (simulated)
+    {
+        struct DLSimulator* simulator = dl_simulator_create(DLAlgorithm_Auto, DLDeficiency_Protan, 0.7f);
+        dl_simulator_apply_format(simulator, file->format, pixels, pixels, file->width, file->height, 0, 0);
+        dl_simulator_destroy(simulator);
+    }
+    return headerSize + pixel_bytes(file);
+}
+
+static int write_file (const char* path, const unsigned char* data, size_t size)
+{
+    FILE* f = fopen(path, "wb");
+    if (f == NULL)
+        return 0;
+    const int ok = fwrite(data, 1, size, f) == size;
+    return fclose(f) == 0 && ok;
+}
+
+// Returns 1 if the file at 'path' contains exactly 'data'.
+static int file_equals (const char* path, const unsigned char* data, size_t size)
+{
+    unsigned char buffer[1024];
+    FILE* f = fopen(path, "rb");
+    if (f == NULL)
+        return 0;
+    const size_t n = fread(buffer, 1, sizeof(buffer), f);
+    fclose (f);
+    return n == size && memcmp(buffer, data, size) == 0;
+}
+
+// Only 'expected' entries, e.g. no temporary file left behind.
+static int directory_has_only (const char* path, int numExpected)
+{
+    DIR* dir = opendir(path);
+    if (dir == NULL)
+        return 0;
+    int numEntries = 0;
+    for (struct dirent* entry = readdir(dir); entry; entry = readdir(dir))
+        numEntries += strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0;
+    closedir (dir);
+    return numEntries == numExpected;
+}
+
+// Returns the exit code of dl_batch, or -1 if it crashed.
+static int run_batch (const char* args)
+{
+    char command[1024];
+    snprintf (command, sizeof(command), "\"%s\" %s %s", DL_BATCH_PATH, BATCH_OPTIONS, args);
+    const int status = system(command);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+int test_conversions ()
+{
+    unsigned char input[1024], expected[1024];
+    char path[256], outPath[256], args[512];
+    int numFailed = 0;
+
+    for (size_t i = 0; i < sizeof(testFiles)/sizeof(testFiles[0]); ++i)
+    {
+        const struct TestFile* file = &testFiles[i];
+        const size_t size = make_file(file, (int)i, 0, input);
+        make_file (file, (int)i, 1, expected);
+
+        // In place.
+        snprintf (path, sizeof(path), "test_batch/in/%s", file->name);
+        write_file (path, input, size);
+        snprintf (args, sizeof(args), "%s %s", file->args, path);
+        if (run_batch(args) != 0 || !file_equals(path, expected, size))
+        {
+            fprintf (stderr, "FAIL: (%s) in place\n", file->name);
+            ++numFailed;
+        }
+
+        // Into another directory, leaving the input alone.
+        write_file (path, input, size);
+        snprintf (outPath, sizeof(outPath), "test_batch/out/%s", file->name);
+        snprintf (args, sizeof(args), "%s --output-dir test_batch/out %s", file->args, path);
+        if (run_batch(args) != 0 || !file_equals(outPath, expected, size) || !file_equals(path, input, size))
+        {
+            fprintf (stderr, "FAIL: (%s) output directory\n", file->name);
+            ++numFailed;
+        }
+
+        // Into the directory of the input, which is the output itself.
+        snprintf (args, sizeof(args), "%s --output-dir test_batch/in %s", file->args, path);
+        if (run_batch(args) != 0 || !file_equals(path, expected, size))
+        {
+            fprintf (stderr, "FAIL: (%s) output directory of the input\n", file->name);
+            ++numFailed;
+        }
+    }
+
+    if (!directory_has_only("test_batch/in", 3) || !directory_has_only("test_batch/out", 3))
+    {
+        fprintf (stderr, "FAIL: unexpected files in the output directories\n");
+        ++numFailed;
+    }
+
+    if (numFailed == 0)
+        fprintf (stderr, "GOOD: (dl_batch) PPM, PAM and raw files\n");
+    return numFailed;
+}
+
+int test_errors ()
+{
+    const struct TestFile* file = &testFiles[0];
+    unsigned char first[1024], second[1024], expected[1024];
+    int numFailed = 0;
+
+    // Two inputs with the same name: the second one fails instead of
+    // overwriting the output of the first one.
+    const size_t size = make_file(file, 1, 0, first);
+    make_file (file, 2, 0, second);
+    make_file (file, 1, 1, expected);
+    write_file ("test_batch/x/a.ppm", first, size);
+    write_file ("test_batch/y/a.ppm", second, size);
+    if (run_batch("--output-dir test_batch/collisions test_batch/x/a.ppm test_batch/y/a.ppm") != 1
+        || !file_equals("test_batch/collisions/a.ppm", expected, size)
+        || !directory_has_only("test_batch/collisions", 1))
+    {
+        fprintf (stderr, "FAIL: same output name\n");
+        ++numFailed;
+    }
+
+    // Invalid files leave nothing in the output directory.
+    const char* invalid = "P6\n2 2\n65535\n";
+    write_file ("test_batch/x/invalid.ppm", (const unsigned char*)invalid, strlen(invalid));
+    if (run_batch("--output-dir test_batch/invalid test_batch/x/invalid.ppm") != 1
+        || !directory_has_only("test_batch/invalid", 0))
+    {
+        fprintf (stderr, "FAIL: invalid file\n");
+        ++numFailed;
+    }
+
+    // An output directory that can't be written fails the file cleanly.
+    // Root can write to read-only directories, but not to /proc.
+    struct stat st;
+    const int isRoot = geteuid() == 0;
+    const char* readonlyDir = isRoot ? "/proc" : "test_batch/readonly";
+    char args[256];
+    snprintf (args, sizeof(args), "--output-dir %s test_batch/x/a.ppm", readonlyDir);
+    write_file ("test_batch/x/a.ppm", first, size);
+    if (stat(readonlyDir, &st) == 0
+        && (run_batch(args) != 1
+            || !file_equals("test_batch/x/a.ppm", first, size)
+            || (!isRoot && !directory_has_only(readonlyDir, 0))))
+    {
+        fprintf (stderr, "FAIL: output directory that can't be written\n");
+        ++numFailed;
+    }
+
+    if (numFailed == 0)
+        fprintf (stderr, "GOOD: (dl_batch) errors\n");
+    return numFailed;
+}
+
+int main ()
+{
+    const char* dirs[] = { "test_batch", "test_batch/in", "test_batch/out", "test_batch/x", "test_batch/y", "test_batch/collisions", "test_batch/invalid", "test_batch/readonly" };
+    // Start from a clean state.
+    int status = system("rm -rf test_batch");
+    for (size_t i = 0; i < sizeof(dirs)/sizeof(dirs[0]); ++i)
+        mkdir (dirs[i], 0755);
+    chmod ("test_batch/readonly", 0555);
+
+    int numFailed = 0;
+
+    fprintf (stderr, ">> Testing conversions\n");
+    if (test_conversions () != 0)
+    {
+        fprintf (stderr, "TEST FAILED: conversions\n");
+        ++numFailed;
+    }
+
+    fprintf (stderr, ">> Testing errors\n");
+    if (test_errors () != 0)
+    {
+        fprintf (stderr, "TEST FAILED: errors\n");
+        ++numFailed;
+    }
+
+    if (numFailed == 0)
+    {
+        status = system("rm -rf test_batch");
+        fprintf (stderr, "All tests passed\n");
+    }
+    else
+    {
+        fprintf (stderr, "%d tests failed\n", numFailed);
+    }
+    (void)status;
+    return numFailed;
+}
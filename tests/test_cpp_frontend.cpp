@@ -0,0 +1,90 @@
+#include <libDaltonLens.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+/*
+
+    The C++ front end must give exactly the same output as the C library,
+    for every algorithm, deficiency, pixel format and severity mode.
+
+*/
+
+static const float severities[] = { 1.f, 0.9995f, 0.55f, 0.f };
+
+template <DLAlgorithm Algorithm, DLDeficiency Deficiency, DLPixelFormat Format>
+int test_combination (const std::vector<unsigned char>& input, size_t width, size_t height, size_t bytesPerRow)
+{
+    int numFailed = 0;
+    std::vector<unsigned char> expected (input.size());
+    std::vector<unsigned char> actual (input.size());
+    for (float severity : severities)
+    {
+        expected = input;
+        dl_simulate_cvd_format (Algorithm, Format, Deficiency, severity, expected.data(), expected.data(), width, height, bytesPerRow, bytesPerRow);
+
+        // In place, and out of place with the default destination stride.
+        actual = input;
+        dl::simulate<Algorithm, Deficiency, Format>(severity, actual.data(), width, height, bytesPerRow);
+        std::vector<unsigned char> packed (width * height * dl::detail::pixelLayouts[Format].pixelSize);
+        dl::simulate_to<Algorithm, Deficiency, Format>(severity, input.data(), packed.data(), width, height, bytesPerRow);
+
+        bool same = (actual == expected);
+        for (size_t row = 0; row < height; ++row)
+        {
+            const size_t packedBytesPerRow = packed.size() / height;
+            same = same && std::memcmp(packed.data() + row*packedBytesPerRow, expected.data() + row*bytesPerRow, packedBytesPerRow) == 0;
+        }
+
+        if (!same)
+        {
+            fprintf (stderr, "FAIL: (algorithm %d, deficiency %d, format %d, severity %.4f)\n", Algorithm, Deficiency, Format, severity);
+            ++numFailed;
+        }
+    }
+    return numFailed;
+}
+
+template <DLAlgorithm Algorithm, DLDeficiency Deficiency>
+int test_formats (const std::vector<unsigned char>& input, size_t width, size_t height, size_t bytesPerRow)
+{
+    return test_combination<Algorithm, Deficiency, DLPixelFormat_RGBA32>(input, width, height, bytesPerRow)
+         + test_combination<Algorithm, Deficiency, DLPixelFormat_BGRA32>(input, width, height, bytesPerRow)
+         + test_combination<Algorithm, Deficiency, DLPixelFormat_ARGB32>(input, width, height, bytesPerRow)
+         + test_combination<Algorithm, Deficiency, DLPixelFormat_RGBX32>(input, width, height, bytesPerRow)
+         + test_combination<Algorithm, Deficiency, DLPixelFormat_RGB24>(input, width, height, bytesPerRow)
+         + test_combination<Algorithm, Deficiency, DLPixelFormat_BGR24>(input, width, height, bytesPerRow);
+}
+
+template <DLAlgorithm Algorithm>
+int test_deficiencies (const std::vector<unsigned char>& input, size_t width, size_t height, size_t bytesPerRow)
+{
+    return test_formats<Algorithm, DLDeficiency_Protan>(input, width, height, bytesPerRow)
+         + test_formats<Algorithm, DLDeficiency_Deutan>(input, width, height, bytesPerRow)
+         + test_formats<Algorithm, DLDeficiency_Tritan>(input, width, height, bytesPerRow);
+}
+
+int main ()
+{
+    // Random colors, with a padded stride.
+    const size_t width = 301, height = 217, bytesPerRow = width*4 + 12;
+    std::vector<unsigned char> input (bytesPerRow * height);
+    srand (42);
+    for (unsigned char& v : input)
+        v = rand() % 256;
+
+    fprintf (stderr, ">> Testing the C++ front end\n");
+    const int numFailed = test_deficiencies<DLAlgorithm_Auto>(input, width, height, bytesPerRow)
+                        + test_deficiencies<DLAlgorithm_Brettel1997>(input, width, height, bytesPerRow)
+                        + test_deficiencies<DLAlgorithm_Vienot1999>(input, width, height, bytesPerRow);
+    if (numFailed == 0)
+    {
+        fprintf (stderr, "GOOD: (dl::simulate)\n");
+        return 0;
+    }
+
+    fprintf (stderr, "TEST FAILED: C++ front end\n");
+    return 1;
+}
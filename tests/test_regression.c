@@ -0,0 +1,581 @@
+#include <libDaltonLens.h>
+
+#define SOKOL_TIME_IMPL
+#include "sokol_time.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+
+    Accuracy and performance regression harness for all the kernels.
+
+    Usage: test_regression [--exhaustive] [--baseline file] [--write-baseline file] [--tolerance 0.25]
+
+    The reference is the scalar simulator with DLAccuracy_Exact, i.e. the
+    textbook powf encoding, computed for 1M RGB colors spread over the cube,
+    or all the 16.7M colors with --exhaustive, for each algorithm,
+    deficiency and severity. The exhaustive run takes a few minutes in an
+    optimized build, so ctest only runs the default one. Then
+    every path (functions, simulators, fast mode, threads, cache, LUT,
+    severity maps) is checked against it with its own error budget, and
+    every SIMD kernel must give exactly the output of the scalar kernel,
+    also with odd widths, sub-vector tails and padded strides, without
+    writing outside of the rows.
+
+    Finally the paths get timed on each kernel. In optimized builds the SIMD
+    kernels may not be slower than the scalar one, and with --baseline the
+    throughputs may not drop by more than 'tolerance' compared to a file
+    written by --write-baseline on the same machine.
+
+*/
+
+struct Config
+{
+    enum DLAlgorithm algorithm;
+    enum DLDeficiency deficiency;
+    float severity;
+};
+
+static const char* kernelNames[] = { "auto", "scalar", "sse4.1", "avx2", "neon", "wasm-simd128" };
+static const char* algorithmNames[] = { "auto", "brettel1997", "vienot1999" };
+static const float severities[] = { 1.f, 0.55f };
+
+// Everything a path needs for one configuration. The simulators and the
+// LUT are created for each kernel since they run the kernels too.
+struct PathContext
+{
+    const struct Config* config;
+    struct DLSimulator* simulator;
+    struct DLSimulator* fastSimulator;
+    struct DLLut3D* lut;
+};
+
+struct Image
+{
+    const unsigned char* src;
+    unsigned char* dst;
+    size_t width;
+    size_t height;
+    size_t srcBytesPerRow;
+    size_t dstBytesPerRow;
+};
+
+typedef void (*PathFunc) (const struct PathContext* ctx, const struct Image* image);
+
+static size_t bytes_per_row (size_t bytesPerRow, size_t width)
+{
+    return bytesPerRow ? bytesPerRow : width * 4;
+}
+
+// For the in-place functions, copies the source rows to 'dst' first.
+static void copy_rows (const struct Image* image)
+{
+    const size_t srcBytesPerRow = bytes_per_row(image->srcBytesPerRow, image->width);
+    const size_t dstBytesPerRow = bytes_per_row(image->dstBytesPerRow, image->width);
+    for (size_t row = 0; row < image->height; ++row)
+        memcpy (image->dst + row * dstBytesPerRow, image->src + row * srcBytesPerRow, image->width * 4);
+}
+
+static void path_simulate_to (const struct PathContext* ctx, const struct Image* image)
+{
+    const struct Config* c = ctx->config;
+    if (c->algorithm == DLAlgorithm_Brettel1997)
+        dl_simulate_cvd_brettel1997_to(c->deficiency, c->severity, image->src, image->dst, image->width, image->height, image->srcBytesPerRow, image->dstBytesPerRow);
+    else
+        dl_simulate_cvd_vienot1999_to(c->deficiency, c->severity, image->src, image->dst, image->width, image->height, image->srcBytesPerRow, image->dstBytesPerRow);
+}
+
+static void path_simulate_mt (const struct PathContext* ctx, const struct Image* image)
+{
+    const struct Config* c = ctx->config;
+    copy_rows (image);
+    if (c->algorithm == DLAlgorithm_Brettel1997)
+        dl_simulate_cvd_brettel1997_mt(c->deficiency, c->severity, image->dst, image->width, image->height, image->dstBytesPerRow, 4);
+    else
+        dl_simulate_cvd_vienot1999_mt(c->deficiency, c->severity, image->dst, image->width, image->height, image->dstBytesPerRow, 4);
+}
+
+static void path_severity_map (const struct PathContext* ctx, const struct Image* image)
+{
+    const struct Config* c = ctx->config;
+    const struct DLSeverityMap map = { &c->severity, DLSeverityMapFormat_F32, 1, 1, 0 };
+    dl_simulate_cvd_severity_map(c->algorithm, DLPixelFormat_RGBA32, c->deficiency, &map, image->src, image->dst, image->width, image->height, image->srcBytesPerRow, image->dstBytesPerRow);
+}
+
+static void path_simulator (const struct PathContext* ctx, const struct Image* image)
+{
+    dl_simulator_apply_to(ctx->simulator, image->src, image->dst, image->width, image->height, image->srcBytesPerRow, image->dstBytesPerRow);
+}
+
+static void path_simulator_fast (const struct PathContext* ctx, const struct Image* image)
+{
+    dl_simulator_apply_to(ctx->fastSimulator, image->src, image->dst, image->width, image->height, image->srcBytesPerRow, image->dstBytesPerRow);
+}
+
+static void path_simulator_mt (const struct PathContext* ctx, const struct Image* image)
+{
+    copy_rows (image);
+    dl_simulator_apply_mt(ctx->simulator, image->dst, image->width, image->height, image->dstBytesPerRow, 4);
+}
+
+static void path_cached (const struct PathContext* ctx, const struct Image* image)
+{
+    dl_simulator_apply_cached_to(ctx->simulator, image->src, image->dst, image->width, image->height, image->srcBytesPerRow, image->dstBytesPerRow, NULL);
+}
+
+static void path_lut3d (const struct PathContext* ctx, const struct Image* image)
+{
+    dl_lut3d_apply_to(ctx->lut, image->src, image->dst, image->width, image->height, image->srcBytesPerRow, image->dstBytesPerRow);
+}
+
+/*
+    Error budget of each path against the exact reference, as the maximum
+    difference of a channel and the maximum fraction of channels that may
+    differ at all. Every path must stay within ±1 of the textbook formula,
+    the fast encoding being off by one much more often.
+*/
+struct Path
+{
+    const char* name;
+    PathFunc func;
+    int maxDiff;
+    double maxDiffFraction;
+};
+
+static const struct Path paths[] = {
+    { "simulate_to", path_simulate_to, 1, 0.01 },
+    { "simulate_mt", path_simulate_mt, 1, 0.01 },
+    { "severity_map", path_severity_map, 1, 0.01 },
+    { "simulator", path_simulator, 1, 0.01 },
+    { "simulator_fast", path_simulator_fast, 1, 0.40 },
+    { "simulator_mt", path_simulator_mt, 1, 0.01 },
+    { "cached", path_cached, 1, 0.01 },
+    { "lut3d", path_lut3d, 1, 0.01 },
+};
+#define NUM_PATHS (sizeof(paths)/sizeof(paths[0]))
+
+struct Histogram
+{
+    size_t numChannels;
+    // diff 0, 1, 2, more
+    size_t counts[4];
+    size_t numAlphaChanged;
+};
+
+static void compare_to_reference (const unsigned char* reference, const unsigned char* actual, size_t numPixels, struct Histogram* histogram)
+{
+    for (size_t i = 0; i < numPixels * 4; i += 4)
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            const int diff = abs(reference[i + c] - actual[i + c]);
+            ++histogram->counts[diff < 3 ? diff : 3];
+        }
+        histogram->numAlphaChanged += reference[i + 3] != actual[i + 3];
+    }
+    histogram->numChannels += numPixels * 3;
+}
+
+static int histogram_max_diff (const struct Histogram* histogram)
+{
+    int maxDiff = 0;
+    for (int d = 0; d < 4; ++d)
+        if (histogram->counts[d] > 0) maxDiff = d;
+    return maxDiff;
+}
+
+static void create_path_context (struct PathContext* ctx, const struct Config* config, int withLut)
+{
+    ctx->config = config;
+    ctx->simulator = dl_simulator_create(config->algorithm, config->deficiency, config->severity);
+    ctx->fastSimulator = dl_simulator_create(config->algorithm, config->deficiency, config->severity);
+    dl_simulator_set_accuracy(ctx->fastSimulator, DLAccuracy_Fast);
+    ctx->lut = withLut ? dl_lut3d_create(ctx->simulator, 256) : NULL;
+}
+
+static void destroy_path_context (struct PathContext* ctx)
+{
+    dl_simulator_destroy(ctx->simulator);
+    dl_simulator_destroy(ctx->fastSimulator);
+    dl_lut3d_destroy(ctx->lut);
+}
+
+// Odd widths around the vector sizes (4, 8 and 16 pixels), and strides
+// with a padding that breaks the alignment of the rows.
+static const size_t tailWidths[] = { 1, 2, 3, 4, 5, 7, 8, 9, 13, 15, 16, 17, 23, 31, 33, 47, 63, 65, 255, 257 };
+static const size_t tailPaddings[] = { 0, 1, 13 };
+#define TAIL_HEIGHT 3
+#define GUARD_BYTE 0xA5
+
+/*
+    Runs 'path' on small images taken from 'input' at various widths and
+    strides, and checks the result against 'expected' (the output of the
+    scalar kernel on the whole input) and that the padding and the bytes
+    after the last row are left alone.
+*/
+static int check_tails (const struct Path* path, const struct PathContext* ctx, const unsigned char* input, const unsigned char* expected, size_t numPixels, unsigned char* src, unsigned char* dst)
+{
+    int numFailed = 0;
+    for (size_t w = 0; w < sizeof(tailWidths)/sizeof(tailWidths[0]); ++w)
+    for (size_t p = 0; p < sizeof(tailPaddings)/sizeof(tailPaddings[0]); ++p)
+    {
+        const size_t width = tailWidths[w];
+        const size_t padding = tailPaddings[p];
+        const size_t srcBytesPerRow = width * 4 + padding;
+        const size_t dstBytesPerRow = width * 4 + 2 * padding;
+        const size_t dstBytes = dstBytesPerRow * TAIL_HEIGHT + 64;
+        // Somewhere in the input that depends on the size.
+        const size_t firstPixel = (width * 7919 + padding * 104729) % (numPixels - width * TAIL_HEIGHT);
+
+        memset (src, GUARD_BYTE, srcBytesPerRow * TAIL_HEIGHT);
+        memset (dst, GUARD_BYTE, dstBytes);
+        for (size_t row = 0; row < TAIL_HEIGHT; ++row)
+            memcpy (src + row * srcBytesPerRow, input + (firstPixel + row * width) * 4, width * 4);
+
+        const struct Image image = { src, dst, width, TAIL_HEIGHT, padding ? srcBytesPerRow : 0, padding ? dstBytesPerRow : 0 };
+        path->func(ctx, &image);
+
+        int ok = 1;
+        for (size_t row = 0; row < TAIL_HEIGHT; ++row)
+        {
+            const unsigned char* dstRow = dst + row * dstBytesPerRow;
+            ok &= memcmp(dstRow, expected + (firstPixel + row * width) * 4, width * 4) == 0;
+            for (size_t i = width * 4; i < dstBytesPerRow; ++i)
+                ok &= dstRow[i] == GUARD_BYTE;
+        }
+        for (size_t i = dstBytesPerRow * TAIL_HEIGHT; i < dstBytes; ++i)
+            ok &= dst[i] == GUARD_BYTE;
+
+        if (!ok)
+        {
+            fprintf (stderr, "FAIL: (%s, %s) width %d, padding %d\n", path->name, kernelNames[dl_get_kernel()], (int)width, (int)padding);
+            ++numFailed;
+        }
+    }
+    return numFailed;
+}
+
+static int test_accuracy (const unsigned char* input, size_t width, size_t height)
+{
+    const size_t numPixels = width * height;
+    const size_t numBytes = numPixels * 4;
+    unsigned char* reference = malloc(numBytes);
+    unsigned char* expected = malloc(numBytes);
+    unsigned char* actual = malloc(numBytes);
+    const size_t maxTailBytes = (257 * 4 + 2 * 13) * TAIL_HEIGHT + 64;
+    unsigned char* tailSrc = malloc(maxTailBytes);
+    unsigned char* tailDst = malloc(maxTailBytes);
+
+    struct Histogram histograms[NUM_PATHS];
+    memset (histograms, 0, sizeof(histograms));
+
+    int numFailed = 0;
+    for (int algorithm = DLAlgorithm_Brettel1997; algorithm <= DLAlgorithm_Vienot1999; ++algorithm)
+    for (int deficiency = DLDeficiency_Protan; deficiency <= DLDeficiency_Tritan; ++deficiency)
+    for (size_t s = 0; s < sizeof(severities)/sizeof(severities[0]); ++s)
+    {
+        const struct Config config = { algorithm, deficiency, severities[s] };
+        fprintf (stderr, "%s, deficiency %d, severity %.2f\n", algorithmNames[algorithm], deficiency, severities[s]);
+
+        dl_force_kernel(DLKernel_Scalar);
+        struct DLSimulator* exactSimulator = dl_simulator_create(algorithm, deficiency, severities[s]);
+        dl_simulator_set_accuracy(exactSimulator, DLAccuracy_Exact);
+        dl_simulator_apply_to(exactSimulator, input, reference, width, height, 0, 0);
+        dl_simulator_destroy(exactSimulator);
+
+        for (size_t p = 0; p < NUM_PATHS; ++p)
+        {
+            const struct Path* path = &paths[p];
+            const int withLut = path->func == path_lut3d;
+            const struct Image image = { input, expected, width, height, 0, 0 };
+
+            struct PathContext ctx;
+            dl_force_kernel(DLKernel_Scalar);
+            create_path_context(&ctx, &config, withLut);
+            path->func(&ctx, &image);
+            compare_to_reference(reference, expected, numPixels, &histograms[p]);
+            numFailed += check_tails(path, &ctx, input, expected, numPixels, tailSrc, tailDst);
+            destroy_path_context(&ctx);
+
+            for (int kernel = DLKernel_Scalar + 1; kernel <= DLKernel_WasmSIMD128; ++kernel)
+            {
+                if (!dl_force_kernel(kernel))
+                    continue;
+
+                create_path_context(&ctx, &config, withLut);
+                const struct Image kernelImage = { input, actual, width, height, 0, 0 };
+                path->func(&ctx, &kernelImage);
+                if (memcmp(expected, actual, numBytes) != 0)
+                {
+                    fprintf (stderr, "FAIL: (%s, %s, %s, deficiency %d, severity %.2f) differs from the scalar kernel\n",
+                             path->name, kernelNames[kernel], algorithmNames[algorithm], deficiency, severities[s]);
+                    ++numFailed;
+                }
+                numFailed += check_tails(path, &ctx, input, expected, numPixels, tailSrc, tailDst);
+                destroy_path_context(&ctx);
+            }
+        }
+    }
+    dl_force_kernel(DLKernel_Auto);
+
+    for (size_t p = 0; p < NUM_PATHS; ++p)
+    {
+        const struct Histogram* h = &histograms[p];
+        const int maxDiff = histogram_max_diff(h);
+        const double diffFraction = (double)(h->numChannels - h->counts[0]) / h->numChannels;
+        const int ok = maxDiff <= paths[p].maxDiff && diffFraction <= paths[p].maxDiffFraction && h->numAlphaChanged == 0;
+        fprintf (stderr, "%s: (%s) diff 0: %zu, 1: %zu, 2: %zu, more: %zu, %.2f%% off (budget ±%d, %.0f%%), %zu alpha changed\n",
+                 ok ? "GOOD" : "FAIL", paths[p].name, h->counts[0], h->counts[1], h->counts[2], h->counts[3],
+                 100. * diffFraction, paths[p].maxDiff, 100. * paths[p].maxDiffFraction, h->numAlphaChanged);
+        numFailed += !ok;
+    }
+
+    free (reference);
+    free (expected);
+    free (actual);
+    free (tailSrc);
+    free (tailDst);
+    return numFailed;
+}
+
+/*
+    Baseline files have one line per measurement: kernel, path and MPix/s.
+*/
+struct Timing
+{
+    int kernel;
+    size_t path;
+    double mpixPerSecond;
+};
+
+static int compare_doubles (const void* a, const void* b)
+{
+    const double da = *(const double*)a, db = *(const double*)b;
+    return (da > db) - (da < db);
+}
+
+static double find_timing (const struct Timing* timings, int numTimings, int kernel, size_t path)
+{
+    for (int i = 0; i < numTimings; ++i)
+        if (timings[i].kernel == kernel && timings[i].path == path)
+            return timings[i].mpixPerSecond;
+    return 0.;
+}
+
+static int read_baseline (const char* path, struct Timing* timings, int maxTimings)
+{
+    FILE* f = fopen(path, "r");
+    if (f == NULL)
+        return -1;
+
+    int numTimings = 0;
+    char kernelName[32], pathName[32];
+    double mpixPerSecond;
+    while (numTimings < maxTimings && fscanf(f, "%31s %31s %lf", kernelName, pathName, &mpixPerSecond) == 3)
+    {
+        for (int k = DLKernel_Scalar; k <= DLKernel_WasmSIMD128; ++k)
+        for (size_t p = 0; p < NUM_PATHS; ++p)
+        {
+            if (strcmp(kernelName, kernelNames[k]) == 0 && strcmp(pathName, paths[p].name) == 0)
+            {
+                timings[numTimings].kernel = k;
+                timings[numTimings].path = p;
+                timings[numTimings].mpixPerSecond = mpixPerSecond;
+                ++numTimings;
+            }
+        }
+    }
+    fclose (f);
+    return numTimings;
+}
+
+#define NUM_TIMING_SAMPLES 7
+#define MAX_TIMINGS 64
+
+static int test_performance (const unsigned char* input, size_t width, size_t height, const char* baselinePath, const char* writeBaselinePath, double tolerance)
+{
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(__OPTIMIZE__)
+    const int optimized = 0;
+    fprintf (stderr, "WARNING: built without optimizations, only reporting the timings.\n");
+#else
+    const int optimized = 1;
+#endif
+
+    const size_t numBytes = width * height * 4;
+    unsigned char* output = malloc(numBytes);
+    struct Timing timings[MAX_TIMINGS];
+    int numTimings = 0;
+
+    // Viénot 1999 is the default for protan and deutan, and the
+    // interpolation of the intermediate severities is part of the cost.
+    const struct Config config = { DLAlgorithm_Vienot1999, DLDeficiency_Protan, 0.55f };
+    for (int kernel = DLKernel_Scalar; kernel <= DLKernel_WasmSIMD128; ++kernel)
+    {
+        if (!dl_force_kernel(kernel))
+            continue;
+
+        struct PathContext ctx;
+        create_path_context(&ctx, &config, 1);
+        for (size_t p = 0; p < NUM_PATHS && numTimings < MAX_TIMINGS; ++p)
+        {
+            const struct Image image = { input, output, width, height, 0, 0 };
+            double samples[NUM_TIMING_SAMPLES];
+            // The first call warms up the caches and the thread pool.
+            paths[p].func(&ctx, &image);
+            for (int i = 0; i < NUM_TIMING_SAMPLES; ++i)
+            {
+                const uint64_t timeStart = stm_now();
+                paths[p].func(&ctx, &image);
+                samples[i] = stm_ms(stm_since(timeStart));
+            }
+            qsort (samples, NUM_TIMING_SAMPLES, sizeof(double), compare_doubles);
+            const double mpixPerSecond = (double)width * height / (samples[NUM_TIMING_SAMPLES / 2] * 1000.);
+
+            timings[numTimings].kernel = kernel;
+            timings[numTimings].path = p;
+            timings[numTimings].mpixPerSecond = mpixPerSecond;
+            ++numTimings;
+            fprintf (stderr, "%-12s %-15s %8.1f MPix/s\n", kernelNames[kernel], paths[p].name, mpixPerSecond);
+        }
+        destroy_path_context(&ctx);
+    }
+    dl_force_kernel(DLKernel_Auto);
+    free (output);
+
+    int numFailed = 0;
+
+    // The LUT and the cache barely depend on the kernel, so only the
+    // direct paths are compared to the scalar kernel.
+    for (int i = 0; i < numTimings && optimized; ++i)
+    {
+        const struct Timing* t = &timings[i];
+        const double scalar = find_timing(timings, numTimings, DLKernel_Scalar, t->path);
+        const int direct = paths[t->path].func != path_lut3d && paths[t->path].func != path_cached;
+        if (direct && t->kernel != DLKernel_Scalar && t->mpixPerSecond < scalar * (1. - tolerance))
+        {
+            fprintf (stderr, "FAIL: (%s, %s) %.1f MPix/s is slower than the scalar kernel (%.1f MPix/s)\n",
+                     kernelNames[t->kernel], paths[t->path].name, t->mpixPerSecond, scalar);
+            ++numFailed;
+        }
+    }
+
+    if (baselinePath)
+    {
+        struct Timing baseline[MAX_TIMINGS];
+        const int numBaseline = read_baseline(baselinePath, baseline, MAX_TIMINGS);
+        if (numBaseline < 0)
+        {
+            fprintf (stderr, "FAIL: could not read the baseline %s\n", baselinePath);
+            ++numFailed;
+        }
+
+        for (int i = 0; i < numTimings && optimized; ++i)
+        {
+            const struct Timing* t = &timings[i];
+            const double expected = find_timing(baseline, numBaseline, t->kernel, t->path);
+            if (expected > 0. && t->mpixPerSecond < expected * (1. - tolerance))
+            {
+                fprintf (stderr, "FAIL: (%s, %s) %.1f MPix/s, the baseline was %.1f MPix/s\n",
+                         kernelNames[t->kernel], paths[t->path].name, t->mpixPerSecond, expected);
+                ++numFailed;
+            }
+        }
+    }
+
+    if (writeBaselinePath)
+    {
+        FILE* f = fopen(writeBaselinePath, "w");
+        if (f == NULL)
+        {
+            fprintf (stderr, "FAIL: could not write the baseline %s\n", writeBaselinePath);
+            ++numFailed;
+        }
+        else
+        {
+            for (int i = 0; i < numTimings; ++i)
+                fprintf (f, "%s %s %.2f\n", kernelNames[timings[i].kernel], paths[timings[i].path].name, timings[i].mpixPerSecond);
+            fclose (f);
+        }
+    }
+
+    if (numFailed == 0)
+        fprintf (stderr, "GOOD: (timings) %d measurements%s\n", numTimings, optimized ? "" : ", not checked");
+    return numFailed;
+}
+
+int main (int argc, char** argv)
+{
+    int exhaustive = 0;
+    const char* baselinePath = NULL;
+    const char* writeBaselinePath = NULL;
+    double tolerance = 0.25;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--exhaustive") == 0)
+            exhaustive = 1;
+        else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc)
+            baselinePath = argv[++i];
+        else if (strcmp(argv[i], "--write-baseline") == 0 && i + 1 < argc)
+            writeBaselinePath = argv[++i];
+        else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc)
+            tolerance = atof(argv[++i]);
+        else
+        {
+            fprintf (stderr, "Usage: %s [--exhaustive] [--baseline file] [--write-baseline file] [--tolerance 0.25]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    stm_setup ();
+
+    // Pixel i gets the color i*K, which goes through all the 2^24 colors
+    // since K is odd, in an order that mixes the bright and dark ones in
+    // each row. The default run keeps the first 2^20 of them.
+    const size_t width = 4096;
+    const size_t height = exhaustive ? 4096 : 256;
+    unsigned char* input = malloc(width * height * 4);
+    if (input == NULL)
+    {
+        fprintf (stderr, "Could not allocate the input\n");
+        return 1;
+    }
+    for (size_t i = 0; i < width * height; ++i)
+    {
+        const uint32_t color = (uint32_t)(i * 0x9E3779B1u) & 0xFFFFFF;
+        input[i * 4 + 0] = color >> 16;
+        input[i * 4 + 1] = (color >> 8) & 0xFF;
+        input[i * 4 + 2] = color & 0xFF;
+        input[i * 4 + 3] = (unsigned char)(i * 7);
+    }
+
+    int numFailed = 0;
+
+    fprintf (stderr, ">> Testing the accuracy of all the kernels (%zu colors)\n", width * height);
+    if (test_accuracy (input, width, height) != 0)
+    {
+        fprintf (stderr, "TEST FAILED: accuracy\n");
+        ++numFailed;
+    }
+
+    fprintf (stderr, ">> Testing the performance of all the kernels\n");
+    if (test_performance (input, width, height, baselinePath, writeBaselinePath, tolerance) != 0)
+    {
+        fprintf (stderr, "TEST FAILED: performance\n");
+        ++numFailed;
+    }
+
+    free (input);
+
+    if (numFailed == 0)
+    {
+        fprintf (stderr, "All tests passed\n");
+    }
+    else
+    {
+        fprintf (stderr, "%d tests failed\n", numFailed);
+    }
+    return numFailed;
+}
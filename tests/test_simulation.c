@@ -10,6 +10,7 @@
 #include "sokol_time.h"
 
 #include <stdio.h>
+#include <math.h>
 
 /*
 
@@ -62,6 +63,16 @@ struct Context
     int height;
 };
 
+static const char* kernelNames[] = { "auto", "scalar", "sse4.1", "avx2", "neon", "wasm-simd128" };
+
+// The same random bytes on every run.
+static void fill_random (unsigned char* buffer, size_t size)
+{
+    srand(42);
+    for (size_t i = 0; i < size; ++i)
+        buffer[i] = rand() % 256;
+}
+
 int test_Vienot1999 (struct Context* context)
 {
     int cumulatedComparison = 0;
@@ -186,26 +197,1866 @@ int test_automaticDispatch (struct Context* context)
     return cumulatedComparison;
 }
 
-int main ()
+// Textbook implementation, used as a reference for the lookup tables.
+static float reference_linearRGB_from_sRGB (unsigned char v)
 {
-    stm_setup();
+    float fv = v / 255.f;
+    if (fv < 0.04045f) return fv / 12.92f;
+    return powf((fv + 0.055f) / 1.055f, 2.4f);
+}
 
-    char inputImagePath[1024];
-    snprintf (inputImagePath, 1024, "%s%s", TEST_IMAGES_DIR, "input.png");
+static unsigned char reference_sRGB_from_linearRGB (float v)
+{
+    if (v <= 0.f) return 0;
+    if (v >= 1.f) return 255;
+    if (v < 0.0031308f) return 0.5f + (v * 12.92 * 255.f);
+    return 0.f + 255.f * (powf(v, 1.f / 2.4f) * 1.055f - 0.055f);
+}
 
-    struct Context context;
-    int channels = 0;
-    context.inputBuffer = stbi_load (inputImagePath, &context.width, &context.height, &channels, 4 /* rgba */);
+int test_sRGBTransferFunctions ()
+{
+    for (int v = 0; v < 256; ++v)
+    {
+        float expected = reference_linearRGB_from_sRGB((unsigned char)v);
+        float actual = dl_linearRGB_from_sRGB((unsigned char)v);
+        if (fabsf(expected - actual) > 1e-7f)
+        {
+            fprintf (stderr, "FAIL: dl_linearRGB_from_sRGB(%d) = %.9g, expected %.9g\n", v, actual, expected);
+            return 1;
+        }
+    }
+    fprintf (stderr, "GOOD: (dl_linearRGB_from_sRGB)\n");
 
-    if (context.inputBuffer == NULL)
+    // Sweep the float bit patterns covering [0,1] and a bit beyond, with a
+    // prime stride to hit all the table segments at various offsets. The
+    // full range was checked exhaustively, but it takes a few seconds.
+    const float outOfRange[] = { -1.f, -0.f, 1.f, 1.5f, 1e10f };
+    for (size_t i = 0; i < sizeof(outOfRange)/sizeof(float); ++i)
     {
-        fprintf (stderr, "Could not read image %s", inputImagePath);
-        return 2;
+        if (dl_sRGB_from_linearRGB(outOfRange[i]) != reference_sRGB_from_linearRGB(outOfRange[i]))
+        {
+            fprintf (stderr, "FAIL: dl_sRGB_from_linearRGB(%g) is not clamped\n", outOfRange[i]);
+            return 1;
+        }
     }
 
-    context.tmpImageBuffer = malloc(context.width * context.height * 4);
+    // NaN used to index far outside of the table.
+    if (dl_sRGB_from_linearRGB(NAN) != 0 || dl_sRGB_from_linearRGB(-NAN) != 0)
+    {
+        fprintf (stderr, "FAIL: dl_sRGB_from_linearRGB(NaN) is not 0\n");
+        return 1;
+    }
+
+    for (uint32_t bits = 0; bits <= 0x3f810000u /* just above 1.0 */; bits += 61)
+    {
+        float v;
+        memcpy (&v, &bits, sizeof(float));
+        int diff = abs(dl_sRGB_from_linearRGB(v) - reference_sRGB_from_linearRGB(v));
+        if (diff > 1)
+        {
+            fprintf (stderr, "FAIL: dl_sRGB_from_linearRGB(%.9g) diff=%d\n", v, diff);
+            return 1;
+        }
+    }
+    fprintf (stderr, "GOOD: (dl_sRGB_from_linearRGB)\n");
+    return 0;
+}
+
+// Compare all the kernels supported by this machine with the scalar one,
+// on a random image with an odd width to exercise the tails, and with some
+// padding at the end of each row that should be left untouched. The
+// out-of-place versions are also checked, with a different stride.
+int test_kernels ()
+{
+    const int w = 67, h = 13, bytesPerRow = w*4 + 12, dstBytesPerRow = w*4 + 20;
+    unsigned char* input = malloc(bytesPerRow * h);
+    unsigned char* inputCopy = malloc(bytesPerRow * h);
+    unsigned char* expected = malloc(bytesPerRow * h);
+    unsigned char* actual = malloc(bytesPerRow * h);
+    unsigned char* actualTo = malloc(dstBytesPerRow * h);
+
+    fill_random (input, bytesPerRow * h);
+    memcpy (inputCopy, input, bytesPerRow * h);
+
+    const float severities[] = { 1.f, 0.55f, 0.f };
+
+    int numFailed = 0;
+    for (int kernel = DLKernel_Scalar; kernel <= DLKernel_WasmSIMD128; ++kernel)
+    {
+        if (!dl_force_kernel(kernel))
+        {
+            fprintf (stderr, "SKIP: (%s) not supported\n", kernelNames[kernel]);
+            continue;
+        }
+
+        int maxDiff = 0;
+        int outOfPlaceFailed = 0;
+        for (int algorithm = 0; algorithm < 2; ++algorithm)
+        for (int deficiency = DLDeficiency_Protan; deficiency <= DLDeficiency_Tritan; ++deficiency)
+        for (int s = 0; s < 3; ++s)
+        {
+            void (*simulate)(enum DLDeficiency, float, unsigned char*, size_t, size_t, size_t) = algorithm == 0 ? dl_simulate_cvd_brettel1997 : dl_simulate_cvd_vienot1999;
+            void (*simulate_to)(enum DLDeficiency, float, const unsigned char*, unsigned char*, size_t, size_t, size_t, size_t) = algorithm == 0 ? dl_simulate_cvd_brettel1997_to : dl_simulate_cvd_vienot1999_to;
+
+            memcpy (expected, input, bytesPerRow * h);
+            dl_force_kernel(DLKernel_Scalar);
+            simulate(deficiency, severities[s], expected, w, h, bytesPerRow);
+
+            memcpy (actual, input, bytesPerRow * h);
+            dl_force_kernel(kernel);
+            simulate(deficiency, severities[s], actual, w, h, bytesPerRow);
+
+            for (int i = 0; i < bytesPerRow * h; ++i)
+            {
+                int diff = abs(expected[i] - actual[i]);
+                if (diff > maxDiff) maxDiff = diff;
+            }
+
+            memset (actualTo, 0xcd, dstBytesPerRow * h);
+            simulate_to(deficiency, severities[s], input, actualTo, w, h, bytesPerRow, dstBytesPerRow);
+            for (int r = 0; r < h; ++r)
+            {
+                outOfPlaceFailed |= memcmp(actualTo + r*dstBytesPerRow, actual + r*bytesPerRow, w*4) != 0;
+                for (int c = w*4; c < dstBytesPerRow; ++c)
+                    outOfPlaceFailed |= actualTo[r*dstBytesPerRow + c] != 0xcd;
+            }
+            outOfPlaceFailed |= memcmp(input, inputCopy, bytesPerRow * h) != 0;
+        }
+
+        if (maxDiff > 1 || outOfPlaceFailed)
+        {
+            fprintf (stderr, "FAIL: (%s) differs from scalar, maxDiff=%d outOfPlaceFailed=%d\n", kernelNames[kernel], maxDiff, outOfPlaceFailed);
+            ++numFailed;
+        }
+        else
+        {
+            fprintf (stderr, "GOOD: (%s)\n", kernelNames[kernel]);
+        }
+    }
+
+    dl_force_kernel(DLKernel_Auto);
+    fprintf (stderr, "Using kernel %s\n", kernelNames[dl_get_kernel()]);
+
+    free (input);
+    free (inputCopy);
+    free (expected);
+    free (actual);
+    free (actualTo);
+    return numFailed;
+}
+
+// Every format should give the same colors as RGBA32 for every kernel,
+// preserve the 4th byte, and not write after the end of the rows.
+int test_pixelFormats ()
+{
+    const int w = 67, h = 13, rgbaBytesPerRow = w*4;
+    const int formatSizes[] = { 4, 4, 4, 4, 3, 3 };
+    // Offsets of R, G, B and the extra byte (-1 if none) for each format.
+    const int formatOffsets[][4] = { {0,1,2,3}, {2,1,0,3}, {1,2,3,0}, {0,1,2,3}, {0,1,2,-1}, {2,1,0,-1} };
+    const char* formatNames[] = { "RGBA32", "BGRA32", "ARGB32", "RGBX32", "RGB24", "BGR24" };
+
+    unsigned char* rgba = malloc(rgbaBytesPerRow * h);
+    unsigned char* expected = malloc(rgbaBytesPerRow * h);
+    // Large enough for all the formats, with some padding.
+    const int bytesPerRow = w*4 + 12;
+    unsigned char* input = malloc(bytesPerRow * h);
+    unsigned char* actual = malloc(bytesPerRow * h);
+
+    fill_random (rgba, rgbaBytesPerRow * h);
+
+
+    int numFailed = 0;
+    for (int kernel = DLKernel_Scalar; kernel <= DLKernel_WasmSIMD128; ++kernel)
+    {
+        if (!dl_force_kernel(kernel))
+            continue;
+
+        for (int format = DLPixelFormat_RGBA32; format <= DLPixelFormat_BGR24; ++format)
+        {
+            const int* offsets = formatOffsets[format];
+            const int pixelSize = formatSizes[format];
+            int failed = 0;
+
+            for (int algorithm = DLAlgorithm_Brettel1997; algorithm <= DLAlgorithm_Vienot1999; ++algorithm)
+            for (int deficiency = DLDeficiency_Protan; deficiency <= DLDeficiency_Tritan; ++deficiency)
+            {
+                memcpy (expected, rgba, rgbaBytesPerRow * h);
+                if (algorithm == DLAlgorithm_Brettel1997)
+                    dl_simulate_cvd_brettel1997(deficiency, 0.8f, expected, w, h, rgbaBytesPerRow);
+                else
+                    dl_simulate_cvd_vienot1999(deficiency, 0.8f, expected, w, h, rgbaBytesPerRow);
+
+                memset (input, 0xcd, bytesPerRow * h);
+                for (int r = 0; r < h; ++r)
+                for (int c = 0; c < w; ++c)
+                for (int k = 0; k < 4; ++k)
+                {
+                    if (offsets[k] >= 0)
+                        input[r*bytesPerRow + c*pixelSize + offsets[k]] = rgba[r*rgbaBytesPerRow + c*4 + k];
+                }
+
+                memcpy (actual, input, bytesPerRow * h);
+                failed |= !dl_simulate_cvd_format(algorithm, format, deficiency, 0.8f, actual, actual, w, h, bytesPerRow, bytesPerRow);
+
+                for (int r = 0; r < h; ++r)
+                {
+                    for (int c = 0; c < w; ++c)
+                    for (int k = 0; k < 4; ++k)
+                    {
+                        if (offsets[k] >= 0)
+                            failed |= actual[r*bytesPerRow + c*pixelSize + offsets[k]] != expected[r*rgbaBytesPerRow + c*4 + k];
+                    }
+                    for (int i = w*pixelSize; i < bytesPerRow; ++i)
+                        failed |= actual[r*bytesPerRow + i] != 0xcd;
+                }
+            }
+
+            if (failed)
+            {
+                fprintf (stderr, "FAIL: (%s, %s) differs from RGBA32\n", kernelNames[kernel], formatNames[format]);
+                ++numFailed;
+            }
+        }
+    }
+    dl_force_kernel(DLKernel_Auto);
+
+    if (dl_simulate_cvd_format(DLAlgorithm_Auto, (enum DLPixelFormat)42, DLDeficiency_Protan, 1.f, input, actual, w, h, 0, 0))
+    {
+        fprintf (stderr, "FAIL: invalid format accepted\n");
+        ++numFailed;
+    }
+
+    if (numFailed == 0)
+        fprintf (stderr, "GOOD: (dl_simulate_cvd_format)\n");
+
+    free (rgba);
+    free (expected);
+    free (input);
+    free (actual);
+    return numFailed;
+}
+
+// SkipTransparent should match Straight except for the transparent pixels,
+// left unchanged, and Premultiplied should match unpremultiplying,
+// simulating and premultiplying again, for every kernel.
+int test_alphaModes ()
+{
+    const int w = 131, h = 9, bytesPerRow = w*4 + 8;
+    // BGRA32, to make sure the alpha offset comes from the format.
+    const int b = 0, g = 1, r = 2, a = 3;
+
+    unsigned char* input = malloc(bytesPerRow * h);
+    unsigned char* unpremultiplied = malloc(bytesPerRow * h);
+    unsigned char* expected = malloc(bytesPerRow * h);
+    unsigned char* actual = malloc(bytesPerRow * h);
+
+    fill_random (input, bytesPerRow * h);
+    for (int row = 0; row < h; ++row)
+    for (int col = 0; col < w; ++col)
+    {
+        unsigned char* p = input + row*bytesPerRow + col*4;
+        // Long transparent runs, then isolated transparent and opaque pixels.
+        if (col < 40 || (col >= 70 && col < 90))
+            p[a] = 0;
+        else if (rand() % 4 == 0)
+            p[a] = (rand() % 2) ? 0 : 255;
+    }
+
+
+    int numFailed = 0;
+    for (int kernel = DLKernel_Scalar; kernel <= DLKernel_WasmSIMD128; ++kernel)
+    {
+        if (!dl_force_kernel(kernel))
+            continue;
+
+        int skipFailed = 0, premultipliedFailed = 0;
+        for (int deficiency = DLDeficiency_Protan; deficiency <= DLDeficiency_Tritan; ++deficiency)
+        {
+            memcpy (expected, input, bytesPerRow * h);
+            dl_simulate_cvd_format(DLAlgorithm_Auto, DLPixelFormat_BGRA32, deficiency, 0.8f, expected, expected, w, h, bytesPerRow, bytesPerRow);
+            for (int row = 0; row < h; ++row)
+            for (int col = 0; col < w; ++col)
+            {
+                if (input[row*bytesPerRow + col*4 + a] == 0)
+                    memcpy (expected + row*bytesPerRow + col*4, input + row*bytesPerRow + col*4, 4);
+            }
+
+            // In place, and out of place into a dirty buffer.
+            memcpy (actual, input, bytesPerRow * h);
+            skipFailed |= !dl_simulate_cvd_alpha(DLAlgorithm_Auto, DLPixelFormat_BGRA32, DLAlphaMode_SkipTransparent, deficiency, 0.8f, actual, actual, w, h, bytesPerRow, bytesPerRow);
+            for (int row = 0; row < h; ++row)
+                skipFailed |= memcmp(actual + row*bytesPerRow, expected + row*bytesPerRow, w*4) != 0;
+
+            memset (actual, 0xcd, bytesPerRow * h);
+            skipFailed |= !dl_simulate_cvd_alpha(DLAlgorithm_Auto, DLPixelFormat_BGRA32, DLAlphaMode_SkipTransparent, deficiency, 0.8f, input, actual, w, h, bytesPerRow, bytesPerRow);
+            for (int row = 0; row < h; ++row)
+            {
+                skipFailed |= memcmp(actual + row*bytesPerRow, expected + row*bytesPerRow, w*4) != 0;
+                for (int i = w*4; i < bytesPerRow; ++i)
+                    skipFailed |= actual[row*bytesPerRow + i] != 0xcd;
+            }
+
+            // The input colors are used as premultiplied values, possibly
+            // invalid (above alpha), which should get clamped.
+            memcpy (unpremultiplied, input, bytesPerRow * h);
+            for (int row = 0; row < h; ++row)
+            for (int col = 0; col < w; ++col)
+            {
+                unsigned char* p = unpremultiplied + row*bytesPerRow + col*4;
+                if (p[a] == 0)
+                    continue;
+                for (int k = 0; k < 3; ++k)
+                {
+                    const int v = (int)((p[k]*255.0 / p[a]) + 0.5);
+                    p[k] = v > 255 ? 255 : v;
+                }
+            }
+            dl_simulate_cvd_format(DLAlgorithm_Auto, DLPixelFormat_BGRA32, deficiency, 0.8f, unpremultiplied, unpremultiplied, w, h, bytesPerRow, bytesPerRow);
+
+            memcpy (actual, input, bytesPerRow * h);
+            premultipliedFailed |= !dl_simulate_cvd_alpha(DLAlgorithm_Auto, DLPixelFormat_BGRA32, DLAlphaMode_Premultiplied, deficiency, 0.8f, actual, actual, w, h, bytesPerRow, bytesPerRow);
+            for (int row = 0; row < h; ++row)
+            for (int col = 0; col < w; ++col)
+            {
+                const unsigned char* in = input + row*bytesPerRow + col*4;
+                const unsigned char* ref = unpremultiplied + row*bytesPerRow + col*4;
+                const unsigned char* out = actual + row*bytesPerRow + col*4;
+                if (in[a] == 0)
+                {
+                    premultipliedFailed |= memcmp(out, in, 4) != 0;
+                    continue;
+                }
+                premultipliedFailed |= out[a] != in[a];
+                premultipliedFailed |= out[r] != (int)(ref[r]*in[a]/255.0 + 0.5);
+                premultipliedFailed |= out[g] != (int)(ref[g]*in[a]/255.0 + 0.5);
+                premultipliedFailed |= out[b] != (int)(ref[b]*in[a]/255.0 + 0.5);
+            }
+        }
+
+        if (skipFailed || premultipliedFailed)
+        {
+            fprintf (stderr, "FAIL: (%s) skipFailed=%d premultipliedFailed=%d\n", kernelNames[kernel], skipFailed, premultipliedFailed);
+            ++numFailed;
+        }
+    }
+    dl_force_kernel(DLKernel_Auto);
+
+    if (dl_simulate_cvd_alpha(DLAlgorithm_Auto, DLPixelFormat_RGBX32, DLAlphaMode_SkipTransparent, DLDeficiency_Protan, 1.f, input, actual, w, h, 0, 0)
+        || dl_simulate_cvd_alpha(DLAlgorithm_Auto, DLPixelFormat_RGBA32, (enum DLAlphaMode)42, DLDeficiency_Protan, 1.f, input, actual, w, h, 0, 0))
+    {
+        fprintf (stderr, "FAIL: invalid alpha mode accepted\n");
+        ++numFailed;
+    }
+
+    if (numFailed == 0)
+        fprintf (stderr, "GOOD: (dl_simulate_cvd_alpha)\n");
+
+    free (input);
+    free (unpremultiplied);
+    free (expected);
+    free (actual);
+    return numFailed;
+}
+
+// The linear float path should match the 8-bit kernels up to the encoding,
+// for every kernel, and leave alpha and the row padding untouched. Half
+// floats and 16-bit sRGB should round-trip exactly with a severity of 0.
+int test_sampleFormats ()
+{
+    const int w = 67, h = 5, floatsPerRow = w*4 + 8;
+    const int numValues = 65536;
+    unsigned char* srgba = malloc(w*4*h);
+    unsigned char* expected = malloc(w*4*h);
+    float* input = malloc(floatsPerRow*h*sizeof(float));
+    float* actual = malloc(floatsPerRow*h*sizeof(float));
+    uint16_t* input16 = malloc(numValues*sizeof(uint16_t));
+    uint16_t* actual16 = malloc(numValues*sizeof(uint16_t));
+
+    fill_random (srgba, w*4*h);
+
+    for (int r = 0; r < h; ++r)
+    {
+        for (int c = 0; c < w; ++c)
+        {
+            const unsigned char* px = srgba + (r*w + c)*4;
+            float* out = input + r*floatsPerRow + c*4;
+            for (int k = 0; k < 3; ++k)
+                out[k] = dl_linearRGB_from_sRGB(px[k]);
+            out[3] = px[3] / 255.f;
+        }
+        for (int i = w*4; i < floatsPerRow; ++i)
+            input[r*floatsPerRow + i] = 12345.f;
+    }
+
+
+    int numFailed = 0;
+    for (int kernel = DLKernel_Scalar; kernel <= DLKernel_WasmSIMD128; ++kernel)
+    {
+        if (!dl_force_kernel(kernel))
+            continue;
+
+        int floatFailed = 0, sRGB16Failed = 0;
+        for (int algorithm = DLAlgorithm_Brettel1997; algorithm <= DLAlgorithm_Vienot1999; ++algorithm)
+        for (int deficiency = DLDeficiency_Protan; deficiency <= DLDeficiency_Tritan; ++deficiency)
+        {
+            memcpy (expected, srgba, w*4*h);
+            dl_simulate_cvd_format(algorithm, DLPixelFormat_RGBA32, deficiency, 0.8f, expected, expected, w, h, 0, 0);
+
+            memcpy (actual, input, floatsPerRow*h*sizeof(float));
+            floatFailed |= !dl_simulate_cvd_samples(algorithm, DLSampleFormat_LinearRGBA32F, deficiency, 0.8f, actual, actual, w, h, floatsPerRow*sizeof(float), floatsPerRow*sizeof(float));
+            for (int r = 0; r < h; ++r)
+            {
+                for (int c = 0; c < w; ++c)
+                {
+                    const float* px = actual + r*floatsPerRow + c*4;
+                    for (int k = 0; k < 3; ++k)
+                        floatFailed |= abs(dl_sRGB_from_linearRGB(px[k]) - expected[(r*w + c)*4 + k]) > 1;
+                    floatFailed |= px[3] != input[r*floatsPerRow + c*4 + 3];
+                }
+                for (int i = w*4; i < floatsPerRow; ++i)
+                    floatFailed |= actual[r*floatsPerRow + i] != 12345.f;
+            }
+
+            // The same colors with 16 bits, compared with 8-bit precision.
+            for (int i = 0; i < w*4*h; ++i)
+                input16[i] = srgba[i] * 257;
+            sRGB16Failed |= !dl_simulate_cvd_samples(algorithm, DLSampleFormat_sRGBA16, deficiency, 0.8f, input16, actual16, w, h, 0, 0);
+            for (int i = 0; i < w*4*h; ++i)
+            {
+                const int maxDiff = (i % 4 == 3) ? 0 : 1;
+                sRGB16Failed |= abs((int)(actual16[i] / 257.f + 0.5f) - (i % 4 == 3 ? srgba[i] : expected[i])) > maxDiff;
+            }
+        }
+
+        // All the 16-bit values, except the half float infinities and NaNs.
+        int halfFailed = 0;
+        for (int i = 0; i < numValues; ++i)
+            input16[i] = ((i >> 10) & 0x1f) == 0x1f ? 0 : i;
+        halfFailed |= !dl_simulate_cvd_samples(DLAlgorithm_Vienot1999, DLSampleFormat_LinearRGBA16F, DLDeficiency_Protan, 0.f, input16, actual16, numValues/4, 1, 0, 0);
+        halfFailed |= memcmp(input16, actual16, numValues*sizeof(uint16_t)) != 0;
+
+        for (int i = 0; i < numValues; ++i)
+            input16[i] = i;
+        sRGB16Failed |= !dl_simulate_cvd_samples(DLAlgorithm_Vienot1999, DLSampleFormat_sRGBA16, DLDeficiency_Protan, 0.f, input16, actual16, numValues/4, 1, 0, 0);
+        sRGB16Failed |= memcmp(input16, actual16, numValues*sizeof(uint16_t)) != 0;
+
+        if (floatFailed || halfFailed || sRGB16Failed)
+        {
+            fprintf (stderr, "FAIL: (%s) floatFailed=%d halfFailed=%d sRGB16Failed=%d\n", kernelNames[kernel], floatFailed, halfFailed, sRGB16Failed);
+            ++numFailed;
+        }
+    }
+    dl_force_kernel(DLKernel_Auto);
+
+    if (dl_simulate_cvd_samples(DLAlgorithm_Auto, (enum DLSampleFormat)42, DLDeficiency_Protan, 1.f, input, actual, w, h, 0, 0))
+    {
+        fprintf (stderr, "FAIL: invalid sample format accepted\n");
+        ++numFailed;
+    }
+
+    if (numFailed == 0)
+        fprintf (stderr, "GOOD: (dl_simulate_cvd_samples)\n");
+
+    free (srgba);
+    free (expected);
+    free (input);
+    free (actual);
+    free (input16);
+    free (actual16);
+    return numFailed;
+}
+
+// BT.709 limited range, in float.
+static void reference_rgb_from_yuv (int y, int u, int v, int rgb[3])
+{
+    const float fy = 1.164383f*(y - 16);
+    const float rgbf[3] = { fy + 1.792741f*(v - 128), fy - 0.213249f*(u - 128) - 0.532909f*(v - 128), fy + 2.112402f*(u - 128) };
+    for (int c = 0; c < 3; ++c)
+        rgb[c] = rgbf[c] < 0.f ? 0 : (rgbf[c] > 255.f ? 255 : (int)(rgbf[c] + 0.5f));
+}
+
+static void reference_yuv_from_rgb (const float rgb[3], int yuv[3])
+{
+    yuv[0] = (int)(16.5f + 0.182586f*rgb[0] + 0.614231f*rgb[1] + 0.062007f*rgb[2]);
+    yuv[1] = (int)(128.5f - 0.100644f*rgb[0] - 0.338572f*rgb[1] + 0.439216f*rgb[2]);
+    yuv[2] = (int)(128.5f + 0.439216f*rgb[0] - 0.398942f*rgb[1] - 0.040274f*rgb[2]);
+}
+
+// Planar images should give the same output as RGB24. YUV frames should
+// give the same output as simulating their RGB conversion, both for the
+// RGBA and the YUV output, with NV12 and I420 in sync. Odd sizes exercise
+// the incomplete chroma blocks.
+int test_planarAndYuv ()
+{
+    const int w = 67, h = 13, bytesPerRow = w + 5;
+    const int cw = (w + 1)/2, ch = (h + 1)/2;
+    unsigned char* rgb24 = malloc(w*3*h);
+    unsigned char* planes = malloc(bytesPerRow*h*3);
+    unsigned char* rgba = malloc(w*4*h);
+    unsigned char* expected = malloc(w*4*h);
+    unsigned char* i420 = malloc(w*h + 2*cw*ch);
+    unsigned char* nv12 = malloc(w*h + 2*cw*ch);
+    unsigned char* i420Out = malloc(w*h + 2*cw*ch);
+    unsigned char* nv12Copy = malloc(w*h + 2*cw*ch);
+
+    fill_random (rgb24, w*3*h);
+
+    int numFailed = 0;
+
+    int planarFailed = 0;
+    for (int algorithm = DLAlgorithm_Brettel1997; algorithm <= DLAlgorithm_Vienot1999; ++algorithm)
+    for (int deficiency = DLDeficiency_Protan; deficiency <= DLDeficiency_Tritan; ++deficiency)
+    {
+        memset (planes, 0xcd, bytesPerRow*h*3);
+        unsigned char* rgbPlanes[3] = { planes, planes + bytesPerRow*h, planes + 2*bytesPerRow*h };
+        for (int r = 0; r < h; ++r)
+            for (int c = 0; c < w; ++c)
+                for (int k = 0; k < 3; ++k)
+                    rgbPlanes[k][r*bytesPerRow + c] = rgb24[(r*w + c)*3 + k];
+
+        memcpy (expected, rgb24, w*3*h);
+        dl_simulate_cvd_format(algorithm, DLPixelFormat_RGB24, deficiency, 0.8f, expected, expected, w, h, 0, 0);
+        planarFailed |= !dl_simulate_cvd_planar(algorithm, deficiency, 0.8f, (const unsigned char* const*)rgbPlanes, rgbPlanes, w, h, bytesPerRow, bytesPerRow);
+        for (int r = 0; r < h; ++r)
+        {
+            for (int c = 0; c < w; ++c)
+                for (int k = 0; k < 3; ++k)
+                    planarFailed |= rgbPlanes[k][r*bytesPerRow + c] != expected[(r*w + c)*3 + k];
+            for (int k = 0; k < 3; ++k)
+                for (int c = w; c < bytesPerRow; ++c)
+                    planarFailed |= rgbPlanes[k][r*bytesPerRow + c] != 0xcd;
+        }
+    }
+    if (planarFailed)
+    {
+        fprintf (stderr, "FAIL: (dl_simulate_cvd_planar) differs from RGB24\n");
+        ++numFailed;
+    }
+
+    // Random luma and chroma.
+    for (int i = 0; i < w*h + 2*cw*ch; ++i)
+        i420[i] = 16 + rand() % 220;
+    memcpy (nv12, i420, w*h);
+    for (int i = 0; i < cw*ch; ++i)
+    {
+        nv12[w*h + 2*i] = i420[w*h + i];
+        nv12[w*h + 2*i + 1] = i420[w*h + cw*ch + i];
+    }
+    const struct DLYuvImage i420Image = { { i420, i420 + w*h, i420 + w*h + cw*ch }, { 0, 0, 0 } };
+    const struct DLYuvImage nv12Image = { { nv12, nv12 + w*h, NULL }, { 0, 0, 0 } };
+
+    // Reference conversion to RGBA, in float.
+    unsigned char* converted = malloc(w*4*h);
+    for (int r = 0; r < h; ++r)
+    for (int c = 0; c < w; ++c)
+    {
+        const int ci = (r/2)*cw + c/2;
+        int ref[3];
+        reference_rgb_from_yuv(i420[r*w + c], i420[w*h + ci], i420[w*h + cw*ch + ci], ref);
+        for (int k = 0; k < 3; ++k)
+            converted[(r*w + c)*4 + k] = ref[k];
+        converted[(r*w + c)*4 + 3] = 255;
+    }
+
+    int toRgbaMaxDiff = 0, yuvMaxDiff = 0, yuvFailed = 0;
+    for (int algorithm = DLAlgorithm_Brettel1997; algorithm <= DLAlgorithm_Vienot1999; ++algorithm)
+    for (int deficiency = DLDeficiency_Protan; deficiency <= DLDeficiency_Tritan; ++deficiency)
+    {
+        // RGBA output: same as simulating the converted image, up to the
+        // fixed point rounding.
+        memcpy (expected, converted, w*4*h);
+        dl_simulate_cvd_format(algorithm, DLPixelFormat_RGBA32, deficiency, 0.8f, expected, expected, w, h, 0, 0);
+        yuvFailed |= !dl_simulate_cvd_yuv_to_rgba(algorithm, DLYuvFormat_NV12, deficiency, 0.8f, &nv12Image, rgba, w, h, 0);
+        for (int i = 0; i < w*4*h; ++i)
+        {
+            const int diff = abs(rgba[i] - expected[i]);
+            if (diff > toRgbaMaxDiff) toRgbaMaxDiff = diff;
+        }
+        memcpy (expected, rgba, w*4*h);
+        yuvFailed |= !dl_simulate_cvd_yuv_to_rgba(algorithm, DLYuvFormat_I420, deficiency, 0.8f, &i420Image, rgba, w, h, 0);
+        yuvFailed |= memcmp(rgba, expected, w*4*h) != 0;
+
+        // YUV output, compared with the float conversion of the RGBA
+        // output. The NV12 version is done in place.
+        const struct DLYuvImage i420OutImage = { { i420Out, i420Out + w*h, i420Out + w*h + cw*ch }, { 0, 0, 0 } };
+        yuvFailed |= !dl_simulate_cvd_yuv(algorithm, DLYuvFormat_I420, deficiency, 0.8f, &i420Image, &i420OutImage, w, h);
+        for (int cr = 0; cr < ch; ++cr)
+        for (int cc = 0; cc < cw; ++cc)
+        {
+            float sum[3] = { 0.f, 0.f, 0.f };
+            int n = 0;
+            for (int r = 2*cr; r < 2*cr + 2 && r < h; ++r)
+            for (int c = 2*cc; c < 2*cc + 2 && c < w; ++c)
+            {
+                const float rgb[3] = { rgba[(r*w + c)*4], rgba[(r*w + c)*4 + 1], rgba[(r*w + c)*4 + 2] };
+                int yuv[3];
+                reference_yuv_from_rgb(rgb, yuv);
+                const int diff = abs(i420Out[r*w + c] - yuv[0]);
+                if (diff > yuvMaxDiff) yuvMaxDiff = diff;
+                for (int k = 0; k < 3; ++k)
+                    sum[k] += rgb[k];
+                ++n;
+            }
+            for (int k = 0; k < 3; ++k)
+                sum[k] /= n;
+            int yuv[3];
+            reference_yuv_from_rgb(sum, yuv);
+            const int ci = cr*cw + cc;
+            const int diffs[2] = { abs(i420Out[w*h + ci] - yuv[1]), abs(i420Out[w*h + cw*ch + ci] - yuv[2]) };
+            for (int k = 0; k < 2; ++k)
+                if (diffs[k] > yuvMaxDiff) yuvMaxDiff = diffs[k];
+        }
+
+        memcpy (nv12Copy, nv12, w*h + 2*cw*ch);
+        const struct DLYuvImage nv12CopyImage = { { nv12Copy, nv12Copy + w*h, NULL }, { 0, 0, 0 } };
+        yuvFailed |= !dl_simulate_cvd_yuv(algorithm, DLYuvFormat_NV12, deficiency, 0.8f, &nv12CopyImage, &nv12CopyImage, w, h);
+        yuvFailed |= memcmp(nv12Copy, i420Out, w*h) != 0;
+        for (int i = 0; i < cw*ch; ++i)
+        {
+            yuvFailed |= nv12Copy[w*h + 2*i] != i420Out[w*h + i];
+            yuvFailed |= nv12Copy[w*h + 2*i + 1] != i420Out[w*h + cw*ch + i];
+        }
+    }
+
+    if (dl_simulate_cvd_yuv(DLAlgorithm_Auto, (enum DLYuvFormat)42, DLDeficiency_Protan, 1.f, &i420Image, &i420Image, w, h))
+    {
+        fprintf (stderr, "FAIL: invalid YUV format accepted\n");
+        ++numFailed;
+    }
+
+    if (toRgbaMaxDiff > 1 || yuvMaxDiff > 1 || yuvFailed)
+    {
+        fprintf (stderr, "FAIL: (dl_simulate_cvd_yuv) toRgbaMaxDiff=%d yuvMaxDiff=%d yuvFailed=%d\n", toRgbaMaxDiff, yuvMaxDiff, yuvFailed);
+        ++numFailed;
+    }
+
+    if (numFailed == 0)
+        fprintf (stderr, "GOOD: (dl_simulate_cvd_planar, dl_simulate_cvd_yuv)\n");
+
+    free (rgb24);
+    free (planes);
+    free (rgba);
+    free (expected);
+    free (converted);
+    free (i420);
+    free (nv12);
+    free (i420Out);
+    free (nv12Copy);
+    return numFailed;
+}
+
+// The single pass version should give exactly the same output as separate
+// dl_simulate_cvd_to calls, for every kernel and with NULL outputs.
+int test_allDeficiencies ()
+{
+    const int w = 67, h = 13, srcBytesPerRow = w*4 + 12, dstBytesPerRow = w*4 + 20;
+    unsigned char* input = malloc(srcBytesPerRow * h);
+    unsigned char* expected[3];
+    unsigned char* actual[3];
+    for (int d = 0; d < 3; ++d)
+    {
+        expected[d] = malloc(dstBytesPerRow * h);
+        actual[d] = malloc(dstBytesPerRow * h);
+    }
+
+    fill_random (input, srcBytesPerRow * h);
+
+    const float severities[] = { 1.f, 0.55f };
+
+    int numFailed = 0;
+    for (int kernel = DLKernel_Scalar; kernel <= DLKernel_WasmSIMD128; ++kernel)
+    {
+        if (!dl_force_kernel(kernel))
+            continue;
+
+        int failed = 0;
+        for (int s = 0; s < 2; ++s)
+        {
+            for (int d = 0; d < 3; ++d)
+            {
+                memset (expected[d], 0xcd, dstBytesPerRow * h);
+                dl_simulate_cvd_to(d, severities[s], input, expected[d], w, h, srcBytesPerRow, dstBytesPerRow);
+            }
+
+            // Skip the deutan output on the second pass, it must stay untouched.
+            const int skipDeutan = s == 1;
+            for (int d = 0; d < 3; ++d)
+                memset (actual[d], 0xcd, dstBytesPerRow * h);
+            dl_simulate_cvd_all_deficiencies(severities[s], input, actual[DLDeficiency_Protan], skipDeutan ? NULL : actual[DLDeficiency_Deutan], actual[DLDeficiency_Tritan], w, h, srcBytesPerRow, dstBytesPerRow);
+
+            for (int d = 0; d < 3; ++d)
+            {
+                if (d == DLDeficiency_Deutan && skipDeutan)
+                {
+                    for (int i = 0; i < dstBytesPerRow * h; ++i)
+                        failed |= actual[d][i] != 0xcd;
+                }
+                else
+                {
+                    failed |= memcmp(expected[d], actual[d], dstBytesPerRow * h) != 0;
+                }
+            }
+        }
+
+        if (failed)
+        {
+            fprintf (stderr, "FAIL: (%s) differs from separate calls\n", kernelNames[kernel]);
+            ++numFailed;
+        }
+        else
+        {
+            fprintf (stderr, "GOOD: (%s)\n", kernelNames[kernel]);
+        }
+    }
+    dl_force_kernel(DLKernel_Auto);
+
+    free (input);
+    for (int d = 0; d < 3; ++d)
+    {
+        free (expected[d]);
+        free (actual[d]);
+    }
+    return numFailed;
+}
+
+// Folding the severity in the matrices only changes the rounding, so the
+// output should be within ±1 of the regular functions, and identical for
+// the severities that don't need any interpolation.
+int test_simulator ()
+{
+    const int w = 67, h = 13, bytesPerRow = w*4 + 12;
+    unsigned char* input = malloc(bytesPerRow * h);
+    unsigned char* expected = malloc(bytesPerRow * h);
+    unsigned char* actual = malloc(bytesPerRow * h);
+
+    fill_random (input, bytesPerRow * h);
+
+    const char* algorithmNames[] = { "auto", "brettel1997", "vienot1999" };
+    const float severities[] = { 1.f, 0.55f, 0.f };
 
     int numFailed = 0;
+    for (int algorithm = DLAlgorithm_Auto; algorithm <= DLAlgorithm_Vienot1999; ++algorithm)
+    for (int deficiency = DLDeficiency_Protan; deficiency <= DLDeficiency_Tritan; ++deficiency)
+    for (int s = 0; s < 3; ++s)
+    {
+        memcpy (expected, input, bytesPerRow * h);
+        switch (algorithm)
+        {
+            case DLAlgorithm_Auto: dl_simulate_cvd(deficiency, severities[s], expected, w, h, bytesPerRow); break;
+            case DLAlgorithm_Brettel1997: dl_simulate_cvd_brettel1997(deficiency, severities[s], expected, w, h, bytesPerRow); break;
+            case DLAlgorithm_Vienot1999: dl_simulate_cvd_vienot1999(deficiency, severities[s], expected, w, h, bytesPerRow); break;
+        }
+
+        struct DLSimulator* simulator = dl_simulator_create(algorithm, deficiency, severities[s]);
+        memcpy (actual, input, bytesPerRow * h);
+        dl_simulator_apply(simulator, actual, w, h, bytesPerRow);
+        dl_simulator_destroy(simulator);
+
+        int maxDiff = 0;
+        for (int i = 0; i < bytesPerRow * h; ++i)
+        {
+            int diff = abs(expected[i] - actual[i]);
+            if (diff > maxDiff) maxDiff = diff;
+        }
+
+        const int maxAllowedDiff = (severities[s] == 0.55f) ? 1 : 0;
+        if (maxDiff > maxAllowedDiff)
+        {
+            fprintf (stderr, "FAIL: (%s, deficiency %d, severity %.2f) maxDiff=%d\n", algorithmNames[algorithm], deficiency, severities[s], maxDiff);
+            ++numFailed;
+        }
+    }
+
+    if (dl_simulator_create(DLAlgorithm_Auto, (enum DLDeficiency)42, 1.f) != NULL)
+    {
+        fprintf (stderr, "FAIL: invalid deficiency accepted\n");
+        ++numFailed;
+    }
+
+    if (dl_simulator_create((enum DLAlgorithm)42, DLDeficiency_Protan, 1.f) != NULL)
+    {
+        fprintf (stderr, "FAIL: invalid algorithm accepted\n");
+        ++numFailed;
+    }
+
+    if (numFailed == 0)
+        fprintf (stderr, "GOOD: (dl_simulator_apply)\n");
+
+    free (input);
+    free (expected);
+    free (actual);
+    return numFailed;
+}
+
+// Same mapping and clamping as the library, to build the reference.
+static float severity_map_value (const struct DLSeverityMap* map, int x, int y, int w, int h)
+{
+    const size_t mx = ((size_t)x * map->width) / w, my = ((size_t)y * map->height) / h;
+    if (map->format == DLSeverityMapFormat_U8)
+        return ((const unsigned char*)map->values)[my * map->width + mx] / 255.f;
+    const float v = ((const float*)map->values)[my * map->width + mx];
+    return v > 0.f ? (v < 1.f ? v : 1.f) : 0.f;
+}
+
+// Every kernel must match each pixel simulated alone with its severity.
+int test_severityMaps ()
+{
+    const int w = 253, h = 37;
+    unsigned char* input = malloc(w * h * 4);
+    unsigned char* expected = malloc(w * h * 4);
+    unsigned char* actual = malloc(w * h * 4);
+
+    fill_random (input, w * h * 4);
+
+    // Per-pixel gradient, split view, constant, and out of range values.
+    unsigned char* gradient = malloc(w * h);
+    for (int y = 0; y < h; ++y)
+        for (int x = 0; x < w; ++x)
+            gradient[y * w + x] = (unsigned char)((x + 3 * y) % 256);
+    const float split[] = { 0.f, 1.f };
+    const float constant[] = { 0.6f };
+    const float clamped[] = { -0.5f, 0.9995f, NAN, 2.f, 0.25f, 1.f };
+    const struct DLSeverityMap maps[] = {
+        { gradient, DLSeverityMapFormat_U8, w, h, 0 },
+        { split, DLSeverityMapFormat_F32, 2, 1, 0 },
+        { constant, DLSeverityMapFormat_F32, 1, 1, 0 },
+        { clamped, DLSeverityMapFormat_F32, 3, 2, 3 * sizeof(float) },
+    };
+    const char* mapNames[] = { "gradient", "split", "constant", "clamped" };
+    const enum DLPixelFormat formats[] = { DLPixelFormat_RGBA32, DLPixelFormat_RGB24 };
+    const int pixelSizes[] = { 4, 3 };
+
+    int numFailed = 0;
+    int numChecked = 0;
+    for (int algorithm = DLAlgorithm_Brettel1997; algorithm <= DLAlgorithm_Vienot1999; ++algorithm)
+    for (int deficiency = DLDeficiency_Protan; deficiency <= DLDeficiency_Tritan; ++deficiency)
+    for (int f = 0; f < 2; ++f)
+    for (size_t m = 0; m < sizeof(maps)/sizeof(maps[0]); ++m)
+    {
+        // Reference: each pixel simulated alone with its severity.
+        const int pixelSize = pixelSizes[f];
+        dl_force_kernel(DLKernel_Scalar);
+        for (int y = 0; y < h; ++y)
+            for (int x = 0; x < w; ++x)
+            {
+                const size_t offset = ((size_t)y * w + x) * pixelSize;
+                dl_simulate_cvd_format(algorithm, formats[f], deficiency, severity_map_value(&maps[m], x, y, w, h),
+                                       input + offset, expected + offset, 1, 1, 0, 0);
+            }
+
+        for (int kernel = DLKernel_Scalar; kernel <= DLKernel_WasmSIMD128; ++kernel)
+        {
+            if (!dl_force_kernel(kernel))
+                continue;
+
+            memset (actual, 0, w * h * 4);
+            if (!dl_simulate_cvd_severity_map(algorithm, formats[f], deficiency, &maps[m], input, actual, w, h, 0, 0)
+                || memcmp(expected, actual, w * h * pixelSize) != 0)
+            {
+                fprintf (stderr, "FAIL: (%s, %s, algorithm %d, deficiency %d, format %d) differs from the reference\n",
+                         mapNames[m], kernelNames[kernel], algorithm, deficiency, formats[f]);
+                ++numFailed;
+            }
+
+            memset (actual, 0, w * h * 4);
+            if (!dl_simulate_cvd_severity_map_mt(algorithm, formats[f], deficiency, &maps[m], input, actual, w, h, 0, 0, 4)
+                || memcmp(expected, actual, w * h * pixelSize) != 0)
+            {
+                fprintf (stderr, "FAIL: (%s, %s, algorithm %d, deficiency %d, format %d) _mt differs from the reference\n",
+                         mapNames[m], kernelNames[kernel], algorithm, deficiency, formats[f]);
+                ++numFailed;
+            }
+            ++numChecked;
+        }
+
+        // A constant map is the same as a single severity.
+        if (m == 2)
+        {
+            dl_force_kernel(DLKernel_Auto);
+            dl_simulate_cvd_format(algorithm, formats[f], deficiency, constant[0], input, expected, w, h, 0, 0);
+            dl_simulate_cvd_severity_map(algorithm, formats[f], deficiency, &maps[m], input, actual, w, h, 0, 0);
+            if (memcmp(expected, actual, w * h * pixelSize) != 0)
+            {
+                fprintf (stderr, "FAIL: (algorithm %d, deficiency %d, format %d) constant map differs from dl_simulate_cvd_format\n",
+                         algorithm, deficiency, formats[f]);
+                ++numFailed;
+            }
+        }
+    }
+    dl_force_kernel(DLKernel_Auto);
+
+    const struct DLSeverityMap invalidMaps[] = {
+        { NULL, DLSeverityMapFormat_U8, 1, 1, 0 },
+        { constant, DLSeverityMapFormat_F32, 0, 1, 0 },
+        { constant, (enum DLSeverityMapFormat)42, 1, 1, 0 },
+        { split, DLSeverityMapFormat_F32, 2, 1, 4 },
+    };
+    for (size_t m = 0; m < sizeof(invalidMaps)/sizeof(invalidMaps[0]); ++m)
+    {
+        if (dl_simulate_cvd_severity_map(DLAlgorithm_Auto, DLPixelFormat_RGBA32, DLDeficiency_Protan, &invalidMaps[m], input, actual, w, h, 0, 0))
+        {
+            fprintf (stderr, "FAIL: invalid map %d accepted\n", (int)m);
+            ++numFailed;
+        }
+    }
+    if (dl_simulate_cvd_severity_map(DLAlgorithm_Auto, DLPixelFormat_RGBA32, DLDeficiency_Protan, NULL, input, actual, w, h, 0, 0))
+    {
+        fprintf (stderr, "FAIL: NULL map accepted\n");
+        ++numFailed;
+    }
+
+    if (numFailed == 0)
+        fprintf (stderr, "GOOD: (dl_simulate_cvd_severity_map) %d configurations match the per-pixel reference\n", numChecked);
+
+    free (input);
+    free (expected);
+    free (actual);
+    free (gradient);
+    return numFailed;
+}
+
+// Exact must match the textbook encoding of the linear float output, and
+// the histograms of the differences show the cost of the other modes. The
+// fast SIMD kernels must match the scalar one exactly.
+int test_accuracyModes ()
+{
+    const int w = 253, h = 64;
+    unsigned char* input = malloc(w * h * 4);
+    unsigned char* expected = malloc(w * h * 4);
+    unsigned char* scalar = malloc(w * h * 4);
+    unsigned char* actual = malloc(w * h * 4);
+    float* linear = malloc(w * h * 4 * sizeof(float));
+
+    fill_random (input, w * h * 4);
+
+    const char* accuracyNames[] = { "default", "exact", "fast" };
+    const int maxAllowedDiffs[] = { 1, 0, 1 };
+    const float severities[] = { 1.f, 0.6f };
+
+    int histograms[3][4] = { { 0 } };
+    int numFailed = 0;
+    for (int deficiency = DLDeficiency_Protan; deficiency <= DLDeficiency_Tritan; ++deficiency)
+    for (int s = 0; s < 2; ++s)
+    {
+        struct DLSimulator* simulator = dl_simulator_create(DLAlgorithm_Auto, deficiency, severities[s]);
+
+        dl_force_kernel(DLKernel_Scalar);
+        for (int i = 0; i < w * h * 4; ++i)
+            linear[i] = dl_linearRGB_from_sRGB(input[i]);
+        dl_simulator_apply_samples(simulator, DLSampleFormat_LinearRGBA32F, linear, linear, w, h, 0, 0);
+        for (int i = 0; i < w * h * 4; ++i)
+            expected[i] = (i % 4 == 3) ? input[i] : reference_sRGB_from_linearRGB(linear[i]);
+
+        for (int accuracy = DLAccuracy_Default; accuracy <= DLAccuracy_Fast; ++accuracy)
+        {
+            dl_simulator_set_accuracy(simulator, accuracy);
+            dl_force_kernel(DLKernel_Scalar);
+            dl_simulator_apply_to(simulator, input, scalar, w, h, 0, 0);
+            for (int i = 0; i < w * h * 4; ++i)
+            {
+                const int diff = abs(scalar[i] - expected[i]);
+                ++histograms[accuracy][diff < 3 ? diff : 3];
+            }
+
+            for (int kernel = DLKernel_SSE41; kernel <= DLKernel_WasmSIMD128; ++kernel)
+            {
+                if (!dl_force_kernel(kernel))
+                    continue;
+                dl_simulator_apply_to(simulator, input, actual, w, h, 0, 0);
+                if (memcmp(scalar, actual, w * h * 4) != 0)
+                {
+                    fprintf (stderr, "FAIL: (%s, %s, deficiency %d) differs from scalar\n", accuracyNames[accuracy], kernelNames[kernel], deficiency);
+                    ++numFailed;
+                }
+            }
+
+            dl_force_kernel(DLKernel_Auto);
+            dl_simulator_apply_cached_to(simulator, input, actual, w, h, 0, 0, NULL);
+            if (memcmp(scalar, actual, w * h * 4) != 0)
+            {
+                fprintf (stderr, "FAIL: (%s, deficiency %d) the cache differs\n", accuracyNames[accuracy], deficiency);
+                ++numFailed;
+            }
+        }
+        dl_simulator_destroy(simulator);
+    }
+    dl_force_kernel(DLKernel_Auto);
+
+    for (int accuracy = DLAccuracy_Default; accuracy <= DLAccuracy_Fast; ++accuracy)
+    {
+        const int* histogram = histograms[accuracy];
+        int maxDiff = 0;
+        for (int d = 0; d < 4; ++d)
+            if (histogram[d] > 0) maxDiff = d;
+
+        if (maxDiff > maxAllowedDiffs[accuracy])
+        {
+            fprintf (stderr, "FAIL: (%s) maxDiff=%d\n", accuracyNames[accuracy], maxDiff);
+            ++numFailed;
+        }
+        fprintf (stderr, "%s: (%s) diff 0: %d, 1: %d, 2: %d, more: %d\n", maxDiff > maxAllowedDiffs[accuracy] ? "FAIL" : "GOOD",
+                 accuracyNames[accuracy], histogram[0], histogram[1], histogram[2], histogram[3]);
+    }
+
+    struct DLSimulator* simulator = dl_simulator_create(DLAlgorithm_Auto, DLDeficiency_Protan, 1.f);
+    if (dl_simulator_set_accuracy(simulator, (enum DLAccuracy)42))
+    {
+        fprintf (stderr, "FAIL: invalid accuracy accepted\n");
+        ++numFailed;
+    }
+    dl_simulator_destroy(simulator);
+
+    free (input);
+    free (expected);
+    free (scalar);
+    free (actual);
+    free (linear);
+    return numFailed;
+}
+
+// The daltonizers must follow the documented formula, checked on linear
+// float samples to avoid the 8-bit rounding, and the one-shot functions
+// must match them exactly.
+int test_daltonize ()
+{
+    const float errorShifts[3][9] = {
+        { 0.f, 0.f, 0.f,   0.7f, 1.f, 0.f,   0.7f, 0.f, 1.f },
+        { 0.f, 0.f, 0.f,   0.7f, 1.f, 0.f,   0.7f, 0.f, 1.f },
+        { 1.f, 0.f, 0.7f,  0.f, 1.f, 0.7f,   0.f, 0.f, 0.f },
+    };
+    const float severities[] = { 1.f, 0.6f, 0.f };
+
+    const int w = 97, h = 11;
+    float* input = malloc(w * h * 4 * sizeof(float));
+    float* simulated = malloc(w * h * 4 * sizeof(float));
+    float* corrected = malloc(w * h * 4 * sizeof(float));
+    unsigned char* srgba = malloc(w * h * 4);
+    unsigned char* expected = malloc(w * h * 4);
+    unsigned char* actual = malloc(w * h * 4);
+
+    srand(42);
+    for (int i = 0; i < w * h * 4; ++i)
+        input[i] = rand() / (float)RAND_MAX;
+    for (int i = 0; i < w * h * 4; ++i)
+        srgba[i] = rand() % 256;
+
+    int numFailed = 0;
+    for (int algorithm = DLAlgorithm_Auto; algorithm <= DLAlgorithm_Vienot1999; ++algorithm)
+    for (int deficiency = DLDeficiency_Protan; deficiency <= DLDeficiency_Tritan; ++deficiency)
+    for (int s = 0; s < 3; ++s)
+    {
+        struct DLSimulator* simulator = dl_simulator_create(algorithm, deficiency, severities[s]);
+        struct DLSimulator* daltonizer = dl_daltonizer_create(algorithm, deficiency, severities[s]);
+        dl_simulator_apply_samples(simulator, DLSampleFormat_LinearRGBA32F, input, simulated, w, h, 0, 0);
+        dl_simulator_apply_samples(daltonizer, DLSampleFormat_LinearRGBA32F, input, corrected, w, h, 0, 0);
+
+        const float* errorShift = errorShifts[deficiency];
+        float maxDiff = 0.f;
+        for (int px = 0; px < w * h * 4; px += 4)
+        {
+            float loss[3];
+            for (int c = 0; c < 3; ++c)
+                loss[c] = input[px + c] - simulated[px + c];
+            for (int c = 0; c < 3; ++c)
+            {
+                const float ref = input[px + c] + errorShift[c*3]*loss[0] + errorShift[c*3+1]*loss[1] + errorShift[c*3+2]*loss[2];
+                const float diff = fabsf(ref - corrected[px + c]);
+                if (diff > maxDiff) maxDiff = diff;
+            }
+        }
+
+        if (maxDiff > 1e-5f)
+        {
+            fprintf (stderr, "FAIL: (algorithm %d, deficiency %d, severity %.1f) maxDiff=%g\n", algorithm, deficiency, severities[s], maxDiff);
+            ++numFailed;
+        }
+
+        if (algorithm == DLAlgorithm_Auto)
+        {
+            dl_simulator_apply_to(daltonizer, srgba, expected, w, h, 0, 0);
+
+            memcpy (actual, srgba, w * h * 4);
+            dl_daltonize(deficiency, severities[s], actual, w, h, 0);
+            int same = memcmp(expected, actual, w * h * 4) == 0;
+
+            memset (actual, 0, w * h * 4);
+            dl_daltonize_to(deficiency, severities[s], srgba, actual, w, h, 0, 0);
+            same = same && memcmp(expected, actual, w * h * 4) == 0;
+
+            memcpy (actual, srgba, w * h * 4);
+            dl_daltonize_mt(deficiency, severities[s], actual, w, h, 0, 4);
+            same = same && memcmp(expected, actual, w * h * 4) == 0;
+
+            if (!same)
+            {
+                fprintf (stderr, "FAIL: (deficiency %d, severity %.1f) dl_daltonize differs from the daltonizer\n", deficiency, severities[s]);
+                ++numFailed;
+            }
+        }
+
+        dl_simulator_destroy(simulator);
+        dl_simulator_destroy(daltonizer);
+    }
+
+    if (dl_daltonizer_create(DLAlgorithm_Auto, (enum DLDeficiency)42, 1.f) != NULL)
+    {
+        fprintf (stderr, "FAIL: invalid deficiency accepted\n");
+        ++numFailed;
+    }
+
+    if (dl_daltonizer_create((enum DLAlgorithm)42, DLDeficiency_Protan, 1.f) != NULL)
+    {
+        fprintf (stderr, "FAIL: invalid algorithm accepted\n");
+        ++numFailed;
+    }
+
+    if (numFailed == 0)
+        fprintf (stderr, "GOOD: (dl_daltonize)\n");
+
+    free (input);
+    free (simulated);
+    free (corrected);
+    free (srgba);
+    free (expected);
+    free (actual);
+    return numFailed;
+}
+
+// Pushing strips of various heights through a single recycled buffer must
+// give the same output as processing the whole image at once.
+int test_stream ()
+{
+    const int w = 53, h = 41, pixelSize = 3, bytesPerRow = w*pixelSize + 5;
+    const int stripHeights[] = { 1, 7, 16, 3, 14 };
+    unsigned char* input = malloc(bytesPerRow * h);
+    unsigned char* expected = malloc(bytesPerRow * h);
+    unsigned char* actual = malloc(bytesPerRow * h);
+    unsigned char* strip = malloc(bytesPerRow * 16);
+
+    fill_random (input, bytesPerRow * h);
+
+    int numFailed = 0;
+    for (int deficiency = DLDeficiency_Protan; deficiency <= DLDeficiency_Tritan; ++deficiency)
+    {
+        struct DLSimulator* simulator = dl_simulator_create(DLAlgorithm_Auto, deficiency, 0.7f);
+        memcpy (expected, input, bytesPerRow * h);
+        dl_simulator_apply_format(simulator, DLPixelFormat_RGB24, expected, expected, w, h, bytesPerRow, bytesPerRow);
+
+        // The stream has its own copy of the simulator.
+        struct DLStream* stream = dl_stream_begin(simulator, DLPixelFormat_RGB24, w);
+        dl_simulator_destroy(simulator);
+
+        memcpy (actual, input, bytesPerRow * h);
+        int row = 0;
+        for (int s = 0; row < h; ++s)
+        {
+            int numRows = stripHeights[s % 5];
+            if (row + numRows > h) numRows = h - row;
+            if (s % 2 == 0)
+            {
+                memcpy (strip, input + row*bytesPerRow, numRows*bytesPerRow);
+                dl_stream_push_rows(stream, strip, numRows, bytesPerRow);
+                memcpy (actual + row*bytesPerRow, strip, numRows*bytesPerRow);
+            }
+            else
+            {
+                dl_stream_push_rows_to(stream, input + row*bytesPerRow, actual + row*bytesPerRow, numRows, bytesPerRow, bytesPerRow);
+            }
+            row += numRows;
+        }
+
+        const size_t numRowsPushed = dl_stream_end(stream);
+        if (numRowsPushed != (size_t)h || memcmp(expected, actual, bytesPerRow * h) != 0)
+        {
+            fprintf (stderr, "FAIL: (deficiency %d) rows=%d\n", deficiency, (int)numRowsPushed);
+            ++numFailed;
+        }
+    }
+
+    struct DLSimulator* simulator = dl_simulator_create(DLAlgorithm_Auto, DLDeficiency_Protan, 1.f);
+    if (dl_stream_begin(simulator, (enum DLPixelFormat)42, w) != NULL)
+    {
+        fprintf (stderr, "FAIL: invalid format accepted\n");
+        ++numFailed;
+    }
+    dl_simulator_destroy(simulator);
+
+    if (numFailed == 0)
+        fprintf (stderr, "GOOD: (dl_stream_push_rows)\n");
+
+    free (input);
+    free (expected);
+    free (actual);
+    free (strip);
+    return numFailed;
+}
+
+// Updating the simulation of the previous frame with the rectangles found
+// by dl_diff_tiles must give the simulation of the new frame.
+int test_dirtyRects ()
+{
+    const int w = 150, h = 70, bytesPerRow = w*4 + 8, tileSize = 32;
+    unsigned char* previous = malloc(bytesPerRow * h);
+    unsigned char* current = malloc(bytesPerRow * h);
+    unsigned char* expected = malloc(bytesPerRow * h);
+    unsigned char* actual = malloc(bytesPerRow * h);
+
+    fill_random (previous, bytesPerRow * h);
+    memcpy (current, previous, bytesPerRow * h);
+
+    // Changes in tiles (0,0), (1,1), (2,1) and in the partial tile (4,2).
+    const int changes[][2] = { {3, 5}, {40, 33}, {70, 60}, {149, 69} };
+    for (int i = 0; i < 4; ++i)
+        current[changes[i][1]*bytesPerRow + changes[i][0]*4 + i%4] ^= 0x80;
+
+    struct DLSimulator* simulator = dl_simulator_create(DLAlgorithm_Auto, DLDeficiency_Deutan, 1.f);
+    int numFailed = 0;
+
+    struct DLRect rects[16];
+    const size_t numRects = dl_diff_tiles(previous, current, w, h, bytesPerRow, bytesPerRow, tileSize, rects, 16);
+    const struct DLRect expectedRects[] = { {0, 0, 32, 32}, {32, 32, 64, 32}, {128, 64, 22, 6} };
+    if (numRects != 3 || memcmp(rects, expectedRects, sizeof(expectedRects)) != 0)
+    {
+        fprintf (stderr, "FAIL: dl_diff_tiles found %d rects\n", (int)numRects);
+        ++numFailed;
+    }
+
+    memcpy (expected, current, bytesPerRow * h);
+    dl_simulator_apply(simulator, expected, w, h, bytesPerRow);
+
+    memcpy (actual, previous, bytesPerRow * h);
+    dl_simulator_apply(simulator, actual, w, h, bytesPerRow);
+    dl_simulator_apply_rects(simulator, current, actual, w, h, bytesPerRow, bytesPerRow, rects, numRects);
+    if (memcmp(expected, actual, bytesPerRow * h) != 0)
+    {
+        fprintf (stderr, "FAIL: dl_simulator_apply_rects differs from dl_simulator_apply\n");
+        ++numFailed;
+    }
+
+    // Not enough room, so everything is covered by one rectangle.
+    if (dl_diff_tiles(previous, current, w, h, bytesPerRow, bytesPerRow, tileSize, rects, 2) != 1
+        || rects[0].x != 0 || rects[0].y != 0 || rects[0].width != 150 || rects[0].height != 70)
+    {
+        fprintf (stderr, "FAIL: dl_diff_tiles overflow\n");
+        ++numFailed;
+    }
+
+    if (dl_diff_tiles(previous, previous, w, h, bytesPerRow, bytesPerRow, 0, rects, 16) != 0)
+    {
+        fprintf (stderr, "FAIL: dl_diff_tiles on identical frames\n");
+        ++numFailed;
+    }
+
+    if (numFailed == 0)
+        fprintf (stderr, "GOOD: (dl_simulator_apply_rects, dl_diff_tiles)\n");
+
+    dl_simulator_destroy(simulator);
+    free (previous);
+    free (current);
+    free (expected);
+    free (actual);
+    return numFailed;
+}
+
+// Many small images of various sizes, some in place and some with padded
+// strides, must give the same output as one dl_simulator_apply_to each,
+// whatever the number of threads.
+int test_batch ()
+{
+    enum { numImages = 300 };
+    struct DLBatchImage images[numImages];
+    unsigned char* inputs[numImages];
+    unsigned char* expected[numImages];
+
+    srand(42);
+    struct DLSimulator* simulator = dl_simulator_create(DLAlgorithm_Auto, DLDeficiency_Tritan, 0.8f);
+    for (int i = 0; i < numImages; ++i)
+    {
+        struct DLBatchImage* image = &images[i];
+        image->width = (i % 37 == 0) ? 0 : 1 + rand() % 90;
+        image->height = 1 + rand() % 40;
+        image->srcBytesPerRow = image->width*4 + (i % 3)*4;
+        image->dstBytesPerRow = (i % 2) ? image->width*4 + 8 : 0;
+
+        const size_t srcSize = image->srcBytesPerRow * image->height;
+        const size_t dstSize = image->width*4 + 8 + (image->width*4 + 8) * image->height;
+        inputs[i] = malloc(srcSize + 1);
+        expected[i] = malloc(dstSize + 1);
+        for (size_t b = 0; b < srcSize; ++b)
+            inputs[i][b] = rand() % 256;
+        memset (expected[i], 0xcd, dstSize);
+        dl_simulator_apply_to(simulator, inputs[i], expected[i], image->width, image->height, image->srcBytesPerRow, image->dstBytesPerRow);
+    }
+
+    int numFailed = 0;
+    const int numThreads[] = { 1, 4 };
+    for (int t = 0; t < 2; ++t)
+    {
+        unsigned char* outputs[numImages];
+        for (int i = 0; i < numImages; ++i)
+        {
+            const size_t size = images[i].width*4 + 8 + (images[i].width*4 + 8) * images[i].height;
+            outputs[i] = malloc(size + 1);
+            memset (outputs[i], 0xcd, size);
+            if (i % 5 == 0 && images[i].dstBytesPerRow == 0)
+            {
+                // In place, starting from a copy of the input.
+                memcpy (outputs[i], inputs[i], images[i].srcBytesPerRow * images[i].height);
+                images[i].srgba_src = outputs[i];
+                images[i].srgba_dst = NULL;
+            }
+            else
+            {
+                images[i].srgba_src = inputs[i];
+                images[i].srgba_dst = outputs[i];
+            }
+        }
+
+        if (!dl_simulator_apply_batch(simulator, images, numImages, numThreads[t]))
+        {
+            fprintf (stderr, "FAIL: dl_simulator_apply_batch failed\n");
+            ++numFailed;
+        }
+
+        for (int i = 0; i < numImages; ++i)
+        {
+            const struct DLBatchImage* image = &images[i];
+            const size_t dstBytesPerRow = image->srgba_dst ? (image->dstBytesPerRow ? image->dstBytesPerRow : image->width*4) : image->srcBytesPerRow;
+            const size_t expectedBytesPerRow = image->dstBytesPerRow ? image->dstBytesPerRow : image->width*4;
+            for (size_t row = 0; row < image->height; ++row)
+            {
+                if (memcmp(outputs[i] + row*dstBytesPerRow, expected[i] + row*expectedBytesPerRow, image->width*4) != 0)
+                {
+                    fprintf (stderr, "FAIL: (%d threads) image %d (%dx%d) differs at row %d\n", numThreads[t], i, (int)image->width, (int)image->height, (int)row);
+                    ++numFailed;
+                    break;
+                }
+            }
+            free (outputs[i]);
+        }
+    }
+
+    if (numFailed == 0)
+        fprintf (stderr, "GOOD: (dl_simulator_apply_batch)\n");
+
+    for (int i = 0; i < numImages; ++i)
+    {
+        free (inputs[i]);
+        free (expected[i]);
+    }
+    dl_simulator_destroy(simulator);
+    return numFailed;
+}
+
+// The shader sources can't be compiled here, but they must follow the
+// snprintf conventions and define the documented functions.
+int test_shaderSource ()
+{
+    const char* languageNames[] = { "GLSL", "HLSL", "MSL", "WGSL" };
+    const char* expectedStrings[] = { "vec3 dl_simulate_cvd (vec3 srgb)", "float3 dl_simulate_cvd (float3 srgb)", "float3 dl_simulate_cvd (float3 srgb)", "fn dl_simulate_cvd (srgb: vec3<f32>) -> vec3<f32>" };
+
+    int numFailed = 0;
+    for (int algorithm = DLAlgorithm_Brettel1997; algorithm <= DLAlgorithm_Vienot1999; ++algorithm)
+    for (int language = DLShaderLanguage_GLSL; language <= DLShaderLanguage_WGSL; ++language)
+    {
+        struct DLSimulator* simulator = dl_simulator_create(algorithm, DLDeficiency_Protan, 0.5f);
+        const size_t length = dl_simulator_shader_source(simulator, language, NULL, 0);
+        char* source = malloc(length + 1);
+        char truncated[64];
+        memset (truncated, 0xcd, sizeof(truncated));
+        if (dl_simulator_shader_source(simulator, language, source, length + 1) != length
+            || strlen(source) != length
+            || strstr(source, expectedStrings[language]) == NULL
+            || strstr(source, "dl_simulate_cvd_linear") == NULL
+            || dl_simulator_shader_source(simulator, language, truncated, 16) != length
+            || strlen(truncated) != 15 || strncmp(truncated, source, 15) != 0)
+        {
+            fprintf (stderr, "FAIL: (algorithm %d, %s)\n", algorithm, languageNames[language]);
+            ++numFailed;
+        }
+        free (source);
+
+        if (dl_simulator_shader_source(simulator, (enum DLShaderLanguage)42, NULL, 0) != 0)
+        {
+            fprintf (stderr, "FAIL: invalid language accepted\n");
+            ++numFailed;
+        }
+        dl_simulator_destroy(simulator);
+    }
+
+    if (numFailed == 0)
+        fprintf (stderr, "GOOD: (dl_simulator_shader_source)\n");
+    return numFailed;
+}
+
+// The memoized version must give exactly the same output, and this image
+// with 10 colors repeated in runs should be mostly served from the cache.
+int test_simulatorCache ()
+{
+    const int w = 67, h = 13, bytesPerRow = w*4 + 12;
+    unsigned char* input = malloc(bytesPerRow * h);
+    unsigned char* expected = malloc(bytesPerRow * h);
+    unsigned char* actual = malloc(bytesPerRow * h);
+
+    srand(42);
+    unsigned char palette[10][4];
+    for (int i = 0; i < 10*4; ++i)
+        palette[i/4][i%4] = rand() % 256;
+    for (int r = 0; r < h; ++r)
+    for (int c = 0; c < w; ++c)
+        memcpy (input + r*bytesPerRow + c*4, palette[(r + c/5) % 10], 4);
+
+    int numFailed = 0;
+    for (int deficiency = DLDeficiency_Protan; deficiency <= DLDeficiency_Tritan; ++deficiency)
+    {
+        struct DLSimulator* simulator = dl_simulator_create(DLAlgorithm_Auto, deficiency, 0.8f);
+        memcpy (expected, input, bytesPerRow * h);
+        dl_simulator_apply(simulator, expected, w, h, bytesPerRow);
+
+        struct DLCacheStats stats;
+        memcpy (actual, input, bytesPerRow * h);
+        dl_simulator_apply_cached(simulator, actual, w, h, bytesPerRow, &stats);
+        dl_simulator_destroy(simulator);
+
+        if (memcmp(expected, actual, bytesPerRow * h) != 0 || stats.numPixels != w*h || stats.numHits != w*h - 10)
+        {
+            fprintf (stderr, "FAIL: (deficiency %d) numHits=%d\n", deficiency, (int)stats.numHits);
+            ++numFailed;
+        }
+    }
+
+    if (numFailed == 0)
+        fprintf (stderr, "GOOD: (dl_simulator_apply_cached)\n");
+
+    free (input);
+    free (expected);
+    free (actual);
+    return numFailed;
+}
+
+// The direct LUT must be exact, the interpolated ones only approximate.
+int test_lut3d ()
+{
+    const int w = 67, h = 13, bytesPerRow = w*4 + 12;
+    unsigned char* input = malloc(bytesPerRow * h);
+    unsigned char* expected = malloc(bytesPerRow * h);
+    unsigned char* actual = malloc(bytesPerRow * h);
+
+    fill_random (input, bytesPerRow * h);
+
+    const int gridSizes[] = { 256, 65 };
+    const int maxAllowedDiffs[] = { 0, 12 };
+
+    int numFailed = 0;
+    for (int deficiency = DLDeficiency_Protan; deficiency <= DLDeficiency_Tritan; ++deficiency)
+    {
+        struct DLSimulator* simulator = dl_simulator_create(DLAlgorithm_Brettel1997, deficiency, 0.8f);
+        memcpy (expected, input, bytesPerRow * h);
+        dl_simulator_apply(simulator, expected, w, h, bytesPerRow);
+
+        for (int g = 0; g < 2; ++g)
+        {
+            struct DLLut3D* lut = dl_lut3d_create(simulator, gridSizes[g]);
+            memcpy (actual, input, bytesPerRow * h);
+            dl_lut3d_apply(lut, actual, w, h, bytesPerRow);
+            dl_lut3d_destroy(lut);
+
+            int maxDiff = 0;
+            for (int i = 0; i < bytesPerRow * h; ++i)
+            {
+                int diff = abs(expected[i] - actual[i]);
+                if (diff > maxDiff) maxDiff = diff;
+            }
+
+            if (maxDiff > maxAllowedDiffs[g])
+            {
+                fprintf (stderr, "FAIL: (deficiency %d, grid %d) maxDiff=%d\n", deficiency, gridSizes[g], maxDiff);
+                ++numFailed;
+            }
+        }
+
+        dl_simulator_destroy(simulator);
+    }
+
+    // The .cube file should have the 4 header lines and one line per grid point.
+    struct DLSimulator* simulator = dl_simulator_create(DLAlgorithm_Auto, DLDeficiency_Deutan, 1.f);
+    struct DLLut3D* lut = dl_lut3d_create(simulator, 5);
+    const char* cubePath = "test_lut3d.cube";
+    int numLines = -1;
+    if (dl_lut3d_write_cube(lut, cubePath))
+    {
+        FILE* f = fopen(cubePath, "r");
+        numLines = 0;
+        for (int c = fgetc(f); c != EOF; c = fgetc(f))
+            numLines += c == '\n';
+        fclose (f);
+        remove (cubePath);
+    }
+    if (numLines != 4 + 5*5*5 || dl_lut3d_create(simulator, 1) != NULL)
+    {
+        fprintf (stderr, "FAIL: (dl_lut3d_write_cube) numLines=%d\n", numLines);
+        ++numFailed;
+    }
+    dl_lut3d_destroy(lut);
+    dl_simulator_destroy(simulator);
+
+    if (numFailed == 0)
+        fprintf (stderr, "GOOD: (dl_lut3d_apply)\n");
+
+    free (input);
+    free (expected);
+    free (actual);
+    return numFailed;
+}
+
+// Counts the allocations going to an arena.
+struct CountingArena
+{
+    struct DLArena arena;
+    struct DLAllocator arenaAllocator;
+    int numAllocations;
+    int numDeallocations;
+};
+
+static void* counting_allocate (void* allocator_ctx, size_t size)
+{
+    struct CountingArena* counting = (struct CountingArena*)allocator_ctx;
+    ++counting->numAllocations;
+    return counting->arenaAllocator.allocate(counting->arenaAllocator.allocator_ctx, size);
+}
+
+static void counting_deallocate (void* allocator_ctx, void* ptr)
+{
+    struct CountingArena* counting = (struct CountingArena*)allocator_ctx;
+    ++counting->numDeallocations;
+    counting->arenaAllocator.deallocate(counting->arenaAllocator.allocator_ctx, ptr);
+}
+
+// Everything created from a context must match the regular functions, and
+// repeated calls must stop allocating once warmed up.
+int test_contexts ()
+{
+    // No padding, the whole buffers get compared.
+    const int w = 67, h = 13, bytesPerRow = w*4;
+    unsigned char* input = malloc(bytesPerRow * h);
+    unsigned char* expected = malloc(bytesPerRow * h);
+    unsigned char* actual = malloc(bytesPerRow * h);
+
+    fill_random (input, bytesPerRow * h);
+
+    const size_t arenaSize = 1 << 20;
+    void* arenaBuffer = malloc(arenaSize);
+    struct CountingArena counting;
+    memset (&counting, 0, sizeof(counting));
+    dl_arena_init (&counting.arena, arenaBuffer, arenaSize);
+    counting.arenaAllocator = dl_arena_allocator(&counting.arena);
+    const struct DLAllocator allocator = { counting_allocate, counting_deallocate, &counting };
+
+    int numFailed = 0;
+    struct DLContext* context = dl_context_create(&allocator);
+
+    struct DLSimulator* simulator = dl_context_create_simulator(context, DLAlgorithm_Auto, DLDeficiency_Tritan, 0.7f);
+    struct DLSimulator* reference = dl_simulator_create(DLAlgorithm_Auto, DLDeficiency_Tritan, 0.7f);
+    dl_simulator_apply_to(reference, input, expected, w, h, bytesPerRow, bytesPerRow);
+    dl_simulator_apply_to(simulator, input, actual, w, h, bytesPerRow, bytesPerRow);
+    int simulatorFailed = memcmp(expected, actual, bytesPerRow * h) != 0;
+
+    struct DLSimulator* daltonizer = dl_context_create_daltonizer(context, DLAlgorithm_Auto, DLDeficiency_Protan, 1.f);
+    dl_daltonize_to(DLDeficiency_Protan, 1.f, input, expected, w, h, bytesPerRow, bytesPerRow);
+    dl_simulator_apply_to(daltonizer, input, actual, w, h, bytesPerRow, bytesPerRow);
+    simulatorFailed |= memcmp(expected, actual, bytesPerRow * h) != 0;
+
+    struct DLLut3D* lut = dl_context_create_lut3d(context, simulator, 17);
+    struct DLLut3D* referenceLut = dl_lut3d_create(reference, 17);
+    dl_lut3d_apply_to(referenceLut, input, expected, w, h, bytesPerRow, bytesPerRow);
+    dl_lut3d_apply_to(lut, input, actual, w, h, bytesPerRow, bytesPerRow);
+    const int lutFailed = memcmp(expected, actual, bytesPerRow * h) != 0;
+    dl_lut3d_destroy(referenceLut);
+
+    // A stream begun and ended every frame reuses the top of the arena.
+    dl_simulator_apply_to(simulator, input, expected, w, h, bytesPerRow, bytesPerRow);
+    int streamFailed = 0;
+    size_t arenaUsed = counting.arena.used;
+    for (int frame = 0; frame < 3; ++frame)
+    {
+        struct DLStream* stream = dl_context_begin_stream(context, simulator, DLPixelFormat_RGBA32, w);
+        dl_stream_push_rows_to(stream, input, actual, h, bytesPerRow, bytesPerRow);
+        dl_stream_end(stream);
+        streamFailed |= memcmp(expected, actual, bytesPerRow * h) != 0;
+        streamFailed |= counting.arena.used != arenaUsed;
+    }
+
+    // Only the first batch allocates its offsets, on a warmed up thread pool.
+    struct DLBatchImage images[2] = {
+        { input, actual, w, h, bytesPerRow, bytesPerRow },
+        { input, actual, w, h/2, bytesPerRow, bytesPerRow },
+    };
+    int batchFailed = !dl_context_apply_batch(context, simulator, images, 2, 2);
+    const int numAllocationsAfterWarmUp = counting.numAllocations;
+    for (int frame = 0; frame < 3; ++frame)
+    {
+        memset (actual, 0, bytesPerRow * h);
+        batchFailed |= !dl_context_apply_batch(context, simulator, images, 2, 2);
+        batchFailed |= memcmp(expected, actual, bytesPerRow * h) != 0;
+    }
+    batchFailed |= counting.numAllocations != numAllocationsAfterWarmUp;
+
+    dl_lut3d_destroy(lut);
+    dl_simulator_destroy(daltonizer);
+    dl_simulator_destroy(simulator);
+    dl_simulator_destroy(reference);
+    dl_context_destroy(context);
+    const int leaked = counting.numAllocations != counting.numDeallocations;
+
+    // A full arena makes the creation functions fail cleanly.
+    unsigned char smallBuffer[128];
+    struct DLArena smallArena;
+    dl_arena_init (&smallArena, smallBuffer, sizeof(smallBuffer));
+    const struct DLAllocator smallAllocator = dl_arena_allocator(&smallArena);
+    struct DLContext* smallContext = dl_context_create(&smallAllocator);
+    const int fullFailed = smallContext == NULL
+        || dl_context_create_simulator(smallContext, DLAlgorithm_Auto, DLDeficiency_Protan, 1.f) != NULL
+        || smallArena.peak > smallArena.size;
+    dl_context_destroy(smallContext);
+
+    if (simulatorFailed || lutFailed || streamFailed || batchFailed || leaked || fullFailed)
+    {
+        fprintf (stderr, "FAIL: simulatorFailed=%d lutFailed=%d streamFailed=%d batchFailed=%d leaked=%d fullFailed=%d\n",
+                 simulatorFailed, lutFailed, streamFailed, batchFailed, leaked, fullFailed);
+        ++numFailed;
+    }
+    else
+    {
+        fprintf (stderr, "GOOD: (dl_context_*) %d allocations, %zu bytes of arena\n", counting.numAllocations, counting.arena.peak);
+    }
+
+    free (arenaBuffer);
+    free (input);
+    free (expected);
+    free (actual);
+    return numFailed;
+}
+
+// Dummy scheduler that runs the chunks one by one, in reverse order.
+static void reverse_parallel_for (void* scheduler_ctx, size_t begin, size_t end, DLRangeFunc func, void* func_ctx)
+{
+    int* numChunks = (int*)scheduler_ctx;
+    for (size_t i = end; i > begin; --i)
+    {
+        func(func_ctx, i - 1, i);
+        ++*numChunks;
+    }
+}
+
+// The multi-threaded versions should give exactly the same output, the
+// image needs to be large enough to get split.
+int test_multiThreading ()
+{
+    const int w = 1021, h = 301, bytesPerRow = w*4 + 8;
+    unsigned char* input = malloc(bytesPerRow * h);
+    unsigned char* expected = malloc(bytesPerRow * h);
+    unsigned char* actual = malloc(bytesPerRow * h);
+
+    fill_random (input, bytesPerRow * h);
+
+    const int numThreads[] = { 1, 3, 0 /* auto */ };
+    int numFailed = 0;
+    for (int deficiency = DLDeficiency_Protan; deficiency <= DLDeficiency_Tritan; ++deficiency)
+    {
+        memcpy (expected, input, bytesPerRow * h);
+        dl_simulate_cvd(deficiency, 0.8f, expected, w, h, bytesPerRow);
+
+        for (int i = 0; i < 3; ++i)
+        {
+            memcpy (actual, input, bytesPerRow * h);
+            dl_simulate_cvd_mt(deficiency, 0.8f, actual, w, h, bytesPerRow, numThreads[i]);
+            if (memcmp(expected, actual, bytesPerRow * h) != 0)
+            {
+                fprintf (stderr, "FAIL: (deficiency %d, %d threads) differs from single-threaded\n", deficiency, numThreads[i]);
+                ++numFailed;
+            }
+        }
+    }
+
+    if (numFailed == 0)
+        fprintf (stderr, "GOOD: (dl_simulate_cvd_mt)\n");
+
+    // 'expected' still holds the tritan result from the last iteration.
+    int numChunks = 0;
+    dl_set_parallel_for (reverse_parallel_for, &numChunks);
+    memcpy (actual, input, bytesPerRow * h);
+    dl_simulate_cvd_mt(DLDeficiency_Tritan, 0.8f, actual, w, h, bytesPerRow, 4);
+    dl_set_parallel_for (NULL, NULL);
+    if (numChunks < 2 || memcmp(expected, actual, bytesPerRow * h) != 0)
+    {
+        fprintf (stderr, "FAIL: (dl_set_parallel_for) numChunks=%d\n", numChunks);
+        ++numFailed;
+    }
+    else
+    {
+        fprintf (stderr, "GOOD: (dl_set_parallel_for)\n");
+    }
+
+    dl_release_threads ();
+    free (input);
+    free (expected);
+    free (actual);
+    return numFailed;
+}
+
+int main ()
+{
+    stm_setup();
+
+    int numFailed = 0;
+
+    fprintf (stderr, ">> Testing sRGB transfer functions\n");
+    if (test_sRGBTransferFunctions () != 0)
+    {
+        fprintf (stderr, "TEST FAILED: sRGB transfer functions\n");
+        ++numFailed;
+    }
+
+    fprintf (stderr, ">> Testing kernels\n");
+    if (test_kernels () != 0)
+    {
+        fprintf (stderr, "TEST FAILED: kernels\n");
+        ++numFailed;
+    }
+
+    fprintf (stderr, ">> Testing pixel formats\n");
+    if (test_pixelFormats () != 0)
+    {
+        fprintf (stderr, "TEST FAILED: pixel formats\n");
+        ++numFailed;
+    }
+
+    fprintf (stderr, ">> Testing alpha modes\n");
+    if (test_alphaModes () != 0)
+    {
+        fprintf (stderr, "TEST FAILED: alpha modes\n");
+        ++numFailed;
+    }
+
+    fprintf (stderr, ">> Testing sample formats\n");
+    if (test_sampleFormats () != 0)
+    {
+        fprintf (stderr, "TEST FAILED: sample formats\n");
+        ++numFailed;
+    }
+
+    fprintf (stderr, ">> Testing planar and YUV images\n");
+    if (test_planarAndYuv () != 0)
+    {
+        fprintf (stderr, "TEST FAILED: planar and YUV images\n");
+        ++numFailed;
+    }
+
+    fprintf (stderr, ">> Testing all deficiencies at once\n");
+    if (test_allDeficiencies () != 0)
+    {
+        fprintf (stderr, "TEST FAILED: all deficiencies at once\n");
+        ++numFailed;
+    }
+
+    fprintf (stderr, ">> Testing simulators\n");
+    if (test_simulator () != 0)
+    {
+        fprintf (stderr, "TEST FAILED: simulators\n");
+        ++numFailed;
+    }
+
+    fprintf (stderr, ">> Testing accuracy modes\n");
+    if (test_accuracyModes () != 0)
+    {
+        fprintf (stderr, "TEST FAILED: accuracy modes\n");
+        ++numFailed;
+    }
+
+    fprintf (stderr, ">> Testing severity maps\n");
+    if (test_severityMaps () != 0)
+    {
+        fprintf (stderr, "TEST FAILED: severity maps\n");
+        ++numFailed;
+    }
+
+    fprintf (stderr, ">> Testing daltonization\n");
+    if (test_daltonize () != 0)
+    {
+        fprintf (stderr, "TEST FAILED: daltonization\n");
+        ++numFailed;
+    }
+
+    fprintf (stderr, ">> Testing streams\n");
+    if (test_stream () != 0)
+    {
+        fprintf (stderr, "TEST FAILED: streams\n");
+        ++numFailed;
+    }
+
+    fprintf (stderr, ">> Testing dirty rectangles\n");
+    if (test_dirtyRects () != 0)
+    {
+        fprintf (stderr, "TEST FAILED: dirty rectangles\n");
+        ++numFailed;
+    }
+
+    fprintf (stderr, ">> Testing batches\n");
+    if (test_batch () != 0)
+    {
+        fprintf (stderr, "TEST FAILED: batches\n");
+        ++numFailed;
+    }
+
+    fprintf (stderr, ">> Testing simulator cache\n");
+    if (test_simulatorCache () != 0)
+    {
+        fprintf (stderr, "TEST FAILED: simulator cache\n");
+        ++numFailed;
+    }
+
+    fprintf (stderr, ">> Testing 3D LUTs\n");
+    if (test_lut3d () != 0)
+    {
+        fprintf (stderr, "TEST FAILED: 3D LUTs\n");
+        ++numFailed;
+    }
+
+    fprintf (stderr, ">> Testing contexts\n");
+    if (test_contexts () != 0)
+    {
+        fprintf (stderr, "TEST FAILED: contexts\n");
+        ++numFailed;
+    }
+
+    fprintf (stderr, ">> Testing shader sources\n");
+    if (test_shaderSource () != 0)
+    {
+        fprintf (stderr, "TEST FAILED: shader sources\n");
+        ++numFailed;
+    }
+
+    fprintf (stderr, ">> Testing multi-threading\n");
+    if (test_multiThreading () != 0)
+    {
+        fprintf (stderr, "TEST FAILED: multi-threading\n");
+        ++numFailed;
+    }
+
+    char inputImagePath[1024];
+    snprintf (inputImagePath, 1024, "%s%s", TEST_IMAGES_DIR, "input.png");
+
+    struct Context context;
+    int channels = 0;
+    context.inputBuffer = stbi_load (inputImagePath, &context.width, &context.height, &channels, 4 /* rgba */);
+
+    if (context.inputBuffer == NULL)
+    {
+        fprintf (stderr, "Could not read image %s", inputImagePath);
+        return 2;
+    }
+
+    context.tmpImageBuffer = malloc(context.width * context.height * 4);
 
     fprintf (stderr, ">> Testing Vienot 1999\n");
     if (test_Vienot1999 (&context) != 0)
@@ -0,0 +1,167 @@
+#include <libDaltonLens.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+
+    Built with DL_ENABLE_STATS, checks the counters of the instrumentation
+    and that it does not change the output.
+
+*/
+
+struct TraceCounts
+{
+    int numBegin;
+    int numEnd;
+    int numBatch;
+};
+
+static void trace_begin (void* trace_ctx, const char* name)
+{
+    struct TraceCounts* counts = (struct TraceCounts*)trace_ctx;
+    ++counts->numBegin;
+    counts->numBatch += strcmp(name, "dl_batch") == 0;
+}
+
+static void trace_end (void* trace_ctx, const char* name)
+{
+    struct TraceCounts* counts = (struct TraceCounts*)trace_ctx;
+    (void)name;
+    ++counts->numEnd;
+}
+
+int test_counters ()
+{
+    const int w = 301, h = 217;
+    const size_t numPixels = (size_t)w * h;
+    unsigned char* input = malloc(numPixels * 4);
+    unsigned char* expected = malloc(numPixels * 4);
+    unsigned char* actual = malloc(numPixels * 4);
+
+    srand(42);
+    for (size_t i = 0; i < numPixels * 4; ++i)
+        input[i] = rand() % 256;
+
+    int numFailed = 0;
+
+    // Without a scope nothing gets counted.
+    dl_simulate_cvd_to(DLDeficiency_Tritan, 1.f, input, expected, w, h, 0, 0);
+
+    struct DLStats stats;
+    memset (&stats, 0, sizeof(stats));
+    if (!dl_stats_begin(&stats))
+    {
+        fprintf (stderr, "FAIL: instrumentation not compiled in\n");
+        free (input);
+        free (expected);
+        free (actual);
+        return 1;
+    }
+    dl_simulate_cvd_to(DLDeficiency_Tritan, 1.f, input, actual, w, h, 0, 0);
+    dl_stats_end();
+
+    if (memcmp(actual, expected, numPixels * 4) != 0)
+    {
+        fprintf (stderr, "FAIL: the instrumentation changed the output\n");
+        ++numFailed;
+    }
+
+    // Tritan goes through Brettel 1997, random colors hit both planes.
+    if (stats.numPixels != numPixels
+        || stats.numBrettelPlane1 + stats.numBrettelPlane2 != numPixels
+        || stats.numBrettelPlane1 == 0 || stats.numBrettelPlane2 == 0
+        || stats.numClippedChannels > 3*numPixels
+        || stats.kernel != dl_get_kernel()
+        || stats.processingSeconds <= 0. || stats.wallSeconds < stats.processingSeconds)
+    {
+        fprintf (stderr, "FAIL: unexpected Brettel stats, numPixels=%zu plane1=%zu plane2=%zu clipped=%zu kernel=%d seconds=%f wall=%f\n",
+                 stats.numPixels, stats.numBrettelPlane1, stats.numBrettelPlane2, stats.numClippedChannels,
+                 (int)stats.kernel, stats.processingSeconds, stats.wallSeconds);
+        ++numFailed;
+    }
+
+    // Black and white clip every channel, mid gray none.
+    memset (&stats, 0, sizeof(stats));
+    memset (actual, 0, numPixels * 4);
+    memset (actual, 0xff, numPixels * 2);
+    dl_stats_begin(&stats);
+    dl_simulate_cvd_vienot1999(DLDeficiency_Protan, 1.f, actual, w, h, 0);
+    memset (actual, 0x80, numPixels * 4);
+    dl_simulate_cvd_vienot1999(DLDeficiency_Protan, 1.f, actual, w, h, 0);
+    dl_stats_end();
+    if (stats.numPixels != 2*numPixels || stats.numClippedChannels != 3*numPixels
+        || stats.numBrettelPlane1 != 0 || stats.numBrettelPlane2 != 0)
+    {
+        fprintf (stderr, "FAIL: unexpected Vienot stats, numPixels=%zu clipped=%zu\n", stats.numPixels, stats.numClippedChannels);
+        ++numFailed;
+    }
+
+    // The rows processed by the workers, batches and streams accumulate in
+    // the same scope.
+    struct DLSimulator* simulator = dl_simulator_create(DLAlgorithm_Brettel1997, DLDeficiency_Deutan, 0.7f);
+    struct DLBatchImage images[3];
+    for (int i = 0; i < 3; ++i)
+    {
+        images[i].srgba_src = input + i*1000*4;
+        images[i].srgba_dst = actual + i*1000*4;
+        images[i].width = 10 + i;
+        images[i].height = 20;
+        images[i].srcBytesPerRow = 0;
+        images[i].dstBytesPerRow = 0;
+    }
+    const size_t batchPixels = 10*20 + 11*20 + 12*20;
+
+    struct TraceCounts traceCounts = { 0, 0, 0 };
+    dl_set_trace_callbacks(trace_begin, trace_end, &traceCounts);
+    memset (&stats, 0, sizeof(stats));
+    dl_stats_begin(&stats);
+    dl_simulator_apply_batch(simulator, images, 3, 1);
+    struct DLStream* stream = dl_stream_begin(simulator, DLPixelFormat_RGBA32, w);
+    dl_stream_push_rows_to(stream, input, actual, 10, 0, 0);
+    dl_stream_end(stream);
+    dl_set_trace_callbacks(NULL, NULL, NULL);
+    memcpy (actual, input, numPixels * 4);
+    dl_simulator_apply_mt(simulator, actual, w, h, 0, 4);
+    dl_stats_end();
+
+    if (stats.numPixels != batchPixels + 10*(size_t)w + numPixels
+        || stats.numBrettelPlane1 + stats.numBrettelPlane2 != stats.numPixels)
+    {
+        fprintf (stderr, "FAIL: unexpected multi-threaded stats, numPixels=%zu\n", stats.numPixels);
+        ++numFailed;
+    }
+
+    if (traceCounts.numBegin != traceCounts.numEnd || traceCounts.numBatch != 1 || traceCounts.numBegin != 2)
+    {
+        fprintf (stderr, "FAIL: unexpected trace events, begin=%d end=%d batch=%d\n", traceCounts.numBegin, traceCounts.numEnd, traceCounts.numBatch);
+        ++numFailed;
+    }
+
+    if (numFailed == 0)
+        fprintf (stderr, "GOOD: (dl_stats_begin)\n");
+
+    dl_simulator_destroy(simulator);
+    free (input);
+    free (expected);
+    free (actual);
+    return numFailed;
+}
+
+int main (int argc, char** argv)
+{
+    (void)argc;
+    (void)argv;
+    int numFailed = 0;
+
+    fprintf (stderr, ">> Testing counters\n");
+    if (test_counters () != 0)
+    {
+        fprintf (stderr, "TEST FAILED: counters\n");
+        ++numFailed;
+    }
+
+    dl_release_threads ();
+    return numFailed;
+}
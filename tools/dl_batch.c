@@ -0,0 +1,740 @@
+// For madvise with glibc.
+#define _DEFAULT_SOURCE
+
+#include <libDaltonLens.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+
+    Batch converter for large image corpora, without decoding or encoding
+    anything: the inputs are binary PPM (P6), PAM (P7, RGB or RGB_ALPHA
+    tuples) or raw RGBA files, memory-mapped and simulated directly in the
+    mapping.
+
+    Usage: dl_batch [options] <file | directory | -> ...
+
+        --deficiency protan|deutan|tritan   (default deutan)
+        --severity <0..1>                   (default 1)
+        --algorithm auto|brettel1997|vienot1999
+        --daltonize                         correct instead of simulating
+        --accuracy default|exact|fast
+        --raw <width>x<height>              inputs are raw RGBA32 files
+        --output-dir <dir>                  instead of converting in place
+        --threads <n>                       (default: all the cores)
+        --quiet
+
+    Directories contribute their regular files (not recursively), and '-'
+    reads one path per line from stdin, e.g. from find. Without an output
+    directory the files are converted in place. Otherwise each output gets
+    the name of its input in the output directory. It is written to a
+    temporary file in that directory, pre-sized with ftruncate and mapped
+    too so the pixels get read and written exactly once, then renamed into
+    place on success. A failed conversion leaves no output behind, and the
+    output directory can be the one of the inputs. Two inputs with the same
+    name would overwrite each other's output, so the second one is reported
+    as failed.
+
+    Each worker thread claims the next path, maps it, simulates it with the
+    single-threaded functions and unmaps it, so the page faults of one file
+    overlap with the computation of the others. Nothing is allocated per
+    image, the mappings are the buffers. Files that can't be converted are
+    reported and skipped, and the exit code is 1 if there was any.
+
+*/
+
+struct Options
+{
+    enum DLAlgorithm algorithm;
+    enum DLDeficiency deficiency;
+    float severity;
+    int daltonize;
+    enum DLAccuracy accuracy;
+    size_t rawWidth;
+    size_t rawHeight;
+    const char* outputDir;
+    int numThreads;
+    int quiet;
+};
+
+// Where the pixels are in a mapped file.
+struct ImageLayout
+{
+    enum DLPixelFormat format;
+    size_t width;
+    size_t height;
+    size_t headerSize;
+};
+
+/*
+    Paths come from the arguments in order, the directories and '-' getting
+    expanded in place. Only one worker reads from them at a time.
+*/
+struct PathSource
+{
+    pthread_mutex_t mutex;
+    char** args;
+    int numArgs;
+    int nextArg;
+    DIR* dir;
+    const char* dirPath;
+    int readingStdin;
+    // Paths that were too long for the buffer, reported and skipped.
+    size_t numInvalid;
+};
+
+// Names already used in the output directory, as an open addressing hash
+// set that doubles when half full.
+struct NameSet
+{
+    char** names;
+    size_t capacity;
+    size_t count;
+};
+
+struct Batch
+{
+    const struct Options* options;
+    const struct DLSimulator* simulator;
+    struct PathSource source;
+
+    pthread_mutex_t mutex;
+    struct NameSet outputNames;
+    size_t numFiles;
+    size_t numFailed;
+    double numPixels;
+};
+
+static double seconds_now (void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static int is_directory (const char* path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+static int is_regular_file (const char* path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+// FNV-1a
+static size_t hash_name (const char* name)
+{
+    size_t h = 2166136261u;
+    for (; *name; ++name)
+        h = (h ^ (unsigned char)*name) * 16777619u;
+    return h;
+}
+
+static char** name_set_find (char** names, size_t capacity, const char* name)
+{
+    size_t i = hash_name(name) & (capacity - 1);
+    while (names[i] && strcmp(names[i], name) != 0)
+        i = (i + 1) & (capacity - 1);
+    return &names[i];
+}
+
+// Returns 1 if 'name' was added, 0 if it was already there or on failure.
+static int name_set_insert (struct NameSet* set, const char* name)
+{
+    if (2 * (set->count + 1) > set->capacity)
+    {
+        const size_t capacity = set->capacity ? 2 * set->capacity : 1024;
+        char** names = (char**)calloc(capacity, sizeof(char*));
+        if (names == NULL)
+            return 0;
+        for (size_t i = 0; i < set->capacity; ++i)
+            if (set->names[i])
+                *name_set_find(names, capacity, set->names[i]) = set->names[i];
+        free (set->names);
+        set->names = names;
+        set->capacity = capacity;
+    }
+
+    char** slot = name_set_find(set->names, set->capacity, name);
+    if (*slot)
+        return 0;
+    *slot = strdup(name);
+    if (*slot == NULL)
+        return 0;
+    ++set->count;
+    return 1;
+}
+
+static void name_set_release (struct NameSet* set)
+{
+    for (size_t i = 0; i < set->capacity; ++i)
+        free (set->names[i]);
+    free (set->names);
+}
+
+// Returns 0 when there are no more paths.
+static int next_path (struct PathSource* source, char* path, size_t pathSize)
+{
+    int found = 0;
+    pthread_mutex_lock (&source->mutex);
+    while (!found)
+    {
+        if (source->dir)
+        {
+            struct dirent* entry = readdir(source->dir);
+            if (entry == NULL)
+            {
+                closedir (source->dir);
+                source->dir = NULL;
+                continue;
+            }
+            if (entry->d_name[0] == '.')
+                continue;
+            const int n = snprintf(path, pathSize, "%s/%s", source->dirPath, entry->d_name);
+            if (n < 0 || (size_t)n >= pathSize)
+            {
+                fprintf (stderr, "%s/%s: path too long\n", source->dirPath, entry->d_name);
+                ++source->numInvalid;
+                continue;
+            }
+            found = is_regular_file(path);
+        }
+        else if (source->readingStdin)
+        {
+            if (fgets(path, (int)pathSize, stdin) == NULL)
+            {
+                source->readingStdin = 0;
+                continue;
+            }
+            const size_t length = strcspn(path, "\n");
+            if (path[length] != '\n' && !feof(stdin))
+            {
+                // Skip the rest of the line rather than splitting it.
+                int c;
+                while ((c = getchar()) != EOF && c != '\n')
+                    ;
+                fprintf (stderr, "%.64s...: path too long\n", path);
+                ++source->numInvalid;
+                continue;
+            }
+            path[strcspn(path, "\r\n")] = '\0';
+            found = path[0] != '\0';
+        }
+        else if (source->nextArg < source->numArgs)
+        {
+            const char* arg = source->args[source->nextArg++];
+            if (strcmp(arg, "-") == 0)
+            {
+                source->readingStdin = 1;
+            }
+            else if (is_directory(arg))
+            {
+                source->dir = opendir(arg);
+                source->dirPath = arg;
+                if (source->dir == NULL)
+                    fprintf (stderr, "Could not open the directory %s: %s\n", arg, strerror(errno));
+            }
+            else if (strlen(arg) >= pathSize)
+            {
+                fprintf (stderr, "%.64s...: path too long\n", arg);
+                ++source->numInvalid;
+            }
+            else
+            {
+                memcpy (path, arg, strlen(arg) + 1);
+                found = 1;
+            }
+        }
+        else
+        {
+            break;
+        }
+    }
+    pthread_mutex_unlock (&source->mutex);
+    return found;
+}
+
+/*
+    Netpbm headers: whitespace separated fields, with comments from '#' to
+    the end of the line. A single whitespace separates the P6 header from
+    the pixels, and PAM headers end with an ENDHDR line.
+*/
+struct HeaderReader
+{
+    const unsigned char* data;
+    size_t size;
+    size_t pos;
+};
+
+static void skip_whitespace_and_comments (struct HeaderReader* r)
+{
+    while (r->pos < r->size)
+    {
+        const unsigned char c = r->data[r->pos];
+        if (c == '#')
+        {
+            while (r->pos < r->size && r->data[r->pos] != '\n')
+                ++r->pos;
+        }
+        else if (c == ' ' || c == '\t' || c == '\n' || c == '\r')
+        {
+            ++r->pos;
+        }
+        else
+        {
+            break;
+        }
+    }
+}
+
+// Reads the next token into 'token', returns 0 if there is none.
+static int read_token (struct HeaderReader* r, char* token, size_t tokenSize)
+{
+    skip_whitespace_and_comments (r);
+    size_t n = 0;
+    while (r->pos < r->size && n + 1 < tokenSize)
+    {
+        const unsigned char c = r->data[r->pos];
+        if (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '#')
+            break;
+        token[n++] = (char)c;
+        ++r->pos;
+    }
+    token[n] = '\0';
+    return n > 0;
+}
+
+static int read_size (struct HeaderReader* r, size_t* value)
+{
+    char token[32];
+    if (!read_token(r, token, sizeof(token)))
+        return 0;
+    char* end = NULL;
+    const unsigned long long v = strtoull(token, &end, 10);
+    *value = (size_t)v;
+    return *end == '\0' && v > 0;
+}
+
+static const char* parse_ppm_header (struct HeaderReader* r, struct ImageLayout* layout)
+{
+    size_t maxval = 0;
+    if (!read_size(r, &layout->width) || !read_size(r, &layout->height) || !read_size(r, &maxval))
+        return "invalid PPM header";
+    if (maxval != 255)
+        return "only 8-bit PPM files are supported";
+    // Exactly one whitespace before the pixels.
+    if (r->pos >= r->size)
+        return "truncated PPM header";
+    layout->headerSize = r->pos + 1;
+    layout->format = DLPixelFormat_RGB24;
+    return NULL;
+}
+
+static const char* parse_pam_header (struct HeaderReader* r, struct ImageLayout* layout)
+{
+    size_t depth = 0, maxval = 0;
+    char tupleType[32] = "";
+    char token[32];
+    layout->width = layout->height = 0;
+    while (1)
+    {
+        if (!read_token(r, token, sizeof(token)))
+            return "truncated PAM header";
+        if (strcmp(token, "ENDHDR") == 0)
+            break;
+
+        int ok = 1;
+        if (strcmp(token, "WIDTH") == 0)
+            ok = read_size(r, &layout->width);
+        else if (strcmp(token, "HEIGHT") == 0)
+            ok = read_size(r, &layout->height);
+        else if (strcmp(token, "DEPTH") == 0)
+            ok = read_size(r, &depth);
+        else if (strcmp(token, "MAXVAL") == 0)
+            ok = read_size(r, &maxval);
+        else if (strcmp(token, "TUPLTYPE") == 0)
+            ok = read_token(r, tupleType, sizeof(tupleType));
+        else
+            return "unknown PAM header field";
+        if (!ok)
+            return "invalid PAM header";
+    }
+    // The pixels start after the end of the ENDHDR line.
+    while (r->pos < r->size && r->data[r->pos] != '\n')
+        ++r->pos;
+    layout->headerSize = r->pos + 1;
+
+    if (layout->width == 0 || layout->height == 0 || maxval != 255)
+        return "only 8-bit PAM files are supported";
+    if (depth == 4 && (tupleType[0] == '\0' || strcmp(tupleType, "RGB_ALPHA") == 0))
+        layout->format = DLPixelFormat_RGBA32;
+    else if (depth == 3 && (tupleType[0] == '\0' || strcmp(tupleType, "RGB") == 0))
+        layout->format = DLPixelFormat_RGB24;
+    else
+        return "only RGB and RGB_ALPHA PAM files are supported";
+    return NULL;
+}
+
+// Returns NULL on success, or the error message.
+static const char* parse_image_layout (const struct Options* options, const unsigned char* data, size_t size, struct ImageLayout* layout)
+{
+    const char* error = NULL;
+    if (options->rawWidth > 0)
+    {
+        layout->format = DLPixelFormat_RGBA32;
+        layout->width = options->rawWidth;
+        layout->height = options->rawHeight;
+        layout->headerSize = 0;
+    }
+    else
+    {
+        struct HeaderReader r = { data, size, 2 };
+        if (size < 2 || data[0] != 'P')
+            return "not a PPM or PAM file";
+        else if (data[1] == '6')
+            error = parse_ppm_header(&r, layout);
+        else if (data[1] == '7')
+            error = parse_pam_header(&r, layout);
+        else
+            return "only binary PPM (P6) and PAM (P7) files are supported";
+        if (error)
+            return error;
+    }
+
+    const size_t pixelSize = layout->format == DLPixelFormat_RGB24 ? 3 : 4;
+    if (layout->width > (size_t)-1 / pixelSize / layout->height
+        || layout->headerSize > size
+        || size - layout->headerSize < layout->width * layout->height * pixelSize)
+    {
+        return "the file is smaller than its pixels";
+    }
+    return NULL;
+}
+
+static void* map_file (int fd, size_t size, int writable)
+{
+    void* data = mmap(NULL, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED)
+        return NULL;
+    // Each file is read once from start to end.
+    madvise (data, size, MADV_SEQUENTIAL);
+    return data;
+}
+
+// Returns NULL on success, or the error message.
+static const char* convert_file (struct Batch* batch, const char* path, size_t* numPixels)
+{
+    const struct Options* options = batch->options;
+    const int inPlace = options->outputDir == NULL;
+    const char* error = NULL;
+
+    const int fd = open(path, inPlace ? O_RDWR : O_RDONLY);
+    if (fd < 0)
+        return strerror(errno);
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close (fd);
+        return "empty or unreadable file";
+    }
+    const size_t size = (size_t)st.st_size;
+
+    unsigned char* src = (unsigned char*)map_file(fd, size, inPlace);
+    close (fd);
+    if (src == NULL)
+        return strerror(errno);
+
+    struct ImageLayout layout;
+    error = parse_image_layout(options, src, size, &layout);
+
+    unsigned char* dst = src;
+    char outputPath[4096];
+    char tmpPath[4096];
+    tmpPath[0] = '\0';
+    if (error == NULL && !inPlace)
+    {
+        const char* name = strrchr(path, '/');
+        name = name ? name + 1 : path;
+        const int n = snprintf(outputPath, sizeof(outputPath), "%s/%s", options->outputDir, name);
+        const int tmpN = snprintf(tmpPath, sizeof(tmpPath), "%s/.%s.XXXXXX", options->outputDir, name);
+        if (n < 0 || (size_t)n >= sizeof(outputPath) || tmpN < 0 || (size_t)tmpN >= sizeof(tmpPath))
+        {
+            error = "output path too long";
+            tmpPath[0] = '\0';
+        }
+        else
+        {
+            pthread_mutex_lock (&batch->mutex);
+            const int claimed = name_set_insert(&batch->outputNames, name);
+            pthread_mutex_unlock (&batch->mutex);
+            if (!claimed)
+            {
+                error = "another input has the same name in the output directory";
+                tmpPath[0] = '\0';
+            }
+        }
+    }
+
+    if (error == NULL && !inPlace)
+    {
+        // A new file that no other worker knows about, so there is nothing
+        // to truncate, and the input stays intact even if it is the output.
+        // 'src' is read-only, so 'dst' stays NULL until the output is mapped.
+        dst = NULL;
+        const int outFd = mkstemp(tmpPath);
+        if (outFd < 0)
+        {
+            error = strerror(errno);
+            tmpPath[0] = '\0';
+        }
+        else if (fchmod(outFd, 0644) != 0 || ftruncate(outFd, (off_t)size) != 0)
+        {
+            error = strerror(errno);
+        }
+        else
+        {
+            dst = (unsigned char*)map_file(outFd, size, 1);
+            if (dst == NULL)
+                error = strerror(errno);
+        }
+        if (outFd >= 0)
+            close (outFd);
+
+        if (dst != NULL)
+        {
+            // The header and whatever follows the pixels are kept as is.
+            const size_t pixelsEnd = layout.headerSize + layout.width * layout.height * (layout.format == DLPixelFormat_RGB24 ? 3 : 4);
+            memcpy (dst, src, layout.headerSize);
+            memcpy (dst + pixelsEnd, src + pixelsEnd, size - pixelsEnd);
+        }
+    }
+
+    if (error == NULL)
+    {
+        dl_simulator_apply_format(batch->simulator, layout.format,
+                                  src + layout.headerSize, dst + layout.headerSize,
+                                  layout.width, layout.height, 0, 0);
+        *numPixels = layout.width * layout.height;
+    }
+
+    if (dst != NULL && dst != src)
+        munmap (dst, size);
+    munmap (src, size);
+
+    if (tmpPath[0] != '\0')
+    {
+        if (error == NULL && rename(tmpPath, outputPath) != 0)
+            error = strerror(errno);
+        if (error != NULL)
+            unlink (tmpPath);
+    }
+    return error;
+}
+
+static void* batch_worker (void* ctx)
+{
+    struct Batch* batch = (struct Batch*)ctx;
+    char path[4096];
+    while (next_path(&batch->source, path, sizeof(path)))
+    {
+        size_t numPixels = 0;
+        const char* error = convert_file(batch, path, &numPixels);
+
+        pthread_mutex_lock (&batch->mutex);
+        ++batch->numFiles;
+        if (error)
+        {
+            ++batch->numFailed;
+            fprintf (stderr, "%s: %s\n", path, error);
+        }
+        else
+        {
+            batch->numPixels += (double)numPixels;
+        }
+        pthread_mutex_unlock (&batch->mutex);
+    }
+    return NULL;
+}
+
+static void print_usage (const char* program)
+{
+    fprintf (stderr, "Usage: %s [--deficiency protan|deutan|tritan] [--severity s] [--algorithm auto|brettel1997|vienot1999]\n"
+                     "       [--daltonize] [--accuracy default|exact|fast] [--raw WxH] [--output-dir dir] [--threads n] [--quiet]\n"
+                     "       <file | directory | -> ...\n", program);
+}
+
+// Returns the index of 'value' in 'names', or -1.
+static int parse_enum (const char* value, const char* const* names, int numNames)
+{
+    for (int i = 0; i < numNames; ++i)
+    {
+        if (strcmp(value, names[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+int main (int argc, char** argv)
+{
+    static const char* const deficiencyNames[] = { "protan", "deutan", "tritan" };
+    static const char* const algorithmNames[] = { "auto", "brettel1997", "vienot1999" };
+    static const char* const accuracyNames[] = { "default", "exact", "fast" };
+
+    struct Options options;
+    memset (&options, 0, sizeof(options));
+    options.algorithm = DLAlgorithm_Auto;
+    options.deficiency = DLDeficiency_Deutan;
+    options.severity = 1.f;
+    options.accuracy = DLAccuracy_Default;
+
+    int argIndex = 1;
+    for (; argIndex < argc && strncmp(argv[argIndex], "--", 2) == 0; ++argIndex)
+    {
+        const char* option = argv[argIndex];
+        const char* value = argIndex + 1 < argc ? argv[argIndex + 1] : NULL;
+        int valid = 1;
+        if (strcmp(option, "--daltonize") == 0)
+        {
+            options.daltonize = 1;
+            continue;
+        }
+        else if (strcmp(option, "--quiet") == 0)
+        {
+            options.quiet = 1;
+            continue;
+        }
+        else if (value == NULL)
+        {
+            valid = 0;
+        }
+        else if (strcmp(option, "--deficiency") == 0)
+        {
+            const int v = parse_enum(value, deficiencyNames, 3);
+            options.deficiency = (enum DLDeficiency)v;
+            valid = v >= 0;
+        }
+        else if (strcmp(option, "--algorithm") == 0)
+        {
+            const int v = parse_enum(value, algorithmNames, 3);
+            options.algorithm = (enum DLAlgorithm)v;
+            valid = v >= 0;
+        }
+        else if (strcmp(option, "--accuracy") == 0)
+        {
+            const int v = parse_enum(value, accuracyNames, 3);
+            options.accuracy = (enum DLAccuracy)v;
+            valid = v >= 0;
+        }
+        else if (strcmp(option, "--severity") == 0)
+        {
+            options.severity = (float)atof(value);
+            valid = options.severity >= 0.f && options.severity <= 1.f;
+        }
+        else if (strcmp(option, "--raw") == 0)
+        {
+            unsigned long long w = 0, h = 0;
+            valid = sscanf(value, "%llux%llu", &w, &h) == 2 && w > 0 && h > 0;
+            options.rawWidth = (size_t)w;
+            options.rawHeight = (size_t)h;
+        }
+        else if (strcmp(option, "--output-dir") == 0)
+        {
+            options.outputDir = value;
+            valid = is_directory(value);
+            if (!valid)
+                fprintf (stderr, "%s is not a directory\n", value);
+        }
+        else if (strcmp(option, "--threads") == 0)
+        {
+            options.numThreads = atoi(value);
+            valid = options.numThreads > 0;
+        }
+        else
+        {
+            valid = 0;
+        }
+
+        if (!valid)
+        {
+            print_usage (argv[0]);
+            return 1;
+        }
+        ++argIndex;
+    }
+
+    if (argIndex == argc)
+    {
+        print_usage (argv[0]);
+        return 1;
+    }
+
+    if (options.numThreads == 0)
+    {
+        const long numCores = sysconf(_SC_NPROCESSORS_ONLN);
+        options.numThreads = numCores > 0 ? (int)numCores : 1;
+    }
+
+    struct DLSimulator* simulator = options.daltonize
+        ? dl_daltonizer_create(options.algorithm, options.deficiency, options.severity)
+        : dl_simulator_create(options.algorithm, options.deficiency, options.severity);
+    if (simulator == NULL || !dl_simulator_set_accuracy(simulator, options.accuracy))
+    {
+        fprintf (stderr, "Could not create the simulator\n");
+        return 1;
+    }
+
+    struct Batch batch;
+    memset (&batch, 0, sizeof(batch));
+    batch.options = &options;
+    batch.simulator = simulator;
+    batch.source.args = argv + argIndex;
+    batch.source.numArgs = argc - argIndex;
+    pthread_mutex_init (&batch.source.mutex, NULL);
+    pthread_mutex_init (&batch.mutex, NULL);
+
+    const double timeStart = seconds_now();
+
+    pthread_t* threads = (pthread_t*)malloc(options.numThreads * sizeof(pthread_t));
+    int numStarted = 0;
+    for (; threads != NULL && numStarted < options.numThreads; ++numStarted)
+    {
+        if (pthread_create(&threads[numStarted], NULL, batch_worker, &batch) != 0)
+            break;
+    }
+    // Without any thread, do it all here.
+    if (numStarted == 0)
+        batch_worker (&batch);
+    for (int i = 0; i < numStarted; ++i)
+        pthread_join (threads[i], NULL);
+    free (threads);
+
+    const double seconds = seconds_now() - timeStart;
+    batch.numFiles += batch.source.numInvalid;
+    batch.numFailed += batch.source.numInvalid;
+    if (!options.quiet)
+    {
+        fprintf (stderr, "%zu files (%zu failed), %.1f MPix in %.3f s: %.1f MPix/s with %d threads\n",
+                 batch.numFiles, batch.numFailed, batch.numPixels * 1e-6, seconds,
+                 seconds > 0. ? batch.numPixels * 1e-6 / seconds : 0., numStarted > 0 ? numStarted : 1);
+    }
+
+    pthread_mutex_destroy (&batch.source.mutex);
+    pthread_mutex_destroy (&batch.mutex);
+    name_set_release (&batch.outputNames);
+    dl_simulator_destroy (simulator);
+    return batch.numFailed > 0 ? 1 : 0;
+}
@@ -0,0 +1,135 @@
+/*
+    JavaScript binding for the WebAssembly build of libDaltonLens.
+
+    Build the module with Emscripten from the repository root:
+
+        emcmake cmake -S . -B build-wasm -DCMAKE_BUILD_TYPE=Release
+        cmake --build build-wasm --target daltonlens_wasm
+
+    and copy build-wasm/libDaltonLens.js and libDaltonLens.wasm next to this
+    file. Usage:
+
+        import { createDaltonLens, Deficiency } from './daltonlens.js';
+        const dl = await createDaltonLens();
+        const imageData = ctx.getImageData(0, 0, canvas.width, canvas.height);
+        dl.simulate(imageData, Deficiency.Deutan, 1.0);
+        ctx.putImageData(imageData, 0, 0);
+
+    simulate and daltonize copy the pixels to the WebAssembly heap and back.
+    To avoid the copies, allocate the image in the heap with createImage and
+    draw into its imageData directly. The views over the heap get detached
+    when the memory grows, so always go through image.imageData instead of
+    keeping a reference to it.
+*/
+
+import createDaltonLensModule from './libDaltonLens.js';
+
+// Same values as enum DLDeficiency.
+export const Deficiency = Object.freeze({ Protan: 0, Deutan: 1, Tritan: 2 });
+
+// Same values as enum DLKernel.
+export const Kernel = Object.freeze({ Auto: 0, Scalar: 1, SSE41: 2, AVX2: 3, NEON: 4, WasmSIMD128: 5 });
+
+class HeapImage
+{
+    constructor (module, width, height)
+    {
+        this._module = module;
+        this.width = width;
+        this.height = height;
+        this.byteLength = width * height * 4;
+        this.ptr = module._malloc(this.byteLength);
+        if (this.ptr === 0)
+            throw new Error(`Could not allocate a ${width}x${height} image`);
+        this._imageData = null;
+    }
+
+    get imageData ()
+    {
+        // Re-create the view after a memory growth detached the previous one.
+        if (this._imageData === null || this._imageData.data.buffer !== this._module.HEAPU8.buffer)
+        {
+            const pixels = new Uint8ClampedArray(this._module.HEAPU8.buffer, this.ptr, this.byteLength);
+            this._imageData = new ImageData(pixels, this.width, this.height);
+        }
+        return this._imageData;
+    }
+
+    simulate (deficiency, severity = 1.0)
+    {
+        this._module._dl_simulate_cvd(deficiency, severity, this.ptr, this.width, this.height, 0);
+    }
+
+    daltonize (deficiency, severity = 1.0)
+    {
+        this._module._dl_daltonize(deficiency, severity, this.ptr, this.width, this.height, 0);
+    }
+
+    destroy ()
+    {
+        this._module._free(this.ptr);
+        this.ptr = 0;
+        this._imageData = null;
+    }
+}
+
+class DaltonLens
+{
+    constructor (module)
+    {
+        this._module = module;
+        // Scratch buffer for the copying API, grown on demand.
+        this._scratchPtr = 0;
+        this._scratchSize = 0;
+    }
+
+    kernel ()
+    {
+        return this._module._dl_get_kernel();
+    }
+
+    createImage (width, height)
+    {
+        return new HeapImage(this._module, width, height);
+    }
+
+    simulate (imageData, deficiency, severity = 1.0)
+    {
+        this._applyInPlace(imageData, (ptr) => this._module._dl_simulate_cvd(deficiency, severity, ptr, imageData.width, imageData.height, 0));
+    }
+
+    daltonize (imageData, deficiency, severity = 1.0)
+    {
+        this._applyInPlace(imageData, (ptr) => this._module._dl_daltonize(deficiency, severity, ptr, imageData.width, imageData.height, 0));
+    }
+
+    _applyInPlace (imageData, func)
+    {
+        const size = imageData.width * imageData.height * 4;
+        if (size > this._scratchSize)
+        {
+            this._module._free(this._scratchPtr);
+            this._scratchPtr = this._module._malloc(size);
+            this._scratchSize = this._scratchPtr === 0 ? 0 : size;
+            if (this._scratchPtr === 0)
+                throw new Error(`Could not allocate a ${imageData.width}x${imageData.height} image`);
+        }
+        this._module.HEAPU8.set(imageData.data, this._scratchPtr);
+        func(this._scratchPtr);
+        // Get HEAPU8 again, in case the call grew the memory.
+        imageData.data.set(this._module.HEAPU8.subarray(this._scratchPtr, this._scratchPtr + size));
+    }
+
+    destroy ()
+    {
+        this._module._free(this._scratchPtr);
+        this._scratchPtr = 0;
+        this._scratchSize = 0;
+    }
+}
+
+export async function createDaltonLens (moduleOptions = {})
+{
+    const module = await createDaltonLensModule(moduleOptions);
+    return new DaltonLens(module);
+}